@@ -7,7 +7,7 @@ import threading
 import ssl
 import os
 
-SYMBOL = "btcusdt"
+SYMBOLS = ["btcusdt"]
 OUTPUT_FILE = "data/market_data.csv"
 DURATION_SECONDS = 60
 BATCH_SIZE = 100
@@ -34,6 +34,7 @@ def on_message(ws, message):
     
     payload = data.get('data', {})
     event_type = payload.get('e')
+    symbol = payload.get('s', '')
     
     row = None
     
@@ -42,7 +43,7 @@ def on_message(ws, message):
         price = payload['p']
         qty = payload['q']
         timestamp = payload['T']
-        row = [timestamp, 'T', side, price, qty]
+        row = [timestamp, 'T', side, price, qty, symbol]
         
     elif event_type == 'depthUpdate':
         timestamp = payload['E'] 
@@ -50,11 +51,11 @@ def on_message(ws, message):
         
         for price, qty in payload.get('b', []):
             op_type = 'C' if float(qty) == 0 else 'A'
-            updates.append([timestamp, op_type, 'B', price, qty])
+            updates.append([timestamp, op_type, 'B', price, qty, symbol])
             
         for price, qty in payload.get('a', []):
             op_type = 'C' if float(qty) == 0 else 'A'
-            updates.append([timestamp, op_type, 'S', price, qty])
+            updates.append([timestamp, op_type, 'S', price, qty, symbol])
             
         if updates:
             with file_lock:
@@ -78,8 +79,9 @@ def on_close(ws, close_status_code, close_msg):
     print("\nConnection closed")
 
 def on_open(ws):
-    print(f"Connected to Binance. Recording {SYMBOL} for {DURATION_SECONDS} seconds...")
-    params = [f"{SYMBOL}@trade", f"{SYMBOL}@depth@100ms"]
+    print(f"Connected to Binance. Recording {', '.join(SYMBOLS)} for {DURATION_SECONDS} seconds...")
+    params = [stream for symbol in SYMBOLS
+              for stream in (f"{symbol}@trade", f"{symbol}@depth@100ms")]
     subscribe_message = {
         "method": "SUBSCRIBE",
         "params": params,
@@ -90,14 +92,17 @@ def on_open(ws):
 if __name__ == "__main__":
     if len(sys.argv) > 1:
         DURATION_SECONDS = int(sys.argv[1])
+    if len(sys.argv) > 2:
+        SYMBOLS = [s.strip().lower() for s in sys.argv[2].split(",")]
         
     os.makedirs("data", exist_ok=True)
     
     csv_file = open(OUTPUT_FILE, 'w', newline='')
     writer = csv.writer(csv_file)
-    writer.writerow(["timestamp", "type", "side", "price", "quantity"])
+    writer.writerow(["timestamp", "type", "side", "price", "quantity", "symbol"])
     
-    socket = "wss://stream.binance.com:9443/stream?streams=" + f"{SYMBOL}@trade/{SYMBOL}@depth@100ms"
+    socket = "wss://stream.binance.com:9443/stream?streams=" + "/".join(
+        f"{symbol}@trade/{symbol}@depth@100ms" for symbol in SYMBOLS)
     
     ws = websocket.WebSocketApp(socket,
                               on_open=on_open,
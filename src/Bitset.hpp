@@ -18,6 +18,10 @@ class PriceBitset {
     if (index < size_) data_[index / 64] &= ~(1ULL << (index % 64));
   }
   void clearAll() { std::fill(data_.begin(), data_.end(), 0); }
+  // Raw words, for bulk copies (book snapshots).
+  const uint64_t* words() const { return data_.data(); }
+  uint64_t* words() { return data_.data(); }
+  size_t wordCount() const { return data_.size(); }
   bool test(size_t index) const {
     if (index >= size_) return false;
     return (data_[index / 64] & (1ULL << (index % 64))) != 0;
@@ -1,8 +1,22 @@
 #include "Exchange.hpp"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 
-Exchange::Exchange(int numWorkers) {
+#include "Journal.hpp"
+#include "Snapshot.hpp"
+#include "Tsc.hpp"
+
+Exchange::Exchange(int numWorkers, int maxSymbols)
+    : maxSymbols_(std::max(1, maxSymbols)) {
   if (numWorkers <= 0) {
     numWorkers = static_cast<int>(std::thread::hardware_concurrency());
   }
@@ -11,7 +25,16 @@ Exchange::Exchange(int numWorkers) {
   shards_.resize(numWorkers);
   for (int i = 0; i < numWorkers; ++i) {
     shards_[i] = std::make_unique<Shard>();
+    auto &shard = *shards_[i];
+    shard.reportBuffer.reserve(4096);
+    shard.books.resize(maxSymbols_);
+    shard.strategies.resize(maxSymbols_, nullptr);
+    shard.touchedFlags.resize(maxSymbols_, 0);
+    shard.publishedQuotes.resize(maxSymbols_);
+    shard.depth.resize(maxSymbols_);
+    shard.staleDepthFlags.resize(maxSymbols_, 0);
   }
+  symbolIdToShardId_.resize(maxSymbols_);
 
   for (int i = 0; i < numWorkers; ++i) {
     workers_.emplace_back(&Exchange::workerLoop, this, i);
@@ -30,30 +53,56 @@ void Exchange::stop() {
   workers_.clear();
 }
 
-int32_t Exchange::registerSymbol(const std::string &symbol, int shardId) {
+int32_t Exchange::registerSymbol(const std::string &symbol, int shardId,
+                                 MatchingAlgorithm algorithm) {
+  std::lock_guard<std::mutex> lock(symbolsMutex_);
   if (symbolNameToId_.find(symbol) != symbolNameToId_.end()) {
     return symbolNameToId_[symbol];
   }
 
   int32_t symbolId = static_cast<int32_t>(symbolIdToName_.size());
+  if (symbolId >= maxSymbols_) return -1;
   symbolIdToName_.push_back(symbol);
   symbolNameToId_[symbol] = symbolId;
 
   if (shardId < 0 || shardId >= static_cast<int>(shards_.size())) {
     shardId = symbolId % shards_.size();
   }
-  symbolIdToShardId_.push_back(shardId);
+  symbolIdToShardId_[symbolId] = shardId;
+  symbolAlgorithms_.push_back(algorithm);
+  if (journal_) journal_->appendSymbol(symbolId, shardId, algorithm, symbol);
 
+  // Only entries no reader can reach yet are written; the stores of the
+  // limit and the count below publish them.
   auto &shard = *shards_[shardId];
-  if (shard.books.size() <= static_cast<size_t>(symbolId)) {
-    shard.books.resize(symbolId + 1);
-  }
+  shard.publishedQuotes[symbolId] = {symbolId, 0, 0, -1, 0};
+  shard.depth[symbolId] = std::make_unique<SeqLock<DepthSnapshot>>();
+  DepthSnapshot empty;
+  empty.symbolId = symbolId;
+  shard.depth[symbolId]->store(empty);
   shard.books[symbolId] = std::make_unique<OrderBook>();
+  shard.books[symbolId]->setReportSink(&shard.reportBuffer);
+  if (shard.l3Ring) shard.books[symbolId]->setL3Sink(&shard.l3Buffer);
+
+  switch (algorithm) {
+    case MatchingAlgorithm::ProRata:
+      shard.strategies[symbolId] = &shard.proRataStrategy;
+      break;
+    case MatchingAlgorithm::PriceTimeProRata:
+      shard.strategies[symbolId] = &shard.priceTimeProRataStrategy;
+      break;
+    default:
+      shard.strategies[symbolId] = &shard.matchingStrategy;
+      break;
+  }
 
+  shard.symbolLimit.store(symbolId + 1, std::memory_order_release);
+  symbolCount_.store(symbolId + 1, std::memory_order_release);
   return symbolId;
 }
 
 std::string Exchange::getSymbolName(int32_t symbolId) const {
+  std::lock_guard<std::mutex> lock(symbolsMutex_);
   if (symbolId >= 0 &&
       symbolId < static_cast<int32_t>(symbolIdToName_.size())) {
     return symbolIdToName_[symbolId];
@@ -101,9 +150,8 @@ void Exchange::submitOrder(const Order &order, int shardHint,
 
   if (shardHint >= 0 && shardHint < static_cast<int>(shards_.size())) {
     shardId = shardHint;
-  } else if (symbolId >= 0 &&
-             symbolId < static_cast<int32_t>(symbolIdToShardId_.size())) {
-    shardId = symbolIdToShardId_[symbolId];
+  } else if (int owner = shardOf(symbolId); owner >= 0) {
+    shardId = owner;
   } else {
     return;
   }
@@ -115,6 +163,8 @@ void Exchange::submitOrder(const Order &order, int shardHint,
   auto &batch = localBatches[shardId];
   Command &cmd = batch.commands[batch.count++];
   cmd.type = Command::Add;
+  cmd.submitTicks =
+      latencyMetrics_.load(std::memory_order_relaxed) ? tscNow() : 0;
   cmd.add.order = order;
 
   if (wait_duration) {
@@ -145,15 +195,16 @@ void Exchange::submitOrders(const std::vector<Order> &orders, int shardHint) {
     localBatches.resize(shards_.size());
   }
 
+  const uint64_t submitTicks =
+      latencyMetrics_.load(std::memory_order_relaxed) ? tscNow() : 0;
   for (const auto &order : orders) {
     int32_t symbolId = order.symbolId;
     size_t shardId = 0;
 
     if (shardHint >= 0 && shardHint < static_cast<int>(shards_.size())) {
       shardId = shardHint;
-    } else if (symbolId >= 0 &&
-               symbolId < static_cast<int32_t>(symbolIdToShardId_.size())) {
-      shardId = symbolIdToShardId_[symbolId];
+    } else if (int owner = shardOf(symbolId); owner >= 0) {
+      shardId = owner;
     } else {
       continue;
     }
@@ -161,6 +212,7 @@ void Exchange::submitOrders(const std::vector<Order> &orders, int shardHint) {
     auto &batch = localBatches[shardId];
     Command &cmd = batch.commands[batch.count++];
     cmd.type = Command::Add;
+    cmd.submitTicks = submitTicks;
     cmd.add.order = order;
 
     if (batch.count == PRODUCER_BATCH_SIZE) {
@@ -173,25 +225,52 @@ void Exchange::submitOrders(const std::vector<Order> &orders, int shardHint) {
   }
 }
 
-void Exchange::cancelOrder(int32_t symbolId, OrderId orderId) {
-  size_t shardId = 0;
-  if (symbolId >= 0 &&
-      symbolId < static_cast<int32_t>(symbolIdToShardId_.size())) {
-    shardId = symbolIdToShardId_[symbolId];
-  } else {
-    return;
+void Exchange::cancelOrder(int32_t symbolId, OrderId orderId,
+                           uint32_t sessionId) {
+  int shardId = shardOf(symbolId);
+  if (shardId < 0) return;
+
+  Command cmd;
+  cmd.type = Command::Cancel;
+  cmd.cancel.orderId = orderId;
+  cmd.cancel.symbolId = symbolId;
+  cmd.cancel.sessionId = sessionId;
+  enqueue(shardId, cmd);
+}
+
+void Exchange::modifyOrder(int32_t symbolId, OrderId orderId, Price price,
+                           Quantity quantity, uint32_t sessionId) {
+  int shardId = shardOf(symbolId);
+  if (shardId < 0) return;
+
+  Command cmd;
+  cmd.type = Command::Modify;
+  cmd.modify.orderId = orderId;
+  cmd.modify.price = price;
+  cmd.modify.symbolId = symbolId;
+  cmd.modify.sessionId = sessionId;
+  cmd.modify.quantity = quantity;
+  enqueue(shardId, cmd);
+}
+
+int Exchange::shardOf(int32_t symbolId) const {
+  if (symbolId < 0 ||
+      symbolId >= symbolCount_.load(std::memory_order_acquire)) {
+    return -1;
   }
+  return symbolIdToShardId_[symbolId];
+}
 
+void Exchange::enqueue(size_t shardId, const Command &cmd) {
   if (localBatches.size() != shards_.size()) {
     localBatches.resize(shards_.size());
   }
 
   auto &batch = localBatches[shardId];
-  Command &cmd = batch.commands[batch.count++];
-
-  cmd.type = Command::Cancel;
-  cmd.cancel.orderId = orderId;
-  cmd.cancel.symbolId = symbolId;
+  Command &queued = batch.commands[batch.count++];
+  queued = cmd;
+  queued.submitTicks =
+      latencyMetrics_.load(std::memory_order_relaxed) ? tscNow() : 0;
 
   if (batch.count == PRODUCER_BATCH_SIZE) {
     while (!shards_[shardId]->queue.push_batch(batch.commands.data(),
@@ -202,6 +281,23 @@ void Exchange::cancelOrder(int32_t symbolId, OrderId orderId) {
   }
 }
 
+void Exchange::massCancel(int32_t symbolId, uint32_t ownerId,
+                          MassCancelSide side) {
+  Command cmd;
+  cmd.type = Command::MassCancel;
+  cmd.massCancel.symbolId = symbolId;
+  cmd.massCancel.ownerId = ownerId;
+  cmd.massCancel.side = side;
+
+  if (symbolId < 0) {
+    for (size_t shardId = 0; shardId < shards_.size(); ++shardId) {
+      enqueue(shardId, cmd);
+    }
+  } else if (int shardId = shardOf(symbolId); shardId >= 0) {
+    enqueue(shardId, cmd);
+  }
+}
+
 void Exchange::reset() {
   for (auto &shard : shards_) {
     Command cmd;
@@ -211,7 +307,95 @@ void Exchange::reset() {
   std::this_thread::sleep_for(std::chrono::milliseconds(20));
 }
 
-void Exchange::setTradeCallback(TradeCallback cb) { onTrade_ = std::move(cb); }
+std::vector<std::unique_lock<std::mutex>> Exchange::lockListeners() {
+  std::vector<std::unique_lock<std::mutex>> locks;
+  locks.reserve(shards_.size());
+  for (auto &shard : shards_) locks.emplace_back(shard->listenersMutex);
+  return locks;
+}
+
+template <typename Callback>
+Exchange::CallbackHandle Exchange::addListener(Listeners<Callback> &listeners,
+                                               Callback cb) {
+  auto locks = lockListeners();
+  const CallbackHandle handle = nextCallbackHandle_++;
+  listeners.emplace_back(handle, std::move(cb));
+  return handle;
+}
+
+template <typename Callback>
+void Exchange::setListener(Listeners<Callback> &listeners,
+                           CallbackHandle &handle, Callback cb) {
+  auto locks = lockListeners();
+  std::erase_if(listeners,
+                [&](const auto &entry) { return entry.first == handle; });
+  handle = nextCallbackHandle_++;
+  listeners.emplace_back(handle, std::move(cb));
+}
+
+void Exchange::setTradeCallback(TradeCallback cb) {
+  setListener(tradeCallbacks_, setTradeHandle_, std::move(cb));
+}
+
+Exchange::CallbackHandle Exchange::addTradeCallback(TradeCallback cb) {
+  return addListener(tradeCallbacks_, std::move(cb));
+}
+
+Exchange::CallbackHandle Exchange::addQuoteCallback(QuoteCallback cb) {
+  return addListener(quoteCallbacks_, std::move(cb));
+}
+
+Exchange::CallbackHandle Exchange::addBookDeltaCallback(BookDeltaCallback cb) {
+  return addListener(deltaCallbacks_, std::move(cb));
+}
+
+void Exchange::setExecutionReportCallback(ExecutionReportCallback cb) {
+  setListener(reportCallbacks_, setReportHandle_, std::move(cb));
+}
+
+Exchange::CallbackHandle Exchange::addExecutionReportCallback(
+    ExecutionReportCallback cb) {
+  return addListener(reportCallbacks_, std::move(cb));
+}
+
+void Exchange::removeCallback(CallbackHandle handle) {
+  auto locks = lockListeners();
+  auto matches = [handle](const auto &entry) { return entry.first == handle; };
+  std::erase_if(tradeCallbacks_, matches);
+  std::erase_if(reportCallbacks_, matches);
+  std::erase_if(quoteCallbacks_, matches);
+  std::erase_if(deltaCallbacks_, matches);
+}
+
+namespace {
+void rejectCommand(std::vector<ExecutionReport> &reports, OrderId orderId,
+                   uint64_t clientOrderId, int32_t symbolId,
+                   uint32_t sessionId, ExecStatus status) {
+  if (sessionId == 0) return;
+  reports.push_back({.orderId = orderId,
+                     .clientOrderId = clientOrderId,
+                     .lastPrice = 0,
+                     .symbolId = symbolId,
+                     .sessionId = sessionId,
+                     .lastQuantity = 0,
+                     .leavesQuantity = 0,
+                     .cumQuantity = 0,
+                     .status = status});
+}
+
+Quote topOfBook(const OrderBook &book, int32_t symbolId) {
+  Quote quote{symbolId, book.getBestBid(), 0, book.getBestAsk(), 0};
+  if (quote.bidPrice > 0) {
+    quote.bidQuantity =
+        book.getLevel(quote.bidPrice, OrderSide::Buy).totalQuantity;
+  }
+  if (quote.askPrice >= 0) {
+    quote.askQuantity =
+        book.getLevel(quote.askPrice, OrderSide::Sell).totalQuantity;
+  }
+  return quote;
+}
+}  // namespace
 
 #ifdef __linux__
 #include <pthread.h>
@@ -244,63 +428,1026 @@ void Exchange::workerLoop(int shardId) {
   std::array<Command, BATCH_SIZE> cmdBuffer;
 
   while (true) {
+    if (!shard.heldBatches.empty()) releaseDurable(shardId, shard);
     size_t count = shard.queue.pop_batch(cmdBuffer.data(), BATCH_SIZE);
 
     if (count == 0) {
+      if (!shard.staleDepth.empty()) publishDepth(shard);
       std::this_thread::yield();
       continue;
     }
 
+    const uint64_t firstSequence = shard.inputSequence + 1;
+    if (journal_) {
+      // Nothing after a Stop is applied, so nothing after it is journaled.
+      size_t applied = 0;
+      while (applied < count && cmdBuffer[applied].type != Command::Stop) {
+        ++applied;
+      }
+      journal_->append(shardId, firstSequence, cmdBuffer.data(), applied);
+      shard.inputSequence += applied;
+    }
+
     for (size_t i = 0; i < count; ++i) {
       auto &cmd = cmdBuffer[i];
 
       if (cmd.type == Command::Stop) {
-        if (!shard.tradeBuffer.empty() && onTrade_) {
-          onTrade_(shard.tradeBuffer);
+        if (!shard.tradeBuffer.empty()) checkpointTrades(shardId, shard);
+        publishBatch(shard);
+        if (!shard.heldBatches.empty()) {
+          journal_->sync();
+          releaseDurable(shardId, shard);
         }
         return;
       }
 
-      if (cmd.type == Command::Type::Add) {
-        int32_t symId = cmd.add.order.symbolId;
-        if (symId >= shard.books.size() || !shard.books[symId]) {
-          continue;
-        }
-        OrderBook *book = shard.books[symId].get();
-        shard.matchingStrategy.match(*book, cmd.add.order, shard.tradeBuffer);
-      } else if (cmd.type == Command::Type::Cancel) {
-        int32_t symId = cmd.cancel.symbolId;
-        if (symId >= shard.books.size() || !shard.books[symId]) {
-          continue;
+      if (cmd.type == Command::Recover) {
+        ReplayJob &job = *cmd.recover.job;
+        publishBatch(shard);
+        if (job.image == nullptr || loadImages(shard, job)) {
+          replayJournal(shardId, shard, job);
         }
-        OrderBook *book = shard.books[symId].get();
-        book->cancelOrder(cmd.cancel.orderId);
-      } else if (cmd.type == Command::Type::Reset) {
-        for (auto &b : shard.books) {
-          if (b) b->reset();
+        publishBatch(shard);
+        job.done.store(true, std::memory_order_release);
+        continue;
+      }
+
+      // Journaled like any command, and a no-op on replay; its sequence
+      // marks where the images end.
+      if (cmd.type == Command::Snapshot) {
+        captureSnapshot(shard, *cmd.snapshot.job,
+                        journal_ ? firstSequence + i : 0);
+        continue;
+      }
+
+      if (cmd.type == Command::Verify) {
+        verifyReplicated(shard, cmd);
+        continue;
+      }
+
+      if (cmd.type == Command::Digest) {
+        DigestJob &job = *cmd.digest.job;
+        tradeChecksum(shard, job.digest.tradeCount, job.digest.tradeHash);
+        job.digest.bookHash = bookHash(shard);
+        job.done.store(true, std::memory_order_release);
+        continue;
+      }
+
+      if (cmd.type == Command::Latency) {
+        LatencyJob &job = *cmd.latency.job;
+        // Commands ahead of it in the batch are counted.
+        if (!shard.latencyStamps.empty()) recordLatency(shard);
+        job.metrics.ack = shard.ackLatency;
+        job.metrics.trade = shard.tradeLatency;
+        if (job.reset) {
+          shard.ackLatency.reset();
+          shard.tradeLatency.reset();
         }
+        job.done.store(true, std::memory_order_release);
+        continue;
       }
+
+      if (cmd.submitTicks != 0) {
+        const size_t trades = shard.tradeBuffer.size();
+        applyCommand(shard, cmd);
+        shard.latencyStamps.push_back(
+            {cmd.submitTicks, shard.tradeBuffer.size() > trades});
+        continue;
+      }
+      applyCommand(shard, cmd);
     }
 
-    if (!shard.tradeBuffer.empty()) {
-      if (onTrade_) {
-        onTrade_(shard.tradeBuffer);
+    if (!shard.tradeBuffer.empty()) checkpointTrades(shardId, shard);
+    if (journal_) checkState(shardId, shard);
+    if (!shard.latencyStamps.empty()) recordLatency(shard);
+    publishBatch(shard);
+  }
+}
+
+// Applies one order-flow command to the shard's books; shared by the live
+// loop and journal replay.
+void Exchange::applyCommand(Shard &shard, Command &cmd) {
+  if (cmd.type == Command::Type::Add) {
+    int32_t symId = cmd.add.order.symbolId;
+    OrderBook *book = findBook(shard, symId);
+    if (!book) {
+      const Order &o = cmd.add.order;
+      rejectCommand(shard.reportBuffer, o.id, o.clientOrderId, symId,
+                    o.sessionId, ExecStatus::Rejected);
+      return;
+    }
+    shard.strategies[symId]->match(*book, cmd.add.order, shard.tradeBuffer);
+    markTouched(shard, symId);
+  } else if (cmd.type == Command::Type::Cancel) {
+    int32_t symId = cmd.cancel.symbolId;
+    OrderBook *book = findBook(shard, symId);
+    if (!book ||
+        !book->cancelOrder(cmd.cancel.orderId, cmd.cancel.sessionId)) {
+      rejectCommand(shard.reportBuffer, cmd.cancel.orderId, 0, symId,
+                    cmd.cancel.sessionId, ExecStatus::CancelRejected);
+    } else {
+      markTouched(shard, symId);
+    }
+  } else if (cmd.type == Command::Type::Modify) {
+    int32_t symId = cmd.modify.symbolId;
+    OrderBook *book = findBook(shard, symId);
+    Order replacement;
+    auto result = OrderBook::ModifyResult::Rejected;
+    if (book) {
+      result = book->modifyOrder(cmd.modify.orderId, cmd.modify.price,
+                                 cmd.modify.quantity, replacement,
+                                 cmd.modify.sessionId);
+    }
+    if (result != OrderBook::ModifyResult::Rejected) {
+      markTouched(shard, symId);
+    }
+    if (result == OrderBook::ModifyResult::Replaced) {
+      shard.strategies[symId]->match(*book, replacement, shard.tradeBuffer);
+    } else if (result == OrderBook::ModifyResult::Rejected) {
+      rejectCommand(shard.reportBuffer, cmd.modify.orderId, 0, symId,
+                    cmd.modify.sessionId, ExecStatus::CancelRejected);
+    }
+  } else if (cmd.type == Command::Type::MassCancel) {
+    int32_t symId = cmd.massCancel.symbolId;
+    const int32_t numBooks =
+        shard.symbolLimit.load(std::memory_order_acquire);
+    for (int32_t b = 0; b < numBooks; ++b) {
+      if (!shard.books[b] || (symId >= 0 && symId != b)) continue;
+      if (shard.books[b]->massCancel(cmd.massCancel.ownerId,
+                                     cmd.massCancel.side) > 0) {
+        markTouched(shard, b);
+      }
+    }
+  } else if (cmd.type == Command::Type::Reset) {
+    const int32_t numBooks =
+        shard.symbolLimit.load(std::memory_order_acquire);
+    for (int32_t b = 0; b < numBooks; ++b) {
+      if (!shard.books[b]) continue;
+      shard.books[b]->reset();
+      markTouched(shard, b);
+      if (shard.l3Ring) {
+        shard.l3Buffer.push_back({.sequence = 0,
+                                  .orderId = 0,
+                                  .price = 0,
+                                  .symbolId = b,
+                                  .quantity = 0,
+                                  .position = 0,
+                                  .side = OrderSide::Buy,
+                                  .type = L3EventType::Clear});
       }
-      shard.tradeBuffer.clear();
     }
   }
 }
 
-void Exchange::printOrderBook(int32_t symbolId) const {
+OrderBook *Exchange::findBook(Shard &shard, int32_t symbolId) {
   if (symbolId < 0 ||
-      symbolId >= static_cast<int32_t>(symbolIdToShardId_.size()))
+      symbolId >= shard.symbolLimit.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  return shard.books[symbolId].get();
+}
+
+void Exchange::markTouched(Shard &shard, int32_t symbolId) {
+  if (shard.touchedFlags[symbolId]) return;
+  shard.touchedFlags[symbolId] = 1;
+  shard.touchedBooks.push_back(symbolId);
+}
+
+// One clock read for the whole batch: its results all go out together.
+void Exchange::recordLatency(Shard &shard) {
+  const uint64_t now = tscNow();
+  for (const Shard::LatencyStamp &stamp : shard.latencyStamps) {
+    // Counters of different cores can disagree by a few ticks.
+    const uint64_t nanos =
+        now > stamp.submitTicks ? tscToNanos(now - stamp.submitTicks) : 0;
+    shard.ackLatency.record(nanos);
+    if (stamp.traded) shard.tradeLatency.record(nanos);
+  }
+  shard.latencyStamps.clear();
+}
+
+// Hands everything the batch produced to the listeners, or holds it for
+// the journal under GroupCommit, and resets the per-batch buffers.
+void Exchange::publishBatch(Shard &shard) {
+  publishL3(shard);
+  for (int32_t symId : shard.touchedBooks) {
+    shard.touchedFlags[symId] = 0;
+    if (!shard.staleDepthFlags[symId]) {
+      shard.staleDepthFlags[symId] = 1;
+      shard.staleDepth.push_back(symId);
+    }
+    shard.books[symId]->collectDeltas(symId, shard.deltaBuffer);
+    Quote quote = topOfBook(*shard.books[symId], symId);
+    if (quote == shard.publishedQuotes[symId]) continue;
+    shard.publishedQuotes[symId] = quote;
+    shard.quoteBuffer.push_back(quote);
+  }
+  shard.touchedBooks.clear();
+  if (journal_ && journal_->options().sync == JournalSyncPolicy::GroupCommit) {
+    holdBatch(shard);
+  } else {
+    notifyListeners(shard, shard.tradeBuffer, shard.reportBuffer,
+                    shard.deltaBuffer, shard.quoteBuffer);
+  }
+  publishDepth(shard);
+}
+
+// Swaps the batch's buffers out, so nothing is copied; the shard carries on
+// with a released batch's emptied ones.
+void Exchange::holdBatch(Shard &shard) {
+  if (shard.tradeBuffer.empty() && shard.reportBuffer.empty() &&
+      shard.deltaBuffer.empty() && shard.quoteBuffer.empty()) {
     return;
+  }
+  Shard::HeldBatch batch;
+  if (!shard.spareBatches.empty()) {
+    batch = std::move(shard.spareBatches.back());
+    shard.spareBatches.pop_back();
+  }
+  batch.sequence = shard.inputSequence;
+  batch.trades.swap(shard.tradeBuffer);
+  batch.reports.swap(shard.reportBuffer);
+  batch.deltas.swap(shard.deltaBuffer);
+  batch.quotes.swap(shard.quoteBuffer);
+  shard.heldBatches.push_back(std::move(batch));
+}
+
+void Exchange::releaseDurable(int shardId, Shard &shard) {
+  const uint64_t durable = journal_->durableSequence(shardId);
+  while (!shard.heldBatches.empty() &&
+         shard.heldBatches.front().sequence <= durable) {
+    Shard::HeldBatch &batch = shard.heldBatches.front();
+    notifyListeners(shard, batch.trades, batch.reports, batch.deltas,
+                    batch.quotes);
+    shard.spareBatches.push_back(std::move(batch));
+    shard.heldBatches.pop_front();
+  }
+}
+
+void Exchange::notifyListeners(Shard &shard, std::vector<Trade> &trades,
+                               std::vector<ExecutionReport> &reports,
+                               std::vector<BookDelta> &deltas,
+                               std::vector<Quote> &quotes) {
+  std::lock_guard<std::mutex> lock(shard.listenersMutex);
+  if (!trades.empty()) {
+    for (auto &[handle, callback] : tradeCallbacks_) callback(trades);
+    trades.clear();
+  }
+  if (!reports.empty()) {
+    for (auto &[handle, callback] : reportCallbacks_) callback(reports);
+    reports.clear();
+  }
+  if (!deltas.empty()) {
+    for (auto &[handle, callback] : deltaCallbacks_) callback(deltas);
+    deltas.clear();
+  }
+  if (!quotes.empty()) {
+    for (auto &[handle, callback] : quoteCallbacks_) callback(quotes);
+    quotes.clear();
+  }
+}
+
+void Exchange::publishL3(Shard &shard) {
+  if (shard.l3Buffer.empty()) return;
+  for (auto &event : shard.l3Buffer) {
+    event.sequence = ++shard.l3Sequence;
+  }
+  if (!shard.l3Ring->push_batch(shard.l3Buffer.data(),
+                                shard.l3Buffer.size())) {
+    shard.l3Dropped += shard.l3Buffer.size();
+  }
+  shard.l3Buffer.clear();
+}
+
+void Exchange::publishDepth(Shard &shard) {
+  if (shard.staleDepth.empty()) return;
+  auto interval = std::chrono::nanoseconds(depthIntervalNs_.load());
+  if (interval.count() > 0) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - shard.lastDepthPublish < interval) return;
+    shard.lastDepthPublish = now;
+  }
+
+  for (int32_t symId : shard.staleDepth) {
+    shard.staleDepthFlags[symId] = 0;
+    shard.depthScratch.symbolId = symId;
+    shard.books[symId]->fillDepth(shard.depthScratch);
+    shard.depth[symId]->store(shard.depthScratch);
+  }
+  shard.staleDepth.clear();
+}
+
+bool Exchange::enableJournal(const std::string &path,
+                             const JournalOptions &options) {
+  auto journal = std::make_unique<Journal>(path, shards_.size(), options);
+  if (!journal->open()) return false;
+  // Sequences and trade checksums restart with the file.
+  for (auto &shard : shards_) {
+    shard->inputSequence = 0;
+    shard->tradeCount = 0;
+    shard->tradeHash = 0;
+  }
+  {
+    std::lock_guard<std::mutex> lock(symbolsMutex_);
+    for (size_t id = 0; id < symbolIdToName_.size(); ++id) {
+      journal->appendSymbol(static_cast<int32_t>(id), symbolIdToShardId_[id],
+                            symbolAlgorithms_[id], symbolIdToName_[id]);
+    }
+    journal_ = std::move(journal);
+  }
+  // The books the journal starts from, taken at its first command.
+  return options.baseSnapshot.empty() || writeSnapshot(options.baseSnapshot);
+}
+
+namespace {
+// Read-only private mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() {
+    if (data_ != nullptr) munmap(const_cast<std::byte *>(data_), size_);
+  }
+
+  bool map(const std::string &path, std::string &error) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st {};
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      error = path + ": " + std::strerror(errno);
+      if (fd >= 0) ::close(fd);
+      return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ == 0) {
+      ::close(fd);
+      error = path + ": empty file";
+      return false;
+    }
+    void *map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+      error = path + ": " + std::strerror(errno);
+      return false;
+    }
+    madvise(map, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const std::byte *>(map);
+    return true;
+  }
+
+  const std::byte *data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const std::byte *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Checks a mapped journal's header; returns its records, or nullptr with
+// `error` set.
+const JournalRecord *journalRecords(const MappedFile &file,
+                                    const std::string &path,
+                                    size_t shardCount,
+                                    JournalFileHeader &header, size_t &count,
+                                    std::string &error) {
+  if (file.size() < sizeof(JournalFileHeader)) {
+    error = path + ": not a journal";
+    return nullptr;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, JournalFileHeader::MAGIC,
+                  sizeof(header.magic)) != 0 ||
+      header.recordSize != sizeof(JournalRecord)) {
+    error = path + ": not a journal written by this build";
+    return nullptr;
+  }
+  if (header.shardCount != shardCount) {
+    error = "journal has " + std::to_string(header.shardCount) +
+            " shards, engine has " + std::to_string(shardCount);
+    return nullptr;
+  }
+  count = (file.size() - sizeof(JournalFileHeader)) / sizeof(JournalRecord);
+  return reinterpret_cast<const JournalRecord *>(file.data() +
+                                                 sizeof(JournalFileHeader));
+}
+
+bool writeAll(int fd, const void *data, size_t size) {
+  const auto *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t n = ::write(fd, bytes, size);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    bytes += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+}  // namespace
+
+bool Exchange::registerRecoveredSymbol(const char *name, size_t maxName,
+                                       int32_t symbolId, int shardId,
+                                       MatchingAlgorithm algorithm,
+                                       std::string &error) {
+  std::string symbol(name, strnlen(name, maxName));
+  if (registerSymbol(symbol, shardId, algorithm) != symbolId) {
+    error = "symbol " + symbol + " does not get its recorded id";
+    return false;
+  }
+  return true;
+}
+
+// Registration must hand out the journaled ids again, which holds on an
+// engine with no symbols, or with only the ones the journal already lists.
+bool Exchange::registerJournaledSymbols(const JournalRecord *records,
+                                        size_t count, std::string &error) {
+  for (size_t i = 0; i < count; ++i) {
+    const JournalRecord &record = records[i];
+    if (record.type != JournalRecordType::Symbol) continue;
+    if (record.checksum != record.computeChecksum()) break;
+    const JournalSymbol &symbol = record.payload.symbol;
+    if (!registerRecoveredSymbol(symbol.name, sizeof(symbol.name),
+                                 symbol.symbolId, symbol.shardId,
+                                 symbol.algorithm, error)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Exchange::runReplayJobs(std::vector<std::unique_ptr<ReplayJob>> &jobs,
+                             OrderId maxOrderId, RecoveryResult &result) {
+  for (size_t s = 0; s < jobs.size(); ++s) {
+    Command cmd;
+    cmd.type = Command::Recover;
+    cmd.recover.job = jobs[s].get();
+    shards_[s]->queue.push_block(cmd);
+  }
+
+  for (size_t s = 0; s < jobs.size(); ++s) {
+    ReplayJob &job = *jobs[s];
+    while (!job.done.load(std::memory_order_acquire)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    result.commands += job.commands;
+    result.trades += job.trades;
+    result.checkpoints += job.checkpoints;
+    result.stateChecks += job.stateChecks;
+    result.orders += job.orders;
+    maxOrderId = std::max(maxOrderId, job.maxOrderId);
+    if (!job.error.empty() && result.error.empty()) {
+      result.error = "shard " + std::to_string(s) + ": " + job.error;
+    }
+  }
+  // New orders must not reuse a recovered order's id.
+  advanceIds(maxOrderId, 0);
+  result.ok = result.error.empty();
+}
+
+void Exchange::advanceIds(OrderId orderId, uint32_t sessionId) {
+  OrderId next = nextOrderId_.load();
+  while (next <= orderId &&
+         !nextOrderId_.compare_exchange_weak(next, orderId + 1)) {
+  }
+  uint32_t nextSession = nextSessionId_.load();
+  while (nextSession <= sessionId &&
+         !nextSessionId_.compare_exchange_weak(nextSession, sessionId + 1)) {
+  }
+}
+
+Exchange::RecoveryResult Exchange::recoverFromJournal(
+    const std::string &path) {
+  RecoveryResult result;
+  if (journal_) {
+    result.error = "recover before enabling a new journal";
+    return result;
+  }
+
+  MappedFile file;
+  JournalFileHeader header;
+  size_t count = 0;
+  if (!file.map(path, result.error)) return result;
+  const JournalRecord *records = journalRecords(file, path, shards_.size(),
+                                                header, count, result.error);
+  if (records != nullptr && header.hasBaseSnapshot) {
+    result.error = path +
+                   " continues a snapshot of earlier books; restore it with "
+                   "restoreFromSnapshot";
+    return result;
+  }
+  // Symbols first, so every shard finds its books.
+  if (records == nullptr ||
+      !registerJournaledSymbols(records, count, result.error)) {
+    return result;
+  }
+
+  std::vector<std::unique_ptr<ReplayJob>> jobs;
+  for (size_t s = 0; s < shards_.size(); ++s) {
+    jobs.push_back(std::make_unique<ReplayJob>());
+    jobs.back()->records = records;
+    jobs.back()->count = count;
+  }
+  runReplayJobs(jobs, 0, result);
+  return result;
+}
+
+bool Exchange::writeSnapshot(const std::string &path) {
+  // The barrier: every shard captures its books once it reaches the
+  // command, in parallel with the others.
+  flush();
+  std::vector<std::unique_ptr<SnapshotJob>> jobs;
+  for (auto &shard : shards_) {
+    jobs.push_back(std::make_unique<SnapshotJob>());
+    Command cmd;
+    cmd.type = Command::Snapshot;
+    cmd.snapshot.job = jobs.back().get();
+    shard->queue.push_block(cmd);
+  }
+  for (auto &job : jobs) {
+    while (!job->done.load(std::memory_order_acquire)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  SnapshotFileHeader header{};
+  std::memcpy(header.magic, SnapshotFileHeader::MAGIC, sizeof(header.magic));
+  header.orderSize = sizeof(Order);
+  header.shardCount = static_cast<uint32_t>(shards_.size());
+  header.nextOrderId = nextOrderId_.load();
+  if (journal_) {
+    journal_->sync();
+    header.journalId = journal_->id();
+  }
+
+  std::vector<SnapshotSymbol> symbols;
+  {
+    std::lock_guard<std::mutex> lock(symbolsMutex_);
+    for (size_t id = 0; id < symbolIdToName_.size(); ++id) {
+      SnapshotSymbol symbol{};
+      symbol.symbolId = static_cast<int32_t>(id);
+      symbol.shardId = symbolIdToShardId_[id];
+      symbol.algorithm = symbolAlgorithms_[id];
+      std::memcpy(symbol.name, symbolIdToName_[id].data(),
+                  std::min(symbolIdToName_[id].size(),
+                           SnapshotSymbol::MAX_NAME - 1));
+      symbols.push_back(symbol);
+    }
+  }
+  header.symbolCount = static_cast<uint32_t>(symbols.size());
+
+  const std::string staging = path + ".tmp";
+  int fd = ::open(staging.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    std::cerr << "Error creating snapshot " << staging << ": "
+              << std::strerror(errno) << "\n";
+    return false;
+  }
+  bool ok = writeAll(fd, &header, sizeof(header)) &&
+            writeAll(fd, symbols.data(),
+                     symbols.size() * sizeof(SnapshotSymbol));
+  for (size_t s = 0; s < jobs.size() && ok; ++s) {
+    const SnapshotJob &job = *jobs[s];
+    SnapshotShard shard{.sequence = job.sequence,
+                        .tradeCount = job.tradeCount,
+                        .tradeHash = job.tradeHash,
+                        .imageSize = job.image.size(),
+                        .books = job.books,
+                        .reserved = 0};
+    ok = writeAll(fd, &shard, sizeof(shard)) &&
+         writeAll(fd, job.image.data(), job.image.size());
+  }
+  ok = ok && fdatasync(fd) == 0;
+  ::close(fd);
+  if (!ok || std::rename(staging.c_str(), path.c_str()) != 0) {
+    std::cerr << "Error writing snapshot " << path << ": "
+              << std::strerror(errno) << "\n";
+    std::remove(staging.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::vector<Exchange::ShardDigest> Exchange::digest() {
+  flush();
+  std::vector<std::unique_ptr<DigestJob>> jobs;
+  for (auto &shard : shards_) {
+    jobs.push_back(std::make_unique<DigestJob>());
+    Command cmd;
+    cmd.type = Command::Digest;
+    cmd.digest.job = jobs.back().get();
+    shard->queue.push_block(cmd);
+  }
+  std::vector<ShardDigest> digests;
+  for (auto &job : jobs) {
+    while (!job->done.load(std::memory_order_acquire)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    digests.push_back(job->digest);
+  }
+  return digests;
+}
+
+void Exchange::enableLatencyMetrics(bool enabled) {
+  if (enabled) tscNanosPerTick();
+  latencyMetrics_.store(enabled, std::memory_order_relaxed);
+}
+
+Exchange::LatencyMetrics Exchange::latencyMetrics(bool reset) {
+  flush();
+  std::vector<std::unique_ptr<LatencyJob>> jobs;
+  for (auto &shard : shards_) {
+    jobs.push_back(std::make_unique<LatencyJob>());
+    jobs.back()->reset = reset;
+    Command cmd;
+    cmd.type = Command::Latency;
+    cmd.latency.job = jobs.back().get();
+    shard->queue.push_block(cmd);
+  }
+  LatencyMetrics metrics;
+  for (auto &job : jobs) {
+    while (!job->done.load(std::memory_order_acquire)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    metrics.ack.merge(job->metrics.ack);
+    metrics.trade.merge(job->metrics.trade);
+  }
+  return metrics;
+}
+
+Exchange::RecoveryResult Exchange::restoreFromSnapshot(
+    const std::string &snapshotPath, const std::string &journalPath) {
+  RecoveryResult result;
+  if (journal_) {
+    result.error = "restore before enabling a new journal";
+    return result;
+  }
+
+  MappedFile snapshot;
+  if (!snapshot.map(snapshotPath, result.error)) return result;
+  SnapshotFileHeader header;
+  if (snapshot.size() < sizeof(header)) {
+    result.error = snapshotPath + ": not a snapshot";
+    return result;
+  }
+  std::memcpy(&header, snapshot.data(), sizeof(header));
+  if (std::memcmp(header.magic, SnapshotFileHeader::MAGIC,
+                  sizeof(header.magic)) != 0 ||
+      header.orderSize != sizeof(Order)) {
+    result.error = snapshotPath + ": not a snapshot written by this build";
+    return result;
+  }
+  if (header.shardCount != shards_.size()) {
+    result.error = "snapshot has " + std::to_string(header.shardCount) +
+                   " shards, engine has " + std::to_string(shards_.size());
+    return result;
+  }
+
+  const std::byte *data = snapshot.data() + sizeof(header);
+  const std::byte *end = snapshot.data() + snapshot.size();
+  if (static_cast<size_t>(end - data) / sizeof(SnapshotSymbol) <
+      header.symbolCount) {
+    result.error = snapshotPath + ": truncated";
+    return result;
+  }
+  for (uint32_t i = 0; i < header.symbolCount; ++i) {
+    SnapshotSymbol symbol;
+    std::memcpy(&symbol, data, sizeof(symbol));
+    data += sizeof(symbol);
+    if (!registerRecoveredSymbol(symbol.name, sizeof(symbol.name),
+                                 symbol.symbolId, symbol.shardId,
+                                 symbol.algorithm, result.error)) {
+      return result;
+    }
+  }
+
+  std::vector<std::unique_ptr<ReplayJob>> jobs;
+  for (size_t s = 0; s < shards_.size(); ++s) {
+    SnapshotShard shard;
+    if (static_cast<size_t>(end - data) < sizeof(shard)) {
+      result.error = snapshotPath + ": truncated";
+      return result;
+    }
+    std::memcpy(&shard, data, sizeof(shard));
+    data += sizeof(shard);
+    if (static_cast<size_t>(end - data) < shard.imageSize) {
+      result.error = snapshotPath + ": truncated";
+      return result;
+    }
+    jobs.push_back(std::make_unique<ReplayJob>());
+    ReplayJob &job = *jobs.back();
+    job.image = data;
+    job.imageSize = shard.imageSize;
+    job.imageBooks = shard.books;
+    job.startSequence = shard.sequence;
+    job.startTradeCount = shard.tradeCount;
+    job.startTradeHash = shard.tradeHash;
+    data += shard.imageSize;
+  }
+
+  MappedFile journal;
+  if (!journalPath.empty()) {
+    JournalFileHeader journalHeader;
+    size_t count = 0;
+    if (!journal.map(journalPath, result.error)) return result;
+    const JournalRecord *records =
+        journalRecords(journal, journalPath, shards_.size(), journalHeader,
+                       count, result.error);
+    if (records == nullptr) return result;
+    if (journalHeader.journalId != header.journalId) {
+      result.error = journalPath + " is not the journal the snapshot follows";
+      return result;
+    }
+    // Symbols registered after the snapshot, ahead of their commands.
+    if (!registerJournaledSymbols(records, count, result.error)) {
+      return result;
+    }
+    for (auto &job : jobs) {
+      job->records = records;
+      job->count = count;
+    }
+  }
+
+  runReplayJobs(jobs, header.nextOrderId > 0 ? header.nextOrderId - 1 : 0,
+                result);
+  return result;
+}
+
+// Runs on the worker at the snapshot barrier: everything before the command
+// is applied, nothing after it.
+void Exchange::captureSnapshot(Shard &shard, SnapshotJob &job,
+                               uint64_t sequence) {
+  job.sequence = sequence;
+  tradeChecksum(shard, job.tradeCount, job.tradeHash);
+  const int32_t numBooks = shard.symbolLimit.load(std::memory_order_acquire);
+  for (int32_t b = 0; b < numBooks; ++b) {
+    if (!shard.books[b]) continue;
+    shard.books[b]->writeImage(b, job.image);
+    ++job.books;
+  }
+  job.done.store(true, std::memory_order_release);
+}
+
+// Runs on the worker: loads the shard's snapshot images into its empty
+// books.
+bool Exchange::loadImages(Shard &shard, ReplayJob &job) {
+  const std::byte *data = job.image;
+  const std::byte *end = job.image + job.imageSize;
+  for (uint32_t b = 0; b < job.imageBooks; ++b) {
+    BookImage image;
+    if (static_cast<size_t>(end - data) < sizeof(image)) {
+      job.error = "snapshot image is truncated";
+      return false;
+    }
+    std::memcpy(&image, data, sizeof(image));
+    const int32_t symId = image.symbolId;
+    OrderBook *book = findBook(shard, symId);
+    if (!book) {
+      job.error = "snapshot has a book for unknown symbol " +
+                  std::to_string(symId);
+      return false;
+    }
+    data = book->loadImage(data, end);
+    if (data == nullptr) {
+      job.error = "snapshot image of symbol " + std::to_string(symId) +
+                  " is malformed";
+      return false;
+    }
+    job.orders += image.orderCount;
+    markTouched(shard, symId);
+  }
+  return true;
+}
+
+// Runs on the worker: applies this shard's records in order, skipping the
+// ones a snapshot already covers. Trades only feed the checksum; reports
+// and L3 events of the replay are dropped.
+void Exchange::replayJournal(int shardId, Shard &shard, ReplayJob &job) {
+  uint64_t expected = job.startSequence + 1;
+  uint64_t tradeCount = job.startTradeCount;
+  uint64_t tradeHash = job.startTradeHash;
+  bool reachedStart = job.startSequence == 0;
+
+  for (size_t i = 0; i < job.count; ++i) {
+    const JournalRecord &record = job.records[i];
+    if (record.shardId != shardId ||
+        record.type == JournalRecordType::Symbol) {
+      continue;
+    }
+    if (record.sequence <= job.startSequence) {
+      reachedStart |= record.sequence == job.startSequence;
+      continue;
+    }
+    if (record.checksum != record.computeChecksum()) break;
+
+    if (record.type == JournalRecordType::Checkpoint) {
+      const JournalCheckpoint &checkpoint = record.payload.checkpoint;
+      if (record.sequence != expected - 1 ||
+          checkpoint.tradeCount != tradeCount ||
+          checkpoint.tradeHash != tradeHash) {
+        job.error = "trades after command " +
+                    std::to_string(record.sequence) +
+                    " differ from the journaled checksum";
+        break;
+      }
+      ++job.checkpoints;
+      continue;
+    }
+
+    if (record.type == JournalRecordType::StateCheck) {
+      if (record.sequence != expected - 1 ||
+          record.payload.stateCheck.bookHash != bookHash(shard)) {
+        job.error = "books after command " + std::to_string(record.sequence) +
+                    " differ from the journaled state check";
+        break;
+      }
+      ++job.stateChecks;
+      continue;
+    }
+
+    if (record.sequence != expected) {
+      job.error = "expected command " + std::to_string(expected) +
+                  ", found " + std::to_string(record.sequence);
+      break;
+    }
+    ++expected;
+
+    Command cmd = record.payload.command;
+    if (cmd.type == Command::Add) {
+      job.maxOrderId = std::max(job.maxOrderId, cmd.add.order.id);
+    }
+    applyCommand(shard, cmd);
+
+    for (const Trade &trade : shard.tradeBuffer) {
+      tradeHash = hashTrade(tradeHash, trade);
+    }
+    tradeCount += shard.tradeBuffer.size();
+    shard.tradeBuffer.clear();
+    shard.reportBuffer.clear();
+    shard.l3Buffer.clear();
+  }
+
+  if (job.records != nullptr && !reachedStart && job.error.empty()) {
+    job.error = "journal ends before command " +
+                std::to_string(job.startSequence) + " of the snapshot";
+  }
+  job.commands = expected - 1 - job.startSequence;
+  job.trades = tradeCount - job.startTradeCount;
+  // Carried on, so the recovered engine's digest matches the original's.
+  shard.tradeCount = tradeCount;
+  shard.tradeHash = tradeHash;
+}
+
+// Folds a batch's trades into the running checksum and journals it.
+void Exchange::checkpointTrades(int shardId, Shard &shard) {
+  tradeChecksum(shard, shard.tradeCount, shard.tradeHash);
+  if (journal_) {
+    journal_->appendCheckpoint(shardId, shard.inputSequence,
+                               {shard.tradeCount, shard.tradeHash});
+  }
+}
+
+// Journals the shard's book hash once stateCheckInterval has passed since
+// the last one.
+void Exchange::checkState(int shardId, Shard &shard) {
+  const auto interval = journal_->options().stateCheckInterval;
+  if (interval.count() == 0) return;
+  const auto now = std::chrono::steady_clock::now();
+  if (now - shard.lastStateCheck < interval) return;
+  shard.lastStateCheck = now;
+  journal_->appendStateCheck(shardId, shard.inputSequence, bookHash(shard));
+}
+
+void Exchange::tradeChecksum(const Shard &shard, uint64_t &count,
+                             uint64_t &hash) {
+  // Trades of the batch so far are only folded in at its end.
+  count = shard.tradeCount + shard.tradeBuffer.size();
+  hash = shard.tradeHash;
+  for (const Trade &trade : shard.tradeBuffer) hash = hashTrade(hash, trade);
+}
+
+uint64_t Exchange::bookHash(const Shard &shard) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  const auto numBooks = static_cast<size_t>(
+      shard.symbolLimit.load(std::memory_order_acquire));
+  for (size_t b = 0; b < numBooks; ++b) {
+    if (!shard.books[b]) continue;
+    hash = (hash ^ b) * 0x100000001b3ULL;
+    hash = (hash ^ shard.books[b]->stateHash()) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+void Exchange::replicate(size_t shardId, const JournalRecord &record) {
+  Command cmd;
+  switch (record.type) {
+    case JournalRecordType::Command:
+      cmd = record.payload.command;
+      // Only order flow crosses over; the primary's own barriers point
+      // into its process.
+      if (cmd.type == Command::Stop || cmd.type == Command::Recover ||
+          cmd.type == Command::Snapshot || cmd.type == Command::Verify ||
+          cmd.type == Command::Digest || cmd.type == Command::Latency) {
+        return;
+      }
+      break;
+    case JournalRecordType::Checkpoint:
+      cmd.type = Command::Verify;
+      cmd.verify = {.sequence = record.sequence,
+                    .tradeCount = record.payload.checkpoint.tradeCount,
+                    .tradeHash = record.payload.checkpoint.tradeHash,
+                    .bookHash = 0,
+                    .checks = Command::CHECK_TRADES};
+      break;
+    case JournalRecordType::StateCheck:
+      cmd.type = Command::Verify;
+      cmd.verify = {.sequence = record.sequence,
+                    .tradeCount = 0,
+                    .tradeHash = 0,
+                    .bookHash = record.payload.stateCheck.bookHash,
+                    .checks = Command::CHECK_BOOKS};
+      break;
+    default:
+      return;
+  }
+  enqueue(shardId, cmd);
+}
+
+void Exchange::markReplicated(size_t shardId, uint64_t sequence) {
+  Command cmd;
+  cmd.type = Command::Verify;
+  cmd.verify = {.sequence = sequence,
+                .tradeCount = 0,
+                .tradeHash = 0,
+                .bookHash = 0,
+                .checks = 0};
+  enqueue(shardId, cmd);
+}
+
+// Runs on the worker, at the point of the replicated stream the command
+// was queued at.
+void Exchange::verifyReplicated(Shard &shard, const Command &cmd) {
+  const auto &verify = cmd.verify;
+  bool matches = true;
+  if (verify.checks & Command::CHECK_TRADES) {
+    uint64_t count;
+    uint64_t hash;
+    tradeChecksum(shard, count, hash);
+    matches = count == verify.tradeCount && hash == verify.tradeHash;
+  }
+  if (matches && (verify.checks & Command::CHECK_BOOKS)) {
+    matches = bookHash(shard) == verify.bookHash;
+  }
+  if (!matches) {
+    uint64_t none = 0;
+    shard.divergedAt.compare_exchange_strong(none, verify.sequence);
+  }
+  shard.replicatedSequence.store(verify.sequence, std::memory_order_release);
+}
+
+void Exchange::enableL3Events(size_t ringCapacity) {
+  for (auto &shard : shards_) {
+    if (shard->l3Ring) continue;
+    shard->l3Ring = std::make_unique<RingBuffer<L3Event>>(ringCapacity);
+    shard->l3Buffer.reserve(4096);
+    const int32_t numBooks =
+        shard->symbolLimit.load(std::memory_order_acquire);
+    for (int32_t b = 0; b < numBooks; ++b) {
+      if (shard->books[b]) shard->books[b]->setL3Sink(&shard->l3Buffer);
+    }
+  }
+}
+
+size_t Exchange::pollL3Events(size_t shardId, L3Event *out, size_t max) {
+  if (shardId >= shards_.size() || !shards_[shardId]->l3Ring) return 0;
+  return shards_[shardId]->l3Ring->pop_batch(out, max);
+}
+
+uint64_t Exchange::droppedL3Events() const {
+  uint64_t dropped = 0;
+  for (const auto &shard : shards_) dropped += shard->l3Dropped.load();
+  return dropped;
+}
+
+bool Exchange::getDepth(int32_t symbolId, DepthSnapshot &out) const {
+  int shardId = shardOf(symbolId);
+  if (shardId < 0) return false;
+  out = shards_[shardId]->depth[symbolId]->load();
+  return true;
+}
+
+void Exchange::setDepthPublishInterval(std::chrono::nanoseconds interval) {
+  depthIntervalNs_ = interval.count();
+}
+
+void Exchange::printOrderBook(int32_t symbolId) const {
+  int shardId = shardOf(symbolId);
+  if (shardId < 0) return;
 
-  size_t shardId = symbolIdToShardId_[symbolId];
   const auto &shard = *shards_[shardId];
 
-  if (static_cast<size_t>(symbolId) < shard.books.size() &&
-      shard.books[symbolId]) {
+  if (shard.books[symbolId]) {
     std::cout << "Symbol ID: " << symbolId << " (" << getSymbolName(symbolId)
               << ")\n";
     shard.books[symbolId]->printBook();
@@ -310,21 +1457,14 @@ void Exchange::printOrderBook(int32_t symbolId) const {
 }
 
 void Exchange::printAllOrderBooks() const {
-  for (size_t sid = 0; sid < symbolIdToName_.size(); ++sid) {
-    printOrderBook(static_cast<int32_t>(sid));
+  const int32_t count = symbolCount_.load(std::memory_order_acquire);
+  for (int32_t sid = 0; sid < count; ++sid) {
+    printOrderBook(sid);
   }
 }
 
 const OrderBook *Exchange::getOrderBook(int32_t symbolId) const {
-  if (symbolId < 0 ||
-      symbolId >= static_cast<int32_t>(symbolIdToShardId_.size()))
-    return nullptr;
-
-  size_t shardId = symbolIdToShardId_[symbolId];
-  const auto &shard = *shards_[shardId];
-
-  if (static_cast<size_t>(symbolId) < shard.books.size()) {
-    return shard.books[symbolId].get();
-  }
-  return nullptr;
+  int shardId = shardOf(symbolId);
+  if (shardId < 0) return nullptr;
+  return shards_[shardId]->books[symbolId].get();
 }
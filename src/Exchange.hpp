@@ -1,21 +1,48 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "LatencyHistogram.hpp"
 #include "MatchingStrategy.hpp"
 #include "OrderBook.hpp"
 #include "RingBuffer.hpp"
+#include "SeqLock.hpp"
+
+class Journal;
+struct JournalOptions;
+struct JournalRecord;
 
 class Exchange {
+  struct ReplayJob;
+  struct SnapshotJob;
+  struct DigestJob;
+  struct LatencyJob;
+
  public:
   using TradeCallback = std::function<void(const std::vector<Trade> &)>;
+  using ExecutionReportCallback =
+      std::function<void(const std::vector<ExecutionReport> &)>;
+  using QuoteCallback = std::function<void(const std::vector<Quote> &)>;
+  using BookDeltaCallback =
+      std::function<void(const std::vector<BookDelta> &)>;
+  // Identifies one registered listener, of any kind, for removeCallback.
+  using CallbackHandle = uint64_t;
+
+  static constexpr int DEFAULT_MAX_SYMBOLS = 4096;
 
-  Exchange(int numWorkers = 0);
+  // The per-symbol tables are sized for maxSymbols up front and never move,
+  // so gateways can register symbols while others read them.
+  Exchange(int numWorkers = 0, int maxSymbols = DEFAULT_MAX_SYMBOLS);
   ~Exchange();
 
   Exchange(const Exchange &) = delete;
@@ -24,7 +51,24 @@ class Exchange {
   Exchange &operator=(Exchange &&) = delete;
 
   struct Command {
-    enum Type : uint8_t { Add, Cancel, Stop, Reset } type;
+    enum Type : uint8_t {
+      Add,
+      Cancel,
+      Modify,
+      MassCancel,
+      Stop,
+      Reset,
+      Recover,
+      Snapshot,
+      Verify,
+      Digest,
+      Latency
+    } type;
+    // tscNow() when submitted while latency metrics are on, else 0.
+    uint64_t submitTicks = 0;
+    // Checks a Verify command carries.
+    static constexpr uint8_t CHECK_TRADES = 1;
+    static constexpr uint8_t CHECK_BOOKS = 2;
     union {
       struct {
         Order order;
@@ -32,7 +76,39 @@ class Exchange {
       struct {
         OrderId orderId;
         int32_t symbolId;
+        uint32_t sessionId;
       } cancel;
+      struct {
+        OrderId orderId;
+        Price price;
+        int32_t symbolId;
+        uint32_t sessionId;
+        Quantity quantity;
+      } modify;
+      struct {
+        int32_t symbolId;
+        uint32_t ownerId;
+        MassCancelSide side;
+      } massCancel;
+      struct {
+        ReplayJob *job;
+      } recover;
+      struct {
+        SnapshotJob *job;
+      } snapshot;
+      struct {
+        DigestJob *job;
+      } digest;
+      struct {
+        LatencyJob *job;
+      } latency;
+      struct {
+        uint64_t sequence;
+        uint64_t tradeCount;
+        uint64_t tradeHash;
+        uint64_t bookHash;
+        uint8_t checks;
+      } verify;
     };
     Command() : type(Add) { std::memset(&add, 0, sizeof(add)); }
   };
@@ -40,16 +116,179 @@ class Exchange {
   void submitOrder(const Order &order, int shardHint = -1,
                    std::chrono::nanoseconds *wait_duration = nullptr);
   void submitOrders(const std::vector<Order> &orders, int shardHint = -1);
-  void cancelOrder(int32_t symbolId, OrderId orderId);
+  // A session may cancel or modify only orders it owns; anything else gets
+  // CancelRejected. Session 0 is unrestricted and gets no reports.
+  void cancelOrder(int32_t symbolId, OrderId orderId, uint32_t sessionId = 0);
+  // See OrderBook::modifyOrder for when the order keeps its queue priority.
+  void modifyOrder(int32_t symbolId, OrderId orderId, Price price,
+                   Quantity quantity, uint32_t sessionId = 0);
+  // Cancels an owner's orders in one command per shard. symbolId -1 covers
+  // every symbol; ownerId 0 covers every owner.
+  void massCancel(int32_t symbolId, uint32_t ownerId,
+                  MassCancelSide side = MassCancelSide::Both);
   void stop();
   void flush();
   void drain();
   void reset();
 
-  int32_t registerSymbol(const std::string &symbol, int shardId);
+  // Safe from any thread. Returns -1 once maxSymbols are registered.
+  int32_t registerSymbol(
+      const std::string &symbol, int shardId,
+      MatchingAlgorithm algorithm = MatchingAlgorithm::PriceTime);
   std::string getSymbolName(int32_t symbolId) const;
 
+  // Listeners run on the shard workers. add*Callback lets several consumers
+  // (gateways, market data feed) share a stream and returns a handle that
+  // the consumer must pass to removeCallback before it goes away. The set*
+  // forms keep one listener of their own for single-consumer callers:
+  // each call replaces the previous set* listener and leaves the add* ones
+  // alone.
   void setTradeCallback(TradeCallback cb);
+  CallbackHandle addTradeCallback(TradeCallback cb);
+  // Top-of-book changes, at most one per book per shard batch, delivered on
+  // the worker thread after the batch's trades.
+  CallbackHandle addQuoteCallback(QuoteCallback cb);
+  // Price-level changes, coalesced per shard batch: a level touched many
+  // times in one batch yields at most one delta. Delivered after the
+  // batch's trades and before its quotes.
+  CallbackHandle addBookDeltaCallback(BookDeltaCallback cb);
+  // Reports are delivered per shard batch on the worker thread; consumers
+  // route them by ExecutionReport::sessionId and skip sessions they do not
+  // own.
+  void setExecutionReportCallback(ExecutionReportCallback cb);
+  CallbackHandle addExecutionReportCallback(ExecutionReportCallback cb);
+  // Once this returns the listener is not running and is never called
+  // again. Waits for the workers to finish their current publish, so it
+  // must not be called from inside a listener.
+  void removeCallback(CallbackHandle handle);
+
+  // Engine-wide order and session ids, shared by every gateway so reports
+  // routed by session id never reach the wrong client. Safe from any thread.
+  OrderId nextOrderId() {
+    return nextOrderId_.fetch_add(1, std::memory_order_relaxed);
+  }
+  uint32_t nextSessionId() {
+    return nextSessionId_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Order-by-order events (see L3Event), sequenced per shard and written to
+  // a per-shard ring at the end of every batch. Off until enabled, and only
+  // complete when enabled before the first order. A full ring drops the
+  // batch, which the consumer sees as a gap in the shard's sequence.
+  void enableL3Events(size_t ringCapacity = 1 << 18);
+  // Drains up to `max` events of one shard; single consumer per shard.
+  size_t pollL3Events(size_t shardId, L3Event *out, size_t max);
+  uint64_t droppedL3Events() const;
+  size_t shardCount() const { return shards_.size(); }
+
+  // Journals every shard's input commands, in the order each worker applies
+  // them, to `path` (see Journal.hpp). Call before the first order; symbols
+  // already registered are journaled first. With options.baseSnapshot set,
+  // the books as they stand are snapshotted there once the journal is
+  // open (see JournalOptions). Returns false if the file already holds a
+  // journal, or if it or the snapshot cannot be written.
+  bool enableJournal(const std::string &path, const JournalOptions &options);
+  Journal *journal() const { return journal_.get(); }
+
+  struct RecoveryResult {
+    bool ok = false;
+    uint64_t commands = 0;     // Replayed, all shards.
+    uint64_t trades = 0;       // Regenerated by the replay.
+    uint64_t checkpoints = 0;  // Trade checksums that matched.
+    uint64_t stateChecks = 0;  // Book hashes that matched.
+    uint64_t orders = 0;       // Loaded from a snapshot.
+    std::string error;
+  };
+  // Rebuilds the books from a journal written by enableJournal. The file is
+  // memory-mapped and each shard worker applies its own records straight to
+  // its books, in parallel and without going through the command queues.
+  // Regenerated trades are checked against the checksums journaled with
+  // them; nothing is reported to trade or execution report listeners, but
+  // quotes, deltas and depth are published for the recovered books. Call on
+  // an idle engine with no symbols yet, and before enabling a new journal.
+  // A record with a bad checksum (a write torn by the crash) ends its
+  // shard's replay.
+  RecoveryResult recoverFromJournal(const std::string &path);
+
+  // Writes a point-in-time image of every book to `path` (see Snapshot.hpp).
+  // Each shard worker captures its own books when it reaches the snapshot
+  // in its queue, behind everything this thread submitted before the call;
+  // the file itself is written from the calling thread. With a journal
+  // enabled, the journal is synced first so that it holds every command the
+  // snapshot includes. The file is written beside `path` and renamed into
+  // place, so a crash never leaves a partial snapshot. Returns false if it
+  // cannot be written.
+  bool writeSnapshot(const std::string &path);
+  // Loads a snapshot into an idle engine with no symbols, then replays only
+  // the commands `journalPath` holds after it, with the same checks as
+  // recoverFromJournal. The journal must be the one that was enabled when
+  // the snapshot was taken; an empty path restores the snapshot alone. Each
+  // shard worker maps its books back with bulk copies, in parallel.
+  RecoveryResult restoreFromSnapshot(const std::string &snapshotPath,
+                                     const std::string &journalPath = "");
+
+  // A shard's state in three words: the running count and hash (see
+  // hashTrade) of every trade it has produced since the engine started or
+  // its journal was enabled, and the combined OrderBook::stateHash of its
+  // books. Two engines fed the same commands agree on every field.
+  struct ShardDigest {
+    uint64_t tradeCount = 0;
+    uint64_t tradeHash = 0;
+    uint64_t bookHash = 0;
+
+    bool operator==(const ShardDigest &) const = default;
+  };
+  // Every shard's digest at a barrier: each shard takes its own when it
+  // reaches the point this thread has submitted up to. O(books) per shard.
+  // With a journal, the request is journaled as a no-op, like a snapshot.
+  std::vector<ShardDigest> digest();
+
+  // Live latency metrics, off by default. While on, every submission is
+  // stamped with tscNow(), and each shard, as it hands a batch's reports and
+  // trades to the callbacks, records how long each command in the batch
+  // took since (submit-to-ack) and, for commands that traded, the same into
+  // a second histogram (submit-to-trade). Costs one counter read per
+  // submission. Turning it on calibrates the counter, which takes about
+  // 10ms on the calling thread rather than on a shard worker.
+  void enableLatencyMetrics(bool enabled);
+  struct LatencyMetrics {
+    LatencyHistogram ack;    // Nanoseconds.
+    LatencyHistogram trade;  // Nanoseconds.
+  };
+  // Every shard's histograms merged, each taken at a barrier as digest()
+  // does. With `reset`, the shards start over from empty histograms.
+  LatencyMetrics latencyMetrics(bool reset = false);
+
+  // Hot-standby replication (see Replica.hpp). replicate queues one record
+  // of a primary's journal to the same shard here: commands are applied
+  // exactly as the primary applied them, and its trade checkpoints and
+  // state checks are compared with this engine's at the same command.
+  // markReplicated queues a marker that makes replicatedSequence report
+  // `sequence` once the shard has applied everything before it. Both go
+  // through the calling thread's batches like any other submission.
+  void replicate(size_t shardId, const JournalRecord &record);
+  void markReplicated(size_t shardId, uint64_t sequence);
+  uint64_t replicatedSequence(size_t shardId) const {
+    return shards_[shardId]->replicatedSequence.load(
+        std::memory_order_acquire);
+  }
+  // Sequence of the first replicated checkpoint or state check the shard
+  // failed; 0 while it matches the primary.
+  uint64_t divergedAt(size_t shardId) const {
+    return shards_[shardId]->divergedAt.load(std::memory_order_acquire);
+  }
+  // Makes nextOrderId and nextSessionId hand out ids above these, so that
+  // orders taken over from elsewhere keep theirs.
+  void advanceIds(OrderId orderId, uint32_t sessionId);
+
+  // Latest depth published by the symbol's shard. Safe from any thread;
+  // never reads the live book. Returns false for an unknown symbol.
+  bool getDepth(int32_t symbolId, DepthSnapshot &out) const;
+  // Minimum spacing between depth publications per shard. Zero (the
+  // default) republishes every changed book at the end of every batch;
+  // otherwise changes accumulate and go out together, at the latest when
+  // the shard next goes idle after the interval has passed.
+  void setDepthPublishInterval(std::chrono::nanoseconds interval);
 
   void printOrderBook(int32_t symbolId) const;
   void printAllOrderBooks() const;
@@ -60,19 +299,198 @@ class Exchange {
  private:
   struct alignas(128) Shard {
     RingBuffer<Command> queue{65536};
+    // Held by the worker while it calls the listeners. Registration takes
+    // every shard's, so the lists never change under a running listener.
+    std::mutex listenersMutex;
 
+    // The per-symbol tables below hold maxSymbols entries from the start.
+    // Entries under symbolLimit, one past the highest id registered on this
+    // shard, are filled in before it is raised.
+    std::atomic<int32_t> symbolLimit{0};
     std::vector<std::unique_ptr<OrderBook>> books;
+    std::vector<MatchingStrategy *> strategies;
     StandardMatchingStrategy matchingStrategy;
+    ProRataMatchingStrategy proRataStrategy;
+    PriceTimeProRataMatchingStrategy priceTimeProRataStrategy;
     std::vector<Trade> tradeBuffer;
+    std::vector<ExecutionReport> reportBuffer;
+
+    // Books changed by the current batch, each listed once.
+    std::vector<int32_t> touchedBooks;
+    std::vector<uint8_t> touchedFlags;
+    std::vector<Quote> publishedQuotes;
+    std::vector<Quote> quoteBuffer;
+    std::vector<BookDelta> deltaBuffer;
+
+    // Under JournalSyncPolicy::GroupCommit, what a batch hands the listeners
+    // waits here until the journal has synced the batch's last command.
+    struct HeldBatch {
+      uint64_t sequence = 0;
+      std::vector<Trade> trades;
+      std::vector<ExecutionReport> reports;
+      std::vector<BookDelta> deltas;
+      std::vector<Quote> quotes;
+    };
+    std::deque<HeldBatch> heldBatches;
+    // Released batches, kept for the capacity of their buffers.
+    std::vector<HeldBatch> spareBatches;
+
+    // Commands taken off the queue so far; the journal's sequence.
+    uint64_t inputSequence = 0;
+    // Running count and hash of the trades since the journal started (or,
+    // on a replica, since the engine did), folded in after every batch.
+    uint64_t tradeCount = 0;
+    uint64_t tradeHash = 0;
+    std::chrono::steady_clock::time_point lastStateCheck;
+
+    // Commands of the current batch stamped at submission, and whether
+    // each traded; recorded into the histograms as the batch is published.
+    struct LatencyStamp {
+      uint64_t submitTicks;
+      bool traded;
+    };
+    std::vector<LatencyStamp> latencyStamps;
+    LatencyHistogram ackLatency;
+    LatencyHistogram tradeLatency;
+
+    std::atomic<uint64_t> replicatedSequence{0};
+    std::atomic<uint64_t> divergedAt{0};
+
+    std::unique_ptr<RingBuffer<L3Event>> l3Ring;
+    std::vector<L3Event> l3Buffer;
+    uint64_t l3Sequence = 0;
+    std::atomic<uint64_t> l3Dropped{0};
+
+    std::vector<std::unique_ptr<SeqLock<DepthSnapshot>>> depth;
+    // Books changed since their depth was last published.
+    std::vector<int32_t> staleDepth;
+    std::vector<uint8_t> staleDepthFlags;
+    std::chrono::steady_clock::time_point lastDepthPublish;
+    DepthSnapshot depthScratch;
+  };
+
+  struct ReplayJob {
+    const JournalRecord *records = nullptr;
+    size_t count = 0;
+    // Snapshot images of the shard's books, loaded before the journal.
+    const std::byte *image = nullptr;
+    size_t imageSize = 0;
+    uint32_t imageBooks = 0;
+    // Journal commands up to startSequence are already in the images, whose
+    // trades are counted in startTradeCount / startTradeHash.
+    uint64_t startSequence = 0;
+    uint64_t startTradeCount = 0;
+    uint64_t startTradeHash = 0;
+    uint64_t orders = 0;
+    uint64_t commands = 0;
+    uint64_t trades = 0;
+    uint64_t checkpoints = 0;
+    uint64_t stateChecks = 0;
+    OrderId maxOrderId = 0;
+    std::string error;
+    std::atomic<bool> done{false};
+  };
+
+  struct DigestJob {
+    ShardDigest digest;
+    std::atomic<bool> done{false};
+  };
+
+  struct LatencyJob {
+    LatencyMetrics metrics;
+    bool reset = false;
+    std::atomic<bool> done{false};
+  };
+
+  struct SnapshotJob {
+    std::vector<std::byte> image;
+    uint32_t books = 0;
+    uint64_t sequence = 0;
+    uint64_t tradeCount = 0;
+    uint64_t tradeHash = 0;
+    std::atomic<bool> done{false};
   };
 
   void workerLoop(int shardId);
+  static void applyCommand(Shard &shard, Command &cmd);
+  void checkpointTrades(int shardId, Shard &shard);
+  void checkState(int shardId, Shard &shard);
+  static void verifyReplicated(Shard &shard, const Command &cmd);
+  // Running trade count and hash including the current batch's trades.
+  static void tradeChecksum(const Shard &shard, uint64_t &count,
+                            uint64_t &hash);
+  // Every book's OrderBook::stateHash, combined in symbol order.
+  static uint64_t bookHash(const Shard &shard);
+  void replayJournal(int shardId, Shard &shard, ReplayJob &job);
+  static bool loadImages(Shard &shard, ReplayJob &job);
+  static void captureSnapshot(Shard &shard, SnapshotJob &job,
+                              uint64_t sequence);
+  // Registers a symbol read back from a journal or snapshot; false if it
+  // does not get its recorded id.
+  bool registerRecoveredSymbol(const char *name, size_t maxName,
+                               int32_t symbolId, int shardId,
+                               MatchingAlgorithm algorithm,
+                               std::string &error);
+  bool registerJournaledSymbols(const JournalRecord *records, size_t count,
+                                std::string &error);
+  // Hands every shard its job, waits for all of them and folds their
+  // results into `result`.
+  void runReplayJobs(std::vector<std::unique_ptr<ReplayJob>> &jobs,
+                     OrderId maxOrderId, RecoveryResult &result);
+  // The symbol's book on this shard, or null.
+  static OrderBook *findBook(Shard &shard, int32_t symbolId);
+  // The shard a registered symbol lives on, or -1.
+  int shardOf(int32_t symbolId) const;
+  static void markTouched(Shard &shard, int32_t symbolId);
+  static void recordLatency(Shard &shard);
+  void publishBatch(Shard &shard);
+  static void holdBatch(Shard &shard);
+  // Hands the held batches the journal has synced to the listeners.
+  void releaseDurable(int shardId, Shard &shard);
+  // Calls the listeners with one batch's output, then clears it.
+  void notifyListeners(Shard &shard, std::vector<Trade> &trades,
+                       std::vector<ExecutionReport> &reports,
+                       std::vector<BookDelta> &deltas,
+                       std::vector<Quote> &quotes);
+  static void publishL3(Shard &shard);
+  void publishDepth(Shard &shard);
+  void enqueue(size_t shardId, const Command &cmd);
 
   std::vector<std::unique_ptr<Shard>> shards_;
   std::vector<std::jthread> workers_;
-  TradeCallback onTrade_;
+  template <typename Callback>
+  using Listeners = std::vector<std::pair<CallbackHandle, Callback>>;
+  // Locks every shard's listenersMutex, in shard order.
+  std::vector<std::unique_lock<std::mutex>> lockListeners();
+  template <typename Callback>
+  CallbackHandle addListener(Listeners<Callback> &listeners, Callback cb);
+  template <typename Callback>
+  void setListener(Listeners<Callback> &listeners, CallbackHandle &handle,
+                   Callback cb);
+
+  Listeners<TradeCallback> tradeCallbacks_;
+  Listeners<ExecutionReportCallback> reportCallbacks_;
+  Listeners<QuoteCallback> quoteCallbacks_;
+  Listeners<BookDeltaCallback> deltaCallbacks_;
+  CallbackHandle nextCallbackHandle_ = 1;
+  CallbackHandle setTradeHandle_ = 0;
+  CallbackHandle setReportHandle_ = 0;
+  std::atomic<int64_t> depthIntervalNs_{0};
+  std::atomic<bool> latencyMetrics_{false};
+  std::atomic<OrderId> nextOrderId_{1};
+  std::atomic<uint32_t> nextSessionId_{1};
+
+  // Gateways register symbols on lookup from their own threads. The mutex
+  // serialises registration; readers of symbolIdToShardId_ and the shards'
+  // tables go by symbolCount_ instead, which is raised once they are filled.
+  mutable std::mutex symbolsMutex_;
+  const int maxSymbols_;
+  std::atomic<int32_t> symbolCount_{0};
 
   std::unordered_map<std::string, int32_t> symbolNameToId_;
   std::vector<std::string> symbolIdToName_;
   std::vector<int> symbolIdToShardId_;
+  std::vector<MatchingAlgorithm> symbolAlgorithms_;
+
+  std::unique_ptr<Journal> journal_;
 };
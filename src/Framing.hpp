@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <utility>
+
+#include "Protocol.hpp"
+
+// Bounded receive buffer for one connection. The socket is read straight
+// into the free space at the back; consumed frames advance the front, and
+// whatever partial frame is left gets slid to the start before the next
+// read. Storage is allocated on the first read, uninitialized, and doubles
+// only while a partial frame fills it, so an idle or chatty-but-small
+// session costs a few kilobytes. A peer can hold at most `capacity` bytes
+// of unframed input.
+class InputBuffer {
+ public:
+  static constexpr size_t INITIAL_BYTES = 4 * 1024;
+
+  explicit InputBuffer(size_t capacity) : capacity_(capacity) {}
+
+  std::string_view readable() const {
+    return {data_.get() + begin_, end_ - begin_};
+  }
+  void consume(size_t n) {
+    begin_ += n;
+    if (begin_ == end_) begin_ = end_ = 0;
+  }
+
+  // Space for the next read(). Empty only when a single unfinished frame
+  // fills the whole capacity.
+  char *writePtr() {
+    compact();
+    if (end_ == size_ && size_ < capacity_) grow();
+    return data_.get() + end_;
+  }
+  size_t writable() const { return size_ - end_; }
+  void commit(size_t n) { end_ += n; }
+
+  bool full() const { return begin_ == 0 && end_ == capacity_; }
+
+ private:
+  void compact() {
+    if (begin_ == 0) return;
+    std::memmove(data_.get(), data_.get() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+  }
+
+  void grow() {
+    const size_t size =
+        std::min(capacity_, std::max(INITIAL_BYTES, size_ * 2));
+    auto data = std::make_unique_for_overwrite<char[]>(size);
+    if (end_ > 0) std::memcpy(data.get(), data_.get(), end_);
+    data_ = std::move(data);
+    size_ = size;
+  }
+
+  std::unique_ptr<char[]> data_;
+  size_t size_ = 0;
+  size_t capacity_;
+  size_t begin_ = 0;
+  size_t end_ = 0;
+};
+
+enum class FrameStatus { Complete, Incomplete, Invalid };
+
+// Text frames end at '\n'; the payload drops the terminator and a
+// preceding '\r'.
+inline FrameStatus nextTextFrame(std::string_view input, size_t &frameLength,
+                                 std::string_view &payload) {
+  size_t end = input.find('\n');
+  if (end == std::string_view::npos) return FrameStatus::Incomplete;
+  frameLength = end + 1;
+  payload = input.substr(0, end);
+  if (!payload.empty() && payload.back() == '\r') payload.remove_suffix(1);
+  return FrameStatus::Complete;
+}
+
+// Binary frames carry their own length in the BinaryHeader.
+inline FrameStatus nextBinaryFrame(std::string_view input,
+                                   BinaryHeader &header) {
+  if (!peekHeader(input.data(), input.size(), header)) {
+    return FrameStatus::Incomplete;
+  }
+  if (header.length < sizeof(BinaryHeader) ||
+      header.length > MAX_BINARY_MESSAGE) {
+    return FrameStatus::Invalid;
+  }
+  return input.size() < header.length ? FrameStatus::Incomplete
+                                      : FrameStatus::Complete;
+}
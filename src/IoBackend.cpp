@@ -0,0 +1,491 @@
+#include "IoBackend.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+namespace {
+
+constexpr size_t READ_BUFFER_BYTES = 64 * 1024;
+
+// Edge-triggered epoll. Each readable socket is read until EAGAIN into one
+// buffer shared by the thread's connections.
+class EpollBackend : public IoBackend {
+ public:
+  EpollBackend()
+      : epollFd_(epoll_create1(EPOLL_CLOEXEC)),
+        buffer_(std::make_unique<char[]>(READ_BUFFER_BYTES)) {}
+  ~EpollBackend() override {
+    if (epollFd_ >= 0) close(epollFd_);
+  }
+
+  bool valid() const { return epollFd_ >= 0; }
+  const char *name() const override { return "epoll"; }
+  IoBackendType type() const override { return IoBackendType::Epoll; }
+
+  bool listen(int listenFd) override {
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+    listenFd_ = listenFd;
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd;
+    return epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd, &ev) == 0;
+  }
+
+  bool add(int fd) override {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    return epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+  }
+
+  void remove(int fd) override {
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+  }
+
+  void poll(int timeoutMs, const Handler &handler) override {
+    constexpr int MAX_EVENTS = 256;
+    std::array<epoll_event, MAX_EVENTS> events{};
+    int n = epoll_wait(epollFd_, events.data(), MAX_EVENTS, timeoutMs);
+    for (int i = 0; i < n; ++i) {
+      int fd = events[i].data.fd;
+      uint32_t flags = events[i].events;
+      if (fd == listenFd_) {
+        acceptAll(handler);
+        continue;
+      }
+      if (flags & (EPOLLERR | EPOLLHUP)) {
+        handler({EventType::Closed, fd, {}});
+        continue;
+      }
+      if ((flags & EPOLLOUT) && !handler({EventType::Writable, fd, {}})) {
+        continue;
+      }
+      if (flags & (EPOLLIN | EPOLLRDHUP)) readAll(fd, handler);
+    }
+  }
+
+ private:
+  void acceptAll(const Handler &handler) {
+    while (true) {
+      int fd = accept4(listenFd_, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        return;
+      }
+      handler({EventType::Accepted, fd, {}});
+    }
+  }
+
+  // Edge-triggered: read until EAGAIN or the handler lets go of the socket.
+  void readAll(int fd, const Handler &handler) {
+    while (true) {
+      ssize_t n = read(fd, buffer_.get(), READ_BUFFER_BYTES);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+      if (n <= 0) {
+        handler({EventType::Closed, fd, {}});
+        return;
+      }
+      if (!handler({EventType::Data, fd,
+                    {buffer_.get(), static_cast<size_t>(n)}})) {
+        return;
+      }
+    }
+  }
+
+  int epollFd_;
+  int listenFd_ = -1;
+  std::unique_ptr<char[]> buffer_;
+};
+
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT) && \
+    defined(IORING_ASYNC_CANCEL_FD) && defined(IORING_SETUP_COOP_TASKRUN)
+#define HAVE_IO_URING_BACKEND 1
+
+// io_uring driven through the raw system calls. Every socket gets one
+// multishot receive drawing from a ring of provided buffers and one
+// multishot POLLOUT; the listener gets a multishot accept. New requests are
+// queued in the submission ring and go to the kernel together with the
+// next wait, so a round costs a single io_uring_enter.
+class IoUringBackend : public IoBackend {
+ public:
+  static constexpr unsigned QUEUE_DEPTH = 1024;
+  static constexpr unsigned BUFFER_COUNT = 512;
+  static constexpr unsigned BUFFER_BYTES = 4096;
+  static constexpr uint16_t BUFFER_GROUP = 0;
+
+  IoUringBackend() = default;
+  ~IoUringBackend() override {
+    if (ringFd_ >= 0) close(ringFd_);
+    if (wakeFd_ >= 0) close(wakeFd_);
+    if (ring_ != nullptr) munmap(ring_, ringBytes_);
+    if (sqes_ != nullptr) munmap(sqes_, sqeBytes_);
+    if (bufferRing_ != nullptr) munmap(bufferRing_, bufferRingBytes_);
+  }
+
+  // Sets up the rings, the provided buffers and the wakeup eventfd. False
+  // when any of it is unsupported here.
+  bool init() {
+    // Cooperative task running keeps the kernel from interrupting whichever
+    // thread submitted a request to post its completion; completions are
+    // only reaped inside poll() anyway.
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = QUEUE_DEPTH * 4;
+    ringFd_ = static_cast<int>(
+        syscall(__NR_io_uring_setup, QUEUE_DEPTH, &params));
+    if (ringFd_ < 0 && errno == EINVAL) {
+      params = {};
+      params.flags = IORING_SETUP_CQSIZE;
+      params.cq_entries = QUEUE_DEPTH * 4;
+      ringFd_ = static_cast<int>(
+          syscall(__NR_io_uring_setup, QUEUE_DEPTH, &params));
+    }
+    if (ringFd_ < 0) return false;
+    constexpr unsigned required = IORING_FEAT_SINGLE_MMAP |
+                                  IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) return false;
+
+    ringBytes_ =
+        std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                 params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ring_ = mmap(nullptr, ringBytes_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+    if (ring_ == MAP_FAILED) {
+      ring_ = nullptr;
+      return false;
+    }
+    sqeBytes_ = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, sqeBytes_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+    auto *base = static_cast<char *>(ring_);
+    sqHead_ = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+    sqEntries_ = params.sq_entries;
+    auto *array = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+    for (unsigned i = 0; i < sqEntries_; ++i) array[i] = i;
+    cqHead_ = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(base + params.cq_off.cqes);
+    sqeTail_ = *sqTail_;
+
+    if (!registerBuffers()) return false;
+
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd_ < 0) return false;
+    // Submitted by the first poll(), from the thread that owns the ring.
+    armPoll(wakeFd_, POLLIN, Op::Wake);
+    return true;
+  }
+
+  const char *name() const override { return "io_uring"; }
+  IoBackendType type() const override { return IoBackendType::IoUring; }
+
+  bool listen(int listenFd) override {
+    listenFd_ = listenFd;
+    armAccept();
+    return true;
+  }
+
+  // Other threads only queue the descriptor; the owning thread arms it on
+  // its next round.
+  bool add(int fd) override {
+    {
+      std::lock_guard<std::mutex> lock(pendingMutex_);
+      pending_.push_back(fd);
+    }
+    uint64_t one = 1;
+    return write(wakeFd_, &one, sizeof(one)) == sizeof(one);
+  }
+
+  // Cancels the socket's requests right away, before the descriptor can be
+  // closed and reused. Completions already posted for it are recognised as
+  // stale by their generation.
+  void remove(int fd) override {
+    {
+      std::lock_guard<std::mutex> lock(pendingMutex_);
+      std::erase(pending_, fd);
+    }
+    if (static_cast<size_t>(fd) < generations_.size()) ++generations_[fd];
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = encode(Op::Cancel, 0);
+    submit(0, 0);
+  }
+
+  void poll(int timeoutMs, const Handler &handler) override {
+    if (submit(1, timeoutMs) < 0 && errno != ETIME && errno != EINTR) return;
+
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      io_uring_cqe cqe = cqes_[head & cqMask_];
+      // Release the slot first: handling may queue and submit more work.
+      __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+      complete(cqe, handler);
+    }
+  }
+
+ private:
+  enum class Op : uint8_t { Wake, Accept, Recv, PollOut, Cancel };
+
+  // user_data: generation (32) | op (8) | fd (24).
+  uint64_t encode(Op op, int fd) const {
+    uint32_t generation = (static_cast<size_t>(fd) < generations_.size())
+                              ? generations_[fd]
+                              : 0;
+    return (static_cast<uint64_t>(generation) << 32) |
+           (static_cast<uint64_t>(op) << 24) | static_cast<uint32_t>(fd);
+  }
+
+  bool current(uint64_t userData, int fd) const {
+    return static_cast<size_t>(fd) < generations_.size() &&
+           generations_[fd] == static_cast<uint32_t>(userData >> 32);
+  }
+
+  bool registerBuffers() {
+    bufferRingBytes_ = BUFFER_COUNT * sizeof(io_uring_buf);
+    void *ring = mmap(nullptr, bufferRingBytes_, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) return false;
+    bufferRing_ = static_cast<io_uring_buf_ring *>(ring);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufferRing_);
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0) {
+      return false;
+    }
+
+    buffers_ = std::make_unique<char[]>(BUFFER_COUNT * BUFFER_BYTES);
+    for (unsigned i = 0; i < BUFFER_COUNT; ++i) {
+      provideBuffer(static_cast<uint16_t>(i));
+    }
+    publishBuffers();
+    return true;
+  }
+
+  void provideBuffer(uint16_t id) {
+    // Not bufferRing_->bufs: in C++ the kernel header's flexible-array
+    // wrapper shifts that member by 8 bytes. The entries start at the ring.
+    auto *entries = reinterpret_cast<io_uring_buf *>(bufferRing_);
+    io_uring_buf &buf = entries[bufferTail_ & (BUFFER_COUNT - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(buffers_.get() +
+                                          size_t{id} * BUFFER_BYTES);
+    buf.len = BUFFER_BYTES;
+    buf.bid = id;
+    ++bufferTail_;
+  }
+
+  void publishBuffers() {
+    __atomic_store_n(&bufferRing_->tail, bufferTail_, __ATOMIC_RELEASE);
+  }
+
+  io_uring_sqe *nextSqe() {
+    if (sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+      submit(0, 0);
+    }
+    io_uring_sqe *sqe = &sqes_[sqeTail_ & sqMask_];
+    ++sqeTail_;
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+  }
+
+  // Hands every queued request to the kernel and, with minComplete > 0,
+  // waits up to timeoutMs for completions in the same call.
+  int submit(unsigned minComplete, int timeoutMs) {
+    __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+    unsigned toSubmit = sqeTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (toSubmit == 0 && minComplete == 0) return 0;
+
+    unsigned flags = 0;
+    __kernel_timespec timeout{.tv_sec = timeoutMs / 1000,
+                              .tv_nsec = (timeoutMs % 1000) * 1000000LL};
+    io_uring_getevents_arg arg{};
+    if (minComplete > 0) {
+      flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+      arg.sigmask_sz = _NSIG / 8;
+      arg.ts = reinterpret_cast<uint64_t>(&timeout);
+    }
+    return static_cast<int>(syscall(__NR_io_uring_enter, ringFd_, toSubmit,
+                                    minComplete, flags,
+                                    minComplete > 0 ? &arg : nullptr,
+                                    sizeof(arg)));
+  }
+
+  void armAccept() {
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = encode(Op::Accept, 0);
+  }
+
+  void armRecv(int fd) {
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = encode(Op::Recv, fd);
+  }
+
+  void armPoll(int fd, uint32_t events, Op op) {
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = encode(op, fd);
+  }
+
+  void armPending() {
+    std::vector<int> fds;
+    {
+      std::lock_guard<std::mutex> lock(pendingMutex_);
+      fds.swap(pending_);
+    }
+    for (int fd : fds) {
+      if (static_cast<size_t>(fd) >= generations_.size()) {
+        generations_.resize(static_cast<size_t>(fd) * 2 + 1, 0);
+      }
+      armRecv(fd);
+      armPoll(fd, POLLOUT, Op::PollOut);
+    }
+  }
+
+  void complete(const io_uring_cqe &cqe, const Handler &handler) {
+    auto op = static_cast<Op>((cqe.user_data >> 24) & 0xff);
+    int fd = static_cast<int>(cqe.user_data & 0xffffff);
+    bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+
+    switch (op) {
+      case Op::Wake: {
+        uint64_t count = 0;
+        while (read(wakeFd_, &count, sizeof(count)) > 0) {
+        }
+        if (!more) armPoll(wakeFd_, POLLIN, Op::Wake);
+        armPending();
+        break;
+      }
+      case Op::Accept:
+        if (cqe.res >= 0) handler({EventType::Accepted, cqe.res, {}});
+        if (!more) armAccept();
+        break;
+      case Op::PollOut:
+        if (!current(cqe.user_data, fd)) break;
+        if (cqe.res > 0 && !handler({EventType::Writable, fd, {}})) break;
+        if (!more && cqe.res >= 0) armPoll(fd, POLLOUT, Op::PollOut);
+        break;
+      case Op::Recv:
+        receive(cqe, fd, more, handler);
+        break;
+      case Op::Cancel:
+        break;
+    }
+  }
+
+  void receive(const io_uring_cqe &cqe, int fd, bool more,
+               const Handler &handler) {
+    bool live = current(cqe.user_data, fd);
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+      auto id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+      if (live && cqe.res > 0) {
+        live = handler({EventType::Data, fd,
+                        {buffers_.get() + size_t{id} * BUFFER_BYTES,
+                         static_cast<size_t>(cqe.res)}});
+      }
+      provideBuffer(id);
+      publishBuffers();
+    }
+    if (!live || more) return;
+
+    // The multishot receive ended. Out of buffers just means re-arm; EOF
+    // or an error closes the connection.
+    if (cqe.res > 0 || cqe.res == -ENOBUFS) {
+      armRecv(fd);
+    } else if (cqe.res != -ECANCELED) {
+      handler({EventType::Closed, fd, {}});
+    }
+  }
+
+  int ringFd_ = -1;
+  int wakeFd_ = -1;
+  int listenFd_ = -1;
+
+  void *ring_ = nullptr;
+  size_t ringBytes_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqeBytes_ = 0;
+  unsigned *sqHead_ = nullptr;
+  unsigned *sqTail_ = nullptr;
+  unsigned sqMask_ = 0;
+  unsigned sqEntries_ = 0;
+  unsigned sqeTail_ = 0;
+  unsigned *cqHead_ = nullptr;
+  unsigned *cqTail_ = nullptr;
+  unsigned cqMask_ = 0;
+  io_uring_cqe *cqes_ = nullptr;
+
+  io_uring_buf_ring *bufferRing_ = nullptr;
+  size_t bufferRingBytes_ = 0;
+  uint16_t bufferTail_ = 0;
+  std::unique_ptr<char[]> buffers_;
+
+  // Bumped when a descriptor is removed, so completions still in flight
+  // for its previous owner are ignored.
+  std::vector<uint32_t> generations_;
+
+  std::mutex pendingMutex_;
+  std::vector<int> pending_;
+};
+#endif
+
+}  // namespace
+
+std::unique_ptr<IoBackend> makeIoBackend(IoBackendType type) {
+#ifdef HAVE_IO_URING_BACKEND
+  if (type == IoBackendType::IoUring) {
+    auto backend = std::make_unique<IoUringBackend>();
+    if (backend->init()) return backend;
+  }
+#endif
+  if (type == IoBackendType::IoUring) {
+    std::cerr << "io_uring unavailable, falling back to epoll\n";
+  }
+  auto backend = std::make_unique<EpollBackend>();
+  if (!backend->valid()) return nullptr;
+  return backend;
+}
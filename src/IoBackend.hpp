@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+enum class IoBackendType : uint8_t { Epoll, IoUring };
+
+// Socket event source for one I/O thread. Backends hand over bytes already
+// received rather than readiness, so the server code is the same whether the
+// bytes came from read() after an epoll wakeup or from a completed io_uring
+// receive. Sends stay synchronous in the caller; backends only report when
+// a socket with queued output becomes writable again.
+class IoBackend {
+ public:
+  enum class EventType : uint8_t {
+    Accepted,  // `fd` is a new non-blocking connection on the listener.
+    Data,      // `data` was received on `fd`; valid only during the call.
+    Writable,  // `fd` may take more output.
+    Closed,    // The peer went away or the socket failed.
+  };
+
+  struct Event {
+    EventType type;
+    int fd;
+    std::string_view data;
+  };
+
+  // Returns false when the handler has closed `fd`; the backend then drops
+  // anything else it had for that descriptor in the current round.
+  using Handler = std::function<bool(const Event &)>;
+
+  virtual ~IoBackend() = default;
+
+  virtual const char *name() const = 0;
+  virtual IoBackendType type() const = 0;
+  // Reports connections accepted on `listenFd` as Accepted events.
+  virtual bool listen(int listenFd) = 0;
+  // Starts receiving on a connected socket. Safe from any thread.
+  virtual bool add(int fd) = 0;
+  // Stops all activity on `fd`; call before closing it.
+  virtual void remove(int fd) = 0;
+  // Waits up to `timeoutMs` for events and hands each one to `handler`.
+  virtual void poll(int timeoutMs, const Handler &handler) = 0;
+};
+
+// Creates the requested backend. io_uring falls back to epoll, with a
+// warning, when the kernel or build lacks what it needs.
+std::unique_ptr<IoBackend> makeIoBackend(IoBackendType type);
@@ -0,0 +1,483 @@
+#include "Journal.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+uint32_t JournalRecord::computeChecksum() const {
+  static_assert((sizeof(JournalRecord) - offsetof(JournalRecord, payload)) %
+                    8 ==
+                0);
+  const auto *bytes = reinterpret_cast<const unsigned char *>(this);
+  uint32_t header;
+  std::memcpy(&header, bytes + offsetof(JournalRecord, shardId),
+              sizeof(header));
+  uint64_t h = (0xcbf29ce484222325ULL ^ sequence) * 0x100000001b3ULL;
+  h = (h ^ header) * 0x100000001b3ULL;
+  for (size_t i = offsetof(JournalRecord, payload); i < sizeof(JournalRecord);
+       i += 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(word));
+    h = (h ^ word) * 0x100000001b3ULL;
+  }
+  return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+Journal::Journal(std::string path, size_t shardCount, JournalOptions options)
+    : path_(std::move(path)), options_(options) {
+  for (size_t i = 0; i < shardCount; ++i) {
+    shards_.push_back(std::make_unique<ShardQueue>(options_.queueCapacity));
+    shards_.back()->staging.reserve(256);
+    shards_.back()->pending.resize(options_.queueCapacity);
+  }
+}
+
+Journal::~Journal() { close(); }
+
+bool Journal::open() {
+  // Readable too: a replica that connects is sent the file so far.
+  fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    std::cerr << "Error opening journal " << path_ << ": "
+              << std::strerror(errno) << "\n";
+    return false;
+  }
+  struct stat st{};
+  if (fstat(fd_, &st) != 0 || st.st_size != 0) {
+    std::cerr << "Journal " << path_
+              << " is not empty; recover from it and journal to a new file\n";
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+
+  JournalFileHeader header{};
+  std::memcpy(header.magic, JournalFileHeader::MAGIC, sizeof(header.magic));
+  header.recordSize = sizeof(JournalRecord);
+  header.shardCount = static_cast<uint32_t>(shards_.size());
+  std::random_device random;
+  id_ = (static_cast<uint64_t>(random()) << 32) | random();
+  header.journalId = id_;
+  header.hasBaseSnapshot = options_.baseSnapshot.empty() ? 0 : 1;
+  if (pwrite(fd_, &header, sizeof(header), 0) !=
+          static_cast<ssize_t>(sizeof(header)) ||
+      fdatasync(fd_) != 0) {
+    std::cerr << "Error writing journal header: " << std::strerror(errno)
+              << "\n";
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  offset_ = sizeof(header);
+  lastSync_ = std::chrono::steady_clock::now();
+  if (!options_.replicaSocket.empty() && !listenForReplica()) {
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+
+  running_ = true;
+  thread_ = std::jthread(&Journal::ioLoop, this);
+  return true;
+}
+
+void Journal::close() {
+  running_ = false;
+  if (thread_.joinable()) thread_.join();
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  if (replicaFd_ >= 0) {
+    ::close(replicaFd_);
+    replicaFd_ = -1;
+    replicaConnected_ = false;
+  }
+  if (listenFd_ >= 0) {
+    ::close(listenFd_);
+    listenFd_ = -1;
+    ::unlink(options_.replicaSocket.c_str());
+  }
+}
+
+void Journal::append(size_t shardId, uint64_t firstSequence,
+                     const Exchange::Command *commands, size_t count) {
+  ShardQueue &queue = *shards_[shardId];
+  queue.staging.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    JournalRecord &record = queue.staging[i];
+    record.sequence = firstSequence + i;
+    record.shardId = static_cast<uint16_t>(shardId);
+    record.type = JournalRecordType::Command;
+    record.payload.command = commands[i];
+  }
+  if (queue.ring.push_batch(queue.staging.data(), count)) return;
+  for (const auto &record : queue.staging) queue.ring.push_block(record);
+}
+
+void Journal::appendCheckpoint(size_t shardId, uint64_t sequence,
+                               const JournalCheckpoint &checkpoint) {
+  JournalRecord record;
+  record.sequence = sequence;
+  record.shardId = static_cast<uint16_t>(shardId);
+  record.type = JournalRecordType::Checkpoint;
+  record.payload.checkpoint = checkpoint;
+  shards_[shardId]->ring.push_block(record);
+}
+
+void Journal::appendStateCheck(size_t shardId, uint64_t sequence,
+                               uint64_t bookHash) {
+  JournalRecord record;
+  record.sequence = sequence;
+  record.shardId = static_cast<uint16_t>(shardId);
+  record.type = JournalRecordType::StateCheck;
+  record.payload.stateCheck.bookHash = bookHash;
+  shards_[shardId]->ring.push_block(record);
+}
+
+void Journal::appendSymbol(int32_t symbolId, int32_t shardId,
+                           MatchingAlgorithm algorithm,
+                           const std::string &name) {
+  JournalRecord record;
+  record.type = JournalRecordType::Symbol;
+  record.payload.symbol.symbolId = symbolId;
+  record.payload.symbol.shardId = shardId;
+  record.payload.symbol.algorithm = algorithm;
+  std::memcpy(record.payload.symbol.name, name.data(),
+              std::min(name.size(), JournalSymbol::MAX_NAME - 1));
+  std::lock_guard<std::mutex> lock(symbolsMutex_);
+  symbols_.push_back(record);
+}
+
+void Journal::sync() {
+  std::unique_lock<std::mutex> lock(syncMutex_);
+  if (!running_) return;
+  uint64_t ticket = ++syncRequested_;
+  syncDone_.wait(lock, [&] { return syncCompleted_ >= ticket; });
+}
+
+uint64_t Journal::durableSequence(size_t shardId) const {
+  return shards_[shardId]->durable.load(std::memory_order_acquire);
+}
+
+uint64_t Journal::replicaSequence(size_t shardId) const {
+  return shards_[shardId]->replicated.load(std::memory_order_acquire);
+}
+
+void Journal::ioLoop() {
+  while (true) {
+    const bool stopping = !running_;
+    uint64_t requested;
+    {
+      std::lock_guard<std::mutex> lock(syncMutex_);
+      requested = syncRequested_;
+    }
+
+    if (listenFd_ >= 0 && replicaFd_ < 0) acceptReplica();
+    // A replica still behind the file gets the next piece of it; writes go
+    // to it live only once it has all of it.
+    const bool catchingUp = replicaFd_ >= 0 && replicaOffset_ < offset_;
+    if (catchingUp) catchUpReplica();
+
+    // Anything queued before the sync request was read is collected here.
+    size_t records = collect();
+    if (records > 0 && !writePending(records)) break;
+    if (replicaFd_ >= 0) waitForReplica();
+
+    auto now = std::chrono::steady_clock::now();
+    bool flush = false;
+    switch (options_.sync) {
+      case JournalSyncPolicy::None:
+        break;
+      case JournalSyncPolicy::GroupCommit:
+        flush = records > 0;
+        break;
+      case JournalSyncPolicy::Interval:
+        flush = unsynced_ && now - lastSync_ >= options_.syncInterval;
+        break;
+    }
+    if (requested > syncCompleted_ || stopping) flush = unsynced_;
+    if (flush && !flushToDisk()) break;
+
+    if (options_.sync == JournalSyncPolicy::None || flush) {
+      for (auto &shard : shards_) {
+        shard->durable.store(shard->written, std::memory_order_release);
+      }
+    }
+    if (requested > syncCompleted_) {
+      std::lock_guard<std::mutex> lock(syncMutex_);
+      syncCompleted_ = requested;
+      syncDone_.notify_all();
+    }
+
+    if (stopping) break;
+    if (records == 0 && !catchingUp) {
+      std::this_thread::sleep_for(options_.idleWait);
+    }
+  }
+
+  // Stopped or failed: nothing more will reach the disk, so release every
+  // waiter.
+  std::lock_guard<std::mutex> lock(syncMutex_);
+  running_ = false;
+  syncCompleted_ = syncRequested_;
+  syncDone_.notify_all();
+}
+
+size_t Journal::collect() {
+  size_t records = 0;
+  for (auto &shard : shards_) {
+    size_t count =
+        shard->ring.pop_batch(shard->pending.data(), shard->pending.size());
+    shard->pendingCount = count;
+    if (count > 0) shard->written = shard->pending[count - 1].sequence;
+    records += count;
+  }
+
+  // Taken after the commands, so a symbol registered before any of them is
+  // here too, and is written ahead of them.
+  {
+    std::lock_guard<std::mutex> lock(symbolsMutex_);
+    pendingSymbols_.swap(symbols_);
+    symbols_.clear();
+  }
+  return records + pendingSymbols_.size();
+}
+
+bool Journal::writePending(size_t records) {
+  std::vector<iovec> iov;
+  iov.reserve(shards_.size() + 1);
+  auto addBatch = [&](JournalRecord *batch, size_t count) {
+    if (count == 0) return;
+    for (size_t i = 0; i < count; ++i) {
+      batch[i].checksum = batch[i].computeChecksum();
+    }
+    iov.push_back({batch, count * sizeof(JournalRecord)});
+  };
+  addBatch(pendingSymbols_.data(), pendingSymbols_.size());
+  for (auto &shard : shards_) {
+    addBatch(shard->pending.data(), shard->pendingCount);
+  }
+
+  // A replica that has everything before this write takes it live;
+  // otherwise catchUpReplica reads it back from the file in turn.
+  const bool live = replicaFd_ >= 0 && replicaOffset_ == offset_;
+  std::vector<iovec> replicaIov;
+  if (live) replicaIov = iov;
+
+  size_t remaining = records * sizeof(JournalRecord);
+  size_t first = 0;
+  while (remaining > 0) {
+    ssize_t n = pwritev(fd_, iov.data() + first,
+                        static_cast<int>(iov.size() - first),
+                        static_cast<off_t>(offset_));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "Journal write failed: " << std::strerror(errno) << "\n";
+      return false;
+    }
+    offset_ += static_cast<uint64_t>(n);
+    remaining -= static_cast<size_t>(n);
+    // Step past what a short write did take.
+    auto taken = static_cast<size_t>(n);
+    while (first < iov.size() && taken >= iov[first].iov_len) {
+      taken -= iov[first].iov_len;
+      ++first;
+    }
+    if (taken > 0) {
+      iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + taken;
+      iov[first].iov_len -= taken;
+    }
+  }
+
+  bytesWritten_ += records * sizeof(JournalRecord);
+  ++writes_;
+  unsynced_ = true;
+  if (live &&
+      sendToReplica(std::move(replicaIov), records * sizeof(JournalRecord))) {
+    replicaOffset_ = offset_;
+  }
+
+  pendingSymbols_.clear();
+  return true;
+}
+
+bool Journal::flushToDisk() {
+  if (fdatasync(fd_) != 0) {
+    std::cerr << "Journal fdatasync failed: " << std::strerror(errno) << "\n";
+    return false;
+  }
+  ++syncs_;
+  unsynced_ = false;
+  lastSync_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+bool Journal::listenForReplica() {
+  const std::string &socketPath = options_.replicaSocket;
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Replica socket path too long: " << socketPath << "\n";
+    return false;
+  }
+  std::memcpy(addr.sun_path, socketPath.data(), socketPath.size());
+  ::unlink(socketPath.c_str());
+  listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listenFd_ < 0 ||
+      bind(listenFd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) !=
+          0 ||
+      listen(listenFd_, 1) != 0) {
+    std::cerr << "Error listening for a replica on " << socketPath << ": "
+              << std::strerror(errno) << "\n";
+    if (listenFd_ >= 0) ::close(listenFd_);
+    listenFd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+// Takes a waiting replica. It is sent the file so far, header included, by
+// catchUpReplica, a piece per pass of the I/O thread, so a long journal
+// never holds up the writes.
+void Journal::acceptReplica() {
+  int fd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd < 0) return;
+  timeval timeout{};
+  timeout.tv_sec = options_.replicaTimeout.count() / 1000;
+  timeout.tv_usec = (options_.replicaTimeout.count() % 1000) * 1000;
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  replicaFd_ = fd;
+  replicaOffset_ = 0;
+  replicaProgress_ = std::chrono::steady_clock::now();
+  replicaCaughtUp_ = false;
+  for (auto &shard : shards_) shard->replicated.store(0);
+}
+
+// Sends the replica as much of the next chunk of the file as its socket
+// takes without waiting. A replica that takes nothing for replicaTimeout
+// is dropped.
+void Journal::catchUpReplica() {
+  catchUpChunk_.resize(1 << 20);
+  ssize_t n = pread(fd_, catchUpChunk_.data(),
+                    std::min<uint64_t>(catchUpChunk_.size(),
+                                       offset_ - replicaOffset_),
+                    static_cast<off_t>(replicaOffset_));
+  if (n < 0 && errno == EINTR) return;
+  if (n <= 0) {
+    dropReplica("cannot read the journal back");
+    return;
+  }
+  ssize_t sent = send(replicaFd_, catchUpChunk_.data(),
+                      static_cast<size_t>(n), MSG_DONTWAIT | MSG_NOSIGNAL);
+  const auto now = std::chrono::steady_clock::now();
+  if (sent < 0) {
+    if (errno != EAGAIN && errno != EINTR) {
+      dropReplica(std::strerror(errno));
+    } else if (now - replicaProgress_ > options_.replicaTimeout) {
+      dropReplica("catch-up timed out");
+    }
+    return;
+  }
+  replicaOffset_ += static_cast<uint64_t>(sent);
+  replicaProgress_ = now;
+  if (replicaOffset_ == offset_) replicaConnected_ = true;
+}
+
+bool Journal::sendToReplica(std::vector<iovec> iov, size_t bytes) {
+  size_t first = 0;
+  while (bytes > 0) {
+    msghdr msg{};
+    msg.msg_iov = iov.data() + first;
+    msg.msg_iovlen = iov.size() - first;
+    ssize_t n = sendmsg(replicaFd_, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      dropReplica(errno == EAGAIN ? "write timed out" : std::strerror(errno));
+      return false;
+    }
+    bytes -= static_cast<size_t>(n);
+    auto taken = static_cast<size_t>(n);
+    while (first < iov.size() && taken >= iov[first].iov_len) {
+      taken -= iov[first].iov_len;
+      ++first;
+    }
+    if (taken > 0) {
+      iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + taken;
+      iov[first].iov_len -= taken;
+    }
+  }
+  return true;
+}
+
+void Journal::readAcks(int timeoutMs) {
+  pollfd pfd{replicaFd_, POLLIN, 0};
+  if (poll(&pfd, 1, timeoutMs) <= 0) return;
+  char buffer[4096];
+  ssize_t n = recv(replicaFd_, buffer, sizeof(buffer), MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+  if (n <= 0) {
+    dropReplica(n == 0 ? "disconnected" : std::strerror(errno));
+    return;
+  }
+  ackBuffer_.insert(ackBuffer_.end(), buffer, buffer + n);
+  size_t used = 0;
+  for (; ackBuffer_.size() - used >= sizeof(ReplicaAck);
+       used += sizeof(ReplicaAck)) {
+    ReplicaAck ack;
+    std::memcpy(&ack, ackBuffer_.data() + used, sizeof(ack));
+    if (ack.shardId < shards_.size()) {
+      shards_[ack.shardId]->replicated.store(ack.sequence,
+                                             std::memory_order_release);
+    }
+  }
+  ackBuffer_.erase(ackBuffer_.begin(), ackBuffer_.begin() + used);
+}
+
+// Holds the I/O thread, and through its queues the workers, while the
+// replica is too far behind.
+void Journal::waitForReplica() {
+  auto lagging = [&] {
+    for (const auto &shard : shards_) {
+      if (shard->written > shard->replicated.load() + options_.replicaMaxLag) {
+        return true;
+      }
+    }
+    return false;
+  };
+  readAcks(0);
+  if (!replicaCaughtUp_) {
+    replicaCaughtUp_ =
+        replicaFd_ >= 0 && replicaOffset_ == offset_ && !lagging();
+    return;
+  }
+  const auto deadline =
+      std::chrono::steady_clock::now() + options_.replicaTimeout;
+  while (replicaFd_ >= 0 && running_ && lagging()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      dropReplica("too far behind");
+      return;
+    }
+    readAcks(10);
+  }
+}
+
+void Journal::dropReplica(const char *reason) {
+  std::cerr << "Dropping replica: " << reason << "\n";
+  ::close(replicaFd_);
+  replicaFd_ = -1;
+  replicaConnected_ = false;
+  replicaCaughtUp_ = false;
+  ackBuffer_.clear();
+}
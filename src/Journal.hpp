@@ -0,0 +1,281 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "Exchange.hpp"
+#include "RingBuffer.hpp"
+
+// Write-ahead journal of the commands each shard worker takes off its queue,
+// in the order the worker will apply them. Workers only copy records into a
+// per-shard ring; one I/O thread gathers everything queued since its last
+// pass into a single pwritev and, depending on the sync policy, one
+// fdatasync, so a burst of commands shares a single disk flush.
+//
+// The file is a JournalFileHeader followed by fixed-size JournalRecords.
+// Records of one shard appear in sequence order; shards interleave.
+//
+// A hot standby (see Replica.hpp) follows the same bytes live: with
+// replicaSocket set, the I/O thread listens there, streams a connecting
+// replica the file so far between writes, then every write as it reaches
+// the file. The replica acknowledges what it has applied with ReplicaAcks,
+// and the I/O thread stops taking new records while any shard is more than
+// replicaMaxLag commands ahead of it.
+
+// Under GroupCommit, a batch's trades, reports and market data reach the
+// Exchange's listeners only once the journal has synced the batch, so no
+// client is told of a fill a crash can undo. The other policies publish
+// as soon as the batch is matched, ahead of the disk. Depth snapshots and
+// L3 events are never held.
+enum class JournalSyncPolicy : uint8_t {
+  None,         // Leave flushing to the page cache.
+  GroupCommit,  // fdatasync after every write.
+  Interval,     // fdatasync at most once per syncInterval.
+};
+
+struct JournalOptions {
+  JournalSyncPolicy sync = JournalSyncPolicy::GroupCommit;
+  std::chrono::microseconds syncInterval{10000};
+  // How long the I/O thread sleeps when it finds nothing to write. Under
+  // load it never sleeps: each write carries whatever queued up during the
+  // previous one.
+  std::chrono::microseconds idleWait{100};
+  // Records each shard may queue ahead of the I/O thread before its worker
+  // waits.
+  size_t queueCapacity = 1 << 16;
+  // Unix socket a Replica connects to; empty for none.
+  std::string replicaSocket;
+  uint64_t replicaMaxLag = 1 << 16;
+  // A replica that takes longer than this to accept a write, or to come
+  // back within replicaMaxLag, is dropped rather than stall the primary.
+  std::chrono::milliseconds replicaTimeout{1000};
+  // How often each shard journals a state check (a hash of its books) after
+  // a batch; zero for never. Replicas and replays compare it with their
+  // own books at the same command.
+  std::chrono::microseconds stateCheckInterval{0};
+  // For an engine that already holds orders when journaling starts (a
+  // promoted replica): Exchange::enableJournal writes a snapshot of the
+  // books here, and the journal header records that it only applies on
+  // top of that snapshot.
+  std::string baseSnapshot;
+};
+
+enum class JournalRecordType : uint8_t {
+  Command = 1,
+  Symbol = 2,
+  Checkpoint = 3,
+  StateCheck = 4,
+};
+
+struct JournalSymbol {
+  static constexpr size_t MAX_NAME = 55;
+
+  int32_t symbolId;
+  int32_t shardId;
+  MatchingAlgorithm algorithm;
+  char name[MAX_NAME];  // NUL-padded.
+};
+
+// Written by a shard after a batch that traded: the number and running hash
+// (see hashTrade) of every trade the shard has produced since the journal
+// started, as of the command whose sequence the record carries.
+struct JournalCheckpoint {
+  uint64_t tradeCount;
+  uint64_t tradeHash;
+};
+
+inline uint64_t hashTrade(uint64_t hash, const Trade &trade) {
+  for (uint64_t word : {static_cast<uint64_t>(trade.makerOrderId),
+                        static_cast<uint64_t>(trade.takerOrderId),
+                        static_cast<uint64_t>(trade.price),
+                        static_cast<uint64_t>(trade.quantity)}) {
+    hash = (hash ^ word) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Hash of every book of the shard (see Exchange::bookHash) after the
+// command whose sequence the record carries.
+struct JournalStateCheck {
+  uint64_t bookHash;
+};
+
+struct JournalRecord {
+  // Per-shard command sequence, from 1; 0 for symbol records. Checkpoints
+  // and state checks carry the sequence of the last command they cover.
+  uint64_t sequence = 0;
+  // Covers every byte after this field; a torn tail fails it.
+  uint32_t checksum = 0;
+  uint16_t shardId = 0;
+  JournalRecordType type = JournalRecordType::Command;
+  uint8_t reserved = 0;
+  union Payload {
+    Exchange::Command command;
+    JournalSymbol symbol;
+    JournalCheckpoint checkpoint;
+    JournalStateCheck stateCheck;
+    // Zeroes every byte, padding included, so the checksum of a record
+    // depends only on the fields it sets; a zeroed command is an empty Add.
+    unsigned char bytes[sizeof(Exchange::Command)];
+    Payload() : bytes{} {}
+  } payload;
+
+  uint32_t computeChecksum() const;
+};
+
+static_assert(std::is_trivially_copyable_v<JournalRecord>);
+static_assert(sizeof(JournalSymbol) <= sizeof(Exchange::Command));
+
+struct JournalFileHeader {
+  static constexpr char MAGIC[8] = {'O', 'M', 'E', 'J', 'R', 'N', 'L', '1'};
+
+  char magic[8];
+  uint32_t recordSize;
+  uint32_t shardCount;
+  // Random per file, so a snapshot can tell its own journal from a later
+  // one whose sequences restarted.
+  uint64_t journalId;
+  // Nonzero when the books did not start empty: replay the journal with
+  // Exchange::restoreFromSnapshot from JournalOptions::baseSnapshot, never
+  // on its own.
+  uint8_t hasBaseSnapshot;
+  char reserved[39];
+};
+
+static_assert(sizeof(JournalFileHeader) == 64);
+
+// Sent by a replica: every command of `shardId` up to `sequence` is applied.
+struct ReplicaAck {
+  uint32_t shardId;
+  uint32_t reserved;
+  uint64_t sequence;
+};
+
+class Journal {
+ public:
+  Journal(std::string path, size_t shardCount, JournalOptions options = {});
+  ~Journal();
+
+  Journal(const Journal &) = delete;
+  Journal &operator=(const Journal &) = delete;
+
+  // Creates the file, writes the header and starts the I/O thread. Fails
+  // rather than truncate a file that already holds a journal, which may be
+  // the only record of a crashed run.
+  bool open();
+  // Writes and syncs whatever is queued, then stops the I/O thread. A write
+  // or sync failure stops the thread too; workers then stall once their
+  // queues fill rather than run ahead of the journal.
+  void close();
+
+  // Worker thread of `shardId` only: journals `count` commands, the first
+  // of which gets sequence `firstSequence`. Waits if the shard's queue is
+  // full rather than lose a command.
+  void append(size_t shardId, uint64_t firstSequence,
+              const Exchange::Command *commands, size_t count);
+  // Worker thread of `shardId` only.
+  void appendCheckpoint(size_t shardId, uint64_t sequence,
+                        const JournalCheckpoint &checkpoint);
+  // Worker thread of `shardId` only.
+  void appendStateCheck(size_t shardId, uint64_t sequence, uint64_t bookHash);
+  // Journals a symbol registration; written before any command queued
+  // after it. Any thread.
+  void appendSymbol(int32_t symbolId, int32_t shardId,
+                    MatchingAlgorithm algorithm, const std::string &name);
+
+  // Blocks until every record queued before the call is written and
+  // flushed to disk, whatever the sync policy.
+  void sync();
+
+  // Highest sequence of `shardId` known to be on disk under the current
+  // policy (written for None, synced otherwise).
+  uint64_t durableSequence(size_t shardId) const;
+
+  // Whether a replica is connected and has been sent the whole file, and
+  // the highest sequence of `shardId` it has acknowledged.
+  bool replicaConnected() const { return replicaConnected_.load(); }
+  uint64_t replicaSequence(size_t shardId) const;
+
+  const std::string &path() const { return path_; }
+  const JournalOptions &options() const { return options_; }
+  // See JournalFileHeader::journalId; set by open().
+  uint64_t id() const { return id_; }
+  uint64_t bytesWritten() const { return bytesWritten_.load(); }
+  uint64_t writes() const { return writes_.load(); }
+  uint64_t syncs() const { return syncs_.load(); }
+
+ private:
+  struct ShardQueue {
+    RingBuffer<JournalRecord> ring;
+    std::vector<JournalRecord> staging;  // Worker side.
+    // I/O thread only.
+    std::vector<JournalRecord> pending;
+    size_t pendingCount = 0;
+    uint64_t written = 0;
+    std::atomic<uint64_t> durable{0};
+    std::atomic<uint64_t> replicated{0};
+    explicit ShardQueue(size_t capacity) : ring(capacity) {}
+  };
+
+  void ioLoop();
+  // Drains every queue; returns the number of records now pending.
+  size_t collect();
+  bool writePending(size_t records);
+  bool flushToDisk();
+  // Replication, I/O thread only. A replica that cannot keep the stream
+  // going is dropped; the journal carries on without it.
+  bool listenForReplica();
+  void acceptReplica();
+  void catchUpReplica();
+  bool sendToReplica(std::vector<iovec> iov, size_t bytes);
+  void readAcks(int timeoutMs);
+  void waitForReplica();
+  void dropReplica(const char *reason);
+
+  std::string path_;
+  JournalOptions options_;
+  int fd_ = -1;
+  uint64_t offset_ = 0;
+  uint64_t id_ = 0;
+  int listenFd_ = -1;
+  int replicaFd_ = -1;
+  std::atomic<bool> replicaConnected_{false};
+  // Bytes of the file sent to the replica. Behind offset_ while it catches
+  // up from the file; equal once it takes writes live.
+  uint64_t replicaOffset_ = 0;
+  std::chrono::steady_clock::time_point replicaProgress_;
+  std::vector<char> catchUpChunk_;
+  // Set once the replica first comes within replicaMaxLag; until then it is
+  // catching up and the lag bound does not apply.
+  bool replicaCaughtUp_ = false;
+  std::vector<char> ackBuffer_;
+
+  std::vector<std::unique_ptr<ShardQueue>> shards_;
+  std::mutex symbolsMutex_;
+  std::vector<JournalRecord> symbols_;
+  std::vector<JournalRecord> pendingSymbols_;
+
+  std::atomic<bool> running_{false};
+  std::jthread thread_;
+  std::chrono::steady_clock::time_point lastSync_;
+  bool unsynced_ = false;
+
+  std::mutex syncMutex_;
+  std::condition_variable syncDone_;
+  uint64_t syncRequested_ = 0;
+  uint64_t syncCompleted_ = 0;
+
+  std::atomic<uint64_t> bytesWritten_{0};
+  std::atomic<uint64_t> writes_{0};
+  std::atomic<uint64_t> syncs_{0};
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "OrderBook.hpp"
+
+// Reference L3 consumer: rebuilds every order resting in one shard's books
+// from that shard's L3Event stream, and checks the result against a live
+// OrderBook order by order, including each order's slot in its level.
+class L3BookBuilder {
+ public:
+  // Events must be applied in sequence order. Returns false, and applies
+  // nothing, when `event` does not follow the last one applied.
+  bool apply(const L3Event& event) {
+    if (event.sequence != lastSequence_ + 1) return false;
+    lastSequence_ = event.sequence;
+
+    switch (event.type) {
+      case L3EventType::Add:
+      case L3EventType::Modify:
+        remove(event.orderId);
+        orders_[event.orderId] = {event.symbolId, event.side, event.price,
+                                  event.quantity, event.position};
+        levels_[{event.symbolId, event.side, event.price}][event.position] =
+            event.orderId;
+        break;
+      case L3EventType::Execute: {
+        auto it = orders_.find(event.orderId);
+        if (it == orders_.end()) break;
+        it->second.quantity -= std::min(it->second.quantity, event.quantity);
+        if (it->second.quantity == 0) remove(event.orderId);
+        break;
+      }
+      case L3EventType::Cancel:
+        remove(event.orderId);
+        break;
+      case L3EventType::Clear:
+        std::erase_if(orders_, [&](const auto& entry) {
+          return entry.second.symbolId == event.symbolId;
+        });
+        std::erase_if(levels_, [&](const auto& entry) {
+          return std::get<0>(entry.first) == event.symbolId;
+        });
+        break;
+    }
+    return true;
+  }
+
+  uint64_t lastSequence() const { return lastSequence_; }
+  size_t orderCount() const { return orders_.size(); }
+
+  // Compares the rebuilt orders of `symbolId` with `book`: same orders,
+  // same displayed quantities, same queue order. On a mismatch, describes
+  // the first difference in `error`.
+  bool matches(int32_t symbolId, const OrderBook& book,
+               std::string* error = nullptr) const {
+    std::ostringstream why;
+    size_t bookOrders = 0;
+    for (OrderSide side : {OrderSide::Buy, OrderSide::Sell}) {
+      const auto& mask =
+          (side == OrderSide::Buy) ? book.getBidMask() : book.getAskMask();
+      for (size_t p = mask.findFirstSet(0); p < OrderBook::MAX_PRICE;
+           p = mask.findFirstSet(p + 1)) {
+        const PriceLevel& level = book.getLevel(static_cast<Price>(p), side);
+        auto rebuilt = levels_.find({symbolId, side, static_cast<Price>(p)});
+        auto next = std::map<uint32_t, OrderId>::const_iterator{};
+        if (rebuilt != levels_.end()) next = rebuilt->second.begin();
+
+        for (size_t i = level.headIndex; i < level.orders.size(); ++i) {
+          const Order& o = level.orders[i];
+          if (!o.active) continue;
+          ++bookOrders;
+          if (rebuilt == levels_.end() || next == rebuilt->second.end()) {
+            why << "order " << o.id << " missing at price " << p;
+            return fail(why, error);
+          }
+          const RestingOrder& mine = orders_.at(next->second);
+          const uint32_t position =
+              level.firstPosition + static_cast<uint32_t>(i);
+          if (next->second != o.id || next->first != position ||
+              mine.quantity != o.quantity) {
+            why << "price " << p << " slot " << position
+                << ": book has order " << o.id << " x" << o.quantity
+                << ", rebuilt has " << next->second << " x" << mine.quantity
+                << " at slot " << next->first;
+            return fail(why, error);
+          }
+          ++next;
+        }
+      }
+    }
+
+    size_t rebuiltOrders = 0;
+    for (const auto& [id, order] : orders_) {
+      if (order.symbolId == symbolId) ++rebuiltOrders;
+    }
+    if (rebuiltOrders != bookOrders) {
+      why << "book has " << bookOrders << " orders, rebuilt has "
+          << rebuiltOrders;
+      return fail(why, error);
+    }
+    return true;
+  }
+
+ private:
+  struct RestingOrder {
+    int32_t symbolId;
+    OrderSide side;
+    Price price;
+    Quantity quantity;
+    uint32_t position;
+  };
+  using LevelKey = std::tuple<int32_t, OrderSide, Price>;
+
+  void remove(OrderId orderId) {
+    auto it = orders_.find(orderId);
+    if (it == orders_.end()) return;
+    const RestingOrder& o = it->second;
+    auto level = levels_.find({o.symbolId, o.side, o.price});
+    if (level != levels_.end()) {
+      level->second.erase(o.position);
+      if (level->second.empty()) levels_.erase(level);
+    }
+    orders_.erase(it);
+  }
+
+  static bool fail(const std::ostringstream& why, std::string* error) {
+    if (error != nullptr) *error = why.str();
+    return false;
+  }
+
+  uint64_t lastSequence_ = 0;
+  std::unordered_map<OrderId, RestingOrder> orders_;
+  std::map<LevelKey, std::map<uint32_t, OrderId>> levels_;
+};
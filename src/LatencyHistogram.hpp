@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+
+// HDR-style log-linear histogram of latencies. Values below 128 are counted
+// exactly; every power-of-two range above that is split into 64 equal
+// buckets, so a percentile is reported within 1/64 of the recorded value.
+// Memory is fixed at about 30KB whatever the range or count, and recording
+// is one increment. Not thread-safe: each thread records into its own
+// histogram and the results are merged.
+class LatencyHistogram {
+ public:
+  void record(uint64_t value) {
+    ++counts_[bucketOf(value)];
+    ++count_;
+    sum_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  void merge(const LatencyHistogram &other) {
+    for (size_t i = 0; i < BUCKETS; ++i) counts_[i] += other.counts_[i];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+
+  void reset() { *this = LatencyHistogram(); }
+
+  uint64_t count() const { return count_; }
+  uint64_t min() const { return count_ ? min_ : 0; }
+  uint64_t max() const { return max_; }
+  double mean() const {
+    return count_ ? static_cast<double>(sum_) / static_cast<double>(count_)
+                  : 0.0;
+  }
+
+  // The value at or below which `percent` of the recorded values fall, as
+  // the top of its bucket (never above max()). 0 when empty.
+  uint64_t percentile(double percent) const {
+    if (count_ == 0) return 0;
+    const auto rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(
+               std::ceil(percent / 100.0 * static_cast<double>(count_))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      seen += counts_[i];
+      if (seen >= rank) return std::min(bucketTop(i), max_);
+    }
+    return max_;
+  }
+
+  // "p50=.. p90=.. p99=.. p99.9=.. p99.99=.. max=.. (n samples)".
+  std::string summary() const {
+    std::string out;
+    for (auto [label, percent] :
+         {std::pair<const char *, double>{"p50", 50.0}, {"p90", 90.0},
+          {"p99", 99.0}, {"p99.9", 99.9}, {"p99.99", 99.99}}) {
+      out += label;
+      out += '=' + std::to_string(percentile(percent)) + ' ';
+    }
+    return out + "max=" + std::to_string(max_) + " (" +
+           std::to_string(count_) + " samples)";
+  }
+
+ private:
+  static constexpr int SUB_BUCKET_BITS = 7;
+  static constexpr uint64_t SUB_BUCKETS = 1ULL << SUB_BUCKET_BITS;
+  static constexpr uint64_t HALF = SUB_BUCKETS / 2;
+  // 128 exact buckets, then 64 per power of two up to 2^64.
+  static constexpr size_t BUCKETS = (64 - SUB_BUCKET_BITS + 2) * HALF;
+
+  static size_t bucketOf(uint64_t value) {
+    if (value < SUB_BUCKETS) return value;
+    const int shift = static_cast<int>(std::bit_width(value)) - SUB_BUCKET_BITS;
+    return static_cast<size_t>(shift) * HALF + (value >> shift);
+  }
+
+  // Largest value that lands in bucket `index`. The last bucket's top wraps
+  // to 2^64 - 1.
+  static uint64_t bucketTop(size_t index) {
+    if (index < SUB_BUCKETS) return index;
+    const size_t shift = index / HALF - 1;
+    return ((index % HALF + HALF + 1) << shift) - 1;
+  }
+
+  std::array<uint64_t, BUCKETS> counts_{};
+  uint64_t count_ = 0;
+  uint64_t sum_ = 0;
+  uint64_t min_ = std::numeric_limits<uint64_t>::max();
+  uint64_t max_ = 0;
+};
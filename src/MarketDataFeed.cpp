@@ -0,0 +1,446 @@
+#include "MarketDataFeed.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+MarketDataFeed::MarketDataFeed(Exchange &engine, const std::string &host,
+                               int udpPort, int recoveryPort,
+                               size_t queueCapacity)
+    : engine_(engine),
+      host_(host),
+      udpPort_(udpPort),
+      recoveryPort_(recoveryPort),
+      events_(queueCapacity),
+      history_(RETRANSMIT_WINDOW) {
+  tradeListener_ =
+      engine_.addTradeCallback([this](const std::vector<Trade> &trades) {
+        thread_local std::vector<Event> batch;
+        batch.clear();
+        for (const auto &trade : trades) {
+          FeedTrade msg{.type = FeedMessageType::Trade,
+                        .symbolId = trade.symbolId,
+                        .price = trade.price,
+                        .quantity = trade.quantity,
+                        .makerOrderId = trade.makerOrderId,
+                        .takerOrderId = trade.takerOrderId};
+          batch.push_back(toEvent(&msg, sizeof(msg)));
+        }
+        enqueue(batch);
+      });
+  deltaListener_ = engine_.addBookDeltaCallback(
+      [this](const std::vector<BookDelta> &deltas) {
+        thread_local std::vector<Event> batch;
+        batch.clear();
+        for (const auto &delta : deltas) {
+          FeedLevelUpdate msg{.type = FeedMessageType::LevelUpdate,
+                              .symbolId = delta.symbolId,
+                              .side = delta.side,
+                              .action = delta.action,
+                              .price = delta.price,
+                              .quantity = delta.quantity};
+          batch.push_back(toEvent(&msg, sizeof(msg)));
+        }
+        enqueue(batch);
+      });
+  quoteListener_ =
+      engine_.addQuoteCallback([this](const std::vector<Quote> &quotes) {
+        thread_local std::vector<Event> batch;
+        batch.clear();
+        for (const auto &quote : quotes) {
+          FeedQuote msg{.type = FeedMessageType::Quote,
+                        .symbolId = quote.symbolId,
+                        .bidPrice = quote.bidPrice,
+                        .bidQuantity = quote.bidQuantity,
+                        .askPrice = quote.askPrice,
+                        .askQuantity = quote.askQuantity};
+          batch.push_back(toEvent(&msg, sizeof(msg)));
+        }
+        enqueue(batch);
+      });
+}
+
+MarketDataFeed::~MarketDataFeed() {
+  stop();
+  for (auto handle : {tradeListener_, deltaListener_, quoteListener_}) {
+    engine_.removeCallback(handle);
+  }
+}
+
+bool MarketDataFeed::start() {
+  udpSocket_ = socket(AF_INET, SOCK_DGRAM, 0);
+  if (udpSocket_ < 0) {
+    std::cerr << "Error creating feed socket\n";
+    return false;
+  }
+  sockaddr_in destination{};
+  destination.sin_family = AF_INET;
+  destination.sin_port = htons(udpPort_);
+  if (inet_pton(AF_INET, host_.c_str(), &destination.sin_addr) != 1) {
+    std::cerr << "Invalid feed address " << host_ << "\n";
+    return false;
+  }
+  if (IN_MULTICAST(ntohl(destination.sin_addr.s_addr))) {
+    unsigned char ttl = 1;
+    unsigned char loop = 1;
+    setsockopt(udpSocket_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(udpSocket_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+  }
+  // The feed socket only ever sends to one group, so connect it once.
+  if (connect(udpSocket_, reinterpret_cast<sockaddr *>(&destination),
+              sizeof(destination)) < 0) {
+    std::cerr << "Error connecting feed socket\n";
+    return false;
+  }
+
+  recoverySocket_ = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(recoverySocket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in recoveryAddr{};
+  recoveryAddr.sin_family = AF_INET;
+  recoveryAddr.sin_addr.s_addr = INADDR_ANY;
+  recoveryAddr.sin_port = htons(recoveryPort_);
+  if (bind(recoverySocket_, reinterpret_cast<sockaddr *>(&recoveryAddr),
+           sizeof(recoveryAddr)) < 0 ||
+      listen(recoverySocket_, 16) < 0) {
+    std::cerr << "Error opening feed recovery port\n";
+    return false;
+  }
+  socklen_t addrLen = sizeof(recoveryAddr);
+  getsockname(recoverySocket_, reinterpret_cast<sockaddr *>(&recoveryAddr),
+              &addrLen);
+  recoveryPort_ = ntohs(recoveryAddr.sin_port);
+
+  running_ = true;
+  publisherThread_ = std::jthread(&MarketDataFeed::publisherLoop, this);
+  recoveryThread_ = std::jthread(&MarketDataFeed::recoveryLoop, this);
+  std::cout << "Market data feed on " << host_ << ":" << udpPort_
+            << ", recovery on port " << recoveryPort_ << "\n";
+  return true;
+}
+
+void MarketDataFeed::stop() {
+  if (!running_.exchange(false)) return;
+
+  shutdown(recoverySocket_, SHUT_RDWR);
+  int client = recoveryClient_.load();
+  if (client >= 0) shutdown(client, SHUT_RDWR);
+  if (recoveryThread_.joinable()) recoveryThread_.join();
+  if (publisherThread_.joinable()) publisherThread_.join();
+  close(recoverySocket_);
+  close(udpSocket_);
+  recoverySocket_ = udpSocket_ = -1;
+}
+
+MarketDataFeed::Event MarketDataFeed::toEvent(const void *message,
+                                              size_t size) {
+  Event event;
+  event.size = static_cast<uint8_t>(size);
+  std::memcpy(event.bytes, message, size);
+  return event;
+}
+
+// Runs on the shard workers, which must not wait: a full queue drops the
+// batch and leaves the publisher to account for it (see skipDropped).
+void MarketDataFeed::enqueue(const std::vector<Event> &batch) {
+  if (!events_.push_batch(batch.data(), batch.size())) {
+    droppedEvents_ += batch.size();
+  }
+}
+
+void MarketDataFeed::publisherLoop() {
+  constexpr size_t MAX_BATCH = 4096;
+  std::vector<Event> batch(MAX_BATCH);
+  std::string packet;
+  packet.reserve(MAX_PACKET_BYTES);
+
+  while (running_) {
+    size_t count = events_.pop_batch(batch.data(), MAX_BATCH);
+    const uint64_t dropped = droppedEvents_.load();
+    if (count == 0 && dropped == skippedEvents_) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    const bool gap = dropped != skippedEvents_;
+    if (gap) {
+      skipDropped(dropped - skippedEvents_);
+      skippedEvents_ = dropped;
+    }
+    FeedPacketHeader header{lastSequence_ + 1, 0, 0, 0};
+    packet.assign(sizeof(header), '\0');
+
+    for (size_t i = 0; i < count; ++i) {
+      const Event &event = batch[i];
+      if (packet.size() + event.size > MAX_PACKET_BYTES) {
+        std::memcpy(packet.data(), &header, sizeof(header));
+        sendPacket(packet.data(), packet.size());
+        header.sequence += header.count;
+        header.count = 0;
+        packet.resize(sizeof(header));
+      }
+
+      uint64_t sequence = lastSequence_ + 1;
+      history_[sequence % RETRANSMIT_WINDOW] = event;
+      lastSequence_.store(sequence);
+
+      int32_t symbolId = 0;
+      std::memcpy(&symbolId, event.bytes + 1, sizeof(symbolId));
+      auto slot = static_cast<size_t>(symbolId);
+      growCaches(slot);
+      switch (static_cast<FeedMessageType>(event.bytes[0])) {
+        case FeedMessageType::Trade:
+          std::memcpy(&lastTrades_[slot], event.bytes, sizeof(FeedTrade));
+          break;
+        case FeedMessageType::Quote:
+          std::memcpy(&lastQuotes_[slot], event.bytes, sizeof(FeedQuote));
+          break;
+        case FeedMessageType::LevelUpdate: {
+          FeedLevelUpdate update;
+          std::memcpy(&update, event.bytes, sizeof(update));
+          auto &levels = (update.side == OrderSide::Buy)
+                             ? lastLevels_[slot].bids
+                             : lastLevels_[slot].asks;
+          if (update.action == DeltaAction::Delete) {
+            levels.erase(update.price);
+          } else {
+            levels[update.price] = update.quantity;
+          }
+          break;
+        }
+      }
+
+      packet.append(event.bytes, event.size);
+      header.count++;
+    }
+    if (header.count > 0) {
+      std::memcpy(packet.data(), &header, sizeof(header));
+      sendPacket(packet.data(), packet.size());
+    }
+    // Only now, so that no event taken before the depth is read is applied
+    // over it.
+    if (gap) rebuildCaches();
+  }
+}
+
+// Dropped events get their sequence numbers ahead of the batch being
+// published, so its first packet shows the gap.
+void MarketDataFeed::skipDropped(uint64_t count) {
+  const uint64_t last = lastSequence_ + count;
+  for (uint64_t seq = last - std::min<uint64_t>(count, RETRANSMIT_WINDOW) + 1;
+       seq <= last; ++seq) {
+    history_[seq % RETRANSMIT_WINDOW] = Event{};
+  }
+  lastSequence_.store(last);
+}
+
+// What dropped events changed is unknown, so every symbol's quote and levels
+// are reset to the depth its shard last published; the updates queued since
+// apply on top of that. Levels beyond DepthSnapshot::MAX_LEVELS come back
+// as they next change.
+void MarketDataFeed::rebuildCaches() {
+  DepthSnapshot depth;
+  for (int32_t symbolId = 0; engine_.getDepth(symbolId, depth); ++symbolId) {
+    auto slot = static_cast<size_t>(symbolId);
+    growCaches(slot);
+    LevelCache &levels = lastLevels_[slot];
+    levels.bids.clear();
+    levels.asks.clear();
+    for (int32_t i = 0; i < depth.bidLevels; ++i) {
+      levels.bids[depth.bids[i].price] = depth.bids[i].quantity;
+    }
+    for (int32_t i = 0; i < depth.askLevels; ++i) {
+      levels.asks[depth.asks[i].price] = depth.asks[i].quantity;
+    }
+    FeedQuote &quote = lastQuotes_[slot];
+    const bool hasBid = depth.bidLevels > 0;
+    const bool hasAsk = depth.askLevels > 0;
+    if (quote.type != FeedMessageType::Quote && !hasBid && !hasAsk) continue;
+    quote = FeedQuote{.type = FeedMessageType::Quote,
+                      .symbolId = symbolId,
+                      .bidPrice = hasBid ? depth.bids[0].price : 0,
+                      .bidQuantity = hasBid ? depth.bids[0].quantity : 0,
+                      .askPrice = hasAsk ? depth.asks[0].price : -1,
+                      .askQuantity = hasAsk ? depth.asks[0].quantity : 0};
+  }
+}
+
+void MarketDataFeed::growCaches(size_t slot) {
+  if (slot < lastTrades_.size()) return;
+  lastTrades_.resize(slot + 1, FeedTrade{});
+  lastQuotes_.resize(slot + 1, FeedQuote{});
+  lastLevels_.resize(slot + 1);
+}
+
+void MarketDataFeed::sendPacket(const char *packet, size_t size) {
+  // Loss is recovered by sequence, so a failed send is not retried.
+  ::send(udpSocket_, packet, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+void MarketDataFeed::recoveryLoop() {
+  while (running_) {
+    int fd = accept(recoverySocket_, nullptr, nullptr);
+    if (fd < 0) continue;
+    timeval timeout{.tv_sec = 5, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    recoveryClient_ = fd;
+    if (running_) serveRecovery(fd);
+    recoveryClient_ = -1;
+    close(fd);
+  }
+}
+
+// Line-oriented requests, answered with length-prefixed feed packets and
+// closed by an empty packet:
+//   RETRANSMIT <fromSequence> <count>
+//   SNAPSHOT
+void MarketDataFeed::serveRecovery(int fd) {
+  std::string input;
+  char buffer[1024];
+  while (running_) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) return;
+    input.append(buffer, static_cast<size_t>(n));
+
+    size_t end = 0;
+    while ((end = input.find('\n')) != std::string::npos) {
+      std::stringstream ss(input.substr(0, end));
+      input.erase(0, end + 1);
+      std::string command;
+      ss >> command;
+      if (command == "RETRANSMIT") {
+        uint64_t from = 0;
+        uint64_t count = 0;
+        ss >> from >> count;
+        sendRetransmit(fd, from, count);
+      } else if (command == "SNAPSHOT") {
+        sendSnapshot(fd);
+      } else {
+        return;
+      }
+    }
+  }
+}
+
+// Replays what is still in the window from [from, from + count). The first
+// packet's sequence tells the client where the replay really starts.
+void MarketDataFeed::sendRetransmit(int fd, uint64_t from, uint64_t count) {
+  std::vector<std::string> packets;
+  uint64_t last = 0;
+  {
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    last = lastSequence_;
+    uint64_t oldest = last >= RETRANSMIT_WINDOW ? last - RETRANSMIT_WINDOW + 1
+                                                : 1;
+    from = std::max(from, oldest);
+    uint64_t available = (from <= last) ? last - from + 1 : 0;
+    uint64_t end = from + std::min(count, available);
+
+    FeedPacketHeader header{from, 0, 0, 0};
+    std::string packet(sizeof(header), '\0');
+    for (uint64_t seq = from; seq < end; ++seq) {
+      const Event &event = history_[seq % RETRANSMIT_WINDOW];
+      // A dropped event ends the packet; the next one starts after it.
+      if (event.size == 0 || packet.size() + event.size > MAX_PACKET_BYTES) {
+        if (header.count > 0) {
+          std::memcpy(packet.data(), &header, sizeof(header));
+          packets.push_back(packet);
+        }
+        header.sequence = (event.size == 0) ? seq + 1 : seq;
+        header.count = 0;
+        packet.resize(sizeof(header));
+        if (event.size == 0) continue;
+      }
+      packet.append(event.bytes, event.size);
+      header.count++;
+    }
+    if (header.count > 0) {
+      std::memcpy(packet.data(), &header, sizeof(header));
+      packets.push_back(packet);
+    }
+  }
+
+  for (const auto &packet : packets) {
+    if (!writeFramed(fd, packet)) return;
+  }
+  FeedPacketHeader done{last, 0, 0, 0};
+  writeFramed(fd, std::string(reinterpret_cast<char *>(&done), sizeof(done)));
+}
+
+// Current quote, last trade and every displayed price level (as New level
+// updates) per symbol, consistent as of the sequence in
+// each packet header. Apply it, then resume from that sequence + 1.
+void MarketDataFeed::sendSnapshot(int fd) {
+  std::vector<std::string> packets;
+  uint64_t last = 0;
+  {
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    last = lastSequence_;
+    FeedPacketHeader header{last, 0, FeedPacketHeader::SNAPSHOT, 0};
+    std::string packet(sizeof(header), '\0');
+    auto add = [&](const void *message, size_t size) {
+      if (packet.size() + size > MAX_PACKET_BYTES) {
+        std::memcpy(packet.data(), &header, sizeof(header));
+        packets.push_back(packet);
+        header.count = 0;
+        packet.resize(sizeof(header));
+      }
+      packet.append(static_cast<const char *>(message), size);
+      header.count++;
+    };
+    for (const auto &quote : lastQuotes_) {
+      if (quote.type == FeedMessageType::Quote) add(&quote, sizeof(quote));
+    }
+    for (const auto &trade : lastTrades_) {
+      if (trade.type == FeedMessageType::Trade) add(&trade, sizeof(trade));
+    }
+    for (size_t symbolId = 0; symbolId < lastLevels_.size(); ++symbolId) {
+      auto addLevels = [&](const std::map<Price, uint64_t> &levels,
+                           OrderSide side) {
+        for (const auto &[price, quantity] : levels) {
+          FeedLevelUpdate msg{.type = FeedMessageType::LevelUpdate,
+                              .symbolId = static_cast<int32_t>(symbolId),
+                              .side = side,
+                              .action = DeltaAction::New,
+                              .price = price,
+                              .quantity = quantity};
+          add(&msg, sizeof(msg));
+        }
+      };
+      addLevels(lastLevels_[symbolId].bids, OrderSide::Buy);
+      addLevels(lastLevels_[symbolId].asks, OrderSide::Sell);
+    }
+    if (header.count > 0) {
+      std::memcpy(packet.data(), &header, sizeof(header));
+      packets.push_back(packet);
+    }
+  }
+
+  for (const auto &packet : packets) {
+    if (!writeFramed(fd, packet)) return;
+  }
+  FeedPacketHeader done{last, 0, FeedPacketHeader::SNAPSHOT, 0};
+  writeFramed(fd, std::string(reinterpret_cast<char *>(&done), sizeof(done)));
+}
+
+bool MarketDataFeed::writeFramed(int fd, const std::string &packet) {
+  auto length = static_cast<uint16_t>(packet.size());
+  std::string frame(reinterpret_cast<const char *>(&length), sizeof(length));
+  frame += packet;
+  size_t written = 0;
+  while (written < frame.size()) {
+    ssize_t n = ::send(fd, frame.data() + written, frame.size() - written,
+                       MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    written += static_cast<size_t>(n);
+  }
+  return true;
+}
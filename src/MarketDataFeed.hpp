@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Exchange.hpp"
+#include "RingBuffer.hpp"
+
+// Sequenced UDP market data. Every trade, price-level change and top-of-book
+// change is given the next feed sequence number and packed with its neighbours into datagrams of
+// at most MAX_PACKET_BYTES. A consumer that sees a gap in the sequence
+// recovers over the TCP recovery port, which serves retransmits of recent
+// messages and snapshots of the last-value cache. Events the workers cannot
+// queue are dropped but still use up their sequence numbers, so the gap is
+// seen; the cache is then rebuilt from the engine's published depth.
+//
+// Wire format (little-endian, packed): a FeedPacketHeader followed by
+// `count` messages, each starting with its FeedMessageType byte.
+
+enum class FeedMessageType : uint8_t {
+  Trade = 'T',
+  Quote = 'Q',
+  LevelUpdate = 'L',
+};
+
+#pragma pack(push, 1)
+struct FeedPacketHeader {
+  // Sequence of the first message. In a snapshot packet, the last sequence
+  // already reflected in the snapshot; its messages carry no sequence.
+  uint64_t sequence;
+  uint16_t count;
+  uint8_t flags;
+  uint8_t reserved;
+
+  static constexpr uint8_t SNAPSHOT = 1;
+};
+
+struct FeedTrade {
+  FeedMessageType type;
+  int32_t symbolId;
+  Price price;
+  Quantity quantity;
+  OrderId makerOrderId;
+  OrderId takerOrderId;
+};
+
+struct FeedQuote {
+  FeedMessageType type;
+  int32_t symbolId;
+  Price bidPrice;
+  uint64_t bidQuantity;
+  Price askPrice;
+  uint64_t askQuantity;
+};
+
+// Net change of one price level over a matching batch. `quantity` is the
+// level's new total; it is 0 for DeltaAction::Delete.
+struct FeedLevelUpdate {
+  FeedMessageType type;
+  int32_t symbolId;
+  OrderSide side;
+  DeltaAction action;
+  Price price;
+  uint64_t quantity;
+};
+#pragma pack(pop)
+
+// Size of the message starting with `type`, or 0 for an unknown type.
+inline size_t feedMessageSize(FeedMessageType type) {
+  switch (type) {
+    case FeedMessageType::Trade:
+      return sizeof(FeedTrade);
+    case FeedMessageType::Quote:
+      return sizeof(FeedQuote);
+    case FeedMessageType::LevelUpdate:
+      return sizeof(FeedLevelUpdate);
+  }
+  return 0;
+}
+
+class MarketDataFeed {
+ public:
+  static constexpr size_t MAX_PACKET_BYTES = 1400;
+  // Messages kept for retransmission.
+  static constexpr size_t RETRANSMIT_WINDOW = 1 << 16;
+  static constexpr size_t QUEUE_CAPACITY = 1 << 16;
+
+  // `host` may be a unicast or multicast IPv4 address. recoveryPort 0 picks
+  // an ephemeral port. queueCapacity bounds the events waiting for the
+  // publisher thread.
+  MarketDataFeed(Exchange &engine, const std::string &host, int udpPort,
+                 int recoveryPort = 0, size_t queueCapacity = QUEUE_CAPACITY);
+  ~MarketDataFeed();
+
+  MarketDataFeed(const MarketDataFeed &) = delete;
+  MarketDataFeed &operator=(const MarketDataFeed &) = delete;
+
+  bool start();
+  void stop();
+
+  int recoveryPort() const { return recoveryPort_; }
+  uint64_t lastSequence() const { return lastSequence_.load(); }
+  // Events dropped because the publisher's queue was full.
+  uint64_t droppedEvents() const { return droppedEvents_.load(); }
+
+ private:
+  // One encoded feed message, staged by the shard workers.
+  struct Event {
+    uint8_t size;
+    char bytes[47];
+  };
+
+  static Event toEvent(const void *message, size_t size);
+  void enqueue(const std::vector<Event> &batch);
+  void publisherLoop();
+  void sendPacket(const char *packet, size_t size);
+  // These run on the publisher thread under stateMutex_.
+  void skipDropped(uint64_t count);
+  void rebuildCaches();
+  void growCaches(size_t slot);
+
+  void recoveryLoop();
+  void serveRecovery(int fd);
+  void sendRetransmit(int fd, uint64_t from, uint64_t count);
+  void sendSnapshot(int fd);
+  static bool writeFramed(int fd, const std::string &packet);
+
+  Exchange &engine_;
+  Exchange::CallbackHandle tradeListener_;
+  Exchange::CallbackHandle deltaListener_;
+  Exchange::CallbackHandle quoteListener_;
+  std::string host_;
+  int udpPort_;
+  int recoveryPort_;
+  int udpSocket_ = -1;
+  int recoverySocket_ = -1;
+  // The recovery client being served, so stop() can cut it off.
+  std::atomic<int> recoveryClient_{-1};
+  std::atomic<bool> running_{false};
+
+  RingBuffer<Event> events_;
+  std::atomic<uint64_t> droppedEvents_{0};
+  // Drops already given sequence numbers; publisher thread only.
+  uint64_t skippedEvents_ = 0;
+  std::jthread publisherThread_;
+  std::jthread recoveryThread_;
+
+  // Guards everything below; shared by the publisher and recovery threads.
+  std::mutex stateMutex_;
+  std::atomic<uint64_t> lastSequence_{0};
+  // Dropped events are kept as empty entries, which retransmits skip.
+  std::vector<Event> history_;
+  std::vector<FeedTrade> lastTrades_;
+  std::vector<FeedQuote> lastQuotes_;
+  // Full displayed depth per symbol, rebuilt from the level updates.
+  struct LevelCache {
+    std::map<Price, uint64_t> bids;
+    std::map<Price, uint64_t> asks;
+  };
+  std::vector<LevelCache> lastLevels_;
+};
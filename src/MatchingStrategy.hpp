@@ -20,10 +20,142 @@ class MatchingStrategy {
                      std::vector<Trade>& trades) = 0;
 };
 
+enum class MatchingAlgorithm : uint8_t { PriceTime, ProRata, PriceTimeProRata };
+
 class StandardMatchingStrategy : public MatchingStrategy {
  public:
   void match(OrderBook& book, Order& incoming,
              std::vector<Trade>& trades) override {
+    if (incoming.isStop()) {
+      if (!book.isStopTriggered(incoming)) {
+        book.addStopOrder(incoming);
+        return;
+      }
+      activateStop(incoming);
+    }
+
+    size_t firstTrade = trades.size();
+    execute(book, incoming, trades);
+    if (trades.size() > firstTrade) {
+      processStopTriggers(book, trades, firstTrade);
+    }
+  }
+
+ protected:
+  // Matches `incoming` against one non-empty price level. Strategies that
+  // allocate a level other than first-in-first-out override this.
+  virtual void fillLevel(OrderBook& book, PriceLevel& level, PriceBitset& mask,
+                         Price price, Order& incoming,
+                         std::vector<Trade>& trades) {
+    for (size_t i = level.headIndex; i < level.orders.size();) {
+      if (!level.orders[i].active) {
+        if (i == level.headIndex) level.headIndex++;
+        ++i;
+        continue;
+      }
+
+      Quantity qty = std::min(incoming.quantity, level.orders[i].quantity);
+      if (fillOrder(book, level, mask, price, i, incoming, qty, trades)) break;
+      if (incoming.quantity == 0) break;
+      // An iceberg slice refilled in place is still live and next in line.
+      if (!level.orders[i].active) ++i;
+    }
+  }
+
+  // Executes `qty` against the resting order at `index`. Returns true if the
+  // fill emptied the level. Refilling an iceberg may compact the level, so
+  // `index` follows its slot down.
+  static bool fillOrder(OrderBook& book, PriceLevel& level, PriceBitset& mask,
+                        Price price, size_t& index, Order& incoming,
+                        Quantity qty, std::vector<Trade>& trades) {
+    Order& bookOrder = level.orders[index];
+    trades.emplace_back(bookOrder.id, incoming.id, incoming.symbolId,
+                        bookOrder.price, qty);
+
+    book.orderHash -= OrderBook::orderDigest(bookOrder);
+    bookOrder.quantity -= qty;
+    bookOrder.filledQuantity += qty;
+    incoming.quantity -= qty;
+    incoming.filledQuantity += qty;
+    level.totalQuantity -= qty;
+    if (bookOrder.quantity + bookOrder.hiddenQuantity > 0) {
+      book.orderHash += OrderBook::orderDigest(bookOrder);
+    }
+    book.markDirty(level, price, bookOrder.side);
+    book.emitL3(L3EventType::Execute, bookOrder, qty, level, index);
+
+    book.report(bookOrder,
+                (bookOrder.quantity + bookOrder.hiddenQuantity == 0)
+                    ? ExecStatus::Filled
+                    : ExecStatus::PartiallyFilled,
+                bookOrder.price, qty);
+    book.report(incoming,
+                (incoming.quantity == 0) ? ExecStatus::Filled
+                                         : ExecStatus::PartiallyFilled,
+                bookOrder.price, qty);
+
+    if (bookOrder.quantity == 0 && bookOrder.hiddenQuantity > 0) {
+      if (!book.replenish(level, index) && index == level.headIndex) {
+        level.headIndex++;
+      }
+    } else if (bookOrder.quantity == 0) {
+      bookOrder.active = false;
+      level.activeCount--;
+      if (index == level.headIndex) level.headIndex++;
+
+      if (level.activeCount == 0) {
+        mask.clear(price);
+        level.orders.clear();
+        level.headIndex = 0;
+        level.firstPosition = 0;
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  std::vector<Order> stopQueue;
+
+  static void activateStop(Order& order) {
+    order.type = (order.type == OrderType::Stop) ? OrderType::Market
+                                                 : OrderType::Limit;
+  }
+
+  // Triggered stops are queued and executed in trigger order; trades they
+  // produce can trigger further stops, which join the back of the queue.
+  void processStopTriggers(OrderBook& book, std::vector<Trade>& trades,
+                           size_t firstTrade) {
+    book.lastTradePrice = trades.back().price;
+    if (!book.hasStopOrders()) return;
+
+    collectTriggered(book, trades, firstTrade);
+    for (size_t next = 0; next < stopQueue.size(); ++next) {
+      Order order = stopQueue[next];
+      activateStop(order);
+
+      size_t before = trades.size();
+      execute(book, order, trades);
+      if (trades.size() > before) {
+        book.lastTradePrice = trades.back().price;
+        collectTriggered(book, trades, before);
+      }
+    }
+    stopQueue.clear();
+  }
+
+  void collectTriggered(OrderBook& book, const std::vector<Trade>& trades,
+                        size_t firstTrade) {
+    Price low = trades[firstTrade].price;
+    Price high = low;
+    for (size_t i = firstTrade + 1; i < trades.size(); ++i) {
+      low = std::min(low, trades[i].price);
+      high = std::max(high, trades[i].price);
+    }
+    book.collectTriggeredStops(low, high, stopQueue);
+  }
+
+  void execute(OrderBook& book, Order& incoming, std::vector<Trade>& trades) {
     if (incoming.type == OrderType::Market) {
       if (incoming.side == OrderSide::Buy)
         incoming.price = OrderBook::MAX_PRICE;
@@ -33,8 +165,7 @@ class StandardMatchingStrategy : public MatchingStrategy {
 
     if (incoming.side == OrderSide::Buy) {
       if (book.bestAsk == -1) {
-        if (incoming.quantity > 0 && incoming.type != OrderType::Market)
-          book.addOrder(incoming);
+        rest(book, incoming);
         return;
       }
 
@@ -50,36 +181,7 @@ class StandardMatchingStrategy : public MatchingStrategy {
 
         auto& level = book.asks[p];
         if (level.activeCount > 0) {
-          size_t size = level.orders.size();
-          for (size_t i = level.headIndex; i < size; ++i) {
-            Order& bookOrder = level.orders[i];
-            if (!bookOrder.active) {
-              if (i == level.headIndex) level.headIndex++;
-              continue;
-            }
-
-            Quantity qty = std::min(incoming.quantity, bookOrder.quantity);
-
-            trades.emplace_back(bookOrder.id, incoming.id, incoming.symbolId,
-                                bookOrder.price, qty);
-
-            bookOrder.quantity -= qty;
-            incoming.quantity -= qty;
-
-            if (bookOrder.quantity == 0) {
-              bookOrder.active = false;
-              level.activeCount--;
-              if (i == level.headIndex) level.headIndex++;
-
-              if (level.activeCount == 0) {
-                book.askMask.clear(p);
-                level.orders.clear();
-                level.headIndex = 0;
-                break;
-              }
-            }
-            if (incoming.quantity == 0) break;
-          }
+          fillLevel(book, level, book.askMask, p, incoming, trades);
         }
 
         if (incoming.quantity == 0) break;
@@ -93,8 +195,7 @@ class StandardMatchingStrategy : public MatchingStrategy {
 
     } else {
       if (book.bestBid == 0 && !book.bidMask.test(0)) {
-        if (incoming.quantity > 0 && incoming.type != OrderType::Market)
-          book.addOrder(incoming);
+        rest(book, incoming);
         return;
       }
 
@@ -118,35 +219,7 @@ class StandardMatchingStrategy : public MatchingStrategy {
 
         auto& level = book.bids[p];
         if (level.activeCount > 0) {
-          size_t size = level.orders.size();
-          for (size_t i = level.headIndex; i < size; ++i) {
-            Order& bookOrder = level.orders[i];
-            if (!bookOrder.active) {
-              if (i == level.headIndex) level.headIndex++;
-              continue;
-            }
-
-            Quantity qty = std::min(incoming.quantity, bookOrder.quantity);
-            trades.emplace_back(bookOrder.id, incoming.id, incoming.symbolId,
-                                bookOrder.price, qty);
-
-            bookOrder.quantity -= qty;
-            incoming.quantity -= qty;
-
-            if (bookOrder.quantity == 0) {
-              bookOrder.active = false;
-              level.activeCount--;
-              if (i == level.headIndex) level.headIndex++;
-
-              if (level.activeCount == 0) {
-                book.bidMask.clear(p);
-                level.orders.clear();
-                level.headIndex = 0;
-                break;
-              }
-            }
-            if (incoming.quantity == 0) break;
-          }
+          fillLevel(book, level, book.bidMask, p, incoming, trades);
         }
 
         if (incoming.quantity == 0) break;
@@ -161,8 +234,87 @@ class StandardMatchingStrategy : public MatchingStrategy {
       }
     }
 
-    if (incoming.quantity > 0 && incoming.type != OrderType::Market) {
-      book.addOrder(incoming);
+    rest(book, incoming);
+  }
+
+  // Whatever is left of a limit order joins the book; a market order's
+  // unfilled remainder is cancelled.
+  static void rest(OrderBook& book, Order& incoming) {
+    if (incoming.quantity == 0) return;
+    if (incoming.type == OrderType::Market) {
+      book.report(incoming, ExecStatus::Cancelled);
+      return;
+    }
+    book.addOrder(incoming);
+  }
+};
+
+// Allocates a level in proportion to displayed size. Each resting order gets
+// floor(size * incoming / levelTotal) in a single pass over the level; the
+// lots lost to rounding then go one apiece to orders in time priority.
+// Incoming quantity that covers the whole level sweeps it FIFO.
+class ProRataMatchingStrategy : public StandardMatchingStrategy {
+ protected:
+  void fillLevel(OrderBook& book, PriceLevel& level, PriceBitset& mask,
+                 Price price, Order& incoming,
+                 std::vector<Trade>& trades) override {
+    if (incoming.quantity >= level.totalQuantity) {
+      StandardMatchingStrategy::fillLevel(book, level, mask, price, incoming,
+                                          trades);
+      return;
+    }
+    allocate(book, level, mask, price, incoming, trades);
+  }
+
+  // Requires incoming.quantity < level.totalQuantity, so every share is
+  // strictly smaller than its order and the level never empties here.
+  static void allocate(OrderBook& book, PriceLevel& level, PriceBitset& mask,
+                       Price price, Order& incoming,
+                       std::vector<Trade>& trades) {
+    const uint64_t total = level.totalQuantity;
+    const uint64_t toAllocate = incoming.quantity;
+    size_t end = level.orders.size();
+
+    for (size_t i = level.headIndex; i < end; ++i) {
+      const Order& bookOrder = level.orders[i];
+      if (!bookOrder.active) continue;
+      auto share = static_cast<Quantity>(bookOrder.quantity * toAllocate /
+                                         total);
+      if (share > 0) {
+        fillOrder(book, level, mask, price, i, incoming, share, trades);
+      }
+    }
+
+    for (size_t i = level.headIndex; i < end && incoming.quantity > 0; ++i) {
+      if (!level.orders[i].active) continue;
+      // Taking a slice's last unit may refill it and compact the level.
+      const size_t before = i;
+      fillOrder(book, level, mask, price, i, incoming, 1, trades);
+      end -= before - i;
+    }
+  }
+};
+
+// Price-time-pro-rata: the order at the top of the queue is filled first,
+// then whatever the incoming order has left is allocated pro-rata.
+class PriceTimeProRataMatchingStrategy : public ProRataMatchingStrategy {
+ protected:
+  void fillLevel(OrderBook& book, PriceLevel& level, PriceBitset& mask,
+                 Price price, Order& incoming,
+                 std::vector<Trade>& trades) override {
+    if (incoming.quantity >= level.totalQuantity) {
+      StandardMatchingStrategy::fillLevel(book, level, mask, price, incoming,
+                                          trades);
+      return;
+    }
+
+    while (!level.orders[level.headIndex].active) level.headIndex++;
+    size_t top = level.headIndex;
+    Quantity qty = std::min(incoming.quantity, level.orders[top].quantity);
+    fillOrder(book, level, mask, price, top, incoming, qty, trades);
+
+    if (incoming.quantity > 0) {
+      allocate(book, level, mask, price, incoming, trades);
     }
   }
 };
@@ -5,7 +5,7 @@
 
 enum class OrderSide : uint8_t { Buy, Sell };
 
-enum class OrderType : uint8_t { Limit, Market };
+enum class OrderType : uint8_t { Limit, Market, Stop, StopLimit };
 
 using OrderId = uint64_t;
 using Price = int64_t;
@@ -15,21 +15,42 @@ struct Order {
   OrderId id;
   Price price;
   uint64_t clientOrderId;
+  Price stopPrice;
   int32_t symbolId;
   Quantity quantity;
+  // Iceberg orders show at most peakQuantity; the remainder waits in
+  // hiddenQuantity and is released one slice at a time.
+  Quantity peakQuantity = 0;
+  Quantity hiddenQuantity = 0;
+  Quantity filledQuantity = 0;
+  // Originating gateway session; 0 means nobody wants execution reports.
+  uint32_t sessionId = 0;
+  // Participant for mass cancel; 0 leaves the order out of the owner index.
+  uint32_t ownerId = 0;
   OrderSide side;
   OrderType type;
   bool active = true;
+  // Set once the owner has been told the order is working (New for a
+  // resting stop, Replaced for a modify), so resting it later does not
+  // report New a second time.
+  bool acknowledged = false;
 
   Order() = default;
 
   Order(OrderId id, uint64_t clientOrderId, int32_t symbolId, OrderSide side,
-        OrderType type, Price price, Quantity quantity)
+        OrderType type, Price price, Quantity quantity, Price stopPrice = 0)
       : id(id),
         price(price),
         clientOrderId(clientOrderId),
+        stopPrice(stopPrice),
         symbolId(symbolId),
         quantity(quantity),
         side(side),
         type(type) {}
+
+  bool isIceberg() const { return peakQuantity > 0; }
+
+  bool isStop() const {
+    return type == OrderType::Stop || type == OrderType::StopLimit;
+  }
 };
@@ -2,29 +2,40 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
 #include "Order.hpp"
+#include "Snapshot.hpp"
 
 OrderBook::OrderBook()
     : buffer(static_cast<size_t>(512 * 1024 * 1024)),
       pool(buffer.data(), buffer.size(), std::pmr::new_delete_resource()),
       bidMask(MAX_PRICE),
-      askMask(MAX_PRICE) {
+      askMask(MAX_PRICE),
+      buyStopMask(MAX_PRICE),
+      sellStopMask(MAX_PRICE) {
   idToLocation.resize(10000000);
 
   bids.reserve(MAX_PRICE);
   asks.reserve(MAX_PRICE);
+  buyStops.reserve(MAX_PRICE);
+  sellStops.reserve(MAX_PRICE);
 
   for (int i = 0; i < MAX_PRICE; ++i) {
     bids.emplace_back(&pool);
     asks.emplace_back(&pool);
+    buyStops.emplace_back(&pool);
+    sellStops.emplace_back(&pool);
   }
 }
 
 void OrderBook::addOrder(const Order& order) {
-  if (order.price < 0 || order.price >= MAX_PRICE) return;
+  if (order.price < 0 || order.price >= MAX_PRICE) {
+    report(order, ExecStatus::Rejected);
+    return;
+  }
 
   if (order.id >= idToLocation.size()) {
     idToLocation.resize(order.id * 2);
@@ -39,6 +50,21 @@ void OrderBook::addOrder(const Order& order) {
   level.orders.push_back(order);
   level.activeCount++;
 
+  Order& resting = level.orders.back();
+  if (resting.isIceberg() && resting.quantity > resting.peakQuantity) {
+    resting.hiddenQuantity += resting.quantity - resting.peakQuantity;
+    resting.quantity = resting.peakQuantity;
+  }
+  level.totalQuantity += resting.quantity;
+  orderHash += orderDigest(resting);
+  markDirty(level, order.price, order.side);
+  emitL3(L3EventType::Add, resting, resting.quantity, level,
+         level.orders.size() - 1);
+  if (resting.filledQuantity == 0 && !resting.acknowledged) {
+    report(resting, ExecStatus::New);
+  }
+  trackOwner(resting);
+
   if (isBid) {
     bidMask.set(order.price);
     if (order.price > bestBid) bestBid = order.price;
@@ -48,11 +74,102 @@ void OrderBook::addOrder(const Order& order) {
   }
 }
 
-void OrderBook::cancelOrder(OrderId orderId) {
-  if (orderId >= idToLocation.size()) return;
+void OrderBook::addStopOrder(const Order& order) {
+  if (order.stopPrice < 0 || order.stopPrice >= MAX_PRICE) {
+    report(order, ExecStatus::Rejected);
+    return;
+  }
+
+  if (order.id >= idToLocation.size()) {
+    idToLocation.resize(order.id * 2);
+  }
+
+  bool isBuy = (order.side == OrderSide::Buy);
+  auto& level = isBuy ? buyStops[order.stopPrice] : sellStops[order.stopPrice];
+
+  idToLocation[order.id] = {.price = order.stopPrice,
+                            .index = (int32_t)level.orders.size(),
+                            .isStop = true};
+
+  level.orders.push_back(order);
+  level.orders.back().acknowledged = true;
+  level.activeCount++;
+  orderHash += orderDigest(order);
+  report(order, ExecStatus::New);
+  trackOwner(order);
+
+  if (isBuy) {
+    buyStopMask.set(order.stopPrice);
+    if (minBuyStop == -1 || order.stopPrice < minBuyStop)
+      minBuyStop = order.stopPrice;
+  } else {
+    sellStopMask.set(order.stopPrice);
+    if (order.stopPrice > maxSellStop) maxSellStop = order.stopPrice;
+  }
+}
+
+bool OrderBook::isStopTriggered(const Order& order) const {
+  if (lastTradePrice == -1) return false;
+  return (order.side == OrderSide::Buy) ? lastTradePrice >= order.stopPrice
+                                        : lastTradePrice <= order.stopPrice;
+}
+
+void OrderBook::collectTriggeredStops(Price low, Price high,
+                                      std::vector<Order>& out) {
+  while (minBuyStop != -1 && minBuyStop <= high) {
+    auto& level = buyStops[minBuyStop];
+    for (size_t i = level.headIndex; i < level.orders.size(); ++i) {
+      const Order& o = level.orders[i];
+      if (!o.active) continue;
+      idToLocation[o.id] = {-1, -1};
+      orderHash -= orderDigest(o);
+      out.push_back(o);
+    }
+    level.orders.clear();
+    level.activeCount = 0;
+    level.headIndex = 0;
+    buyStopMask.clear(minBuyStop);
+
+    size_t next = buyStopMask.findFirstSet(minBuyStop);
+    minBuyStop = (next >= MAX_PRICE) ? -1 : (Price)next;
+  }
+
+  while (maxSellStop != -1 && maxSellStop >= low) {
+    auto& level = sellStops[maxSellStop];
+    for (size_t i = level.headIndex; i < level.orders.size(); ++i) {
+      const Order& o = level.orders[i];
+      if (!o.active) continue;
+      idToLocation[o.id] = {-1, -1};
+      orderHash -= orderDigest(o);
+      out.push_back(o);
+    }
+    level.orders.clear();
+    level.activeCount = 0;
+    level.headIndex = 0;
+    sellStopMask.clear(maxSellStop);
+
+    size_t next = (maxSellStop == 0) ? MAX_PRICE
+                                     : sellStopMask.findFirstSetDown(
+                                           maxSellStop - 1);
+    maxSellStop = (next >= MAX_PRICE) ? -1 : (Price)next;
+  }
+}
+
+bool OrderBook::cancelOrder(OrderId orderId, uint32_t ownerId) {
+  if (ownerId != 0) {
+    const Order* live = findLive(orderId);
+    if (live == nullptr || live->ownerId != ownerId) return false;
+  }
+  return removeOrder(orderId, true);
+}
+
+bool OrderBook::removeOrder(OrderId orderId, bool notify) {
+  if (orderId >= idToLocation.size()) return false;
 
   OrderLocation loc = idToLocation[orderId];
-  if (loc.price == -1) return;
+  if (loc.price == -1) return false;
+
+  if (loc.isStop) return cancelStopOrder(orderId, loc);
 
   bool found = false;
   if (loc.price < MAX_PRICE && loc.price >= 0) {
@@ -61,7 +178,13 @@ void OrderBook::cancelOrder(OrderId orderId) {
         Order& o = bids[loc.price].orders[loc.index];
         if (o.active) {
           o.active = false;
+          orderHash -= orderDigest(o);
+          if (notify) report(o, ExecStatus::Cancelled);
           bids[loc.price].activeCount--;
+          bids[loc.price].totalQuantity -= o.quantity;
+          markDirty(bids[loc.price], loc.price, OrderSide::Buy);
+          emitL3(L3EventType::Cancel, o, o.quantity, bids[loc.price],
+                 loc.index);
           if (bids[loc.price].activeCount == 0) {
             bidMask.clear(loc.price);
             if (loc.price == bestBid) {
@@ -78,7 +201,13 @@ void OrderBook::cancelOrder(OrderId orderId) {
         Order& o = asks[loc.price].orders[loc.index];
         if (o.active) {
           o.active = false;
+          orderHash -= orderDigest(o);
+          if (notify) report(o, ExecStatus::Cancelled);
           asks[loc.price].activeCount--;
+          asks[loc.price].totalQuantity -= o.quantity;
+          markDirty(asks[loc.price], loc.price, OrderSide::Sell);
+          emitL3(L3EventType::Cancel, o, o.quantity, asks[loc.price],
+                 loc.index);
           if (asks[loc.price].activeCount == 0) {
             askMask.clear(loc.price);
             if (loc.price == bestAsk) {
@@ -95,15 +224,414 @@ void OrderBook::cancelOrder(OrderId orderId) {
   if (found) {
     idToLocation[orderId] = {-1, -1};
   }
+  return found;
+}
+
+bool OrderBook::cancelStopOrder(OrderId orderId, OrderLocation loc) {
+  for (OrderSide side : {OrderSide::Buy, OrderSide::Sell}) {
+    bool isBuy = (side == OrderSide::Buy);
+    auto& level = isBuy ? buyStops[loc.price] : sellStops[loc.price];
+    if (loc.index >= level.orders.size()) continue;
+
+    Order& o = level.orders[loc.index];
+    if (o.id != orderId || !o.active) continue;
+
+    o.active = false;
+    orderHash -= orderDigest(o);
+    report(o, ExecStatus::Cancelled);
+    level.activeCount--;
+    if (level.activeCount == 0) {
+      level.orders.clear();
+      level.headIndex = 0;
+      if (isBuy) {
+        buyStopMask.clear(loc.price);
+        if (loc.price == minBuyStop) {
+          size_t p = buyStopMask.findFirstSet(loc.price);
+          minBuyStop = (p >= MAX_PRICE) ? -1 : (Price)p;
+        }
+      } else {
+        sellStopMask.clear(loc.price);
+        if (loc.price == maxSellStop) {
+          size_t p = sellStopMask.findFirstSetDown(loc.price);
+          maxSellStop = (p >= MAX_PRICE) ? -1 : (Price)p;
+        }
+      }
+    }
+    idToLocation[orderId] = {-1, -1};
+    return true;
+  }
+  return false;
+}
+
+OrderBook::ModifyResult OrderBook::modifyOrder(OrderId orderId, Price price,
+                                               Quantity quantity,
+                                               Order& replacement,
+                                               uint32_t ownerId) {
+  if (quantity == 0 || price < 0 || price >= MAX_PRICE) {
+    return ModifyResult::Rejected;
+  }
+  const Order* live = findLive(orderId);
+  if (live == nullptr || idToLocation[orderId].isStop ||
+      (ownerId != 0 && live->ownerId != ownerId)) {
+    return ModifyResult::Rejected;
+  }
+
+  OrderLocation loc = idToLocation[orderId];
+  PriceLevel& level = getLevelMutable(loc.price, live->side);
+  Order& o = level.orders[loc.index];
+  Quantity leaves = o.quantity + o.hiddenQuantity;
+
+  if (price == o.price && quantity < leaves) {
+    // Size reductions come out of the reserve first, then the displayed
+    // slice, and never touch the order's place in the queue.
+    Quantity reduce = leaves - quantity;
+    Quantity fromHidden = std::min(o.hiddenQuantity, reduce);
+    orderHash -= orderDigest(o);
+    o.hiddenQuantity -= fromHidden;
+    o.quantity -= reduce - fromHidden;
+    level.totalQuantity -= reduce - fromHidden;
+    orderHash += orderDigest(o);
+    markDirty(level, loc.price, o.side);
+    emitL3(L3EventType::Modify, o, o.quantity, level, loc.index);
+    report(o, ExecStatus::Replaced);
+    return ModifyResult::Amended;
+  }
+
+  replacement = o;
+  replacement.price = price;
+  replacement.quantity = quantity;
+  replacement.hiddenQuantity = 0;
+  replacement.acknowledged = true;
+  removeOrder(orderId, false);
+  report(replacement, ExecStatus::Replaced);
+  return ModifyResult::Replaced;
+}
+
+void OrderBook::collectDeltas(int32_t symbolId, std::vector<BookDelta>& out) {
+  for (const DirtyLevel& dirty : dirtyLevels) {
+    PriceLevel& level = getLevelMutable(dirty.price, dirty.side);
+    level.deltaPending = false;
+
+    uint64_t quantity = (level.activeCount > 0) ? level.totalQuantity : 0;
+    if (quantity == level.publishedQuantity) continue;
+
+    DeltaAction action = (level.publishedQuantity == 0) ? DeltaAction::New
+                         : (quantity == 0)              ? DeltaAction::Delete
+                                                        : DeltaAction::Change;
+    out.push_back({symbolId, dirty.side, action, dirty.price, quantity});
+    level.publishedQuantity = quantity;
+  }
+  dirtyLevels.clear();
+}
+
+void OrderBook::fillDepth(DepthSnapshot& snapshot) const {
+  snapshot.bidLevels = 0;
+  snapshot.askLevels = 0;
+  snapshot.lastTradePrice = lastTradePrice;
+
+  for (size_t p = bidMask.findFirstSetDown(MAX_PRICE);
+       p < MAX_PRICE && snapshot.bidLevels < DepthSnapshot::MAX_LEVELS;
+       p = (p == 0) ? MAX_PRICE : bidMask.findFirstSetDown(p - 1)) {
+    const PriceLevel& level = bids[p];
+    if (level.activeCount > 0 && level.totalQuantity > 0) {
+      snapshot.bids[snapshot.bidLevels++] = {(Price)p, level.totalQuantity};
+    }
+  }
+  for (size_t p = askMask.findFirstSet(0);
+       p < MAX_PRICE && snapshot.askLevels < DepthSnapshot::MAX_LEVELS;
+       p = askMask.findFirstSet(p + 1)) {
+    const PriceLevel& level = asks[p];
+    if (level.activeCount > 0 && level.totalQuantity > 0) {
+      snapshot.asks[snapshot.askLevels++] = {(Price)p, level.totalQuantity};
+    }
+  }
+}
+
+namespace {
+template <typename T>
+void appendBytes(std::vector<std::byte>& out, const T* data, size_t count) {
+  const auto* bytes = reinterpret_cast<const std::byte*>(data);
+  out.insert(out.end(), bytes, bytes + (count * sizeof(T)));
+}
+}  // namespace
+
+void OrderBook::writeImage(int32_t symbolId,
+                           std::vector<std::byte>& out) const {
+  const size_t imageAt = out.size();
+  BookImage image{.symbolId = symbolId,
+                  .maskWords = static_cast<uint32_t>(bidMask.wordCount()),
+                  .bestBid = bestBid,
+                  .bestAsk = bestAsk,
+                  .lastTradePrice = lastTradePrice,
+                  .minBuyStop = minBuyStop,
+                  .maxSellStop = maxSellStop,
+                  .orderCount = 0};
+  appendBytes(out, &image, 1);
+
+  const std::vector<PriceLevel>* levels[] = {&bids, &asks, &buyStops,
+                                             &sellStops};
+  const PriceBitset* masks[] = {&bidMask, &askMask, &buyStopMask,
+                                &sellStopMask};
+  for (const PriceBitset* mask : masks) {
+    appendBytes(out, mask->words(), mask->wordCount());
+  }
+
+  for (int s = 0; s < 4; ++s) {
+    for (size_t p = masks[s]->findFirstSet(0); p < MAX_PRICE;
+         p = masks[s]->findFirstSet(p + 1)) {
+      const PriceLevel& level = (*levels[s])[p];
+      const size_t levelAt = out.size();
+      LevelImage levelImage{.totalQuantity = level.totalQuantity,
+                            .orderCount = 0,
+                            .reserved = 0};
+      appendBytes(out, &levelImage, 1);
+      // Live orders go out in runs, skipping the tombstones between them.
+      const size_t size = level.orders.size();
+      for (size_t i = level.headIndex; i < size;) {
+        if (!level.orders[i].active) {
+          ++i;
+          continue;
+        }
+        size_t run = i;
+        while (run < size && level.orders[run].active) ++run;
+        appendBytes(out, &level.orders[i], run - i);
+        levelImage.orderCount += static_cast<uint32_t>(run - i);
+        i = run;
+      }
+      std::memcpy(out.data() + levelAt, &levelImage, sizeof(levelImage));
+      image.orderCount += levelImage.orderCount;
+    }
+  }
+  std::memcpy(out.data() + imageAt, &image, sizeof(image));
+}
+
+const std::byte* OrderBook::loadImage(const std::byte* data,
+                                      const std::byte* end) {
+  BookImage image;
+  if (static_cast<size_t>(end - data) < sizeof(image)) return nullptr;
+  std::memcpy(&image, data, sizeof(image));
+  data += sizeof(image);
+  if (image.maskWords != bidMask.wordCount()) return nullptr;
+
+  PriceBitset* masks[] = {&bidMask, &askMask, &buyStopMask, &sellStopMask};
+  const size_t maskBytes = image.maskWords * sizeof(uint64_t);
+  if (static_cast<size_t>(end - data) < 4 * maskBytes) return nullptr;
+  for (PriceBitset* mask : masks) {
+    std::memcpy(mask->words(), data, maskBytes);
+    data += maskBytes;
+  }
+  bestBid = image.bestBid;
+  bestAsk = image.bestAsk;
+  lastTradePrice = image.lastTradePrice;
+  minBuyStop = image.minBuyStop;
+  maxSellStop = image.maxSellStop;
+
+  std::vector<PriceLevel>* levels[] = {&bids, &asks, &buyStops, &sellStops};
+  uint64_t orderCount = 0;
+  for (int s = 0; s < 4; ++s) {
+    const bool isStop = s >= 2;
+    const OrderSide side = (s % 2 == 0) ? OrderSide::Buy : OrderSide::Sell;
+    for (size_t p = masks[s]->findFirstSet(0); p < MAX_PRICE;
+         p = masks[s]->findFirstSet(p + 1)) {
+      LevelImage levelImage;
+      if (static_cast<size_t>(end - data) < sizeof(levelImage)) {
+        return nullptr;
+      }
+      std::memcpy(&levelImage, data, sizeof(levelImage));
+      data += sizeof(levelImage);
+      if (static_cast<size_t>(end - data) / sizeof(Order) <
+          levelImage.orderCount) {
+        return nullptr;
+      }
+
+      PriceLevel& level = (*levels[s])[p];
+      const auto* first = reinterpret_cast<const Order*>(data);
+      level.orders.assign(first, first + levelImage.orderCount);
+      data += levelImage.orderCount * sizeof(Order);
+      level.totalQuantity = levelImage.totalQuantity;
+      level.activeCount = static_cast<int32_t>(levelImage.orderCount);
+      level.headIndex = 0;
+      level.firstPosition = 0;
+      orderCount += levelImage.orderCount;
+
+      for (size_t i = 0; i < level.orders.size(); ++i) {
+        const Order& o = level.orders[i];
+        if (o.id >= idToLocation.size()) idToLocation.resize(o.id * 2);
+        idToLocation[o.id] = {.price = static_cast<Price>(p),
+                              .index = static_cast<int32_t>(i),
+                              .isStop = isStop};
+        orderHash += orderDigest(o);
+        trackOwner(o);
+      }
+      if (!isStop) markDirty(level, static_cast<Price>(p), side);
+    }
+  }
+  return orderCount == image.orderCount ? data : nullptr;
+}
+
+uint64_t OrderBook::stateHash() const {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (uint64_t word :
+       {static_cast<uint64_t>(bestBid), static_cast<uint64_t>(bestAsk),
+        static_cast<uint64_t>(lastTradePrice),
+        static_cast<uint64_t>(minBuyStop), static_cast<uint64_t>(maxSellStop),
+        orderHash}) {
+    h = (h ^ word) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+bool OrderBook::replenish(PriceLevel& level, size_t& index) {
+  bool last = true;
+  for (size_t i = index + 1; i < level.orders.size() && last; ++i) {
+    last = !level.orders[i].active;
+  }
+  if (last) {
+    Order& order = level.orders[index];
+    orderHash -= orderDigest(order);
+    order.quantity = std::min(order.peakQuantity, order.hiddenQuantity);
+    order.hiddenQuantity -= order.quantity;
+    orderHash += orderDigest(order);
+    level.totalQuantity += order.quantity;
+    emitL3(L3EventType::Modify, order, order.quantity, level, index);
+    return true;
+  }
+
+  if (level.orders.size() == level.orders.capacity() && level.headIndex > 0) {
+    const size_t consumed = level.headIndex;
+    level.orders.erase(level.orders.begin(),
+                       level.orders.begin() + consumed);
+    for (size_t i = 0; i < level.orders.size(); ++i) {
+      if (level.orders[i].active) {
+        idToLocation[level.orders[i].id].index = (int32_t)i;
+      }
+    }
+    level.headIndex = 0;
+    level.firstPosition += static_cast<uint32_t>(consumed);
+    index -= consumed;
+  }
+
+  Order refill = level.orders[index];
+  level.orders[index].active = false;
+  orderHash -= orderDigest(refill);
+
+  refill.quantity = std::min(refill.peakQuantity, refill.hiddenQuantity);
+  refill.hiddenQuantity -= refill.quantity;
+  orderHash += orderDigest(refill);
+
+  idToLocation[refill.id].index = (int32_t)level.orders.size();
+  level.orders.push_back(refill);
+  level.totalQuantity += refill.quantity;
+  emitL3(L3EventType::Modify, refill, refill.quantity, level,
+         level.orders.size() - 1);
+  return false;
+}
+
+void OrderBook::trackOwner(const Order& order) {
+  if (order.ownerId == 0) return;
+  if (ownerOrders.size() >= ownerSweepAt) {
+    for (auto it = ownerOrders.begin(); it != ownerOrders.end();) {
+      std::erase_if(it->second,
+                    [this](OrderId id) { return findLive(id) == nullptr; });
+      it = it->second.empty() ? ownerOrders.erase(it) : std::next(it);
+    }
+    ownerSweepAt = std::max<size_t>(64, ownerOrders.size() * 2);
+  }
+
+  auto& ids = ownerOrders[order.ownerId];
+  if (ids.size() == ids.capacity()) {
+    std::erase_if(ids, [this](OrderId id) { return findLive(id) == nullptr; });
+    if (ids.size() > ids.capacity() / 2) ids.reserve(ids.capacity() * 2);
+  }
+  ids.push_back(order.id);
+}
+
+const Order* OrderBook::findLive(OrderId orderId) const {
+  if (orderId >= idToLocation.size()) return nullptr;
+
+  OrderLocation loc = idToLocation[orderId];
+  if (loc.price == -1) return nullptr;
+
+  for (OrderSide side : {OrderSide::Buy, OrderSide::Sell}) {
+    const PriceLevel& level =
+        loc.isStop ? getStopLevel(loc.price, side) : getLevel(loc.price, side);
+    if (loc.index < level.orders.size()) {
+      const Order& o = level.orders[loc.index];
+      if (o.id == orderId && o.active) return &o;
+    }
+  }
+  return nullptr;
+}
+
+size_t OrderBook::massCancel(uint32_t ownerId, MassCancelSide side) {
+  auto onSide = [side](OrderSide s) {
+    return side == MassCancelSide::Both ||
+           (side == MassCancelSide::Buy) == (s == OrderSide::Buy);
+  };
+  size_t cancelled = 0;
+
+  if (ownerId != 0) {
+    auto it = ownerOrders.find(ownerId);
+    if (it == ownerOrders.end()) return 0;
+    std::erase_if(it->second, [&](OrderId id) {
+      const Order* o = findLive(id);
+      if (o == nullptr) return true;
+      if (!onSide(o->side)) return false;
+      cancelled += cancelOrder(id) ? 1 : 0;
+      return true;
+    });
+    if (it->second.empty()) ownerOrders.erase(it);
+    return cancelled;
+  }
+
+  auto cancelLevels = [&](std::vector<PriceLevel>& levels, PriceBitset& mask) {
+    for (size_t p = mask.findFirstSet(0); p < MAX_PRICE;
+         p = mask.findFirstSet(p + 1)) {
+      auto& level = levels[p];
+      for (size_t i = level.headIndex; i < level.orders.size(); ++i) {
+        if (!level.orders[i].active) continue;
+        OrderId id = level.orders[i].id;
+        cancelled += cancelOrder(id) ? 1 : 0;
+      }
+    }
+  };
+  if (onSide(OrderSide::Buy)) {
+    cancelLevels(bids, bidMask);
+    cancelLevels(buyStops, buyStopMask);
+  }
+  if (onSide(OrderSide::Sell)) {
+    cancelLevels(asks, askMask);
+    cancelLevels(sellStops, sellStopMask);
+  }
+  return cancelled;
 }
 
 void OrderBook::reset() {
-  for (auto& level : bids) {
+  // Levels consumers still see are queued so the next collection deletes
+  // them.
+  dirtyLevels.clear();
+  auto clearLevels = [this](std::vector<PriceLevel>& levels, OrderSide side) {
+    for (size_t price = 0; price < levels.size(); ++price) {
+      PriceLevel& level = levels[price];
+      level.orders.clear();
+      level.totalQuantity = 0;
+      level.activeCount = 0;
+      level.headIndex = 0;
+      level.firstPosition = 0;
+      level.deltaPending = false;
+      if (level.publishedQuantity > 0) {
+        markDirty(level, static_cast<Price>(price), side);
+      }
+    }
+  };
+  clearLevels(bids, OrderSide::Buy);
+  clearLevels(asks, OrderSide::Sell);
+  for (auto& level : buyStops) {
     level.orders.clear();
     level.activeCount = 0;
     level.headIndex = 0;
   }
-  for (auto& level : asks) {
+  for (auto& level : sellStops) {
     level.orders.clear();
     level.activeCount = 0;
     level.headIndex = 0;
@@ -113,9 +641,16 @@ void OrderBook::reset() {
 
   bidMask.clearAll();
   askMask.clearAll();
+  buyStopMask.clearAll();
+  sellStopMask.clearAll();
   bestBid = 0;
   bestAsk = -1;
+  lastTradePrice = -1;
+  minBuyStop = -1;
+  maxSellStop = -1;
   std::fill(idToLocation.begin(), idToLocation.end(), OrderLocation{-1, -1});
+  ownerOrders.clear();
+  orderHash = 0;
 }
 
 void OrderBook::printBook() const {
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <memory_resource>
+#include <unordered_map>
 #include <vector>
 
 #include "Bitset.hpp"
@@ -22,10 +24,111 @@ struct Trade {
         takerOrderId(taker) {}
 };
 
+enum class ExecStatus : uint8_t {
+  New,
+  PartiallyFilled,
+  Filled,
+  Cancelled,
+  Rejected,
+  CancelRejected,
+  Replaced
+};
+
+struct ExecutionReport {
+  OrderId orderId;
+  uint64_t clientOrderId;
+  Price lastPrice;
+  int32_t symbolId;
+  uint32_t sessionId;
+  Quantity lastQuantity;
+  Quantity leavesQuantity;
+  Quantity cumQuantity;
+  ExecStatus status;
+};
+
+// Best bid and offer with the displayed quantity resting at each. An empty
+// side is bidPrice 0 / askPrice -1, matching getBestBid/getBestAsk.
+struct Quote {
+  int32_t symbolId;
+  Price bidPrice;
+  uint64_t bidQuantity;
+  Price askPrice;
+  uint64_t askQuantity;
+
+  bool operator==(const Quote&) const = default;
+};
+
+// Aggregated levels nearest the touch, best first. Built by the owning shard
+// so that other threads can read depth without touching live book memory.
+struct DepthSnapshot {
+  static constexpr int MAX_LEVELS = 20;
+
+  struct Level {
+    Price price;
+    uint64_t quantity;
+  };
+
+  int32_t symbolId = -1;
+  int32_t bidLevels = 0;
+  int32_t askLevels = 0;
+  Price lastTradePrice = -1;
+  Level bids[MAX_LEVELS];
+  Level asks[MAX_LEVELS];
+};
+
+enum class DeltaAction : uint8_t { New, Change, Delete };
+
+// Net change of one price level's displayed quantity since it was last
+// reported. `quantity` is the level's new total (0 for Delete).
+struct BookDelta {
+  int32_t symbolId;
+  OrderSide side;
+  DeltaAction action;
+  Price price;
+  uint64_t quantity;
+};
+
+// Order-by-order book events. `position` is the order's slot in its price
+// level: within a level, a lower position trades first, and positions only
+// restart once the level has emptied.
+enum class L3EventType : uint8_t {
+  Add = 'A',      // Order rests with `quantity` displayed.
+  Execute = 'E',  // `quantity` traded against the resting order.
+  Cancel = 'X',   // Order left the book with `quantity` still displayed.
+  Modify = 'M',   // Order now shows `quantity` at `position`; a new position
+                  // means it lost priority (iceberg refill).
+  Clear = 'C',    // Every order of `symbolId` was dropped (book reset).
+};
+
+#pragma pack(push, 1)
+struct L3Event {
+  // Per-shard, gapless; stamped when the shard writes the event out.
+  uint64_t sequence;
+  OrderId orderId;
+  Price price;
+  int32_t symbolId;
+  Quantity quantity;
+  uint32_t position;
+  OrderSide side;
+  L3EventType type;
+};
+#pragma pack(pop)
+
+enum class MassCancelSide : uint8_t { Buy, Sell, Both };
+
 struct PriceLevel {
   std::pmr::vector<Order> orders;
+  // Displayed quantity only; iceberg reserves are never counted here.
+  uint64_t totalQuantity = 0;
   int32_t activeCount = 0;
   int32_t headIndex = 0;
+  // L3 position of orders[0]. Compacting the level moves orders down but
+  // not their positions, which only restart once the level is cleared.
+  uint32_t firstPosition = 0;
+  // Total last reported through collectDeltas, and whether the level is
+  // already queued to be compared against it.
+  uint64_t publishedQuantity = 0;
+  bool deltaPending = false;
 
   explicit PriceLevel(
       std::pmr::memory_resource* mr = std::pmr::get_default_resource())
@@ -44,12 +147,50 @@ class OrderBook {
   struct OrderLocation {
     Price price = -1;
     int32_t index = -1;
+    bool isStop = false;
   };
 
   OrderBook();
 
   void addOrder(const Order& order);
-  void cancelOrder(OrderId orderId);
+  // A nonzero `ownerId` must match the order's owner; another owner's order
+  // is left alone and the call fails as if it did not exist.
+  bool cancelOrder(OrderId orderId, uint32_t ownerId = 0);
+
+  enum class ModifyResult : uint8_t { Rejected, Amended, Replaced };
+  // Shrinking a resting order at the same price amends it in place and keeps
+  // its queue priority. Any other change pulls the order and hands it back
+  // in `replacement` with the new price and size; the caller re-matches it
+  // under the same id, behind everything already at the new level. Stop
+  // orders cannot be modified, nor, with a nonzero `ownerId`, another
+  // owner's orders.
+  ModifyResult modifyOrder(OrderId orderId, Price price, Quantity quantity,
+                           Order& replacement, uint32_t ownerId = 0);
+
+  // Cancels every resting and stop order on `side` belonging to `ownerId`,
+  // visiting only that owner's order list. ownerId 0 cancels every owner's
+  // orders by walking the populated levels. Returns the number cancelled.
+  size_t massCancel(uint32_t ownerId, MassCancelSide side);
+
+  // Execution reports for orders carrying a session id are appended here.
+  // The owning shard clears the vector after each batch, so steady state
+  // reporting never allocates.
+  void setReportSink(std::vector<ExecutionReport>* sink) { reportSink = sink; }
+  // Same, for L3 events of orders resting in the visible book. Stop orders
+  // appear only once they trigger and rest.
+  void setL3Sink(std::vector<L3Event>* sink) { l3Sink = sink; }
+
+  // Stop and stop-limit orders rest in a trigger index bucketed by stop
+  // price until a trade prints through their stop.
+  void addStopOrder(const Order& order);
+  bool isStopTriggered(const Order& order) const;
+  bool hasStopOrders() const {
+    return minBuyStop != -1 || maxSellStop != -1;
+  }
+  // Removes every stop order triggered by trades in [low, high] and appends
+  // them to `out`: buy stops by ascending stop price, then sell stops by
+  // descending stop price, FIFO within a stop price.
+  void collectTriggeredStops(Price low, Price high, std::vector<Order>& out);
 
   std::vector<PriceLevel>& getBids() { return bids; }
   std::vector<PriceLevel>& getAsks() { return asks; }
@@ -70,6 +211,39 @@ class OrderBook {
 
   Price getBestBid() const { return bestBid; }
   Price getBestAsk() const { return bestAsk; }
+  Price getLastTradePrice() const { return lastTradePrice; }
+
+  const PriceLevel& getStopLevel(Price stopPrice, OrderSide side) const {
+    return (side == OrderSide::Buy) ? buyStops[stopPrice]
+                                    : sellStops[stopPrice];
+  }
+
+  // Appends one BookDelta per price level whose displayed quantity differs
+  // from what was last collected, however many times it changed in
+  // between, then starts a new collection window.
+  void collectDeltas(int32_t symbolId, std::vector<BookDelta>& out);
+
+  // Fills the snapshot's levels and last trade price; symbolId is left to
+  // the caller.
+  void fillDepth(DepthSnapshot& snapshot) const;
+
+  // Appends the book's image (see Snapshot.hpp): price bitmaps, best prices
+  // and the live orders of every populated level, tombstones left out.
+  void writeImage(int32_t symbolId, std::vector<std::byte>& out) const;
+  // Loads an image written by writeImage into this empty book with one bulk
+  // copy per bitmap and per level, then rebuilds the order and owner
+  // indexes. Every level is queued as a delta. Returns the first byte after
+  // the image, or nullptr if it is malformed.
+  const std::byte* loadImage(const std::byte* data, const std::byte* end);
+
+  // Hash of the book's state: best prices, stop bounds, last trade price and
+  // the set of live resting and stop orders with their prices and remaining
+  // quantities. O(1): the order part is kept up to date by every add, fill,
+  // cancel, amend and iceberg refill. Tombstones never count, so a book
+  // loaded from an image hashes like the one it was taken from. Queue order
+  // within a level is not covered; orders that differ only there diverge
+  // at their next fill, in the trades.
+  uint64_t stateHash() const;
 
   void reset();
   void printBook() const;
@@ -83,9 +257,106 @@ class OrderBook {
 
   Price bestBid = 0;
   Price bestAsk = -1;
+  Price lastTradePrice = -1;
+
+  std::vector<PriceLevel> buyStops;
+  std::vector<PriceLevel> sellStops;
+
+  PriceBitset buyStopMask;
+  PriceBitset sellStopMask;
+
+  Price minBuyStop = -1;
+  Price maxSellStop = -1;
 
   std::vector<OrderLocation> idToLocation;
 
+  // Sum of orderDigest over every live order (see stateHash). A sum, so
+  // that removing an order is a subtraction wherever it sits.
+  uint64_t orderHash = 0;
+
+  static uint64_t orderDigest(const Order& o) {
+    uint64_t h = o.id * 0x9e3779b97f4a7c15ULL;
+    h ^= static_cast<uint64_t>(o.price) * 0xbf58476d1ce4e5b9ULL;
+    h ^= static_cast<uint64_t>(o.stopPrice) * 0x94d049bb133111ebULL;
+    h ^= ((static_cast<uint64_t>(o.hiddenQuantity) << 32) | o.quantity) *
+         0xff51afd7ed558ccdULL;
+    h ^= ((static_cast<uint64_t>(o.side) << 8) |
+          static_cast<uint64_t>(o.type)) *
+         0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 31;
+    h *= 0xd6e8feb86659fd93ULL;
+    return h ^ (h >> 32);
+  }
+
+  struct DirtyLevel {
+    Price price;
+    OrderSide side;
+  };
+  std::vector<DirtyLevel> dirtyLevels;
+
+  void markDirty(PriceLevel& level, Price price, OrderSide side) {
+    if (level.deltaPending) return;
+    level.deltaPending = true;
+    dirtyLevels.push_back({price, side});
+  }
+
+  // Order ids per owner, keyed by session id, which only ever grows. Filled
+  // and cancelled ids are dropped lazily when a list would otherwise grow,
+  // so each list stays within 2x its live orders; owners left with none are
+  // swept out whenever the map has doubled since the last sweep.
+  std::unordered_map<uint32_t, std::vector<OrderId>> ownerOrders;
+  size_t ownerSweepAt = 64;
+
+  void trackOwner(const Order& order);
+  const Order* findLive(OrderId orderId) const;
+
+  std::vector<ExecutionReport>* reportSink = nullptr;
+
+  void report(const Order& order, ExecStatus status, Price lastPrice = 0,
+              Quantity lastQuantity = 0) {
+    if (reportSink == nullptr || order.sessionId == 0) return;
+    bool done = (status == ExecStatus::Cancelled ||
+                 status == ExecStatus::Rejected);
+    reportSink->push_back(
+        {.orderId = order.id,
+         .clientOrderId = order.clientOrderId,
+         .lastPrice = lastPrice,
+         .symbolId = order.symbolId,
+         .sessionId = order.sessionId,
+         .lastQuantity = lastQuantity,
+         .leavesQuantity = done ? 0 : order.quantity + order.hiddenQuantity,
+         .cumQuantity = order.filledQuantity,
+         .status = status});
+  }
+
+  std::vector<L3Event>* l3Sink = nullptr;
+
+  void emitL3(L3EventType type, const Order& order, Quantity quantity,
+              const PriceLevel& level, size_t index) {
+    if (l3Sink == nullptr) return;
+    l3Sink->push_back({.sequence = 0,
+                       .orderId = order.id,
+                       .price = order.price,
+                       .symbolId = order.symbolId,
+                       .quantity = quantity,
+                       .position = level.firstPosition +
+                                   static_cast<uint32_t>(index),
+                       .side = order.side,
+                       .type = type});
+  }
+
+  bool removeOrder(OrderId orderId, bool notify);
+  bool cancelStopOrder(OrderId orderId, OrderLocation loc);
+  // Tops up an exhausted iceberg slice from its reserve and requeues it at
+  // the back of the same level. When no live order is queued behind it, its
+  // own slot already is the back, so it is refilled in place and true is
+  // returned; otherwise the slot becomes a tombstone and the slice is
+  // appended. A full vector with consumed slots at its head is compacted
+  // first, moving `index` with it, rather than grown: the pool never gets
+  // a block back, so icebergs taking turns at one price would otherwise
+  // leak a block per growth.
+  bool replenish(PriceLevel& level, size_t& index);
+
   std::vector<std::byte> buffer;
   std::pmr::monotonic_buffer_resource pool;
 
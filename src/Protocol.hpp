@@ -0,0 +1,172 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "Order.hpp"
+#include "OrderBook.hpp"
+
+// Binary order entry. A client selects it by sending BINARY_HELLO as the very
+// first byte of a connection; text clients never start with it. After that
+// every message in either direction is a fixed-layout little-endian struct
+// that begins with a BinaryHeader whose `length` covers the whole message.
+
+static_assert(std::endian::native == std::endian::little,
+              "binary protocol structs are sent in host byte order");
+
+inline constexpr uint8_t BINARY_HELLO = 0xB1;
+
+enum class BinaryMessageType : uint8_t {
+  // Client to server.
+  NewOrder = 1,
+  Cancel = 2,
+  Modify = 3,
+  SymbolLookup = 4,
+  // Server to client.
+  Ack = 64,
+  ExecReport = 65,
+  Reject = 66,
+  SymbolInfo = 67,
+};
+
+enum class RejectReason : uint8_t {
+  UnknownMessage = 1,
+  BadLength = 2,
+  UnknownSymbol = 3,
+  BadField = 4,
+};
+
+#pragma pack(push, 1)
+struct BinaryHeader {
+  uint16_t length;
+  BinaryMessageType type;
+  uint8_t reserved;
+};
+
+struct NewOrderMessage {
+  static constexpr BinaryMessageType TYPE = BinaryMessageType::NewOrder;
+  BinaryHeader header;
+  uint64_t clientOrderId;
+  Price price;
+  Price stopPrice;
+  int32_t symbolId;
+  Quantity quantity;
+  Quantity peakQuantity;
+  OrderSide side;
+  OrderType orderType;
+};
+
+struct CancelMessage {
+  static constexpr BinaryMessageType TYPE = BinaryMessageType::Cancel;
+  BinaryHeader header;
+  OrderId orderId;
+  int32_t symbolId;
+};
+
+struct ModifyMessage {
+  static constexpr BinaryMessageType TYPE = BinaryMessageType::Modify;
+  BinaryHeader header;
+  OrderId orderId;
+  Price price;
+  int32_t symbolId;
+  Quantity quantity;
+};
+
+struct SymbolLookupMessage {
+  static constexpr BinaryMessageType TYPE = BinaryMessageType::SymbolLookup;
+  BinaryHeader header;
+  char symbol[16];
+};
+
+struct AckMessage {
+  static constexpr BinaryMessageType TYPE = BinaryMessageType::Ack;
+  BinaryHeader header;
+  uint64_t clientOrderId;
+  OrderId orderId;
+};
+
+struct ExecReportMessage {
+  static constexpr BinaryMessageType TYPE = BinaryMessageType::ExecReport;
+  BinaryHeader header;
+  OrderId orderId;
+  uint64_t clientOrderId;
+  Price lastPrice;
+  int32_t symbolId;
+  Quantity lastQuantity;
+  Quantity leavesQuantity;
+  Quantity cumQuantity;
+  ExecStatus status;
+};
+
+struct RejectMessage {
+  static constexpr BinaryMessageType TYPE = BinaryMessageType::Reject;
+  BinaryHeader header;
+  uint64_t clientOrderId;
+  BinaryMessageType rejectedType;
+  RejectReason reason;
+};
+
+struct SymbolInfoMessage {
+  static constexpr BinaryMessageType TYPE = BinaryMessageType::SymbolInfo;
+  BinaryHeader header;
+  int32_t symbolId;
+  char symbol[16];
+};
+#pragma pack(pop)
+
+inline constexpr size_t MAX_BINARY_MESSAGE = 256;
+
+template <typename Message>
+Message makeMessage() {
+  Message msg{};
+  msg.header.length = sizeof(Message);
+  msg.header.type = Message::TYPE;
+  return msg;
+}
+
+template <typename Message>
+void appendMessage(std::string& out, const Message& msg) {
+  out.append(reinterpret_cast<const char*>(&msg), sizeof(Message));
+}
+
+// Peeks at the header of the next message in `data`. Returns false until a
+// whole header is available.
+inline bool peekHeader(const char* data, size_t size, BinaryHeader& header) {
+  if (size < sizeof(BinaryHeader)) return false;
+  std::memcpy(&header, data, sizeof(BinaryHeader));
+  return true;
+}
+
+// Copies a complete framed message out of the (possibly unaligned) input.
+template <typename Message>
+bool decodeMessage(const char* data, size_t length, Message& msg) {
+  if (length != sizeof(Message)) return false;
+  std::memcpy(&msg, data, sizeof(Message));
+  return true;
+}
+
+inline bool toOrder(const NewOrderMessage& msg, OrderId id, Order& order) {
+  if (msg.side != OrderSide::Buy && msg.side != OrderSide::Sell) return false;
+  if (msg.orderType > OrderType::StopLimit || msg.quantity == 0) return false;
+
+  order = Order(id, msg.clientOrderId, msg.symbolId, msg.side, msg.orderType,
+                msg.price, msg.quantity, msg.stopPrice);
+  order.peakQuantity = msg.peakQuantity;
+  return true;
+}
+
+inline ExecReportMessage toExecReportMessage(const ExecutionReport& report) {
+  auto msg = makeMessage<ExecReportMessage>();
+  msg.orderId = report.orderId;
+  msg.clientOrderId = report.clientOrderId;
+  msg.lastPrice = report.lastPrice;
+  msg.symbolId = report.symbolId;
+  msg.lastQuantity = report.lastQuantity;
+  msg.leavesQuantity = report.leavesQuantity;
+  msg.cumQuantity = report.cumQuantity;
+  msg.status = report.status;
+  return msg;
+}
@@ -0,0 +1,189 @@
+#include "ReplayFile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+// Splits off the next comma-separated field of `line`.
+std::string_view nextField(std::string_view &line) {
+  size_t comma = line.find(',');
+  std::string_view field = line.substr(0, comma);
+  line.remove_prefix(comma == std::string_view::npos ? line.size()
+                                                     : comma + 1);
+  return field;
+}
+
+bool parseDouble(std::string_view field, double &value) {
+  auto result =
+      std::from_chars(field.data(), field.data() + field.size(), value);
+  return result.ec == std::errc();
+}
+}  // namespace
+
+bool readReplayCsv(const std::string &path, ReplayCapture &out,
+                   const std::string &defaultSymbol) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    std::cerr << "Failed to open file: " << path << "\n";
+    return false;
+  }
+
+  std::unordered_map<std::string, uint16_t> symbolIndex;
+  auto symbolOf = [&](std::string_view name) {
+    if (name.empty()) name = defaultSymbol;
+    auto [it, added] = symbolIndex.try_emplace(
+        std::string(name), static_cast<uint16_t>(out.symbols.size()));
+    if (added) out.symbols.emplace_back(name);
+    return it->second;
+  };
+  // Ids added at each symbol, side and price, for the 'C' rows that clear
+  // them.
+  std::unordered_map<uint64_t, std::vector<OrderId>> resting;
+  OrderId nextId = 1;
+  std::string line;
+  std::getline(file, line);  // Header.
+  while (std::getline(file, line)) {
+    std::string_view rest(line);
+    std::string_view timestampField = nextField(rest);
+    std::string_view type = nextField(rest);
+    std::string_view sideField = nextField(rest);
+    double priceFloat = 0;
+    double qtyFloat = 0;
+    if (!parseDouble(nextField(rest), priceFloat) ||
+        !parseDouble(nextField(rest), qtyFloat) || type.empty()) {
+      continue;
+    }
+
+    ReplayRecord record{};
+    std::from_chars(timestampField.data(),
+                    timestampField.data() + timestampField.size(),
+                    record.timestamp);
+    record.symbol = symbolOf(nextField(rest));
+    record.side = (sideField == "B") ? OrderSide::Buy : OrderSide::Sell;
+    record.price = static_cast<Price>(priceFloat * 100.0);
+    const uint64_t level = (static_cast<uint64_t>(record.symbol) << 48) |
+                           (static_cast<uint64_t>(record.price) << 1) |
+                           (record.side == OrderSide::Sell ? 1 : 0);
+
+    if (type == "C") {
+      auto it = resting.find(level);
+      if (it == resting.end()) continue;
+      record.action = ReplayAction::Cancel;
+      for (OrderId id : it->second) {
+        record.orderId = id;
+        out.records.push_back(record);
+      }
+      resting.erase(it);
+      continue;
+    }
+
+    record.action = ReplayAction::Add;
+    record.orderId = nextId++;
+    record.quantity = static_cast<Quantity>(qtyFloat * 10000.0);
+    if (record.quantity == 0) record.quantity = 1;
+    resting[level].push_back(record.orderId);
+    out.records.push_back(record);
+  }
+  return true;
+}
+
+bool writeReplayFile(const std::string &path, const ReplayCapture &capture) {
+  const auto &records = capture.records;
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  ReplayFileHeader header{};
+  std::memcpy(header.magic, ReplayFileHeader::MAGIC, sizeof(header.magic));
+  header.recordSize = sizeof(ReplayRecord);
+  header.symbolCount = static_cast<uint32_t>(capture.symbols.size());
+  header.recordCount = records.size();
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (const std::string &name : capture.symbols) {
+    ReplaySymbol symbol{};
+    std::memcpy(symbol.name, name.data(),
+                std::min(name.size(), ReplaySymbol::MAX_NAME - 1));
+    file.write(reinterpret_cast<const char *>(&symbol), sizeof(symbol));
+  }
+  file.write(reinterpret_cast<const char *>(records.data()),
+             static_cast<std::streamsize>(records.size() *
+                                          sizeof(ReplayRecord)));
+  return static_cast<bool>(file);
+}
+
+bool isReplayFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  char magic[sizeof(ReplayFileHeader::MAGIC)];
+  return file.read(magic, sizeof(magic)) &&
+         std::memcmp(magic, ReplayFileHeader::MAGIC, sizeof(magic)) == 0;
+}
+
+ReplayFile::~ReplayFile() {
+  if (map_ != nullptr) munmap(map_, mapSize_);
+}
+
+bool ReplayFile::open(const std::string &path, std::string &error) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st {};
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    error = path + ": " + std::strerror(errno);
+    if (fd >= 0) ::close(fd);
+    return false;
+  }
+  const auto size = static_cast<size_t>(st.st_size);
+  if (size < sizeof(ReplayFileHeader)) {
+    ::close(fd);
+    error = path + ": not a replay file";
+    return false;
+  }
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    error = path + ": " + std::strerror(errno);
+    return false;
+  }
+  map_ = map;
+  mapSize_ = size;
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  ReplayFileHeader header;
+  std::memcpy(&header, map, sizeof(header));
+  if (std::memcmp(header.magic, ReplayFileHeader::MAGIC,
+                  sizeof(header.magic)) != 0 ||
+      header.recordSize != sizeof(ReplayRecord)) {
+    error = path + ": not a replay file written by this build";
+    return false;
+  }
+  const size_t symbolBytes = header.symbolCount * sizeof(ReplaySymbol);
+  if (size - sizeof(header) < symbolBytes ||
+      (size - sizeof(header) - symbolBytes) / sizeof(ReplayRecord) <
+          header.recordCount) {
+    error = path + ": truncated";
+    return false;
+  }
+  const char *data = static_cast<const char *>(map) + sizeof(header);
+  for (uint32_t i = 0; i < header.symbolCount; ++i) {
+    ReplaySymbol symbol;
+    std::memcpy(&symbol, data, sizeof(symbol));
+    data += sizeof(symbol);
+    symbols_.emplace_back(symbol.name,
+                          strnlen(symbol.name, sizeof(symbol.name)));
+  }
+  records_ = reinterpret_cast<const ReplayRecord *>(data);
+  count_ = header.recordCount;
+  for (size_t i = 0; i < count_; ++i) {
+    if (records_[i].symbol >= symbols_.size()) {
+      error = path + ": record " + std::to_string(i) + " has no symbol";
+      return false;
+    }
+  }
+  return true;
+}
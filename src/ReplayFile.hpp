@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Order.hpp"
+
+// Fixed-record capture format for `benchmark --replay`. A capture is
+// converted from CSV once; replays then map the file and build orders
+// straight from the records, with no parsing on the replay path.
+//
+// The file is a ReplayFileHeader, symbolCount ReplaySymbols, then
+// recordCount ReplayRecords.
+
+enum class ReplayAction : uint8_t {
+  Add = 'A',
+  Cancel = 'C',
+};
+
+struct ReplayRecord {
+  // As recorded; milliseconds for Binance captures.
+  uint64_t timestamp;
+  OrderId orderId;
+  Price price;  // Cents.
+  Quantity quantity;
+  OrderSide side;
+  ReplayAction action;
+  uint16_t symbol;  // Index into the capture's symbols.
+};
+
+struct ReplaySymbol {
+  static constexpr size_t MAX_NAME = 32;
+  char name[MAX_NAME];  // NUL-padded.
+};
+
+struct ReplayFileHeader {
+  static constexpr char MAGIC[8] = {'O', 'M', 'E', 'R', 'P', 'L', 'Y', '2'};
+
+  char magic[8];
+  uint32_t recordSize;
+  uint32_t symbolCount;
+  uint64_t recordCount;
+  char reserved[40];
+};
+
+static_assert(sizeof(ReplayRecord) == 32);
+static_assert(std::is_trivially_copyable_v<ReplayRecord>);
+static_assert(sizeof(ReplayFileHeader) == 64);
+static_assert(sizeof(ReplaySymbol) % 8 == 0);
+
+struct ReplayCapture {
+  std::vector<std::string> symbols;
+  std::vector<ReplayRecord> records;
+};
+
+// Reads a capture written by scripts/record_l3_data.py. Depth ('A') and
+// trade ('T') rows each add an order under a fresh id, with prices scaled
+// to cents and quantities to 1e-4 units. A 'C' row, a level that went to
+// zero, cancels every order the capture added at that symbol, side and
+// price. Rows without a symbol column belong to `defaultSymbol`. Returns
+// false if the file cannot be opened.
+bool readReplayCsv(const std::string &path, ReplayCapture &out,
+                   const std::string &defaultSymbol = "REPLAY");
+
+bool writeReplayFile(const std::string &path, const ReplayCapture &capture);
+
+// True if `path` starts with a ReplayFileHeader.
+bool isReplayFile(const std::string &path);
+
+// Read-only mapping of a replay file.
+class ReplayFile {
+ public:
+  ReplayFile() = default;
+  ~ReplayFile();
+
+  ReplayFile(const ReplayFile &) = delete;
+  ReplayFile &operator=(const ReplayFile &) = delete;
+
+  bool open(const std::string &path, std::string &error);
+
+  const std::vector<std::string> &symbols() const { return symbols_; }
+  const ReplayRecord *records() const { return records_; }
+  size_t size() const { return count_; }
+
+ private:
+  std::vector<std::string> symbols_;
+  void *map_ = nullptr;
+  size_t mapSize_ = 0;
+  const ReplayRecord *records_ = nullptr;
+  size_t count_ = 0;
+};
@@ -0,0 +1,244 @@
+#include "Replica.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+Replica::Replica(Exchange &engine, std::string socketPath)
+    : engine_(engine),
+      socketPath_(std::move(socketPath)),
+      buffer_(1 << 20),
+      receivedFlags_(engine.shardCount(), 0),
+      received_(std::make_unique<std::atomic<uint64_t>[]>(
+          engine.shardCount())) {}
+
+Replica::~Replica() { stop(); }
+
+bool Replica::start() {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (socketPath_.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Primary socket path too long: " << socketPath_ << "\n";
+    return false;
+  }
+  std::memcpy(addr.sun_path, socketPath_.data(), socketPath_.size());
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0 ||
+      connect(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    std::cerr << "Error connecting to primary at " << socketPath_ << ": "
+              << std::strerror(errno) << "\n";
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+
+  running_ = true;
+  following_ = true;
+  thread_ = std::jthread(&Replica::receiveLoop, this);
+  return true;
+}
+
+void Replica::stop() {
+  running_ = false;
+  if (thread_.joinable()) thread_.join();
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  following_ = false;
+}
+
+Replica::Promotion Replica::promote() {
+  const auto start = std::chrono::steady_clock::now();
+  Promotion result;
+  stop();
+
+  const size_t shards = engine_.shardCount();
+  for (size_t s = 0; s < shards; ++s) {
+    engine_.markReplicated(s, receivedSequence(s));
+  }
+  engine_.flush();
+  for (size_t s = 0; s < shards; ++s) {
+    while (engine_.replicatedSequence(s) < receivedSequence(s)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+    result.commands += receivedSequence(s);
+  }
+  // Resting orders keep the primary's order and session ids.
+  engine_.advanceIds(maxOrderId_, maxSessionId_);
+
+  result.error = error();
+  for (size_t s = 0; s < shards && result.error.empty(); ++s) {
+    if (uint64_t sequence = engine_.divergedAt(s); sequence != 0) {
+      result.error = "shard " + std::to_string(s) +
+                     " diverged from the primary at command " +
+                     std::to_string(sequence);
+    }
+  }
+  result.ok = result.error.empty();
+  result.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  return result;
+}
+
+bool Replica::diverged() const {
+  for (size_t s = 0; s < engine_.shardCount(); ++s) {
+    if (engine_.divergedAt(s) != 0) return true;
+  }
+  return false;
+}
+
+std::string Replica::error() const {
+  std::lock_guard<std::mutex> lock(errorMutex_);
+  return error_;
+}
+
+void Replica::fail(std::string error) {
+  std::cerr << "Replica stopped following: " << error << "\n";
+  {
+    std::lock_guard<std::mutex> lock(errorMutex_);
+    if (error_.empty()) error_ = std::move(error);
+  }
+  following_ = false;
+}
+
+void Replica::receiveLoop() {
+  auto lastAck = std::chrono::steady_clock::now();
+  while (running_ && following_) {
+    pollfd pfd{fd_, POLLIN, 0};
+    if (poll(&pfd, 1, 1) > 0) {
+      ssize_t n = recv(fd_, buffer_.data() + buffered_,
+                       buffer_.size() - buffered_, 0);
+      if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+      if (n < 0) {
+        fail(std::strerror(errno));
+        break;
+      }
+      // The primary going away is what promotion is for, not an error. A
+      // record it was halfway through sending is dropped.
+      if (n == 0) break;
+      buffered_ += static_cast<size_t>(n);
+      if (!processBuffer()) break;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastAck >= ACK_INTERVAL) {
+      sendAcks();
+      lastAck = now;
+    }
+  }
+  following_ = false;
+}
+
+bool Replica::processBuffer() {
+  size_t used = 0;
+  if (!headerRead_) {
+    if (buffered_ < sizeof(JournalFileHeader)) return true;
+    JournalFileHeader header;
+    std::memcpy(&header, buffer_.data(), sizeof(header));
+    if (std::memcmp(header.magic, JournalFileHeader::MAGIC,
+                    sizeof(header.magic)) != 0 ||
+        header.recordSize != sizeof(JournalRecord)) {
+      fail("not a journal stream written by this build");
+      return false;
+    }
+    if (header.shardCount != engine_.shardCount()) {
+      fail("primary has " + std::to_string(header.shardCount) +
+           " shards, engine has " + std::to_string(engine_.shardCount()));
+      return false;
+    }
+    // The stream would rebuild only what came after the snapshot.
+    if (header.hasBaseSnapshot) {
+      fail("primary's journal continues a snapshot, which cannot be followed");
+      return false;
+    }
+    used = sizeof(header);
+    headerRead_ = true;
+  }
+
+  for (; buffered_ - used >= sizeof(JournalRecord);
+       used += sizeof(JournalRecord)) {
+    JournalRecord record;
+    std::memcpy(&record, buffer_.data() + used, sizeof(record));
+    if (!processRecord(record)) return false;
+  }
+  std::memmove(buffer_.data(), buffer_.data() + used, buffered_ - used);
+  buffered_ -= used;
+
+  // Each shard reports how far it got once it has applied the chunk.
+  for (size_t s = 0; s < receivedFlags_.size(); ++s) {
+    if (!receivedFlags_[s]) continue;
+    engine_.markReplicated(s, receivedSequence(s));
+    receivedFlags_[s] = 0;
+  }
+  engine_.flush();
+  return true;
+}
+
+bool Replica::processRecord(const JournalRecord &record) {
+  if (record.checksum != record.computeChecksum()) {
+    fail("record with a bad checksum");
+    return false;
+  }
+
+  if (record.type == JournalRecordType::Symbol) {
+    const JournalSymbol &symbol = record.payload.symbol;
+    std::string name(symbol.name, strnlen(symbol.name, sizeof(symbol.name)));
+    if (engine_.registerSymbol(name, symbol.shardId, symbol.algorithm) !=
+        symbol.symbolId) {
+      fail("symbol " + name + " does not get its primary id");
+      return false;
+    }
+    return true;
+  }
+
+  const size_t s = record.shardId;
+  if (s >= engine_.shardCount()) {
+    fail("record for unknown shard " + std::to_string(s));
+    return false;
+  }
+  const uint64_t last = receivedSequence(s);
+  if (record.type == JournalRecordType::Command) {
+    if (record.sequence != last + 1) {
+      fail("shard " + std::to_string(s) + ": expected command " +
+           std::to_string(last + 1) + ", received " +
+           std::to_string(record.sequence));
+      return false;
+    }
+    received_[s].store(record.sequence, std::memory_order_release);
+    receivedFlags_[s] = 1;
+    const Exchange::Command &cmd = record.payload.command;
+    if (cmd.type == Exchange::Command::Add) {
+      maxOrderId_ = std::max(maxOrderId_, cmd.add.order.id);
+      maxSessionId_ = std::max(maxSessionId_, cmd.add.order.sessionId);
+    }
+  } else if (record.sequence != last) {
+    fail("shard " + std::to_string(s) + ": check for command " +
+         std::to_string(record.sequence) + " received after command " +
+         std::to_string(last));
+    return false;
+  }
+  engine_.replicate(s, record);
+  return true;
+}
+
+// Never blocks: the primary may itself be blocked sending to us.
+void Replica::sendAcks() {
+  if (acks_.empty()) {
+    for (size_t s = 0; s < engine_.shardCount(); ++s) {
+      ReplicaAck ack{static_cast<uint32_t>(s), 0,
+                     engine_.replicatedSequence(s)};
+      const auto *bytes = reinterpret_cast<const char *>(&ack);
+      acks_.insert(acks_.end(), bytes, bytes + sizeof(ack));
+    }
+  }
+  ssize_t n =
+      send(fd_, acks_.data(), acks_.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (n > 0) acks_.erase(acks_.begin(), acks_.begin() + n);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Exchange.hpp"
+#include "Journal.hpp"
+
+// Hot standby. Follows a primary's journal stream over the Unix socket
+// named by its JournalOptions::replicaSocket and queues every shard's
+// commands, in the primary's order, to the same shard of its own engine, so
+// the standby's books stay one queue behind the primary's. The primary's
+// trade checkpoints and state checks are verified as they go past; the
+// first mismatch marks the replica diverged. Applied sequences flow back
+// as ReplicaAcks, which is what bounds how far the primary runs ahead.
+//
+// Failing over is promote(): the books are already built, so it only waits
+// for the commands in flight.
+class Replica {
+ public:
+  // `engine` must be idle, with no symbols and as many shards as the
+  // primary.
+  Replica(Exchange &engine, std::string socketPath);
+  ~Replica();
+
+  Replica(const Replica &) = delete;
+  Replica &operator=(const Replica &) = delete;
+
+  // Connects to the primary and starts the receiving thread.
+  bool start();
+
+  struct Promotion {
+    bool ok = false;
+    uint64_t commands = 0;  // Received from the primary, all shards.
+    std::chrono::microseconds elapsed{0};
+    std::string error;
+  };
+  // Stops following, waits until every received command is applied and
+  // moves the engine's id allocators past the primary's. The engine then
+  // takes orders like any other; enable a journal (and a replica of its
+  // own) before it does. Fails if the replica diverged or broke off with
+  // an error, though the books are left as they are.
+  Promotion promote();
+
+  // False once the primary closed the stream or sent something invalid.
+  bool following() const { return following_.load(); }
+  // Highest sequence of `shardId` received, and applied here.
+  uint64_t receivedSequence(size_t shardId) const {
+    return received_[shardId].load(std::memory_order_acquire);
+  }
+  uint64_t appliedSequence(size_t shardId) const {
+    return engine_.replicatedSequence(shardId);
+  }
+  bool diverged() const;
+  std::string error() const;
+
+ private:
+  static constexpr auto ACK_INTERVAL = std::chrono::milliseconds(1);
+
+  void receiveLoop();
+  // Consumes whole records from buffer_; false on a bad stream.
+  bool processBuffer();
+  bool processRecord(const JournalRecord &record);
+  void sendAcks();
+  void fail(std::string error);
+  void stop();
+
+  Exchange &engine_;
+  std::string socketPath_;
+  int fd_ = -1;
+  std::atomic<bool> running_{false};
+  std::atomic<bool> following_{false};
+  std::jthread thread_;
+
+  // Receiving thread only.
+  std::vector<char> buffer_;
+  size_t buffered_ = 0;
+  bool headerRead_ = false;
+  std::vector<uint8_t> receivedFlags_;
+  std::vector<char> acks_;
+  OrderId maxOrderId_ = 0;
+  uint32_t maxSessionId_ = 0;
+
+  std::unique_ptr<std::atomic<uint64_t>[]> received_;
+
+  mutable std::mutex errorMutex_;
+  std::string error_;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Single-writer, many-reader publication of a trivially copyable value.
+// The writer never waits; a reader that overlaps a store simply copies
+// again, so readers never touch the writer's working memory and never see
+// a torn value.
+template <typename T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  void store(const T& value) {
+    uint64_t seq = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&value_, &value, sizeof(T));
+    sequence_.store(seq + 2, std::memory_order_release);
+  }
+
+  T load() const {
+    T copy;
+    while (true) {
+      uint64_t before = sequence_.load(std::memory_order_acquire);
+      if (before & 1) {
+        pause();
+        continue;
+      }
+      std::memcpy(&copy, &value_, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence_.load(std::memory_order_relaxed) == before) return copy;
+    }
+  }
+
+  // Number of completed stores.
+  uint64_t version() const {
+    return sequence_.load(std::memory_order_acquire) / 2;
+  }
+
+ private:
+  static void pause() {
+#if defined(__x86_64__) || defined(_M_X64)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+  }
+
+  alignas(64) std::atomic<uint64_t> sequence_{0};
+  T value_{};
+};
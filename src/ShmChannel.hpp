@@ -0,0 +1,164 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "Protocol.hpp"
+
+// Shared-memory order entry for clients on the same host. The gateway
+// creates one segment per client slot, named "/<prefix>.<n>"; a client maps
+// the first free one and then exchanges the Protocol.hpp binary messages
+// through two single-producer, single-consumer rings in it, one slot per
+// message, without a system call on either side.
+
+// One direction of a segment. Head and tail are free-running counters on
+// separate cache lines; the producer alone advances tail, the consumer
+// alone advances head.
+struct ShmRing {
+  static constexpr size_t SLOTS = 4096;
+  static constexpr size_t SLOT_SIZE = 64;
+
+  alignas(64) std::atomic<uint64_t> head{0};
+  alignas(64) std::atomic<uint64_t> tail{0};
+  alignas(64) std::array<std::array<char, SLOT_SIZE>, SLOTS> slots;
+
+  // Returns false, and writes nothing, when the ring is full.
+  template <typename Message>
+  bool push(const Message& msg) {
+    static_assert(sizeof(Message) <= SLOT_SIZE);
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == SLOTS) return false;
+    std::memcpy(slots[t % SLOTS].data(), &msg, sizeof(Message));
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // The oldest unread message, framed by its BinaryHeader, or nullptr.
+  // Stays valid until pop().
+  const char* front() const {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) return nullptr;
+    return slots[h % SLOTS].data();
+  }
+
+  void pop() {
+    head.store(head.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                  std::atomic<uint32_t>::is_always_lock_free,
+              "ring counters are shared between processes");
+static_assert(sizeof(NewOrderMessage) <= ShmRing::SLOT_SIZE &&
+              sizeof(ExecReportMessage) <= ShmRing::SLOT_SIZE &&
+              sizeof(SymbolInfoMessage) <= ShmRing::SLOT_SIZE);
+
+enum class ShmSlotState : uint32_t {
+  Free,      // Waiting for a client.
+  Claimed,   // Owned by the client in ownerPid.
+  Closing,   // The client is done; the gateway frees the slot.
+  Detached,  // The gateway dropped the client, which must close.
+};
+
+struct ShmSegment {
+  static constexpr uint32_t MAGIC = 0x314D4853;  // "SHM1"
+
+  // Written last by the gateway once the rest is initialised.
+  std::atomic<uint32_t> magic{0};
+  std::atomic<ShmSlotState> state{ShmSlotState::Free};
+  // Lets the gateway notice a client that died without closing.
+  std::atomic<int32_t> ownerPid{0};
+
+  ShmRing requests;   // Client to gateway.
+  ShmRing responses;  // Gateway to client.
+};
+
+inline std::string shmSegmentName(const std::string& prefix, size_t index) {
+  return "/" + prefix + "." + std::to_string(index);
+}
+
+// Maps an existing segment; nullptr when it does not exist.
+inline ShmSegment* mapShmSegment(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) return nullptr;
+  void* addr = mmap(nullptr, sizeof(ShmSegment), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  return addr == MAP_FAILED ? nullptr : static_cast<ShmSegment*>(addr);
+}
+
+// Client end of a segment: claims a free slot, sends requests, polls
+// responses. Not thread-safe; one thread drives one client.
+class ShmClient {
+ public:
+  ShmClient() = default;
+  ~ShmClient() { close(); }
+
+  ShmClient(const ShmClient&) = delete;
+  ShmClient& operator=(const ShmClient&) = delete;
+
+  // Claims the first free slot under `prefix`. Returns false when every
+  // slot is taken or no gateway runs under that prefix.
+  bool connect(const std::string& prefix) {
+    close();
+    for (size_t i = 0;; ++i) {
+      ShmSegment* segment = mapShmSegment(shmSegmentName(prefix, i));
+      if (segment == nullptr) return false;
+      ShmSlotState expected = ShmSlotState::Free;
+      if (segment->magic.load(std::memory_order_acquire) ==
+              ShmSegment::MAGIC &&
+          segment->state.compare_exchange_strong(expected,
+                                                 ShmSlotState::Claimed)) {
+        segment->ownerPid.store(getpid(), std::memory_order_release);
+        segment_ = segment;
+        return true;
+      }
+      munmap(segment, sizeof(ShmSegment));
+    }
+  }
+
+  // Hands the slot back; the gateway cancels whatever the client left
+  // resting.
+  void close() {
+    if (segment_ == nullptr) return;
+    segment_->state.store(ShmSlotState::Closing, std::memory_order_release);
+    munmap(segment_, sizeof(ShmSegment));
+    segment_ = nullptr;
+  }
+
+  // False once the gateway has detached this client, e.g. for letting its
+  // response ring fill up.
+  bool connected() const {
+    return segment_ != nullptr && segment_->state.load(
+                                      std::memory_order_acquire) ==
+                                      ShmSlotState::Claimed;
+  }
+
+  // Returns false when the request ring is full.
+  template <typename Message>
+  bool send(const Message& msg) {
+    return segment_->requests.push(msg);
+  }
+
+  // Copies the next response into `out` (at least ShmRing::SLOT_SIZE
+  // bytes) and returns its header, or returns false when none is waiting.
+  bool poll(char* out, BinaryHeader& header) {
+    const char* data = segment_->responses.front();
+    if (data == nullptr) return false;
+    peekHeader(data, ShmRing::SLOT_SIZE, header);
+    std::memcpy(out, data, header.length);
+    segment_->responses.pop();
+    return true;
+  }
+
+ private:
+  ShmSegment* segment_ = nullptr;
+};
@@ -0,0 +1,335 @@
+#include "ShmGateway.hpp"
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+ShmGateway::ShmGateway(Exchange &engine, std::string prefix,
+                       size_t maxClients)
+    : engine_(engine), prefix_(std::move(prefix)), clients_(maxClients) {
+  reportScratch_.resize(4096);
+  reportListener_ = engine_.addExecutionReportCallback(
+      [this](const std::vector<ExecutionReport> &reports) {
+        queueReports(reports);
+      });
+}
+
+ShmGateway::~ShmGateway() {
+  stop();
+  engine_.removeCallback(reportListener_);
+}
+
+bool ShmGateway::start() {
+  for (size_t i = 0; i < clients_.size(); ++i) {
+    const std::string name = shmSegmentName(prefix_, i);
+    // A segment left by an earlier run may still be mapped by its old
+    // client; start from a fresh one rather than share it.
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+      std::cerr << "Error creating " << name << ": " << std::strerror(errno)
+                << "\n";
+      stop();
+      return false;
+    }
+    void *addr = MAP_FAILED;
+    if (ftruncate(fd, sizeof(ShmSegment)) == 0) {
+      addr = mmap(nullptr, sizeof(ShmSegment), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (addr == MAP_FAILED) {
+      std::cerr << "Error mapping " << name << ": " << std::strerror(errno)
+                << "\n";
+      shm_unlink(name.c_str());
+      stop();
+      return false;
+    }
+    clients_[i].segment = new (addr) ShmSegment();
+    clients_[i].segment->magic.store(ShmSegment::MAGIC,
+                                     std::memory_order_release);
+  }
+
+  running_ = true;
+  thread_ = std::jthread(&ShmGateway::pollLoop, this);
+  return true;
+}
+
+void ShmGateway::stop() {
+  running_ = false;
+  if (thread_.joinable()) thread_.join();
+
+  for (size_t i = 0; i < clients_.size(); ++i) {
+    Client &client = clients_[i];
+    if (client.segment == nullptr) continue;
+    detach(client, ShmSlotState::Detached);
+    munmap(client.segment, sizeof(ShmSegment));
+    client.segment = nullptr;
+    shm_unlink(shmSegmentName(prefix_, i).c_str());
+  }
+}
+
+void ShmGateway::pollLoop() {
+  int idlePasses = 0;
+  uint32_t passes = 0;
+  while (running_) {
+    bool busy = false;
+    for (Client &client : clients_) {
+      switch (client.segment->state.load(std::memory_order_acquire)) {
+        case ShmSlotState::Claimed:
+          if (client.sessionId == 0) attach(client);
+          busy |= serviceRequests(client);
+          break;
+        case ShmSlotState::Closing:
+          detach(client, ShmSlotState::Free);
+          break;
+        default:
+          break;
+      }
+    }
+    // Orders from every client served in this pass go out together.
+    if (busy) engine_.flush();
+    busy |= deliverReports();
+    if (overflowPending_.load(std::memory_order_acquire)) detachOverflowed();
+
+    if ((++passes & 0xFFFF) == 0) checkOwners();
+
+    if (busy) {
+      idlePasses = 0;
+    } else if (++idlePasses < SPIN_PASSES) {
+#if defined(__x86_64__) || defined(_M_X64)
+      _mm_pause();
+#endif
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Drains one client's request ring. Returns true if it held anything.
+bool ShmGateway::serviceRequests(Client &client) {
+  ShmRing &requests = client.segment->requests;
+  bool any = false;
+  while (client.sessionId != 0) {
+    const char *data = requests.front();
+    if (data == nullptr) break;
+    BinaryHeader header;
+    peekHeader(data, ShmRing::SLOT_SIZE, header);
+    processRequest(client, data, header);
+    requests.pop();
+    any = true;
+  }
+  return any;
+}
+
+template <typename Message>
+void ShmGateway::respond(Client &client, const Message &msg) {
+  if (client.sessionId == 0) return;
+  // A client that lets its responses back up is dropped, as TcpServer
+  // drops a slow consumer, instead of stalling every other client.
+  if (!client.segment->responses.push(msg)) {
+    detach(client, ShmSlotState::Detached);
+  }
+}
+
+namespace {
+RejectMessage makeReject(BinaryMessageType type, uint64_t clientOrderId,
+                         RejectReason reason) {
+  auto reject = makeMessage<RejectMessage>();
+  reject.clientOrderId = clientOrderId;
+  reject.rejectedType = type;
+  reject.reason = reason;
+  return reject;
+}
+}  // namespace
+
+// Same handling as TcpServer::processBinaryRequest, answering through the
+// client's response ring.
+void ShmGateway::processRequest(Client &client, const char *data,
+                                const BinaryHeader &header) {
+  const uint32_t sessionId = client.sessionId;
+  const size_t length = std::min<size_t>(header.length, ShmRing::SLOT_SIZE);
+
+  switch (header.type) {
+    case BinaryMessageType::NewOrder: {
+      NewOrderMessage msg;
+      if (!decodeMessage(data, length, msg)) break;
+      if (!engine_.getOrderBook(msg.symbolId)) {
+        respond(client, makeReject(header.type, msg.clientOrderId,
+                                   RejectReason::UnknownSymbol));
+        return;
+      }
+      Order order;
+      if (!toOrder(msg, engine_.nextOrderId(), order)) {
+        respond(client, makeReject(header.type, msg.clientOrderId,
+                                   RejectReason::BadField));
+        return;
+      }
+      order.sessionId = sessionId;
+      order.ownerId = sessionId;
+      engine_.submitOrder(order);
+
+      auto ack = makeMessage<AckMessage>();
+      ack.clientOrderId = msg.clientOrderId;
+      ack.orderId = order.id;
+      respond(client, ack);
+      return;
+    }
+    case BinaryMessageType::Cancel: {
+      CancelMessage msg;
+      if (!decodeMessage(data, length, msg)) break;
+      if (!engine_.getOrderBook(msg.symbolId)) {
+        respond(client,
+                makeReject(header.type, 0, RejectReason::UnknownSymbol));
+        return;
+      }
+      engine_.cancelOrder(msg.symbolId, msg.orderId, sessionId);
+      return;
+    }
+    case BinaryMessageType::Modify: {
+      ModifyMessage msg;
+      if (!decodeMessage(data, length, msg)) break;
+      if (!engine_.getOrderBook(msg.symbolId)) {
+        respond(client,
+                makeReject(header.type, 0, RejectReason::UnknownSymbol));
+        return;
+      }
+      engine_.modifyOrder(msg.symbolId, msg.orderId, msg.price, msg.quantity,
+                          sessionId);
+      return;
+    }
+    case BinaryMessageType::SymbolLookup: {
+      SymbolLookupMessage msg;
+      if (!decodeMessage(data, length, msg)) break;
+      auto info = makeMessage<SymbolInfoMessage>();
+      std::memcpy(info.symbol, msg.symbol, sizeof(info.symbol));
+      info.symbolId = engine_.registerSymbol(
+          std::string(msg.symbol, strnlen(msg.symbol, sizeof(msg.symbol))),
+          -1);
+      respond(client, info);
+      return;
+    }
+    default:
+      respond(client,
+              makeReject(header.type, 0, RejectReason::UnknownMessage));
+      return;
+  }
+  respond(client, makeReject(header.type, 0, RejectReason::BadLength));
+}
+
+// Moves reports queued by the workers onto the clients' response rings.
+bool ShmGateway::deliverReports() {
+  size_t count = reportQueue_.pop_batch(reportScratch_.data(),
+                                        reportScratch_.size());
+  for (size_t i = 0; i < count; ++i) {
+    const ExecutionReport &report = reportScratch_[i];
+    auto it = sessionClients_.find(report.sessionId);
+    // The client may have gone since the worker queued the report.
+    if (it == sessionClients_.end()) continue;
+    respond(clients_[it->second], toExecReportMessage(report));
+  }
+  return count > 0;
+}
+
+void ShmGateway::attach(Client &client) {
+  client.sessionId = engine_.nextSessionId();
+  sessionClients_[client.sessionId] = &client - clients_.data();
+  std::lock_guard<std::mutex> lock(sessionsMutex_);
+  sessions_.insert(client.sessionId);
+}
+
+// Ends the client's session: its resting orders are cancelled and anything
+// still in flight for it is dropped. `next` is Free when the slot can be
+// handed out again, Detached when the client still holds it.
+void ShmGateway::detach(Client &client, ShmSlotState next) {
+  if (client.sessionId != 0) {
+    {
+      std::lock_guard<std::mutex> lock(sessionsMutex_);
+      sessions_.erase(client.sessionId);
+    }
+    sessionClients_.erase(client.sessionId);
+    engine_.massCancel(-1, client.sessionId);
+    engine_.flush();
+    client.sessionId = 0;
+  }
+
+  ShmSegment &segment = *client.segment;
+  if (next == ShmSlotState::Free) {
+    // The client has let go of the segment, so both rings are ours.
+    segment.requests.head.store(0, std::memory_order_relaxed);
+    segment.requests.tail.store(0, std::memory_order_relaxed);
+    segment.responses.head.store(0, std::memory_order_relaxed);
+    segment.responses.tail.store(0, std::memory_order_relaxed);
+    segment.ownerPid.store(0, std::memory_order_relaxed);
+  }
+  segment.state.store(next, std::memory_order_release);
+}
+
+// Frees the slots of clients that exited without closing.
+void ShmGateway::checkOwners() {
+  for (Client &client : clients_) {
+    ShmSlotState state = client.segment->state.load(std::memory_order_acquire);
+    if (state != ShmSlotState::Claimed && state != ShmSlotState::Detached) {
+      continue;
+    }
+    pid_t pid = client.segment->ownerPid.load(std::memory_order_acquire);
+    if (pid > 0 && kill(pid, 0) != 0 && errno == ESRCH) {
+      detach(client, ShmSlotState::Free);
+    }
+  }
+}
+
+// Runs on the shard workers: keep only this gateway's reports and hand them
+// to the gateway thread. A worker never waits for room: the gateway thread
+// may itself be waiting on the worker in Exchange::flush(). A session whose
+// report does not fit is cut off instead, like a client whose response
+// ring overflows, rather than left with a gap in its fills.
+void ShmGateway::queueReports(const std::vector<ExecutionReport> &reports) {
+  thread_local std::vector<ExecutionReport> batch;
+  batch.clear();
+  {
+    std::lock_guard<std::mutex> lock(sessionsMutex_);
+    if (sessions_.empty()) return;
+    for (const auto &report : reports) {
+      if (sessions_.count(report.sessionId)) batch.push_back(report);
+    }
+  }
+  if (batch.empty() || reportQueue_.push_batch(batch.data(), batch.size())) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(sessionsMutex_);
+  for (const auto &report : batch) {
+    if (!sessions_.count(report.sessionId)) continue;
+    if (!reportQueue_.push(report)) {
+      sessions_.erase(report.sessionId);
+      overflowedSessions_.push_back(report.sessionId);
+      overflowPending_.store(true, std::memory_order_release);
+    }
+  }
+}
+
+// Detaches the clients queueReports cut off.
+void ShmGateway::detachOverflowed() {
+  std::vector<uint32_t> overflowed;
+  {
+    std::lock_guard<std::mutex> lock(sessionsMutex_);
+    overflowed.swap(overflowedSessions_);
+    overflowPending_.store(false, std::memory_order_relaxed);
+  }
+  for (uint32_t sessionId : overflowed) {
+    auto it = sessionClients_.find(sessionId);
+    if (it != sessionClients_.end()) {
+      detach(clients_[it->second], ShmSlotState::Detached);
+    }
+  }
+}
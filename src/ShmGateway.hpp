@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Exchange.hpp"
+#include "RingBuffer.hpp"
+#include "ShmChannel.hpp"
+
+// Order entry over shared memory (see ShmChannel.hpp). One thread polls
+// every client's request ring and calls straight into the engine, so an
+// order reaches Exchange::submitOrder without a socket, a system call or a
+// lock in between. Acks are written as each order is submitted; execution
+// reports hop from the shard workers to the gateway thread, the only
+// producer on the response rings.
+class ShmGateway {
+ public:
+  ShmGateway(Exchange &engine, std::string prefix, size_t maxClients = 16);
+  ~ShmGateway();
+
+  ShmGateway(const ShmGateway &) = delete;
+  ShmGateway &operator=(const ShmGateway &) = delete;
+
+  // Creates the segments and starts the gateway thread.
+  bool start();
+  // Stops the thread, cancels every client's resting orders and unlinks
+  // the segments.
+  void stop();
+
+  const std::string &prefix() const { return prefix_; }
+
+ private:
+  // Idle passes spent spinning before the thread starts yielding the CPU.
+  static constexpr int SPIN_PASSES = 64;
+
+  struct Client {
+    ShmSegment *segment = nullptr;
+    uint32_t sessionId = 0;  // Zero while the slot has no client.
+  };
+
+  void pollLoop();
+  bool serviceRequests(Client &client);
+  void processRequest(Client &client, const char *data,
+                      const BinaryHeader &header);
+  bool deliverReports();
+  template <typename Message>
+  void respond(Client &client, const Message &msg);
+  void attach(Client &client);
+  void detach(Client &client, ShmSlotState next);
+  void checkOwners();
+  void queueReports(const std::vector<ExecutionReport> &reports);
+  void detachOverflowed();
+
+  Exchange &engine_;
+  Exchange::CallbackHandle reportListener_;
+  std::string prefix_;
+  std::vector<Client> clients_;
+  std::atomic<bool> running_{false};
+  std::jthread thread_;
+
+  // Sessions of attached clients; read by the workers to pick out this
+  // gateway's reports.
+  std::mutex sessionsMutex_;
+  std::unordered_set<uint32_t> sessions_;
+  // Sessions whose reports overflowed reportQueue_, for the gateway thread
+  // to detach.
+  std::vector<uint32_t> overflowedSessions_;
+  std::atomic<bool> overflowPending_{false};
+  // Gateway thread only: session id to index in clients_.
+  std::unordered_map<uint32_t, size_t> sessionClients_;
+
+  RingBuffer<ExecutionReport> reportQueue_{65536};
+  std::vector<ExecutionReport> reportScratch_;
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include "MatchingStrategy.hpp"
+#include "OrderBook.hpp"
+
+// Point-in-time image of every book, written by Exchange::writeSnapshot and
+// loaded by Exchange::restoreFromSnapshot. Each shard captures its own books
+// when it reaches the snapshot command in its queue, so a shard's image is
+// exactly the state after journal command `SnapshotShard::sequence`;
+// recovery loads the images and replays only the journal after them.
+//
+// Layout, every part a multiple of 8 bytes so a mapped file can be read in
+// place:
+//   SnapshotFileHeader
+//   SnapshotSymbol x symbolCount
+//   per shard: SnapshotShard, then `books` book images (imageSize bytes)
+//   per book: BookImage, bidMask/askMask/buyStopMask/sellStopMask words,
+//     then for each set bit of each mask, in that order, a LevelImage and
+//     its live orders.
+
+struct SnapshotFileHeader {
+  static constexpr char MAGIC[8] = {'O', 'M', 'E', 'S', 'N', 'A', 'P', '1'};
+
+  char magic[8];
+  uint32_t orderSize;
+  uint32_t shardCount;
+  uint32_t symbolCount;
+  uint32_t reserved0;
+  // Journal the shard sequences refer to (Journal::id); 0 without one.
+  uint64_t journalId;
+  // Engine order id allocator at the barrier.
+  uint64_t nextOrderId;
+  char reserved[24];
+};
+
+struct SnapshotSymbol {
+  static constexpr size_t MAX_NAME = 55;
+
+  int32_t symbolId;
+  int32_t shardId;
+  MatchingAlgorithm algorithm;
+  char name[MAX_NAME];  // NUL-padded.
+};
+
+struct SnapshotShard {
+  // Last journal command the images include; 0 without a journal.
+  uint64_t sequence;
+  // Running trade count and hash (see hashTrade) as of that command.
+  uint64_t tradeCount;
+  uint64_t tradeHash;
+  uint64_t imageSize;
+  uint32_t books;
+  uint32_t reserved;
+};
+
+struct BookImage {
+  int32_t symbolId;
+  uint32_t maskWords;
+  Price bestBid;
+  Price bestAsk;
+  Price lastTradePrice;
+  Price minBuyStop;
+  Price maxSellStop;
+  uint64_t orderCount;
+};
+
+struct LevelImage {
+  uint64_t totalQuantity;
+  uint32_t orderCount;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(SnapshotFileHeader) == 64);
+static_assert(sizeof(SnapshotSymbol) == 64);
+static_assert(sizeof(SnapshotShard) % 8 == 0);
+static_assert(sizeof(BookImage) % 8 == 0);
+static_assert(sizeof(LevelImage) % 8 == 0);
+static_assert(sizeof(Order) % 8 == 0 && alignof(Order) <= 8);
+static_assert(std::is_trivially_copyable_v<Order>);
@@ -1,35 +1,66 @@
 #include "TcpServer.hpp"
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
 #include <cstring>
 #include <iostream>
 #include <mutex>
 #include <sstream>
 
-TcpServer::TcpServer(Exchange &engine, int port)
-    : engine_(engine), port_(port), serverSocket_(-1), running_(false) {
-  engine_.setTradeCallback([this](const std::vector<Trade> &trades) {
-    for (const auto &trade : trades) {
-      std::string symbol = engine_.getSymbolName(trade.symbolId);
-      broadcastTrade(symbol, trade.price, trade.quantity);
-    }
-  });
+TcpServer::TcpServer(Exchange &engine, int port, int numIoThreads,
+                     IoBackendType backend, size_t reportQueueCapacity)
+    : engine_(engine),
+      port_(port),
+      serverSocket_(-1),
+      backendType_(backend),
+      running_(false),
+      reportQueue_(reportQueueCapacity) {
+  for (int i = 0; i < std::max(1, numIoThreads); ++i) {
+    ioThreads_.push_back(std::make_unique<IoThread>());
+  }
+
+  tradeListener_ = engine_.addTradeCallback(
+      [this](const std::vector<Trade> &trades) { publishTrades(trades); });
+  reportListener_ = engine_.addExecutionReportCallback(
+      [this](const std::vector<ExecutionReport> &reports) {
+        queueReports(reports);
+      });
 }
 
-TcpServer::~TcpServer() { stop(); }
+TcpServer::~TcpServer() {
+  stop();
+  engine_.removeCallback(tradeListener_);
+  engine_.removeCallback(reportListener_);
+}
 
 bool TcpServer::start() {
+  // Every session holds a descriptor; lift the soft limit to the hard one.
+  rlimit limit{};
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
   serverSocket_ = socket(AF_INET, SOCK_STREAM, 0);
   if (serverSocket_ < 0) {
     std::cerr << "Error creating socket\n";
     return false;
   }
 
+  int reuse = 1;
+  setsockopt(serverSocket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
   sockaddr_in serverAddr{};
   serverAddr.sin_family = AF_INET;
   serverAddr.sin_addr.s_addr = INADDR_ANY;
@@ -41,66 +72,301 @@ bool TcpServer::start() {
     return false;
   }
 
-  if (listen(serverSocket_, 10) < 0) {
+  if (listen(serverSocket_, SOMAXCONN) < 0) {
     std::cerr << "Error listening\n";
     return false;
   }
 
+  socklen_t addrLen = sizeof(serverAddr);
+  getsockname(serverSocket_, reinterpret_cast<struct sockaddr *>(&serverAddr),
+              &addrLen);
+  port_ = ntohs(serverAddr.sin_port);
+
+  for (auto &io : ioThreads_) {
+    io->backend = makeIoBackend(backendType_);
+    if (!io->backend) {
+      std::cerr << "Error creating I/O backend\n";
+      return false;
+    }
+  }
+  acceptBackend_ = makeIoBackend(backendType_);
+  if (!acceptBackend_ || !acceptBackend_->listen(serverSocket_)) {
+    std::cerr << "Error watching the listening socket\n";
+    return false;
+  }
+
   running_ = true;
-  std::cout << "Server started on port " << port_ << "\n";
+  std::cout << "Server started on port " << port_ << " with "
+            << ioThreads_.size() << " " << ioThreads_[0]->backend->name()
+            << " I/O threads\n";
+  for (auto &io : ioThreads_) {
+    io->thread = std::jthread(&TcpServer::ioLoop, this, std::ref(*io));
+  }
   acceptThread_ = std::jthread(&TcpServer::acceptLoop, this);
+  publisherThread_ = std::jthread(&TcpServer::publisherLoop, this);
+  reporterThread_ = std::jthread(&TcpServer::reporterLoop, this);
   return true;
 }
 
 void TcpServer::stop() {
-  running_ = false;
+  if (!running_.exchange(false)) return;
+
+  if (acceptThread_.joinable()) acceptThread_.join();
+  acceptBackend_.reset();
   if (serverSocket_ >= 0) {
     close(serverSocket_);
     serverSocket_ = -1;
   }
+  if (publisherThread_.joinable()) publisherThread_.join();
+  if (reporterThread_.joinable()) reporterThread_.join();
+
+  for (auto &io : ioThreads_) {
+    if (io->thread.joinable()) io->thread.join();
+    std::vector<std::shared_ptr<Connection>> remaining;
+    {
+      std::lock_guard<std::mutex> lock(io->connectionsMutex);
+      for (auto &[fd, conn] : io->connections) remaining.push_back(conn);
+    }
+    for (auto &conn : remaining) closeConnection(*io, conn);
+    io->backend.reset();
+  }
 }
 
 void TcpServer::acceptLoop() {
   while (running_) {
-    sockaddr_in clientAddr{};
-    socklen_t clientLen = sizeof(clientAddr);
-    int clientSocket =
-        accept(serverSocket_, reinterpret_cast<struct sockaddr *>(&clientAddr),
-               &clientLen);
-
-    if (clientSocket < 0) {
-      if (running_) {
-        std::cerr << "Error accepting connection\n";
+    acceptBackend_->poll(100, [this](const IoBackend::Event &event) {
+      if (event.type == IoBackend::EventType::Accepted) {
+        acceptConnection(event.fd);
       }
-      continue;
-    }
+      return true;
+    });
+  }
+}
+
+void TcpServer::acceptConnection(int clientSocket) {
+  int noDelay = 1;
+  setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay,
+             sizeof(noDelay));
+
+  auto conn = std::make_shared<Connection>();
+  conn->fd = clientSocket;
+  conn->sessionId = engine_.nextSessionId();
+  {
+    std::lock_guard<std::mutex> lock(sessionsMutex_);
+    sessions_[conn->sessionId] = conn;
+  }
+  {
+    std::lock_guard<std::mutex> lock(reportSessionsMutex_);
+    reportSessions_.insert(conn->sessionId);
+  }
+
+  IoThread &io = *ioThreads_[nextIoThread_++ % ioThreads_.size()];
+  {
+    std::lock_guard<std::mutex> lock(io.connectionsMutex);
+    io.connections[clientSocket] = conn;
+  }
 
-    std::cout << "New connection from " << inet_ntoa(clientAddr.sin_addr)
-              << "\n";
-    clientThreads_.emplace_back(&TcpServer::handleClient, this, clientSocket);
+  if (!io.backend->add(clientSocket)) {
+    std::cerr << "Error registering connection\n";
+    closeConnection(io, conn);
   }
 }
 
-void TcpServer::handleClient(int clientSocket) {
-  std::array<char, 1024> buffer{};
+void TcpServer::ioLoop(IoThread &io) {
+  IoBackend::Handler handler = [this, &io](const IoBackend::Event &event) {
+    return handleEvent(io, event);
+  };
   while (running_) {
-    buffer.fill(0);
-    ssize_t bytesRead = read(clientSocket, buffer.data(), buffer.size() - 1);
+    io.backend->poll(100, handler);
+    // Orders from every connection served in this wakeup go out together.
+    engine_.flush();
+  }
+}
 
-    if (bytesRead <= 0) {
+// Returns false once the connection has been closed.
+bool TcpServer::handleEvent(IoThread &io, const IoBackend::Event &event) {
+  std::shared_ptr<Connection> conn;
+  {
+    std::lock_guard<std::mutex> lock(io.connectionsMutex);
+    auto it = io.connections.find(event.fd);
+    if (it == io.connections.end()) return false;
+    conn = it->second;
+  }
+
+  bool open = true;
+  switch (event.type) {
+    case IoBackend::EventType::Writable: {
+      std::lock_guard<std::mutex> lock(conn->outputMutex);
+      flushOutput(*conn);
       break;
     }
+    case IoBackend::EventType::Data:
+      open = receive(conn, event.data);
+      break;
+    case IoBackend::EventType::Closed:
+      open = false;
+      break;
+    case IoBackend::EventType::Accepted:
+      break;
+  }
+  if (!open) closeConnection(io, conn);
+  return open;
+}
 
-    std::string request(buffer.data());
-    std::string response = processRequest(clientSocket, request);
-    write(clientSocket, response.c_str(), response.length());
+// Appends received bytes to the connection's input and handles every
+// complete message. Responses to one delivery leave in a single gathered
+// write. Returns false on a framing violation.
+bool TcpServer::receive(const std::shared_ptr<Connection> &conn,
+                        std::string_view data) {
+  std::string responses;
+  bool open = true;
+
+  while (open && !data.empty()) {
+    char *dest = conn->input.writePtr();
+    size_t n = std::min(data.size(), conn->input.writable());
+    std::memcpy(dest, data.data(), n);
+    conn->input.commit(n);
+    data.remove_prefix(n);
+    // A frame that cannot fit in the buffer is never going to complete.
+    if (!processInput(conn, responses) || conn->input.full()) open = false;
   }
-  close(clientSocket);
-  removeClient(clientSocket);
+
+  if (!responses.empty()) send(*conn, responses);
+  return open;
 }
 
-std::string TcpServer::processRequest(int clientSocket,
+// Handles every complete frame buffered on the connection. The first byte
+// ever received picks the protocol. Returns false on a framing violation.
+bool TcpServer::processInput(const std::shared_ptr<Connection> &conn,
+                             std::string &responses) {
+  if (conn->protocol == Connection::Protocol::Unknown &&
+      !conn->input.readable().empty()) {
+    if (static_cast<uint8_t>(conn->input.readable()[0]) == BINARY_HELLO) {
+      conn->protocol = Connection::Protocol::Binary;
+      conn->input.consume(1);
+    } else {
+      conn->protocol = Connection::Protocol::Text;
+    }
+  }
+
+  std::string_view input = conn->input.readable();
+  size_t consumed = 0;
+  if (conn->protocol == Connection::Protocol::Binary) {
+    BinaryHeader header;
+    FrameStatus status;
+    while ((status = nextBinaryFrame(input.substr(consumed), header)) ==
+           FrameStatus::Complete) {
+      processBinaryRequest(conn, input.data() + consumed, header, responses);
+      consumed += header.length;
+    }
+    if (status == FrameStatus::Invalid) return false;
+  } else {
+    size_t frameLength = 0;
+    std::string_view payload;
+    while (nextTextFrame(input.substr(consumed), frameLength, payload) ==
+           FrameStatus::Complete) {
+      if (!payload.empty()) {
+        responses += processRequest(conn, std::string(payload));
+      }
+      consumed += frameLength;
+    }
+  }
+  conn->input.consume(consumed);
+  return true;
+}
+
+void TcpServer::closeConnection(IoThread &io,
+                                const std::shared_ptr<Connection> &conn) {
+  // Cancel-on-disconnect: every session is its own owner.
+  engine_.massCancel(-1, conn->sessionId);
+  engine_.flush();
+
+  {
+    std::lock_guard<std::mutex> lock(sessionsMutex_);
+    sessions_.erase(conn->sessionId);
+  }
+  {
+    std::lock_guard<std::mutex> lock(reportSessionsMutex_);
+    reportSessions_.erase(conn->sessionId);
+  }
+  {
+    std::lock_guard<std::mutex> lock(subscribersMutex_);
+    for (auto &pair : subscribers_) {
+      auto &clients = pair.second;
+      clients.erase(std::remove(clients.begin(), clients.end(), conn),
+                    clients.end());
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(io.connectionsMutex);
+    io.connections.erase(conn->fd);
+  }
+
+  std::lock_guard<std::mutex> lock(conn->outputMutex);
+  if (conn->closed) return;
+  conn->closed = true;
+  io.backend->remove(conn->fd);
+  close(conn->fd);
+}
+
+int32_t TcpServer::resolveSymbol(const std::string &symbol) {
+  return engine_.registerSymbol(symbol, -1);
+}
+
+// Queued bytes and `data` go out together in one sendmsg; whatever the
+// kernel does not take is kept until the socket is writable again, up to
+// MAX_OUTPUT_BYTES.
+void TcpServer::send(Connection &conn, std::string_view data) {
+  std::lock_guard<std::mutex> lock(conn.outputMutex);
+  if (conn.closed || conn.overflowed) return;
+
+  iovec iov[2] = {{conn.output.data(), conn.output.size()},
+                  {const_cast<char *>(data.data()), data.size()}};
+  msghdr msg{};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  ssize_t n = 0;
+  do {
+    n = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+
+  size_t written = n > 0 ? static_cast<size_t>(n) : 0;
+  size_t fromQueued = std::min(written, conn.output.size());
+  conn.output.erase(0, fromQueued);
+  conn.output.append(data.substr(written - fromQueued));
+
+  if (conn.output.size() > MAX_OUTPUT_BYTES) cutOff(conn);
+}
+
+// Caller holds conn.outputMutex. Drops the backlog and shuts the socket
+// down; the owning I/O thread finishes the close on the resulting hangup.
+void TcpServer::cutOff(Connection &conn) {
+  conn.overflowed = true;
+  conn.output.clear();
+  conn.output.shrink_to_fit();
+  shutdown(conn.fd, SHUT_RDWR);
+}
+
+// Caller holds conn.outputMutex.
+void TcpServer::flushOutput(Connection &conn) {
+  size_t written = 0;
+  while (written < conn.output.size()) {
+    ssize_t n = ::send(conn.fd, conn.output.data() + written,
+                       conn.output.size() - written, MSG_NOSIGNAL);
+    if (n > 0) {
+      written += static_cast<size_t>(n);
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      break;
+    }
+  }
+  conn.output.erase(0, written);
+}
+
+std::string TcpServer::processRequest(const std::shared_ptr<Connection> &conn,
                                       const std::string &request) {
+  const uint32_t sessionId = conn->sessionId;
   std::stringstream ss(request);
   std::string command;
   ss >> command;
@@ -113,18 +379,68 @@ std::string TcpServer::processRequest(int clientSocket,
 
     OrderSide side = (command == "BUY") ? OrderSide::Buy : OrderSide::Sell;
 
-    static std::atomic<OrderId> nextId{1};
-    OrderId id = nextId++;
+    OrderId id = engine_.nextOrderId();
     uint64_t clientOrderId = 0;
     if (ss.rdbuf()->in_avail() > 0) {
       ss >> clientOrderId;
     }
 
-    int32_t symbolId = engine_.registerSymbol(symbol, -1);
+    int32_t symbolId = resolveSymbol(symbol);
 
     Order order(id, clientOrderId, symbolId, side, OrderType::Limit, price,
                 quantity);
+    order.sessionId = sessionId;
+    order.ownerId = sessionId;
+
+    engine_.submitOrder(order);
+
+    std::stringstream response;
+    response << "ORDER_ACCEPTED_ASYNC " << id << "\n";
+    return response.str();
+
+  } else if (command == "BUY_STOP" || command == "SELL_STOP" ||
+             command == "BUY_STOP_LIMIT" || command == "SELL_STOP_LIMIT") {
+    bool isLimit = command.ends_with("_LIMIT");
+    std::string symbol;
+    Quantity quantity = 0;
+    Price price = 0;
+    Price stopPrice = 0;
+    ss >> symbol >> quantity;
+    if (isLimit) ss >> price;
+    ss >> stopPrice;
 
+    OrderSide side =
+        command.starts_with("BUY") ? OrderSide::Buy : OrderSide::Sell;
+    OrderType type = isLimit ? OrderType::StopLimit : OrderType::Stop;
+
+    OrderId id = engine_.nextOrderId();
+    int32_t symbolId = resolveSymbol(symbol);
+
+    Order order(id, 0, symbolId, side, type, price, quantity, stopPrice);
+    order.sessionId = sessionId;
+    order.ownerId = sessionId;
+    engine_.submitOrder(order);
+
+    std::stringstream response;
+    response << "ORDER_ACCEPTED_ASYNC " << id << "\n";
+    return response.str();
+
+  } else if (command == "BUY_ICEBERG" || command == "SELL_ICEBERG") {
+    std::string symbol;
+    Quantity quantity = 0;
+    Price price = 0;
+    Quantity peak = 0;
+    ss >> symbol >> quantity >> price >> peak;
+
+    OrderSide side =
+        (command == "BUY_ICEBERG") ? OrderSide::Buy : OrderSide::Sell;
+    OrderId id = engine_.nextOrderId();
+    int32_t symbolId = resolveSymbol(symbol);
+
+    Order order(id, 0, symbolId, side, OrderType::Limit, price, quantity);
+    order.peakQuantity = peak;
+    order.sessionId = sessionId;
+    order.ownerId = sessionId;
     engine_.submitOrder(order);
 
     std::stringstream response;
@@ -135,10 +451,34 @@ std::string TcpServer::processRequest(int clientSocket,
     std::string symbol;
     OrderId id = 0;
     ss >> symbol >> id;
-    int32_t symbolId = engine_.registerSymbol(symbol, -1);
-    engine_.cancelOrder(symbolId, id);
+    int32_t symbolId = resolveSymbol(symbol);
+    engine_.cancelOrder(symbolId, id, sessionId);
     return "CANCEL_REQUEST_SENT\n";
 
+  } else if (command == "MODIFY") {
+    std::string symbol;
+    OrderId id = 0;
+    Quantity quantity = 0;
+    Price price = 0;
+    ss >> symbol >> id >> quantity >> price;
+    int32_t symbolId = resolveSymbol(symbol);
+    engine_.modifyOrder(symbolId, id, price, quantity, sessionId);
+    return "MODIFY_REQUEST_SENT\n";
+
+  } else if (command == "MASS_CANCEL") {
+    std::string symbol = "*";
+    std::string sideStr = "BOTH";
+    ss >> symbol >> sideStr;
+
+    int32_t symbolId =
+        (symbol == "*") ? -1 : resolveSymbol(symbol);
+    MassCancelSide side = MassCancelSide::Both;
+    if (sideStr == "BUY") side = MassCancelSide::Buy;
+    if (sideStr == "SELL") side = MassCancelSide::Sell;
+
+    engine_.massCancel(symbolId, sessionId, side);
+    return "MASS_CANCEL_REQUEST_SENT\n";
+
   } else if (command == "PRINT") {
     return "PRINT_REQUESTED_CHECK_SERVER_LOGS\n";
 
@@ -147,68 +487,28 @@ std::string TcpServer::processRequest(int clientSocket,
     ss >> symbol;
     {
       std::lock_guard<std::mutex> lock(subscribersMutex_);
-      subscribers_[symbol].push_back(clientSocket);
+      subscribers_[symbol].push_back(conn);
     }
     return "SUBSCRIBED " + symbol + "\n";
 
   } else if (command == "GET_BOOK") {
     std::string symbol;
     ss >> symbol;
-    int32_t symbolId = engine_.registerSymbol(symbol, -1);
-    const OrderBook *book = engine_.getOrderBook(symbolId);
-    if (!book) {
+    int32_t symbolId = resolveSymbol(symbol);
+    DepthSnapshot depth;
+    if (!engine_.getDepth(symbolId, depth)) {
       return "ERROR_NO_BOOK\n";
     }
 
     std::stringstream response;
     response << "BOOK " << symbol << " BIDS";
-
-    Price p = book->getBestBid();
-    int levels = 0;
-
-    const auto &bidMask = book->getBidMask();
-
-    while (p > 0 && levels < 20) {
-      if (bidMask.test(p)) {
-        const auto &level = book->getLevel(p, OrderSide::Buy);
-        if (level.activeCount > 0) {
-          bool hasActive = false;
-          for (const auto &order : level.orders) {
-            if (order.active && order.quantity > 0) {
-              response << " " << order.price << " " << order.quantity;
-              hasActive = true;
-            }
-          }
-          if (hasActive) levels++;
-        }
-      }
-      p--;
+    for (int i = 0; i < depth.bidLevels; ++i) {
+      response << " " << depth.bids[i].price << " " << depth.bids[i].quantity;
     }
-
     response << " ASKS";
-    p = book->getBestAsk();
-    levels = 0;
-
-    const auto &askMask = book->getAskMask();
-    if (p != -1) {
-      while (p < OrderBook::MAX_PRICE && levels < 20) {
-        if (askMask.test(p)) {
-          const auto &level = book->getLevel(p, OrderSide::Sell);
-          if (level.activeCount > 0) {
-            bool hasActive = false;
-            for (const auto &order : level.orders) {
-              if (order.active && order.quantity > 0) {
-                response << " " << order.price << " " << order.quantity;
-                hasActive = true;
-              }
-            }
-            if (hasActive) levels++;
-          }
-        }
-        p++;
-      }
+    for (int i = 0; i < depth.askLevels; ++i) {
+      response << " " << depth.asks[i].price << " " << depth.asks[i].quantity;
     }
-
     response << "\n";
     return response.str();
   }
@@ -216,27 +516,284 @@ std::string TcpServer::processRequest(int clientSocket,
   return "UNKNOWN_COMMAND\n";
 }
 
-void TcpServer::removeClient(int clientSocket) {
-  std::lock_guard<std::mutex> lock(subscribersMutex_);
-  for (auto &pair : subscribers_) {
-    auto &clients = pair.second;
-    clients.erase(std::remove(clients.begin(), clients.end(), clientSocket),
-                  clients.end());
+namespace {
+void appendReject(std::string &out, BinaryMessageType type,
+                  uint64_t clientOrderId, RejectReason reason) {
+  auto reject = makeMessage<RejectMessage>();
+  reject.clientOrderId = clientOrderId;
+  reject.rejectedType = type;
+  reject.reason = reason;
+  appendMessage(out, reject);
+}
+}  // namespace
+
+// Decodes one framed binary message straight into engine calls; only the
+// symbol lookup, which is off the order path, allocates.
+void TcpServer::processBinaryRequest(const std::shared_ptr<Connection> &conn,
+                                     const char *data,
+                                     const BinaryHeader &header,
+                                     std::string &responses) {
+  const uint32_t sessionId = conn->sessionId;
+
+  switch (header.type) {
+    case BinaryMessageType::NewOrder: {
+      NewOrderMessage msg;
+      if (!decodeMessage(data, header.length, msg)) break;
+      if (!engine_.getOrderBook(msg.symbolId)) {
+        appendReject(responses, header.type, msg.clientOrderId,
+                     RejectReason::UnknownSymbol);
+        return;
+      }
+      Order order;
+      if (!toOrder(msg, engine_.nextOrderId(), order)) {
+        appendReject(responses, header.type, msg.clientOrderId,
+                     RejectReason::BadField);
+        return;
+      }
+      order.sessionId = sessionId;
+      order.ownerId = sessionId;
+      engine_.submitOrder(order);
+
+      auto ack = makeMessage<AckMessage>();
+      ack.clientOrderId = msg.clientOrderId;
+      ack.orderId = order.id;
+      appendMessage(responses, ack);
+      return;
+    }
+    case BinaryMessageType::Cancel: {
+      CancelMessage msg;
+      if (!decodeMessage(data, header.length, msg)) break;
+      if (!engine_.getOrderBook(msg.symbolId)) {
+        appendReject(responses, header.type, 0, RejectReason::UnknownSymbol);
+        return;
+      }
+      engine_.cancelOrder(msg.symbolId, msg.orderId, sessionId);
+      return;
+    }
+    case BinaryMessageType::Modify: {
+      ModifyMessage msg;
+      if (!decodeMessage(data, header.length, msg)) break;
+      if (!engine_.getOrderBook(msg.symbolId)) {
+        appendReject(responses, header.type, 0, RejectReason::UnknownSymbol);
+        return;
+      }
+      engine_.modifyOrder(msg.symbolId, msg.orderId, msg.price, msg.quantity,
+                          sessionId);
+      return;
+    }
+    case BinaryMessageType::SymbolLookup: {
+      SymbolLookupMessage msg;
+      if (!decodeMessage(data, header.length, msg)) break;
+      auto info = makeMessage<SymbolInfoMessage>();
+      std::memcpy(info.symbol, msg.symbol, sizeof(info.symbol));
+      info.symbolId = resolveSymbol(
+          std::string(msg.symbol, strnlen(msg.symbol, sizeof(msg.symbol))));
+      appendMessage(responses, info);
+      return;
+    }
+    default:
+      appendReject(responses, header.type, 0, RejectReason::UnknownMessage);
+      return;
+  }
+  appendReject(responses, header.type, 0, RejectReason::BadLength);
+}
+
+// Runs on the shard worker: copy the batch into the publisher queue and
+// return. If the publisher has fallen a whole queue behind, the batch is
+// dropped (and counted) rather than stalling matching.
+void TcpServer::publishTrades(const std::vector<Trade> &trades) {
+  thread_local std::vector<PublishedTrade> batch;
+  batch.clear();
+  for (const auto &trade : trades) {
+    batch.push_back({trade.price, trade.symbolId, trade.quantity});
+  }
+  if (!tradeQueue_.push_batch(batch.data(), batch.size())) {
+    droppedTrades_ += batch.size();
   }
 }
 
-void TcpServer::broadcastTrade(const std::string &symbol, Price price,
-                               Quantity quantity) {
-  std::lock_guard<std::mutex> lock(subscribersMutex_);
-  if (subscribers_.find(symbol) == subscribers_.end()) {
+namespace {
+template <typename T>
+void appendNumber(std::string &out, T value) {
+  char digits[24];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value);
+  out.append(digits, result.ptr);
+}
+}  // namespace
+
+// Drains trades in batches, encodes each symbol's share of a batch once and
+// hands the same bytes to every subscriber of that symbol.
+void TcpServer::publisherLoop() {
+  constexpr size_t MAX_BATCH = 4096;
+  std::vector<PublishedTrade> batch(MAX_BATCH);
+  std::vector<std::string> symbolNames;
+  std::vector<std::string> encoded;
+  std::vector<int32_t> touched;
+
+  while (running_) {
+    size_t count = tradeQueue_.pop_batch(batch.data(), MAX_BATCH);
+    if (count == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      continue;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      const PublishedTrade &trade = batch[i];
+      auto symbolId = static_cast<size_t>(trade.symbolId);
+      if (symbolId >= symbolNames.size()) {
+        for (size_t id = symbolNames.size(); id <= symbolId; ++id) {
+          symbolNames.push_back(
+              engine_.getSymbolName(static_cast<int32_t>(id)));
+        }
+        encoded.resize(symbolNames.size());
+      }
+      std::string &out = encoded[symbolId];
+      if (out.empty()) touched.push_back(trade.symbolId);
+      out += "TRADE ";
+      out += symbolNames[symbolId];
+      out += ' ';
+      appendNumber(out, trade.price);
+      out += ' ';
+      appendNumber(out, trade.quantity);
+      out += '\n';
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(subscribersMutex_);
+      for (int32_t symbolId : touched) {
+        auto it = subscribers_.find(symbolNames[symbolId]);
+        if (it == subscribers_.end()) continue;
+        for (const auto &conn : it->second) {
+          send(*conn, encoded[symbolId]);
+        }
+      }
+    }
+    for (int32_t symbolId : touched) encoded[symbolId].clear();
+    touched.clear();
+  }
+}
+
+namespace {
+const char *execStatusName(ExecStatus status) {
+  switch (status) {
+    case ExecStatus::New:
+      return "NEW";
+    case ExecStatus::PartiallyFilled:
+      return "PARTIAL_FILL";
+    case ExecStatus::Filled:
+      return "FILL";
+    case ExecStatus::Cancelled:
+      return "CANCELLED";
+    case ExecStatus::Rejected:
+      return "REJECTED";
+    case ExecStatus::CancelRejected:
+      return "CANCEL_REJECTED";
+    case ExecStatus::Replaced:
+      return "REPLACED";
+  }
+  return "UNKNOWN";
+}
+}  // namespace
+
+// Runs on the shard workers: keep only this server's reports and hand them
+// to the reporter thread, which does the formatting. A worker never waits
+// for room: a session whose report does not fit is disconnected instead,
+// like one whose output backlog overflows, rather than left with a gap in
+// its fills.
+void TcpServer::queueReports(const std::vector<ExecutionReport> &reports) {
+  thread_local std::vector<ExecutionReport> batch;
+  batch.clear();
+  {
+    std::lock_guard<std::mutex> lock(reportSessionsMutex_);
+    if (reportSessions_.empty()) return;
+    for (const auto &report : reports) {
+      if (reportSessions_.count(report.sessionId)) batch.push_back(report);
+    }
+  }
+  if (batch.empty() || reportQueue_.push_batch(batch.data(), batch.size())) {
     return;
   }
+  std::lock_guard<std::mutex> lock(reportSessionsMutex_);
+  for (const auto &report : batch) {
+    if (!reportSessions_.count(report.sessionId)) continue;
+    if (!reportQueue_.push(report)) {
+      reportSessions_.erase(report.sessionId);
+      overflowedSessions_.push_back(report.sessionId);
+      overflowPending_.store(true, std::memory_order_release);
+    }
+  }
+}
+
+// Disconnects the sessions queueReports cut off.
+void TcpServer::disconnectOverflowed() {
+  std::vector<uint32_t> overflowed;
+  {
+    std::lock_guard<std::mutex> lock(reportSessionsMutex_);
+    overflowed.swap(overflowedSessions_);
+    overflowPending_.store(false, std::memory_order_relaxed);
+  }
+  std::lock_guard<std::mutex> lock(sessionsMutex_);
+  for (uint32_t sessionId : overflowed) {
+    auto it = sessions_.find(sessionId);
+    if (it == sessions_.end()) continue;
+    Connection &conn = *it->second;
+    std::lock_guard<std::mutex> outputLock(conn.outputMutex);
+    if (!conn.closed && !conn.overflowed) cutOff(conn);
+  }
+}
 
-  std::stringstream ss;
-  ss << "TRADE " << symbol << " " << price << " " << quantity << "\n";
-  std::string msg = ss.str();
+// Drains reports in batches. Reports are grouped per session so each
+// connection gets one write per batch.
+void TcpServer::reporterLoop() {
+  constexpr size_t MAX_BATCH = 4096;
+  std::vector<ExecutionReport> batch(MAX_BATCH);
+  std::unordered_map<uint32_t, std::string> outgoing;
 
-  for (int clientSocket : subscribers_[symbol]) {
-    write(clientSocket, msg.c_str(), msg.length());
+  while (running_) {
+    size_t count = reportQueue_.pop_batch(batch.data(), MAX_BATCH);
+    if (overflowPending_.load(std::memory_order_acquire)) {
+      disconnectOverflowed();
+    }
+    if (count == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(sessionsMutex_);
+    for (size_t i = 0; i < count; ++i) {
+      const ExecutionReport &report = batch[i];
+      auto it = sessions_.find(report.sessionId);
+      if (it == sessions_.end()) continue;
+      std::string &out = outgoing[report.sessionId];
+
+      if (it->second->protocol == Connection::Protocol::Binary) {
+        appendMessage(out, toExecReportMessage(report));
+        continue;
+      }
+
+      out += "EXEC ";
+      appendNumber(out, report.orderId);
+      out += ' ';
+      appendNumber(out, report.clientOrderId);
+      out += ' ';
+      out += execStatusName(report.status);
+      out += ' ';
+      appendNumber(out, report.lastQuantity);
+      out += ' ';
+      appendNumber(out, report.lastPrice);
+      out += ' ';
+      appendNumber(out, report.leavesQuantity);
+      out += ' ';
+      appendNumber(out, report.cumQuantity);
+      out += '\n';
+    }
+    for (auto &[sessionId, out] : outgoing) {
+      if (out.empty()) continue;
+      auto it = sessions_.find(sessionId);
+      if (it != sessions_.end()) send(*it->second, out);
+      out.clear();
+    }
+    // Sessions come and go; do not keep a buffer for every one ever seen.
+    if (outgoing.size() > 4 * sessions_.size() + 64) outgoing.clear();
   }
 }
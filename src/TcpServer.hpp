@@ -1,35 +1,148 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "Exchange.hpp"
+#include "Framing.hpp"
+#include "IoBackend.hpp"
+#include "Protocol.hpp"
+#include "RingBuffer.hpp"
 
 class TcpServer {
  public:
-  TcpServer(Exchange &engine, int port);
+  static constexpr size_t REPORT_QUEUE_CAPACITY = 65536;
+
+  TcpServer(Exchange &engine, int port, int numIoThreads = 1,
+            IoBackendType backend = IoBackendType::Epoll,
+            size_t reportQueueCapacity = REPORT_QUEUE_CAPACITY);
   ~TcpServer();
 
+  TcpServer(const TcpServer &) = delete;
+  TcpServer &operator=(const TcpServer &) = delete;
+
   bool start();
   void stop();
 
+  // Bound port; differs from the constructor argument when that was 0.
+  int port() const { return port_; }
+  // Backend the I/O threads run on once started: a requested io_uring may
+  // have fallen back to epoll.
+  IoBackendType backendType() const {
+    return ioThreads_.empty() || !ioThreads_[0]->backend
+               ? backendType_
+               : ioThreads_[0]->backend->type();
+  }
+
  private:
+  static constexpr size_t MAX_INPUT_BYTES = 64 * 1024;
+  // A session whose unsent backlog passes this is a slow consumer and gets
+  // disconnected rather than buffered without bound.
+  static constexpr size_t MAX_OUTPUT_BYTES = 4 * 1024 * 1024;
+
+  // Only the owning I/O thread reads from the socket. Any thread may queue
+  // output through send(); bytes the kernel does not take immediately wait
+  // in `output` until the backend reports the socket writable.
+  struct Connection {
+    enum class Protocol : uint8_t { Unknown, Text, Binary };
+
+    int fd = -1;
+    uint32_t sessionId = 0;
+    // Settled by the first byte received, before any order can produce a
+    // report, so the worker threads only ever read the final value.
+    Protocol protocol = Protocol::Unknown;
+    InputBuffer input{MAX_INPUT_BYTES};
+
+    std::mutex outputMutex;
+    std::string output;
+    bool closed = false;
+    // Set once the backlog overflowed; the socket is shut down and the
+    // owning I/O thread finishes the close on the resulting hangup.
+    bool overflowed = false;
+  };
+
+  // Trades handed from the shard workers to the publisher thread.
+  struct PublishedTrade {
+    Price price;
+    int32_t symbolId;
+    Quantity quantity;
+  };
+
+  // An event loop over a subset of the connections.
+  struct IoThread {
+    std::unique_ptr<IoBackend> backend;
+    std::mutex connectionsMutex;
+    std::unordered_map<int, std::shared_ptr<Connection>> connections;
+    std::jthread thread;
+  };
+
   void acceptLoop();
-  void handleClient(int clientSocket);
-  std::string processRequest(int clientSocket, const std::string &request);
-  void removeClient(int clientSocket);
-  void broadcastTrade(const std::string &symbol, Price price,
-                      Quantity quantity);
+  void acceptConnection(int clientSocket);
+  void ioLoop(IoThread &io);
+  bool handleEvent(IoThread &io, const IoBackend::Event &event);
+  bool receive(const std::shared_ptr<Connection> &conn, std::string_view data);
+  bool processInput(const std::shared_ptr<Connection> &conn,
+                    std::string &responses);
+  void closeConnection(IoThread &io, const std::shared_ptr<Connection> &conn);
+  std::string processRequest(const std::shared_ptr<Connection> &conn,
+                             const std::string &request);
+  void processBinaryRequest(const std::shared_ptr<Connection> &conn,
+                            const char *data, const BinaryHeader &header,
+                            std::string &responses);
+  int32_t resolveSymbol(const std::string &symbol);
+
+  static void send(Connection &conn, std::string_view data);
+  static void flushOutput(Connection &conn);
+  static void cutOff(Connection &conn);
+
+  void publishTrades(const std::vector<Trade> &trades);
+  void publisherLoop();
+  void queueReports(const std::vector<ExecutionReport> &reports);
+  void reporterLoop();
+  void disconnectOverflowed();
 
   Exchange &engine_;
+  Exchange::CallbackHandle tradeListener_;
+  Exchange::CallbackHandle reportListener_;
   int port_;
   int serverSocket_;
+  IoBackendType backendType_;
+  std::unique_ptr<IoBackend> acceptBackend_;
   std::atomic<bool> running_;
   std::jthread acceptThread_;
-  std::vector<std::jthread> clientThreads_;
+
+  std::vector<std::unique_ptr<IoThread>> ioThreads_;
+  size_t nextIoThread_ = 0;
+
+  RingBuffer<PublishedTrade> tradeQueue_{65536};
+  std::atomic<uint64_t> droppedTrades_{0};
+  std::jthread publisherThread_;
+
+  // Execution reports handed from the shard workers to the reporter thread.
+  RingBuffer<ExecutionReport> reportQueue_;
+  std::jthread reporterThread_;
 
   std::mutex subscribersMutex_;
-  std::unordered_map<std::string, std::vector<int>> subscribers_;
+  std::unordered_map<std::string, std::vector<std::shared_ptr<Connection>>>
+      subscribers_;
+
+  std::mutex sessionsMutex_;
+  std::unordered_map<uint32_t, std::shared_ptr<Connection>> sessions_;
+
+  // Ids of the sessions in sessions_, read by the workers to pick out this
+  // server's reports. Kept apart so a worker never waits on sessionsMutex_,
+  // which the reporter holds while it writes.
+  std::mutex reportSessionsMutex_;
+  std::unordered_set<uint32_t> reportSessions_;
+  // Sessions whose reports overflowed reportQueue_, for the reporter thread
+  // to disconnect.
+  std::vector<uint32_t> overflowedSessions_;
+  std::atomic<bool> overflowPending_{false};
 };
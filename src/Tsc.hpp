@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <x86intrin.h>
+#endif
+
+// Cycle-counter timestamps for latency measurement: a register read, where
+// steady_clock can cost tens of nanoseconds. Counts taken on different
+// cores are comparable on x86 with an invariant TSC and on ARM's generic
+// timer; other targets fall back to steady_clock nanoseconds.
+inline uint64_t tscNow() {
+#if defined(__x86_64__) || defined(_M_X64)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#else
+  return static_cast<uint64_t>(
+      std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// Nanoseconds per tscNow() tick, measured against steady_clock over 10ms
+// the first time it is called.
+inline double tscNanosPerTick() {
+  static const double ratio = [] {
+    using namespace std::chrono;
+    const auto start = steady_clock::now();
+    const uint64_t first = tscNow();
+    std::this_thread::sleep_for(milliseconds(10));
+    const uint64_t last = tscNow();
+    const duration<double, std::nano> elapsed = steady_clock::now() - start;
+    return last > first ? elapsed.count() / static_cast<double>(last - first)
+                        : 1.0;
+  }();
+  return ratio;
+}
+
+inline uint64_t tscToNanos(uint64_t ticks) {
+  return static_cast<uint64_t>(static_cast<double>(ticks) * tscNanosPerTick());
+}
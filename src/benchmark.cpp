@@ -1,21 +1,23 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
-#include <fstream>
+#include <cstdio>
+#include <iomanip>
 #include <iostream>
 #include <memory>
-#include <numeric>
+#include <mutex>
 #include <random>
 #include <sstream>
 #include <thread>
 #include <vector>
 
 #include "Exchange.hpp"
+#include "Journal.hpp"
+#include "LatencyHistogram.hpp"
+#include "Protocol.hpp"
+#include "ReplayFile.hpp"
 
 namespace {
-static std::unique_ptr<std::atomic<int64_t>[]> submissionTimes;
-static std::vector<long long> latencies;
-static std::atomic<size_t> latencyIndex{0};
 static bool measureLatency = false;
 
 void pinThreadWithOffset(int threadId) {
@@ -32,11 +34,6 @@ void benchmarkWorker(Exchange &engine, const std::vector<Order> &orders,
 
   for (int i = 0; i < iterations; ++i) {
     for (const auto &order : orders) {
-      if (measureLatency) {
-        submissionTimes[order.id].store(
-            std::chrono::steady_clock::now().time_since_epoch().count(),
-            std::memory_order_relaxed);
-      }
       engine.submitOrder(order, threadId);
     }
   }
@@ -96,13 +93,28 @@ void runVerification() {
   long long trades = totalTrades.load();
   long long vol = totalVolume.load();
 
+  // The same flow through a second engine has to end in the same state.
+  std::vector<Exchange::ShardDigest> digest = engine.digest();
+  Exchange rerun(numThreads);
+  rerun.registerSymbol(SYMBOL, 0);
+  benchmarkWorker(rerun, buyOrders, 0, 1);
+  benchmarkWorker(rerun, sellOrders, 0, 1);
+  bool deterministic = rerun.digest() == digest;
+
   std::cout << "Verification Results:\n";
   std::cout << "  Expected Trades: " << ORDER_COUNT << "\n";
   std::cout << "  Actual Trades:   " << trades << "\n";
   std::cout << "  Expected Volume: " << ORDER_COUNT << "\n";
   std::cout << "  Actual Volume:   " << vol << "\n";
+  for (size_t s = 0; s < digest.size(); ++s) {
+    std::cout << "  Shard " << s << " digest: trades " << digest[s].tradeCount
+              << std::hex << ", trade hash " << digest[s].tradeHash
+              << ", book hash " << digest[s].bookHash << std::dec << "\n";
+  }
+  std::cout << "  Rerun digest:    " << (deterministic ? "match" : "MISMATCH")
+            << "\n";
 
-  if (trades == ORDER_COUNT && vol == ORDER_COUNT) {
+  if (trades == ORDER_COUNT && vol == ORDER_COUNT && deterministic) {
     std::cout << "[PASS] Verification Successful!\n";
   } else {
     std::cout << "[FAIL] Verification Failed!\n";
@@ -111,93 +123,808 @@ void runVerification() {
 }
 }  // namespace
 
-std::vector<std::string> splitString(const std::string &s, char delimiter) {
-  std::vector<std::string> tokens;
-  std::string token;
-  std::istringstream tokenStream(s);
-  while (std::getline(tokenStream, token, delimiter)) {
-    tokens.push_back(token);
+struct ReplayOptions {
+  int threads = 1;
+  int shards = 1;
+  // Multiple of the recorded pace; 0 replays as fast as possible.
+  double speed = 0;
+  // Has the engine report every order, which costs full-speed throughput.
+  bool latency = false;
+};
+
+// Sleeps most of the way to `due`, then spins the rest.
+void waitUntil(std::chrono::steady_clock::time_point due) {
+  using namespace std::chrono;
+  auto now = steady_clock::now();
+  if (due - now > microseconds(200)) {
+    std::this_thread::sleep_for(due - now - microseconds(100));
+  }
+  while (steady_clock::now() < due) {
   }
-  return tokens;
 }
 
-std::vector<Order> readCsv(const std::string &filename, int32_t symbolId) {
-  std::vector<Order> orders;
-  std::ifstream file(filename);
-  if (!file.is_open()) {
-    std::cerr << "Failed to open file: " << filename << "\n";
-    return orders;
+// Feeds one thread's share of the capture, `iterations` times. With
+// options.speed > 0, each record waits for its recorded offset from the
+// first, scaled by the speed, and is stamped with that intended time;
+// otherwise records go out back to back, stamped as they are submitted.
+void replayWorker(Exchange &engine, const ReplayRecord *records,
+                  const std::vector<uint32_t> &mine,
+                  const std::vector<int32_t> &symbolIds,
+                  const ReplayOptions &options, int threadId, int iterations,
+                  const std::atomic<bool> &go,
+                  const std::chrono::steady_clock::time_point &start,
+                  std::vector<std::atomic<int64_t>> &sentAt) {
+  pinThreadWithOffset(threadId);
+  while (!go.load(std::memory_order_acquire)) {
   }
+  const uint64_t firstTimestamp = records[0].timestamp;
 
-  std::string line;
-  // Skip header
-  std::getline(file, line);
-
-  OrderId nextId = 1;
-  while (std::getline(file, line)) {
-    if (line.empty()) continue;
-    auto tokens = splitString(line, ',');
-    if (tokens.size() < 5) continue;
-
-    std::string typeStr = tokens[1];
-    std::string sideStr = tokens[2];
-    double priceFloat = std::stod(tokens[3]);
-    double qtyFloat = std::stod(tokens[4]);
-
-    Price price = static_cast<Price>(priceFloat * 100.0);
-    Quantity qty = static_cast<Quantity>(qtyFloat * 10000.0);
-    if (qty == 0) qty = 1;
-
-    OrderSide side = (sideStr == "B") ? OrderSide::Buy : OrderSide::Sell;
-    OrderType type = OrderType::Limit;
-
-    if (typeStr == "C") continue;
+  for (int i = 0; i < iterations; ++i) {
+    for (uint32_t index : mine) {
+      const ReplayRecord &record = records[index];
+      const int32_t symbolId = symbolIds[record.symbol];
+      std::chrono::steady_clock::time_point stamp;
+      if (options.latency || options.speed > 0) {
+        stamp = std::chrono::steady_clock::now();
+      }
+      if (options.speed > 0) {
+        uint64_t offsetMs = record.timestamp > firstTimestamp
+                                ? record.timestamp - firstTimestamp
+                                : 0;
+        auto due = start + std::chrono::nanoseconds(static_cast<int64_t>(
+                               static_cast<double>(offsetMs) * 1e6 /
+                               options.speed));
+        if (stamp < due) {
+          // The burst so far goes out before the gap.
+          engine.flush();
+          waitUntil(due);
+        }
+        stamp = due;
+      }
 
-    orders.emplace_back(nextId++, 0, symbolId, side, type, price, qty);
+      if (record.action == ReplayAction::Add) {
+        Order order(record.orderId, 0, symbolId, record.side,
+                    OrderType::Limit, record.price, record.quantity);
+        if (options.latency) {
+          sentAt[record.orderId].store(stamp.time_since_epoch().count(),
+                                       std::memory_order_relaxed);
+          // Any session id, so the engine reports the order.
+          order.sessionId = 1;
+        }
+        engine.submitOrder(order);
+      } else {
+        engine.cancelOrder(symbolId, record.orderId);
+      }
+    }
   }
+  engine.drain();
+}
 
-  std::cout << "Loaded " << orders.size() << " orders from " << filename
-            << "\n";
-  return orders;
+// Converts a CSV capture to the binary replay format once, so later
+// replays skip the parse.
+int runConvert(const std::string &csvPath, const std::string &outPath) {
+  ReplayCapture capture;
+  if (!readReplayCsv(csvPath, capture)) return 1;
+  if (!writeReplayFile(outPath, capture)) {
+    std::cerr << "Failed to write " << outPath << "\n";
+    return 1;
+  }
+  std::cout << "Wrote " << capture.records.size() << " records for "
+            << capture.symbols.size() << " symbols to " << outPath << "\n";
+  return 0;
 }
 
-void runReplay(const std::string &filename) {
+// Replays a capture with its symbols spread over `options.shards` workers
+// and fed by `options.threads` threads, each owning whole symbols so every
+// symbol keeps its recorded order. With options.latency, latency runs
+// from a record's submission (or, when paced, its intended send time) to
+// the engine's first report of the order.
+void runReplay(const std::string &filename, const ReplayOptions &options) {
   std::cout << "=== Running Replay Mode ===\n";
   std::cout << "Loading market data from " << filename << "...\n";
 
-  int numThreads = 1;
-  Exchange engine(numThreads);
-  int32_t symbolId = engine.registerSymbol("REPLAY", 0);
-
-  auto orders = readCsv(filename, symbolId);
-  if (orders.empty()) {
+  // A binary capture is mapped as is; a CSV one is parsed first.
+  auto loadStart = std::chrono::steady_clock::now();
+  ReplayFile mapped;
+  ReplayCapture parsed;
+  const ReplayRecord *records = nullptr;
+  size_t count = 0;
+  std::vector<std::string> symbols;
+  if (isReplayFile(filename)) {
+    std::string error;
+    if (!mapped.open(filename, error)) {
+      std::cerr << error << "\n";
+      return;
+    }
+    records = mapped.records();
+    count = mapped.size();
+    symbols = mapped.symbols();
+  } else if (readReplayCsv(filename, parsed)) {
+    records = parsed.records.data();
+    count = parsed.records.size();
+    symbols = parsed.symbols;
+  }
+  std::chrono::duration<double> loadTime =
+      std::chrono::steady_clock::now() - loadStart;
+  if (count == 0) {
     std::cerr << "No orders loaded. Exiting.\n";
     return;
   }
 
-  std::cout << "Starting replay of " << orders.size() << " orders...\n";
-
-  int iterations = 10000000 / std::max(1, (int)orders.size());
-  if (iterations < 1) iterations = 1;
-
-  std::cout << "Replaying dataset " << iterations << " times ("
-            << (orders.size() * iterations) << " total ops)...\n";
+  Exchange engine(options.shards,
+                  std::max(Exchange::DEFAULT_MAX_SYMBOLS,
+                           static_cast<int>(symbols.size())));
+  std::vector<int32_t> symbolIds;
+  for (const std::string &symbol : symbols) {
+    symbolIds.push_back(engine.registerSymbol(symbol, -1));
+  }
 
-  auto start = std::chrono::steady_clock::now();
+  const int threads = std::max(
+      1, std::min(options.threads, static_cast<int>(symbols.size())));
+  std::vector<std::vector<uint32_t>> perThread(threads);
+  size_t cancels = 0;
+  OrderId maxOrderId = 0;
+  for (size_t i = 0; i < count; ++i) {
+    perThread[records[i].symbol % threads].push_back(
+        static_cast<uint32_t>(i));
+    if (records[i].action == ReplayAction::Cancel) ++cancels;
+    maxOrderId = std::max(maxOrderId, records[i].orderId);
+  }
+  const double captureSeconds =
+      static_cast<double>(records[count - 1].timestamp -
+                          std::min(records[0].timestamp,
+                                   records[count - 1].timestamp)) /
+      1000.0;
+  std::cout << "Loaded " << count - cancels << " orders and " << cancels
+            << " cancels over " << symbols.size() << " symbols ("
+            << captureSeconds << " s recorded) in "
+            << loadTime.count() * 1000 << " ms\n";
+
+  std::vector<std::atomic<int64_t>> sentAt(options.latency ? maxOrderId + 1
+                                                          : 0);
+  std::mutex latencyMutex;
+  LatencyHistogram replayLatency;
+  if (options.latency) {
+    engine.setExecutionReportCallback(
+        [&](const std::vector<ExecutionReport> &reports) {
+          int64_t now =
+              std::chrono::steady_clock::now().time_since_epoch().count();
+          std::lock_guard<std::mutex> lock(latencyMutex);
+          for (const auto &report : reports) {
+            if (report.orderId >= sentAt.size()) continue;
+            int64_t sent = sentAt[report.orderId].exchange(
+                0, std::memory_order_relaxed);
+            if (sent != 0) replayLatency.record(now - sent);
+          }
+        });
+  }
 
-  benchmarkWorker(engine, orders, 0, iterations);
+  int iterations = 1;
+  if (options.speed > 0) {
+    std::cout << "Replaying at " << options.speed << "x the recorded pace";
+  } else {
+    iterations = std::max(1, 10000000 / static_cast<int>(count));
+    std::cout << "Replaying dataset " << iterations << " times at full speed";
+  }
+  std::cout << " on " << threads << " threads and " << options.shards
+            << " shards (" << (count * iterations) << " total ops)...\n";
 
+  std::atomic<bool> go{false};
+  std::chrono::steady_clock::time_point start;
+  {
+    std::vector<std::jthread> feeders;
+    for (int t = 0; t < threads; ++t) {
+      feeders.emplace_back(replayWorker, std::ref(engine), records,
+                           std::cref(perThread[t]), std::cref(symbolIds),
+                           std::cref(options), t, iterations, std::cref(go),
+                           std::cref(start), std::ref(sentAt));
+    }
+    start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+  }
   auto end = std::chrono::steady_clock::now();
   std::chrono::duration<double> diff = end - start;
+  // Reports of the last batches may still be on their way.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
 
-  long long totalOps = (long long)orders.size() * iterations;
+  long long totalOps = static_cast<long long>(count) * iterations;
   long long tput =
       static_cast<long long>(static_cast<double>(totalOps) / diff.count());
 
   std::cout << "Replay Complete:\n";
   std::cout << "  Time: " << diff.count() << "s\n";
   std::cout << "  Total Ops: " << totalOps << "\n";
-  std::cout << "  Throughput: " << tput << " orders/sec\n";
+  std::cout << "  Throughput: " << tput << " ops/sec\n";
+
+  std::lock_guard<std::mutex> lock(latencyMutex);
+  if (replayLatency.count() == 0) return;
+  std::cout << "  Order -> first report latency (ns): "
+            << replayLatency.summary() << "\n";
+}
+
+struct OpenLoopOptions {
+  // Target message rates, one step each; the sweep stops at the first step
+  // the engine cannot keep up with.
+  std::vector<double> rates = {1e5, 2.5e5, 5e5, 1e6, 2e6, 4e6, 8e6};
+  double seconds = 2;  // Per step.
+  int symbols = 2;
+  int shards = 1;
+};
+
+// Order-entry traffic shaped like an exchange's: mostly cancels and
+// passive adds near a mid that random-walks, a few marketable orders and
+// modifies. Each symbol keeps the ids it has resting to cancel and modify.
+class OrderFlow {
+ public:
+  struct Message {
+    enum Kind : uint8_t { Add, Cancel, Modify } kind;
+    Order order;  // Add: the order. Cancel/Modify: id, symbol, price, size.
+  };
+
+  OrderFlow(const std::vector<int32_t> &symbolIds, unsigned seed)
+      : symbolIds_(symbolIds),
+        mids_(symbolIds.size(), 10000),
+        live_(symbolIds.size()),
+        gen_(seed) {}
+
+  Message next() {
+    const size_t s = gen_() % symbolIds_.size();
+    if (moveMid_(gen_)) {
+      mids_[s] = std::clamp<Price>(mids_[s] + (coin_(gen_) ? 1 : -1), 1000,
+                                   OrderBook::MAX_PRICE - 1000);
+    }
+    auto &live = live_[s];
+    const int roll = percent_(gen_);
+    Message msg{};
+    if (!live.empty() && (roll < CANCEL_PERCENT || live.size() >= MAX_LIVE)) {
+      // Orders that have since filled are cancelled anyway, as real
+      // clients racing the market do; the engine rejects those.
+      const size_t pick = gen_() % live.size();
+      msg.kind = Message::Cancel;
+      msg.order.id = live[pick].id;
+      msg.order.symbolId = symbolIds_[s];
+      live[pick] = live.back();
+      live.pop_back();
+    } else if (!live.empty() && roll < CANCEL_PERCENT + MODIFY_PERCENT) {
+      const Resting &resting = live[gen_() % live.size()];
+      msg.kind = Message::Modify;
+      msg.order.id = resting.id;
+      msg.order.symbolId = symbolIds_[s];
+      msg.order.price = passivePrice(s, resting.side);
+      msg.order.quantity = quantity();
+    } else {
+      const OrderSide side = coin_(gen_) ? OrderSide::Buy : OrderSide::Sell;
+      const bool marketable = percent_(gen_) < MARKETABLE_PERCENT;
+      const Price price =
+          marketable ? mids_[s] + (side == OrderSide::Buy ? 1 : -1) *
+                                      static_cast<Price>(1 + gen_() % 3)
+                     : passivePrice(s, side);
+      msg.kind = Message::Add;
+      msg.order = Order(nextId_++, 0, symbolIds_[s], side, OrderType::Limit,
+                        price, quantity());
+      // Any session id, so the engine reports the order.
+      msg.order.sessionId = 1;
+      if (!marketable) live.push_back({msg.order.id, side});
+    }
+    return msg;
+  }
+
+ private:
+  static constexpr int CANCEL_PERCENT = 35;
+  static constexpr int MODIFY_PERCENT = 10;
+  static constexpr int MARKETABLE_PERCENT = 10;
+  static constexpr size_t MAX_LIVE = 50000;
+
+  struct Resting {
+    OrderId id;
+    OrderSide side;
+  };
+
+  // Most passive orders join or sit just behind the touch.
+  Price passivePrice(size_t s, OrderSide side) {
+    const auto depth = static_cast<Price>(depth_(gen_));
+    return side == OrderSide::Buy ? mids_[s] - 1 - depth : mids_[s] + 1 + depth;
+  }
+  Quantity quantity() { return 1 + static_cast<Quantity>(size_(gen_)); }
+
+  std::vector<int32_t> symbolIds_;
+  std::vector<Price> mids_;
+  std::vector<std::vector<Resting>> live_;
+  OrderId nextId_ = 1;
+  std::mt19937_64 gen_;
+  std::uniform_int_distribution<int> percent_{0, 99};
+  std::bernoulli_distribution coin_{0.5};
+  std::bernoulli_distribution moveMid_{0.01};
+  std::geometric_distribution<int> depth_{0.25};
+  std::geometric_distribution<int> size_{0.05};
+};
+
+// Open-loop load: each step sends messages on a fixed schedule at the
+// target rate, whether or not the engine has caught up, and measures each
+// add from its intended send time to the engine's first report of it. A
+// sender that falls behind sends late messages at once but keeps their
+// intended times, so queueing delay counts against the engine rather than
+// silently lowering the offered rate (coordinated omission). Cancels and
+// modifies are load only.
+void runOpenLoop(const OpenLoopOptions &options) {
+  std::cout << "=== Running Open-Loop Latency Sweep ===\n";
+  Exchange engine(options.shards,
+                  std::max(Exchange::DEFAULT_MAX_SYMBOLS, options.symbols));
+  std::vector<int32_t> symbolIds;
+  for (int s = 0; s < options.symbols; ++s) {
+    symbolIds.push_back(engine.registerSymbol("OPEN-" + std::to_string(s),
+                                              s % options.shards));
+  }
+
+  // Intended send times by order id, in a ring: an order's first report
+  // comes long before its slot is reused.
+  constexpr size_t SLOTS = 1 << 22;
+  std::vector<std::atomic<int64_t>> intendedAt(SLOTS);
+  std::mutex latencyMutex;
+  LatencyHistogram latency;
+  engine.setExecutionReportCallback(
+      [&](const std::vector<ExecutionReport> &reports) {
+        int64_t now =
+            std::chrono::steady_clock::now().time_since_epoch().count();
+        std::lock_guard<std::mutex> lock(latencyMutex);
+        for (const auto &report : reports) {
+          int64_t intended = intendedAt[report.orderId & (SLOTS - 1)].exchange(
+              0, std::memory_order_relaxed);
+          if (intended != 0) {
+            latency.record(static_cast<uint64_t>(now - intended));
+          }
+        }
+      });
+
+  std::cout << "Sending " << options.seconds << " s per step over "
+            << options.symbols << " symbols and " << options.shards
+            << " shards; latency (ns) from intended send time to first "
+               "report of each add\n";
+  std::cout << std::setw(12) << "target/s" << std::setw(12) << "sent/s"
+            << std::setw(10) << "p50" << std::setw(10) << "p90"
+            << std::setw(10) << "p99" << std::setw(10) << "p99.9"
+            << std::setw(10) << "p99.99" << std::setw(12) << "max" << "\n";
+
+  OrderFlow flow(symbolIds, 42);
+  for (double rate : options.rates) {
+    const auto messages = static_cast<uint64_t>(rate * options.seconds);
+    const double periodNs = 1e9 / rate;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < messages; ++i) {
+      OrderFlow::Message msg = flow.next();
+      const auto due =
+          start + std::chrono::nanoseconds(
+                      static_cast<int64_t>(static_cast<double>(i) * periodNs));
+      if (std::chrono::steady_clock::now() < due) {
+        // What is batched goes out before the gap.
+        engine.flush();
+        waitUntil(due);
+      }
+      const Order &order = msg.order;
+      if (msg.kind == OrderFlow::Message::Add) {
+        intendedAt[order.id & (SLOTS - 1)].store(
+            due.time_since_epoch().count(), std::memory_order_relaxed);
+        engine.submitOrder(order);
+      } else if (msg.kind == OrderFlow::Message::Cancel) {
+        engine.cancelOrder(order.symbolId, order.id);
+      } else {
+        engine.modifyOrder(order.symbolId, order.id, order.price,
+                           order.quantity);
+      }
+    }
+    engine.drain();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    // Reports of the last batches may still be on their way.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    const double sent = static_cast<double>(messages) / elapsed.count();
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    std::cout << std::setw(12) << static_cast<long long>(rate) << std::setw(12)
+              << static_cast<long long>(sent);
+    for (double p : {50.0, 90.0, 99.0, 99.9, 99.99}) {
+      std::cout << std::setw(10) << latency.percentile(p);
+    }
+    std::cout << std::setw(12) << latency.max() << "\n";
+    latency.reset();
+    if (sent < rate * 0.95) {
+      std::cout << "Saturated: the engine kept up with "
+                << static_cast<long long>(sent) << " of "
+                << static_cast<long long>(rate) << " messages/s.\n";
+      break;
+    }
+  }
+}
+
+void runIcebergBenchmark() {
+  std::cout << "=== Running Iceberg Benchmark ===\n";
+
+  int numThreads = std::max(1, static_cast<int>(
+                                   std::thread::hardware_concurrency()) /
+                                   2);
+  const long long poolSize = 200000;
+  const int iterations = 25;
+  const int runs = 5;
+
+  std::vector<std::vector<Order>> threadOrders(numThreads);
+  long long icebergCount = 0;
+  for (int i = 0; i < numThreads; ++i) {
+    threadOrders[i].reserve(static_cast<size_t>(poolSize));
+    std::mt19937 gen(i);
+    std::uniform_int_distribution<long long> priceDist(10000, 10020);
+    std::uniform_int_distribution<> qtyDist(1, 100);
+    std::uniform_int_distribution<> sideDist(0, 1);
+    std::uniform_int_distribution<> icebergDist(0, 4);
+
+    for (long long j = 0; j < poolSize; ++j) {
+      OrderSide side = (sideDist(gen) == 0) ? OrderSide::Buy : OrderSide::Sell;
+      Order order(static_cast<OrderId>((i * poolSize) + j + 1), 0, i,
+                  side, OrderType::Limit,
+                  static_cast<Price>(priceDist(gen)),
+                  static_cast<Quantity>(qtyDist(gen)));
+      // Same size distribution for every order, so one order in five being
+      // an iceberg puts ~20% of the volume behind a peak of a tenth.
+      if (icebergDist(gen) == 0) {
+        order.peakQuantity = std::max<Quantity>(1, order.quantity / 10);
+        icebergCount++;
+      }
+      threadOrders[i].push_back(order);
+    }
+  }
+
+  long long totalOrders =
+      static_cast<long long>(numThreads) * poolSize * iterations;
+  std::cout << "Iceberg orders: " << icebergCount << " of "
+            << (numThreads * poolSize) << " per pass\n";
+
+  Exchange engine(numThreads);
+  for (int s = 0; s < numThreads; ++s) {
+    engine.registerSymbol("SYM-" + std::to_string(s), s);
+  }
+
+  std::atomic<long long> totalTrades{0};
+  engine.setTradeCallback([&](const std::vector<Trade> &trades) {
+    totalTrades.fetch_add(static_cast<long long>(trades.size()),
+                          std::memory_order_relaxed);
+  });
+
+  for (int run = 0; run < runs; ++run) {
+    if (run > 0) engine.reset();
+    totalTrades = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+      std::vector<std::jthread> threads;
+      threads.reserve(numThreads);
+      for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back(benchmarkWorker, std::ref(engine),
+                             std::cref(threadOrders[i]), i, iterations,
+                             nullptr);
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> diff = end - start;
+
+    std::cout << "Run " << (run + 1) << ": " << diff.count()
+              << " seconds. Throughput: "
+              << static_cast<long long>(static_cast<double>(totalOrders) /
+                                        diff.count())
+              << " orders/second, Trades: " << totalTrades.load() << "\n";
+  }
+}
+
+void runProRataBenchmark() {
+  std::cout << "=== Running Level Allocation Benchmark ===\n";
+
+  OrderBook book;
+  StandardMatchingStrategy priceTime;
+  ProRataMatchingStrategy proRata;
+  PriceTimeProRataMatchingStrategy priceTimeProRata;
+  const std::pair<const char *, MatchingStrategy *> strategies[] = {
+      {"PriceTime", &priceTime},
+      {"ProRata", &proRata},
+      {"PriceTimeProRata", &priceTimeProRata}};
+
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<> qtyDist(1, 100);
+  std::vector<Trade> trades;
+  OrderId nextId = 1;
+  // Each repetition builds a fresh level one tick below the last, so the
+  // leftovers of earlier repetitions never cross the next aggressor.
+  Price price = OrderBook::MAX_PRICE - 1;
+
+  for (int levelSize : {10, 1000, 100000}) {
+    int reps = std::max(5, 100000 / levelSize);
+    for (const auto &[name, strategy] : strategies) {
+      std::chrono::nanoseconds elapsed{0};
+      size_t fills = 0;
+
+      for (int r = 0; r < reps; ++r, --price) {
+        Quantity levelTotal = 0;
+        for (int k = 0; k < levelSize; ++k) {
+          Order resting(nextId++, 0, 0, OrderSide::Sell, OrderType::Limit,
+                        price, static_cast<Quantity>(qtyDist(gen)));
+          levelTotal += resting.quantity;
+          strategy->match(book, resting, trades);
+        }
+        Order aggressor(nextId++, 0, 0, OrderSide::Buy, OrderType::Limit,
+                        price, levelTotal / 2);
+
+        trades.clear();
+        auto start = std::chrono::steady_clock::now();
+        strategy->match(book, aggressor, trades);
+        elapsed += std::chrono::steady_clock::now() - start;
+        fills += trades.size();
+      }
+
+      double perMatch =
+          static_cast<double>(elapsed.count()) / static_cast<double>(reps);
+      std::cout << "  Level " << levelSize << " " << name << ": " << perMatch
+                << " ns/match, " << (perMatch / levelSize)
+                << " ns/resting order, " << (fills / reps) << " fills\n";
+    }
+  }
+}
+
+// Decode cost per order for the two gateway protocols: the text path as
+// TcpServer parses a BUY/SELL line, and the binary path from a framed
+// NewOrderMessage. Both decode a stream already sitting in memory.
+void runParseBenchmark() {
+  std::cout << "=== Running Order Entry Parse Benchmark ===\n";
+
+  const int numMessages = 1000000;
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<> priceDist(9000, 11000);
+  std::uniform_int_distribution<> qtyDist(1, 1000);
+
+  std::string text;
+  std::string binary;
+  for (int i = 0; i < numMessages; ++i) {
+    bool buy = (i % 2 == 0);
+    Price price = priceDist(gen);
+    Quantity quantity = static_cast<Quantity>(qtyDist(gen));
+
+    text += buy ? "BUY" : "SELL";
+    text += " SYM " + std::to_string(quantity) + " " + std::to_string(price) +
+            " " + std::to_string(i) + "\n";
+
+    auto msg = makeMessage<NewOrderMessage>();
+    msg.clientOrderId = static_cast<uint64_t>(i);
+    msg.price = price;
+    msg.quantity = quantity;
+    msg.side = buy ? OrderSide::Buy : OrderSide::Sell;
+    msg.orderType = OrderType::Limit;
+    appendMessage(binary, msg);
+  }
+
+  uint64_t checksum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  size_t pos = 0;
+  size_t end = 0;
+  OrderId nextId = 1;
+  while ((end = text.find('\n', pos)) != std::string::npos) {
+    std::stringstream ss(text.substr(pos, end - pos));
+    pos = end + 1;
+    std::string command;
+    std::string symbol;
+    Quantity quantity = 0;
+    Price price = 0;
+    uint64_t clientOrderId = 0;
+    ss >> command >> symbol >> quantity >> price >> clientOrderId;
+    OrderSide side = (command == "BUY") ? OrderSide::Buy : OrderSide::Sell;
+    Order order(nextId++, clientOrderId, 0, side, OrderType::Limit, price,
+                quantity);
+    checksum += order.price + order.quantity;
+  }
+  std::chrono::duration<double> textElapsed =
+      std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  pos = 0;
+  BinaryHeader header;
+  while (peekHeader(binary.data() + pos, binary.size() - pos, header)) {
+    NewOrderMessage msg;
+    Order order;
+    if (decodeMessage(binary.data() + pos, header.length, msg) &&
+        toOrder(msg, nextId++, order)) {
+      checksum += order.price + order.quantity;
+    }
+    pos += header.length;
+  }
+  std::chrono::duration<double> binaryElapsed =
+      std::chrono::steady_clock::now() - start;
+
+  auto print = [&](const char *name, std::chrono::duration<double> elapsed,
+                   size_t bytes) {
+    std::cout << "  " << name << ": "
+              << static_cast<long long>(numMessages / elapsed.count())
+              << " msgs/sec, " << (elapsed.count() * 1e9 / numMessages)
+              << " ns/msg, " << (bytes / numMessages) << " bytes/msg\n";
+  };
+  print("Text  ", textElapsed, text.size());
+  print("Binary", binaryElapsed, binary.size());
+  std::cout << "  (checksum " << checksum << ")\n";
+}
+
+// Order throughput with the input journal off and under each sync policy.
+// The clock stops once every order is durable as the policy defines it, so
+// the group-commit figure includes its final fdatasync.
+void runJournalBenchmark(const std::string &dir) {
+  std::cout << "=== Running Journal Benchmark ===\n";
+
+  int numThreads = std::max(1, static_cast<int>(
+                                   std::thread::hardware_concurrency()) /
+                                   2);
+  const long long poolSize = 200000;
+  const int iterations = 10;
+
+  std::vector<std::vector<Order>> threadOrders(numThreads);
+  for (int i = 0; i < numThreads; ++i) {
+    std::mt19937 gen(i);
+    std::uniform_int_distribution<long long> priceDist(10000, 10020);
+    std::uniform_int_distribution<> qtyDist(1, 100);
+    std::uniform_int_distribution<> sideDist(0, 1);
+    for (long long j = 0; j < poolSize; ++j) {
+      OrderSide side = (sideDist(gen) == 0) ? OrderSide::Buy : OrderSide::Sell;
+      threadOrders[i].emplace_back(
+          static_cast<OrderId>((i * poolSize) + j + 1), 0, i, side,
+          OrderType::Limit, static_cast<Price>(priceDist(gen)),
+          static_cast<Quantity>(qtyDist(gen)));
+    }
+  }
+  const auto perShard = static_cast<uint64_t>(poolSize * iterations);
+  const long long totalOrders =
+      static_cast<long long>(numThreads) * poolSize * iterations;
+
+  struct Variant {
+    const char *name;
+    bool enabled;
+    JournalSyncPolicy sync;
+  };
+  const Variant variants[] = {
+      {"Off", false, JournalSyncPolicy::None},
+      {"None", true, JournalSyncPolicy::None},
+      {"Interval(10ms)", true, JournalSyncPolicy::Interval},
+      {"GroupCommit", true, JournalSyncPolicy::GroupCommit}};
+
+  const std::string path = dir + "/benchmark.journal";
+  for (const auto &variant : variants) {
+    Exchange engine(numThreads);
+    for (int s = 0; s < numThreads; ++s) {
+      engine.registerSymbol("SYM-" + std::to_string(s), s);
+    }
+    JournalOptions options;
+    options.sync = variant.sync;
+    std::remove(path.c_str());
+    if (variant.enabled && !engine.enableJournal(path, options)) return;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+      std::vector<std::jthread> threads;
+      threads.reserve(numThreads);
+      for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back(benchmarkWorker, std::ref(engine),
+                             std::cref(threadOrders[i]), i, iterations,
+                             nullptr);
+      }
+    }
+    if (Journal *journal = engine.journal()) {
+      for (int s = 0; s < numThreads; ++s) {
+        while (journal->durableSequence(s) < perShard) {
+          std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+      }
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    std::cout << "  " << variant.name << ": "
+              << static_cast<long long>(static_cast<double>(totalOrders) /
+                                        elapsed.count())
+              << " orders/sec";
+    if (Journal *journal = engine.journal()) {
+      double mb = static_cast<double>(journal->bytesWritten()) / (1 << 20);
+      std::cout << ", " << mb << " MB (" << (mb / elapsed.count())
+                << " MB/s), " << journal->writes() << " writes, "
+                << journal->syncs() << " syncs, "
+                << (totalOrders / std::max<uint64_t>(1, journal->writes()))
+                << " records/write";
+    }
+    std::cout << "\n";
+  }
+  std::remove(path.c_str());
+}
+
+// Journals `totalCommands` orders from a live engine and snapshots its
+// books, then times a second engine rebuilding them from the journal alone
+// and a third restoring them from the snapshot.
+void runRecoveryBenchmark(const std::string &dir, long long totalCommands) {
+  std::cout << "=== Running Journal Recovery Benchmark ===\n";
+
+  int numThreads = std::max(1, static_cast<int>(
+                                   std::thread::hardware_concurrency()) /
+                                   2);
+  const long long poolSize = 200000;
+  const int iterations = static_cast<int>(std::max(
+      1LL, totalCommands / (static_cast<long long>(numThreads) * poolSize)));
+
+  std::vector<std::vector<Order>> threadOrders(numThreads);
+  for (int i = 0; i < numThreads; ++i) {
+    std::mt19937 gen(i);
+    std::uniform_int_distribution<long long> priceDist(10000, 10020);
+    std::uniform_int_distribution<> qtyDist(1, 100);
+    std::uniform_int_distribution<> sideDist(0, 1);
+    for (long long j = 0; j < poolSize; ++j) {
+      OrderSide side = (sideDist(gen) == 0) ? OrderSide::Buy : OrderSide::Sell;
+      threadOrders[i].emplace_back(
+          static_cast<OrderId>((i * poolSize) + j + 1), 0, i, side,
+          OrderType::Limit, static_cast<Price>(priceDist(gen)),
+          static_cast<Quantity>(qtyDist(gen)));
+    }
+  }
+
+  const std::string path = dir + "/recovery.journal";
+  const std::string snapshotPath = dir + "/recovery.snapshot";
+  {
+    Exchange engine(numThreads);
+    for (int s = 0; s < numThreads; ++s) {
+      engine.registerSymbol("SYM-" + std::to_string(s), s);
+    }
+    JournalOptions options;
+    options.sync = JournalSyncPolicy::None;
+    std::remove(path.c_str());
+    if (!engine.enableJournal(path, options)) return;
+
+    std::vector<std::jthread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+      threads.emplace_back(benchmarkWorker, std::ref(engine),
+                           std::cref(threadOrders[i]), i, iterations,
+                           nullptr);
+    }
+    threads.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    bool written = engine.writeSnapshot(snapshotPath);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (!written) return;
+    std::cout << "  Snapshot written in " << elapsed.count() * 1000
+              << " ms\n";
+  }
+
+  {
+    Exchange engine(numThreads);
+    auto start = std::chrono::steady_clock::now();
+    auto result = engine.recoverFromJournal(path);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (!result.ok) {
+      std::cerr << "Recovery failed: " << result.error << "\n";
+      return;
+    }
+    std::cout << "  Replayed " << result.commands << " commands in "
+              << elapsed.count() << " s ("
+              << static_cast<long long>(static_cast<double>(result.commands) /
+                                        elapsed.count())
+              << " commands/sec), " << result.trades << " trades, "
+              << result.checkpoints << " checkpoints verified\n";
+  }
+
+  Exchange engine(numThreads);
+  auto start = std::chrono::steady_clock::now();
+  auto result = engine.restoreFromSnapshot(snapshotPath, path);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::remove(path.c_str());
+  std::remove(snapshotPath.c_str());
+  if (!result.ok) {
+    std::cerr << "Restore failed: " << result.error << "\n";
+    return;
+  }
+  std::cout << "  Restored " << result.orders << " resting orders from the "
+            << "snapshot and replayed " << result.commands
+            << " tail commands in " << elapsed.count() << " s\n";
 }
 
 int main(int argc, char *argv[]) {
@@ -210,10 +937,69 @@ int main(int argc, char *argv[]) {
     if (arg == "--verify" || arg == "-v") {
       verifyMode = true;
     }
+    if (arg == "--prorata") {
+      runProRataBenchmark();
+      return 0;
+    }
+    if (arg == "--parse") {
+      runParseBenchmark();
+      return 0;
+    }
+    if (arg == "--journal") {
+      runJournalBenchmark(i + 1 < argc ? argv[i + 1] : ".");
+      return 0;
+    }
+    if (arg == "--recover") {
+      std::string dir = (i + 1 < argc) ? argv[i + 1] : ".";
+      long long commands =
+          (i + 2 < argc) ? std::stoll(argv[i + 2]) : 10000000LL;
+      runRecoveryBenchmark(dir, commands);
+      return 0;
+    }
+    if (arg == "--convert") {
+      if (i + 2 < argc) return runConvert(argv[i + 1], argv[i + 2]);
+      std::cerr << "Error: --convert requires a CSV and an output file\n";
+      return 1;
+    }
+    if (arg == "--open-loop") {
+      OpenLoopOptions options;
+      for (int j = i + 1; j + 1 < argc; ++j) {
+        std::string option = argv[j];
+        if (option == "--rates") {
+          // Comma-separated messages per second.
+          options.rates.clear();
+          std::stringstream rates(argv[++j]);
+          for (std::string rate; std::getline(rates, rate, ',');) {
+            options.rates.push_back(std::stod(rate));
+          }
+        }
+        if (option == "--seconds") options.seconds = std::stod(argv[++j]);
+        if (option == "--symbols") options.symbols = std::stoi(argv[++j]);
+        if (option == "--shards") options.shards = std::stoi(argv[++j]);
+      }
+      runOpenLoop(options);
+      return 0;
+    }
+    if (arg == "--iceberg") {
+      runIcebergBenchmark();
+      return 0;
+    }
     if (arg == "--replay") {
       if (i + 1 < argc) {
         std::string filename = argv[i + 1];
-        runReplay(filename);
+        ReplayOptions options;
+        options.latency = measureLatency;
+        for (int j = i + 2; j < argc; ++j) {
+          std::string option = argv[j];
+          if (option == "--latency" || option == "-l") options.latency = true;
+          if (j + 1 >= argc) continue;
+          if (option == "--threads") options.threads = std::stoi(argv[++j]);
+          if (option == "--shards") options.shards = std::stoi(argv[++j]);
+          if (option == "--speed") options.speed = std::stod(argv[++j]);
+        }
+        // Pacing exists to measure latency under the recorded bursts.
+        if (options.speed > 0) options.latency = true;
+        runReplay(filename, options);
         return 0;
       } else {
         std::cerr << "Error: --replay requires a filename\n";
@@ -270,12 +1056,6 @@ int main(int argc, char *argv[]) {
 
   std::cout << "Pre-generating orders...\n";
 
-  if (measureLatency) {
-    submissionTimes = std::make_unique<std::atomic<int64_t>[]>(
-        static_cast<size_t>(totalOrders + 1));
-    latencies.resize(static_cast<size_t>(totalOrders));
-  }
-
   std::vector<std::vector<Order>> threadOrders(numThreads);
 
   for (int i = 0; i < numThreads; ++i) {
@@ -307,6 +1087,7 @@ int main(int argc, char *argv[]) {
 
   {
     Exchange engine(numThreads);
+    engine.enableLatencyMetrics(measureLatency);
     for (int s = 0; s < 10; ++s) {
       engine.registerSymbol("SYM-" + std::to_string(s), -1);
     }
@@ -319,26 +1100,8 @@ int main(int argc, char *argv[]) {
 
       std::atomic<long long> totalTrades{0};
 
-      if (measureLatency) {
-        latencyIndex = 0;
-      }
-
       engine.setTradeCallback([&](const std::vector<Trade> &trades) {
         totalTrades.fetch_add(trades.size(), std::memory_order_relaxed);
-        if (measureLatency) {
-          long long now =
-              std::chrono::steady_clock::now().time_since_epoch().count();
-          for (const auto &trade : trades) {
-            long long submitTime = submissionTimes[trade.takerOrderId].load(
-                std::memory_order_relaxed);
-            if (submitTime > 0) {
-              size_t idx = latencyIndex.fetch_add(1, std::memory_order_relaxed);
-              if (idx < latencies.size()) {
-                latencies[idx] = now - submitTime;
-              }
-            }
-          }
-        }
       });
 
       std::vector<std::jthread> threads;
@@ -372,28 +1135,12 @@ int main(int argc, char *argv[]) {
                 << "ns Avg=" << avgWaitNs << "ns/order\n";
 
       if (measureLatency) {
-        size_t numLatencies =
-            std::min((size_t)latencyIndex.load(), latencies.size());
-        if (numLatencies > 0) {
-          std::sort(
-              latencies.begin(),
-              latencies.begin() + static_cast<std::ptrdiff_t>(numLatencies));
-          long long p50 = latencies[static_cast<size_t>(
-              static_cast<double>(numLatencies) * 0.50)];
-          long long p99 = latencies[static_cast<size_t>(
-              static_cast<double>(numLatencies) * 0.99)];
-          long long maxLat = latencies[numLatencies - 1];
-          long long avgLat =
-              std::reduce(
-                  latencies.begin(),
-                  latencies.begin() + static_cast<std::ptrdiff_t>(numLatencies),
-                  0LL) /
-              static_cast<long long>(numLatencies);
-          std::cout << "  Latency (ns): Avg=" << avgLat << " P50=" << p50
-                    << " P99=" << p99 << " Max=" << maxLat << "\n";
-        } else {
-          std::cout << "  No trades recorded (latencies).\n";
-        }
+        // Taken after the run, so the barrier costs the run nothing.
+        Exchange::LatencyMetrics metrics = engine.latencyMetrics(true);
+        std::cout << "  Submit -> ack latency (ns):   "
+                  << metrics.ack.summary() << "\n";
+        std::cout << "  Submit -> trade latency (ns): "
+                  << metrics.trade.summary() << "\n";
       }
     }
   }
@@ -0,0 +1,183 @@
+// Local load generator for the TCP gateway. Opens many concurrent sessions
+// from a single epoll loop and drives each one as a closed loop of
+// BUY -> ack -> CANCEL -> ack round trips, so the book stays small while the
+// server carries the full connection count.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Session {
+  int fd = -1;
+  bool connected = false;
+  std::string input;
+  Clock::time_point sentAt;
+  std::string symbol;
+};
+
+bool sendLine(Session &session, const std::string &line) {
+  session.sentAt = Clock::now();
+  ssize_t n = send(session.fd, line.data(), line.size(), MSG_NOSIGNAL);
+  return n == static_cast<ssize_t>(line.size());
+}
+
+bool sendOrder(Session &session, int price) {
+  return sendLine(session, "BUY " + session.symbol + " 1 " +
+                               std::to_string(price) + "\n");
+}
+
+long long percentile(const std::vector<long long> &sorted, double p) {
+  if (sorted.empty()) return 0;
+  auto idx = static_cast<size_t>(static_cast<double>(sorted.size() - 1) * p);
+  return sorted[idx];
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string host = "127.0.0.1";
+  int port = 8080;
+  int connections = 1000;
+  int seconds = 10;
+  int symbols = 1;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string arg = argv[i];
+    std::string value = argv[i + 1];
+    if (arg == "--host") host = value;
+    if (arg == "--port") port = std::stoi(value);
+    if (arg == "--connections") connections = std::stoi(value);
+    if (arg == "--duration") seconds = std::stoi(value);
+    if (arg == "--symbols") symbols = std::max(1, std::stoi(value));
+  }
+
+  rlimit limit{};
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+    std::cerr << "Invalid host " << host << "\n";
+    return 1;
+  }
+
+  int epollFd = epoll_create1(0);
+  std::vector<Session> sessions(connections);
+  for (int i = 0; i < connections; ++i) {
+    Session &session = sessions[i];
+    session.symbol = "LOAD-" + std::to_string(i % symbols);
+    session.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (session.fd < 0) {
+      std::cerr << "socket() failed after " << i << " connections: "
+                << std::strerror(errno) << "\n";
+      sessions.resize(i);
+      break;
+    }
+    int noDelay = 1;
+    setsockopt(session.fd, IPPROTO_TCP, TCP_NODELAY, &noDelay,
+               sizeof(noDelay));
+    connect(session.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u32 = static_cast<uint32_t>(i);
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, session.fd, &ev);
+  }
+
+  std::cout << "Driving " << sessions.size() << " sessions against " << host
+            << ":" << port << " for " << seconds << "s...\n";
+
+  std::vector<long long> latencies;
+  latencies.reserve(1 << 20);
+  size_t connected = 0;
+  size_t failed = 0;
+  std::array<epoll_event, 1024> events{};
+  std::array<char, 16384> buffer{};
+
+  auto start = Clock::now();
+  auto deadline = start + std::chrono::seconds(seconds);
+  while (Clock::now() < deadline) {
+    int n = epoll_wait(epollFd, events.data(), events.size(), 10);
+    for (int e = 0; e < n; ++e) {
+      Session &session = sessions[events[e].data.u32];
+      if (session.fd < 0) continue;
+
+      if (events[e].events & (EPOLLERR | EPOLLHUP)) {
+        close(session.fd);
+        session.fd = -1;
+        failed++;
+        continue;
+      }
+
+      if (!session.connected && (events[e].events & EPOLLOUT)) {
+        session.connected = true;
+        connected++;
+        sendOrder(session, 100 + static_cast<int>(events[e].data.u32 % 100));
+      }
+
+      if (!(events[e].events & EPOLLIN)) continue;
+      while (true) {
+        ssize_t bytes = read(session.fd, buffer.data(), buffer.size());
+        if (bytes <= 0) break;
+        session.input.append(buffer.data(), static_cast<size_t>(bytes));
+      }
+
+      size_t pos = 0;
+      size_t end = 0;
+      while ((end = session.input.find('\n', pos)) != std::string::npos) {
+        std::string_view line(session.input.data() + pos, end - pos);
+        pos = end + 1;
+
+        if (line.starts_with("ORDER_ACCEPTED_ASYNC ")) {
+          latencies.push_back((Clock::now() - session.sentAt).count());
+          std::string id(line.substr(line.find(' ') + 1));
+          sendLine(session, "CANCEL " + session.symbol + " " + id + "\n");
+        } else if (line.starts_with("CANCEL_REQUEST_SENT")) {
+          latencies.push_back((Clock::now() - session.sentAt).count());
+          sendOrder(session, 100 + static_cast<int>(events[e].data.u32 % 100));
+        }
+      }
+      session.input.erase(0, pos);
+    }
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+
+  for (auto &session : sessions) {
+    if (session.fd >= 0) close(session.fd);
+  }
+  close(epollFd);
+
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << "Sessions connected: " << connected << " (failed " << failed
+            << ")\n";
+  std::cout << "Round trips: " << latencies.size() << " ("
+            << static_cast<long long>(static_cast<double>(latencies.size()) /
+                                      elapsed.count())
+            << "/s)\n";
+  std::cout << "RTT (ns): P50=" << percentile(latencies, 0.50)
+            << " P99=" << percentile(latencies, 0.99)
+            << " P99.9=" << percentile(latencies, 0.999)
+            << " Max=" << (latencies.empty() ? 0 : latencies.back()) << "\n";
+  return 0;
+}
@@ -1,12 +1,139 @@
+#include <sys/stat.h>
+
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <thread>
 
 #include "Exchange.hpp"
+#include "Journal.hpp"
+#include "MarketDataFeed.hpp"
+#include "Replica.hpp"
+#include "ShmGateway.hpp"
 #include "TcpServer.hpp"
 
-int main() {
+int main(int argc, char *argv[]) {
+  int port = 8080;
+  int ioThreads = 1;
+  std::string feedHost = "127.0.0.1";
+  int feedPort = 0;
+  int recoveryPort = 0;
+  IoBackendType ioBackend = IoBackendType::Epoll;
+  std::string shmPrefix;
+  int shmClients = 16;
+  std::string journalPath;
+  std::string recoverPath;
+  std::string replicaSocket;
+  std::string followSocket;
+  int latencyReport = 0;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string arg = argv[i];
+    if (arg == "--port") port = std::stoi(argv[i + 1]);
+    if (arg == "--io-threads") ioThreads = std::stoi(argv[i + 1]);
+    if (arg == "--feed-host") feedHost = argv[i + 1];
+    if (arg == "--feed-port") feedPort = std::stoi(argv[i + 1]);
+    if (arg == "--recovery-port") recoveryPort = std::stoi(argv[i + 1]);
+    if (arg == "--shm-prefix") shmPrefix = argv[i + 1];
+    if (arg == "--shm-clients") shmClients = std::stoi(argv[i + 1]);
+    if (arg == "--journal") journalPath = argv[i + 1];
+    if (arg == "--recover") recoverPath = argv[i + 1];
+    if (arg == "--replica-socket") replicaSocket = argv[i + 1];
+    if (arg == "--follow") followSocket = argv[i + 1];
+    if (arg == "--latency-report") latencyReport = std::stoi(argv[i + 1]);
+    if (arg == "--io-backend") {
+      ioBackend = (std::string(argv[i + 1]) == "io_uring")
+                      ? IoBackendType::IoUring
+                      : IoBackendType::Epoll;
+    }
+  }
+
+  if (!recoverPath.empty() && !followSocket.empty()) {
+    std::cerr << "--recover and --follow cannot be combined" << "\n";
+    return 1;
+  }
+
   Exchange engine;
-  TcpServer server(engine, 8080);
+
+  // Restart after a crash: rebuild the books from the previous journal, and
+  // from the snapshot it continues if it has one.
+  if (!recoverPath.empty()) {
+    const std::string base = recoverPath + ".base";
+    struct stat st{};
+    auto recovery = (stat(base.c_str(), &st) == 0)
+                        ? engine.restoreFromSnapshot(base, recoverPath)
+                        : engine.recoverFromJournal(recoverPath);
+    if (!recovery.ok) {
+      std::cerr << "Recovery from " << recoverPath
+                << " failed: " << recovery.error << "\n";
+      return 1;
+    }
+    std::cout << "Recovered " << recovery.orders << " snapshot orders and "
+              << recovery.commands << " commands from " << recoverPath << "\n";
+  }
+
+  // Hot standby: mirror the primary until its stream ends, then take over.
+  if (!followSocket.empty()) {
+    Replica replica(engine, followSocket);
+    if (!replica.start()) {
+      std::cerr << "Failed to follow primary" << "\n";
+      return 1;
+    }
+    std::cout << "Following primary at " << followSocket << "\n";
+    while (replica.following()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto promotion = replica.promote();
+    if (!promotion.ok) {
+      std::cerr << "Promotion failed: " << promotion.error << "\n";
+      return 1;
+    }
+    std::cout << "Promoted after " << promotion.commands << " commands in "
+              << promotion.elapsed.count() << "us" << "\n";
+  }
+
+  if (!journalPath.empty()) {
+    JournalOptions options;
+    options.replicaSocket = replicaSocket;
+    if (!replicaSocket.empty()) {
+      options.stateCheckInterval = std::chrono::milliseconds(100);
+    }
+    // Promoted or recovered books predate the new journal, so it starts
+    // from a snapshot of them.
+    if (!followSocket.empty() || !recoverPath.empty()) {
+      options.baseSnapshot = journalPath + ".base";
+    }
+    if (!engine.enableJournal(journalPath, options)) {
+      std::cerr << "Failed to open journal " << journalPath << "\n";
+      return 1;
+    }
+    if (!options.baseSnapshot.empty()) {
+      std::cout << "Journal continues snapshot " << options.baseSnapshot
+                << "\n";
+    }
+  }
+
+  TcpServer server(engine, port, ioThreads, ioBackend);
+
+  std::unique_ptr<MarketDataFeed> feed;
+  if (feedPort > 0) {
+    feed = std::make_unique<MarketDataFeed>(engine, feedHost, feedPort,
+                                            recoveryPort);
+    if (!feed->start()) {
+      std::cerr << "Failed to start market data feed" << "\n";
+      return 1;
+    }
+  }
+
+  std::unique_ptr<ShmGateway> shmGateway;
+  if (!shmPrefix.empty()) {
+    shmGateway =
+        std::make_unique<ShmGateway>(engine, shmPrefix, shmClients);
+    if (!shmGateway->start()) {
+      std::cerr << "Failed to start shared-memory gateway" << "\n";
+      return 1;
+    }
+  }
 
   std::cout << "Starting Order Matching Engine Server..." << "\n";
   if (!server.start()) {
@@ -14,8 +141,17 @@ int main() {
     return 1;
   }
 
+  if (latencyReport > 0) engine.enableLatencyMetrics(true);
   while (true) {
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    std::this_thread::sleep_for(
+        std::chrono::seconds(std::max(latencyReport, 1)));
+    if (latencyReport > 0) {
+      // Each report covers the interval since the previous one.
+      Exchange::LatencyMetrics metrics = engine.latencyMetrics(true);
+      std::cout << "Submit -> ack (ns):   " << metrics.ack.summary() << "\n"
+                << "Submit -> trade (ns): " << metrics.trade.summary()
+                << "\n";
+    }
   }
 
   return 0;
@@ -0,0 +1,230 @@
+// Microbenchmarks for the engine's core data structures, one hot path at a
+// time. Seeds are fixed, so every run measures the same work. For a record
+// to compare against later commits:
+//
+//   ./build/src/microbench --benchmark_out=micro.json
+//       --benchmark_out_format=json
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "Bitset.hpp"
+#include "MatchingStrategy.hpp"
+#include "OrderBook.hpp"
+#include "RingBuffer.hpp"
+
+namespace {
+constexpr size_t BITSET_SIZE = OrderBook::MAX_PRICE;
+constexpr Price MID = OrderBook::MAX_PRICE / 2;
+
+// A book costs hundreds of megabytes to construct, so every benchmark shares
+// one and resets it before use.
+OrderBook &sharedBook() {
+  static auto book = std::make_unique<OrderBook>();
+  return *book;
+}
+
+Order limit(OrderId id, OrderSide side, Price price, Quantity quantity) {
+  return Order(id, id, 0, side, OrderType::Limit, price, quantity);
+}
+
+// findFirstSet/findFirstSetDown from random starts over a bitset with
+// `range(0)` bits set per thousand, as the best-price scans see a sparse or
+// crowded book.
+void BM_PriceBitsetScan(benchmark::State &state) {
+  const double density = static_cast<double>(state.range(0)) / 1000.0;
+  const bool down = state.range(1) != 0;
+  PriceBitset bits(BITSET_SIZE);
+  std::mt19937 gen(42);
+  std::bernoulli_distribution occupied(density);
+  for (size_t i = 0; i < BITSET_SIZE; ++i) {
+    if (occupied(gen)) bits.set(i);
+  }
+  std::vector<size_t> starts(4096);
+  std::uniform_int_distribution<size_t> start(0, BITSET_SIZE - 1);
+  for (auto &s : starts) s = start(gen);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    const size_t from = starts[i++ & (starts.size() - 1)];
+    benchmark::DoNotOptimize(down ? bits.findFirstSetDown(from)
+                                  : bits.findFirstSet(from));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PriceBitsetScan)
+    ->ArgNames({"per_mille", "down"})
+    ->ArgsProduct({{1, 10, 100, 500}, {0, 1}});
+
+// Thread 0 drains the ring with pop_batch while the others push batches of
+// `range(0)` commands into it, the shape of a shard queue with several
+// submitting threads. A push that finds the ring full is not retried.
+// items/s counts what the consumer popped, so each item counts once.
+struct QueueItem {
+  char bytes[64];
+};
+
+void BM_RingBufferBatch(benchmark::State &state) {
+  static std::unique_ptr<RingBuffer<QueueItem>> ring;
+  const auto batch = static_cast<size_t>(state.range(0));
+  if (state.thread_index() == 0) {
+    ring = std::make_unique<RingBuffer<QueueItem>>(1 << 16);
+  }
+  std::vector<QueueItem> items(batch);
+
+  int64_t popped = 0;
+  for (auto _ : state) {
+    if (state.thread_index() == 0) {
+      popped += static_cast<int64_t>(ring->pop_batch(items.data(), batch));
+    } else {
+      benchmark::DoNotOptimize(ring->push_batch(items.data(), batch));
+    }
+  }
+  // Summed over threads, so only the consumer reports.
+  if (state.thread_index() == 0) state.SetItemsProcessed(popped);
+}
+BENCHMARK(BM_RingBufferBatch)
+    ->ArgName("batch")
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(256)
+    ->Threads(2)
+    ->Threads(3)
+    ->Threads(4)
+    ->UseRealTime();
+
+// Resting adds spread over `range(0)` levels either side of the mid. The
+// book is reset, untimed, every BATCH orders.
+void BM_OrderBookAdd(benchmark::State &state) {
+  constexpr size_t BATCH = 1 << 16;
+  const auto levels = static_cast<Price>(state.range(0));
+  OrderBook &book = sharedBook();
+  book.reset();
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<Price> offset(1, levels);
+  std::vector<Order> orders;
+  orders.reserve(BATCH);
+  for (size_t i = 0; i < BATCH; ++i) {
+    const bool buy = i % 2 == 0;
+    orders.push_back(limit(i + 1, buy ? OrderSide::Buy : OrderSide::Sell,
+                           buy ? MID - offset(gen) : MID + offset(gen), 10));
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    if (i == BATCH) {
+      state.PauseTiming();
+      book.reset();
+      i = 0;
+      state.ResumeTiming();
+    }
+    book.addOrder(orders[i++]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OrderBookAdd)->ArgName("levels")->Arg(1)->Arg(10)->Arg(1000);
+
+// Cancels in random order from a book of BATCH resting orders, refilled
+// untimed once empty.
+void BM_OrderBookCancel(benchmark::State &state) {
+  constexpr size_t BATCH = 1 << 16;
+  const auto levels = static_cast<Price>(state.range(0));
+  OrderBook &book = sharedBook();
+  std::mt19937 gen(11);
+  std::uniform_int_distribution<Price> offset(1, levels);
+  std::vector<Order> orders;
+  orders.reserve(BATCH);
+  for (size_t i = 0; i < BATCH; ++i) {
+    const bool buy = i % 2 == 0;
+    orders.push_back(limit(i + 1, buy ? OrderSide::Buy : OrderSide::Sell,
+                           buy ? MID - offset(gen) : MID + offset(gen), 10));
+  }
+  std::vector<OrderId> cancels;
+  for (const Order &o : orders) cancels.push_back(o.id);
+  std::shuffle(cancels.begin(), cancels.end(), gen);
+  auto refill = [&] {
+    book.reset();
+    for (const Order &o : orders) book.addOrder(o);
+  };
+  refill();
+
+  size_t i = 0;
+  for (auto _ : state) {
+    if (i == BATCH) {
+      state.PauseTiming();
+      refill();
+      i = 0;
+      state.ResumeTiming();
+    }
+    benchmark::DoNotOptimize(book.cancelOrder(cancels[i++]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OrderBookCancel)->ArgName("levels")->Arg(1)->Arg(10)->Arg(1000);
+
+// StandardMatchingStrategy::match for an incoming buy that
+//   0: does not cross and rests below the asks;
+//   1: crosses and fills against one resting order;
+//   2: sweeps `range(1)` ask levels, one order each.
+// The asks are one order per price from the mid up. The book is rebuilt,
+// untimed, once they run out or a batch of bids has come to rest.
+void BM_Match(benchmark::State &state) {
+  constexpr size_t BATCH = 1 << 14;
+  constexpr Price ASK_LEVELS = MID - 1;
+  const int64_t shape = state.range(0);
+  const Price consumed = shape == 0 ? 0 : shape == 1 ? 1 : state.range(1);
+  OrderBook &book = sharedBook();
+  StandardMatchingStrategy strategy;
+  std::vector<Trade> trades;
+  trades.reserve(1024);
+
+  OrderId nextId = 1;
+  Price asksLeft = 0;
+  auto refill = [&] {
+    book.reset();
+    nextId = 1;
+    for (Price p = 0; p < ASK_LEVELS; ++p) {
+      book.addOrder(limit(nextId++, OrderSide::Sell, MID + p, 1));
+    }
+    asksLeft = ASK_LEVELS;
+  };
+  refill();
+
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<Price> below(1, 20);
+  std::vector<Price> bidPrices(BATCH);
+  for (auto &p : bidPrices) p = MID - below(gen);
+  const Price crossing = MID + ASK_LEVELS;
+  const auto quantity = static_cast<Quantity>(consumed);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    if (i == BATCH || asksLeft < consumed) {
+      state.PauseTiming();
+      refill();
+      i = 0;
+      state.ResumeTiming();
+    }
+    const OrderId id = nextId++;
+    Order incoming = shape == 0
+                         ? limit(id, OrderSide::Buy, bidPrices[i++], 1)
+                         : limit(id, OrderSide::Buy, crossing, quantity);
+    asksLeft -= consumed;
+    strategy.match(book, incoming, trades);
+    trades.clear();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Match)
+    ->ArgNames({"shape", "sweep"})
+    ->Args({0, 0})
+    ->Args({1, 0})
+    ->Args({2, 4})
+    ->Args({2, 32});
+}  // namespace
+
+BENCHMARK_MAIN();
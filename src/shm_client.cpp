@@ -0,0 +1,222 @@
+// Sample shared-memory client and order entry latency benchmark. Claims a
+// slot on a running ShmGateway, looks up a symbol, then times
+// NewOrder -> Ack round trips, cancelling each order before the next so the
+// book stays empty. With --port it repeats the same loop over the binary
+// TCP protocol for comparison.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ShmChannel.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+class ShmTransport {
+ public:
+  static constexpr int SPIN_POLLS = 64;
+
+  bool connect(const std::string &prefix) { return client_.connect(prefix); }
+
+  template <typename Message>
+  bool send(const Message &msg) {
+    while (!client_.send(msg)) {
+      if (!client_.connected()) return false;
+    }
+    return true;
+  }
+
+  // Spins for a while before yielding, so a client sharing a core with the
+  // gateway still lets it run.
+  bool receive(char *out, BinaryHeader &header) {
+    for (int spins = 0; !client_.poll(out, header); ++spins) {
+      if (!client_.connected()) return false;
+      if (spins >= SPIN_POLLS) std::this_thread::yield();
+    }
+    return true;
+  }
+
+ private:
+  ShmClient client_;
+};
+
+class TcpTransport {
+ public:
+  ~TcpTransport() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+  bool connect(const std::string &host, int port) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) return false;
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0 ||
+        ::connect(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+            0) {
+      return false;
+    }
+    int noDelay = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return ::send(fd_, &BINARY_HELLO, 1, MSG_NOSIGNAL) == 1;
+  }
+
+  template <typename Message>
+  bool send(const Message &msg) {
+    return ::send(fd_, &msg, sizeof(msg), MSG_NOSIGNAL) ==
+           static_cast<ssize_t>(sizeof(msg));
+  }
+
+  bool receive(char *out, BinaryHeader &header) {
+    while (!peekHeader(input_.data(), input_.size(), header) ||
+           input_.size() < header.length) {
+      char buffer[4096];
+      ssize_t n = recv(fd_, buffer, sizeof(buffer), 0);
+      if (n <= 0) return false;
+      input_.append(buffer, static_cast<size_t>(n));
+    }
+    std::memcpy(out, input_.data(), header.length);
+    input_.erase(0, header.length);
+    return true;
+  }
+
+ private:
+  int fd_ = -1;
+  std::string input_;
+};
+
+// Waits for the next message of type `type`, skipping the rest.
+template <typename Transport>
+bool await(Transport &transport, BinaryMessageType type, char *out) {
+  BinaryHeader header;
+  do {
+    if (!transport.receive(out, header)) return false;
+  } while (header.type != type);
+  return true;
+}
+
+template <typename Transport>
+bool lookupSymbol(Transport &transport, const std::string &symbol,
+                  int32_t &symbolId) {
+  auto lookup = makeMessage<SymbolLookupMessage>();
+  std::strncpy(lookup.symbol, symbol.c_str(), sizeof(lookup.symbol));
+  char out[MAX_BINARY_MESSAGE];
+  if (!transport.send(lookup) ||
+      !await(transport, BinaryMessageType::SymbolInfo, out)) {
+    return false;
+  }
+  SymbolInfoMessage info;
+  std::memcpy(&info, out, sizeof(info));
+  symbolId = info.symbolId;
+  return true;
+}
+
+// Returns submit-to-ack times in nanoseconds.
+template <typename Transport>
+std::vector<long long> timeRoundTrips(Transport &transport, int32_t symbolId,
+                                      int orders) {
+  std::vector<long long> latencies;
+  latencies.reserve(orders);
+  char out[MAX_BINARY_MESSAGE];
+
+  auto order = makeMessage<NewOrderMessage>();
+  order.symbolId = symbolId;
+  order.side = OrderSide::Buy;
+  order.orderType = OrderType::Limit;
+  order.price = 100;
+  order.quantity = 1;
+
+  auto cancel = makeMessage<CancelMessage>();
+  cancel.symbolId = symbolId;
+
+  for (int i = 0; i < orders; ++i) {
+    order.clientOrderId = static_cast<uint64_t>(i) + 1;
+    auto sentAt = Clock::now();
+    if (!transport.send(order) ||
+        !await(transport, BinaryMessageType::Ack, out)) {
+      break;
+    }
+    latencies.push_back((Clock::now() - sentAt).count());
+
+    AckMessage ack;
+    std::memcpy(&ack, out, sizeof(ack));
+    cancel.orderId = ack.orderId;
+    if (!transport.send(cancel)) break;
+    // The cancel's report confirms the book is empty again.
+    ExecReportMessage report;
+    do {
+      if (!await(transport, BinaryMessageType::ExecReport, out)) {
+        return latencies;
+      }
+      std::memcpy(&report, out, sizeof(report));
+    } while (report.orderId != ack.orderId ||
+             report.status != ExecStatus::Cancelled);
+  }
+  return latencies;
+}
+
+long long percentile(const std::vector<long long> &sorted, double p) {
+  if (sorted.empty()) return 0;
+  auto idx = static_cast<size_t>(static_cast<double>(sorted.size() - 1) * p);
+  return sorted[idx];
+}
+
+void printLatencies(const char *label, std::vector<long long> latencies) {
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << label << " round trips: " << latencies.size() << "\n";
+  std::cout << label << " RTT (ns): P50=" << percentile(latencies, 0.50)
+            << " P99=" << percentile(latencies, 0.99)
+            << " P99.9=" << percentile(latencies, 0.999)
+            << " Max=" << (latencies.empty() ? 0 : latencies.back()) << "\n";
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string prefix = "ome";
+  std::string symbol = "SHM";
+  std::string host = "127.0.0.1";
+  int port = 0;
+  int orders = 100000;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string arg = argv[i];
+    std::string value = argv[i + 1];
+    if (arg == "--prefix") prefix = value;
+    if (arg == "--symbol") symbol = value;
+    if (arg == "--host") host = value;
+    if (arg == "--port") port = std::stoi(value);
+    if (arg == "--orders") orders = std::stoi(value);
+  }
+
+  ShmTransport shm;
+  int32_t symbolId = -1;
+  if (!shm.connect(prefix) || !lookupSymbol(shm, symbol, symbolId)) {
+    std::cerr << "No free shared-memory slot under prefix " << prefix
+              << "\n";
+    return 1;
+  }
+  std::cout << "Timing " << orders << " orders on " << symbol << " (id "
+            << symbolId << ")...\n";
+  printLatencies("shm", timeRoundTrips(shm, symbolId, orders));
+
+  if (port > 0) {
+    TcpTransport tcp;
+    if (!tcp.connect(host, port) || !lookupSymbol(tcp, symbol, symbolId)) {
+      std::cerr << "Cannot reach " << host << ":" << port << "\n";
+      return 1;
+    }
+    printLatencies("tcp", timeRoundTrips(tcp, symbolId, orders));
+  }
+  return 0;
+}
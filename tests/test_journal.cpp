@@ -0,0 +1,385 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Exchange.hpp"
+#include "Journal.hpp"
+
+namespace {
+std::string journalPath(const char* name) {
+  return ::testing::TempDir() + name + "-" + std::to_string(getpid()) +
+         ".journal";
+}
+
+bool readJournal(const std::string& path, JournalFileHeader& header,
+                 std::vector<JournalRecord>& records) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+    return false;
+  }
+  JournalRecord record;
+  while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+    records.push_back(record);
+  }
+  return true;
+}
+}  // namespace
+
+TEST(JournalTest, RecordsEveryShardsCommandsInOrder) {
+  const std::string path = journalPath("order");
+  {
+    Exchange engine(2);
+    int32_t symA = engine.registerSymbol("SYM_A", 0);
+    ASSERT_TRUE(engine.enableJournal(path, JournalOptions{}));
+    int32_t symB = engine.registerSymbol("SYM_B", 1,
+                                         MatchingAlgorithm::ProRata);
+
+    for (OrderId id = 1; id <= 100; ++id) {
+      int32_t sym = (id % 2) ? symA : symB;
+      OrderSide side = (id % 4 < 2) ? OrderSide::Buy : OrderSide::Sell;
+      engine.submitOrder(Order(id, id, sym, side, OrderType::Limit,
+                               100 + static_cast<Price>(id % 7), 10));
+    }
+    engine.cancelOrder(symA, 1);
+    engine.modifyOrder(symB, 2, 95, 5);
+    engine.drain();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    Journal& journal = *engine.journal();
+    journal.sync();
+    EXPECT_EQ(journal.durableSequence(0), 51u);
+    EXPECT_EQ(journal.durableSequence(1), 51u);
+    EXPECT_GE(journal.syncs(), 1u);
+  }
+
+  JournalFileHeader header;
+  std::vector<JournalRecord> records;
+  ASSERT_TRUE(readJournal(path, header, records));
+  std::remove(path.c_str());
+  EXPECT_EQ(std::memcmp(header.magic, JournalFileHeader::MAGIC, 8), 0);
+  EXPECT_EQ(header.recordSize, sizeof(JournalRecord));
+  EXPECT_EQ(header.shardCount, 2u);
+  ASSERT_GE(records.size(), 2u + 102u);
+
+  // Symbols lead, in registration order.
+  ASSERT_EQ(records[0].type, JournalRecordType::Symbol);
+  EXPECT_STREQ(records[0].payload.symbol.name, "SYM_A");
+  ASSERT_EQ(records[1].type, JournalRecordType::Symbol);
+  EXPECT_STREQ(records[1].payload.symbol.name, "SYM_B");
+  EXPECT_EQ(records[1].payload.symbol.shardId, 1);
+  EXPECT_EQ(records[1].payload.symbol.algorithm, MatchingAlgorithm::ProRata);
+
+  std::map<uint16_t, uint64_t> lastSequence;
+  std::map<uint16_t, std::vector<Exchange::Command::Type>> types;
+  for (size_t i = 2; i < records.size(); ++i) {
+    const JournalRecord& record = records[i];
+    EXPECT_EQ(record.checksum, record.computeChecksum());
+    if (record.type == JournalRecordType::Checkpoint) {
+      // Follows the batch it covers.
+      EXPECT_EQ(record.sequence, lastSequence[record.shardId]);
+      continue;
+    }
+    ASSERT_EQ(record.type, JournalRecordType::Command);
+    EXPECT_EQ(record.sequence, lastSequence[record.shardId] + 1);
+    lastSequence[record.shardId] = record.sequence;
+    types[record.shardId].push_back(record.payload.command.type);
+  }
+  EXPECT_EQ(types[0].size() + types[1].size(), 102u);
+  EXPECT_EQ(types[0].back(), Exchange::Command::Cancel);
+  EXPECT_EQ(types[1].back(), Exchange::Command::Modify);
+}
+
+TEST(JournalTest, PoliciesDecideWhenToSync) {
+  const std::string path = journalPath("policy");
+  Exchange::Command command;
+  command.type = Exchange::Command::Add;
+
+  JournalOptions options;
+  options.sync = JournalSyncPolicy::None;
+  Journal journal(path, 1, options);
+  ASSERT_TRUE(journal.open());
+  journal.append(0, 1, &command, 1);
+  for (int i = 0; i < 200 && journal.durableSequence(0) < 1; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_EQ(journal.durableSequence(0), 1u);
+  EXPECT_EQ(journal.syncs(), 0u);
+  // An explicit sync flushes whatever the policy.
+  journal.sync();
+  EXPECT_EQ(journal.syncs(), 1u);
+  journal.close();
+
+  // A journal in the way is left alone, not truncated.
+  Journal reopened(path, 1, options);
+  EXPECT_FALSE(reopened.open());
+  JournalFileHeader header;
+  std::vector<JournalRecord> records;
+  ASSERT_TRUE(readJournal(path, header, records));
+  EXPECT_EQ(records.size(), 1u);
+  std::remove(path.c_str());
+
+  options.sync = JournalSyncPolicy::Interval;
+  options.syncInterval = std::chrono::hours(1);
+  Journal interval(path, 1, options);
+  ASSERT_TRUE(interval.open());
+  interval.append(0, 1, &command, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(interval.bytesWritten(), sizeof(JournalRecord));
+  EXPECT_EQ(interval.durableSequence(0), 0u);
+  interval.sync();
+  EXPECT_EQ(interval.durableSequence(0), 1u);
+  interval.close();
+  std::remove(path.c_str());
+}
+
+TEST(JournalTest, GroupCommitHoldsResultsUntilSynced) {
+  const std::string path = journalPath("held");
+  std::atomic<uint64_t> reports{0};
+  std::atomic<uint64_t> trades{0};
+  std::atomic<uint64_t> early{0};
+  {
+    Exchange engine(1);
+    int32_t sym = engine.registerSymbol("SYM", 0);
+    ASSERT_TRUE(engine.enableJournal(path, JournalOptions{}));
+    // Order n is the shard's command n, so a result is early if its order's
+    // sequence is not yet durable when the listener sees it.
+    engine.addExecutionReportCallback(
+        [&](const std::vector<ExecutionReport>& batch) {
+          const uint64_t durable = engine.journal()->durableSequence(0);
+          for (const auto& report : batch) {
+            if (report.orderId > durable) ++early;
+          }
+          reports += batch.size();
+        });
+    engine.addTradeCallback([&](const std::vector<Trade>& batch) {
+      const uint64_t durable = engine.journal()->durableSequence(0);
+      for (const auto& trade : batch) {
+        if (trade.takerOrderId > durable) ++early;
+      }
+      trades += batch.size();
+    });
+
+    for (OrderId id = 1; id <= 2000; ++id) {
+      Order order(id, id, sym, (id % 2) ? OrderSide::Buy : OrderSide::Sell,
+                  OrderType::Limit, 100, 1);
+      order.sessionId = 1;
+      order.ownerId = 1;
+      engine.submitOrder(order);
+    }
+    engine.flush();
+    // Stopping releases what is still held once the journal has synced it.
+  }
+  std::remove(path.c_str());
+  EXPECT_EQ(early.load(), 0u);
+  EXPECT_EQ(trades.load(), 1000u);
+  // A New for every buy, and a fill for each side of every trade.
+  EXPECT_EQ(reports.load(), 3000u);
+}
+
+namespace {
+// Drives a journaled two-shard engine with crossing orders, cancels and
+// modifies; returns the live trade count and each symbol's final depth.
+// With `snapshotPath`, a snapshot is taken halfway and `atSnapshot` gets the
+// depth it holds.
+uint64_t runJournaledSession(const std::string& path,
+                             std::vector<DepthSnapshot>& depth,
+                             const std::string& snapshotPath = "",
+                             std::vector<DepthSnapshot>* atSnapshot = nullptr,
+                             uint64_t* tradesAtSnapshot = nullptr,
+                             std::vector<Exchange::ShardDigest>* digest =
+                                 nullptr) {
+  Exchange engine(2);
+  JournalOptions options;
+  options.stateCheckInterval = std::chrono::microseconds(1);
+  EXPECT_TRUE(engine.enableJournal(path, options));
+  const int32_t symbols[] = {engine.registerSymbol("SYM_A", 0),
+                             engine.registerSymbol("SYM_B", 1)};
+  std::atomic<uint64_t> trades{0};
+  engine.setTradeCallback([&](const std::vector<Trade>& batch) {
+    trades += batch.size();
+  });
+
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<int> action(0, 9);
+  std::uniform_int_distribution<Price> price(95, 105);
+  std::uniform_int_distribution<Quantity> quantity(1, 50);
+  for (OrderId id = 1; id <= 3000; ++id) {
+    if (id == 1501 && !snapshotPath.empty()) {
+      EXPECT_TRUE(engine.writeSnapshot(snapshotPath));
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      if (tradesAtSnapshot) *tradesAtSnapshot = trades.load();
+      if (atSnapshot) {
+        atSnapshot->resize(2);
+        for (int s = 0; s < 2; ++s) {
+          EXPECT_TRUE(engine.getDepth(symbols[s], (*atSnapshot)[s]));
+        }
+      }
+    }
+    int32_t sym = symbols[id % 2];
+    int a = action(gen);
+    if (a == 0 && id > 10) {
+      engine.cancelOrder(sym, id - 10);
+    } else if (a == 1 && id > 20) {
+      engine.modifyOrder(sym, id - 20, price(gen), quantity(gen));
+    } else {
+      OrderSide side = (a % 2) ? OrderSide::Buy : OrderSide::Sell;
+      engine.submitOrder(Order(id, id, sym, side, OrderType::Limit,
+                               price(gen), quantity(gen)));
+    }
+  }
+  engine.drain();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  depth.resize(2);
+  for (int s = 0; s < 2; ++s) {
+    EXPECT_TRUE(engine.getDepth(symbols[s], depth[s]));
+  }
+  if (digest) *digest = engine.digest();
+  return trades.load();
+}
+
+void expectSameDepth(const DepthSnapshot& a, const DepthSnapshot& b) {
+  ASSERT_EQ(a.bidLevels, b.bidLevels);
+  ASSERT_EQ(a.askLevels, b.askLevels);
+  for (int i = 0; i < a.bidLevels; ++i) {
+    EXPECT_EQ(a.bids[i].price, b.bids[i].price);
+    EXPECT_EQ(a.bids[i].quantity, b.bids[i].quantity);
+  }
+  for (int i = 0; i < a.askLevels; ++i) {
+    EXPECT_EQ(a.asks[i].price, b.asks[i].price);
+    EXPECT_EQ(a.asks[i].quantity, b.asks[i].quantity);
+  }
+}
+}  // namespace
+
+TEST(JournalTest, RecoveryRebuildsTheBooks) {
+  const std::string path = journalPath("recover");
+  std::vector<DepthSnapshot> live;
+  std::vector<Exchange::ShardDigest> liveDigest;
+  uint64_t liveTrades =
+      runJournaledSession(path, live, "", nullptr, nullptr, &liveDigest);
+  ASSERT_GT(liveTrades, 0u);
+
+  Exchange recovered(2);
+  auto result = recovered.recoverFromJournal(path);
+  std::remove(path.c_str());
+  ASSERT_TRUE(result.ok) << result.error;
+  // Each shard journals the digest request as a no-op command.
+  EXPECT_EQ(result.commands, 3000u + liveDigest.size());
+  EXPECT_EQ(result.trades, liveTrades);
+  EXPECT_GT(result.checkpoints, 0u);
+  EXPECT_GT(result.stateChecks, 0u);
+  EXPECT_EQ(recovered.getSymbolName(1), "SYM_B");
+  for (int32_t s = 0; s < 2; ++s) {
+    DepthSnapshot depth;
+    ASSERT_TRUE(recovered.getDepth(s, depth));
+    expectSameDepth(live[s], depth);
+  }
+  EXPECT_GT(recovered.nextOrderId(), 3000u);
+  // Same trades, same books, shard by shard.
+  EXPECT_EQ(recovered.digest(), liveDigest);
+}
+
+TEST(JournalTest, RecoveryStopsAtTornTailAndCatchesDivergence) {
+  const std::string path = journalPath("torn");
+  std::vector<DepthSnapshot> live;
+  runJournaledSession(path, live);
+
+  // A crash mid-write leaves a partial last record; it is ignored.
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(0, std::ios::end);
+    const char garbage[sizeof(JournalRecord) / 2] = {1};
+    file.write(garbage, sizeof(garbage));
+  }
+  {
+    Exchange recovered(2);
+    auto result = recovered.recoverFromJournal(path);
+    EXPECT_TRUE(result.ok) << result.error;
+    EXPECT_EQ(result.commands, 3000u);
+  }
+
+  // Trades that no longer match their checkpoint fail the recovery.
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(sizeof(JournalFileHeader));
+    JournalRecord record;
+    std::streamoff offset = sizeof(JournalFileHeader);
+    while (file.read(reinterpret_cast<char*>(&record), sizeof(record)) &&
+           record.type != JournalRecordType::Checkpoint) {
+      offset += sizeof(record);
+    }
+    ASSERT_EQ(record.type, JournalRecordType::Checkpoint);
+    record.payload.checkpoint.tradeHash ^= 1;
+    record.checksum = record.computeChecksum();
+    file.seekp(offset);
+    file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+  }
+  Exchange recovered(2);
+  auto result = recovered.recoverFromJournal(path);
+  std::remove(path.c_str());
+  EXPECT_FALSE(result.ok);
+  EXPECT_NE(result.error.find("checksum"), std::string::npos);
+}
+
+TEST(JournalTest, SnapshotRestoreReplaysOnlyTheTail) {
+  const std::string path = journalPath("tail");
+  const std::string snapshot = journalPath("tail-snapshot");
+  std::vector<DepthSnapshot> live;
+  std::vector<DepthSnapshot> atSnapshot;
+  uint64_t tradesAtSnapshot = 0;
+  uint64_t liveTrades = runJournaledSession(path, live, snapshot, &atSnapshot,
+                                            &tradesAtSnapshot);
+  ASSERT_GT(liveTrades, tradesAtSnapshot);
+
+  {
+    Exchange restored(2);
+    auto result = restored.restoreFromSnapshot(snapshot, path);
+    ASSERT_TRUE(result.ok) << result.error;
+    EXPECT_GT(result.orders, 0u);
+    // The snapshot command itself is the last one the images cover.
+    EXPECT_EQ(result.commands, 1500u);
+    EXPECT_EQ(result.trades, liveTrades - tradesAtSnapshot);
+    EXPECT_GT(result.checkpoints, 0u);
+    EXPECT_EQ(restored.getSymbolName(1), "SYM_B");
+    for (int32_t s = 0; s < 2; ++s) {
+      DepthSnapshot depth;
+      ASSERT_TRUE(restored.getDepth(s, depth));
+      expectSameDepth(live[s], depth);
+    }
+    EXPECT_GT(restored.nextOrderId(), 3000u);
+  }
+  {
+    // The snapshot alone is the books as of the barrier.
+    Exchange restored(2);
+    auto result = restored.restoreFromSnapshot(snapshot);
+    ASSERT_TRUE(result.ok) << result.error;
+    EXPECT_EQ(result.commands, 0u);
+    for (int32_t s = 0; s < 2; ++s) {
+      DepthSnapshot depth;
+      ASSERT_TRUE(restored.getDepth(s, depth));
+      expectSameDepth(atSnapshot[s], depth);
+    }
+  }
+
+  // A later journal, once the old one is gone, restarts its sequences and
+  // cannot extend the snapshot.
+  std::remove(path.c_str());
+  std::vector<DepthSnapshot> other;
+  runJournaledSession(path, other);
+  Exchange restored(2);
+  auto result = restored.restoreFromSnapshot(snapshot, path);
+  std::remove(path.c_str());
+  std::remove(snapshot.c_str());
+  EXPECT_FALSE(result.ok);
+  EXPECT_NE(result.error.find("not the journal"), std::string::npos);
+}
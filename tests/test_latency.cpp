@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <thread>
+
+#include "Exchange.hpp"
+#include "LatencyHistogram.hpp"
+#include "Tsc.hpp"
+
+TEST(LatencyHistogramTest, PercentilesWithinBucketPrecision) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.percentile(50), 0u);
+  for (uint64_t v = 1; v <= 100000; ++v) histogram.record(v);
+  EXPECT_EQ(histogram.count(), 100000u);
+  EXPECT_EQ(histogram.min(), 1u);
+  EXPECT_EQ(histogram.max(), 100000u);
+  EXPECT_DOUBLE_EQ(histogram.mean(), 50000.5);
+  for (double p : {50.0, 90.0, 99.0, 99.9, 99.99}) {
+    const auto exact = static_cast<double>(p * 1000);
+    const auto reported = static_cast<double>(histogram.percentile(p));
+    EXPECT_GE(reported, exact) << p;
+    EXPECT_LE(reported, exact * (1 + 1.0 / 64)) << p;
+  }
+  EXPECT_EQ(histogram.percentile(100), 100000u);
+
+  // Small values are exact, huge ones still land somewhere.
+  LatencyHistogram small;
+  for (uint64_t v = 0; v < 100; ++v) small.record(v);
+  EXPECT_EQ(small.percentile(50), 49u);
+  small.record(UINT64_MAX);
+  EXPECT_EQ(small.percentile(100), UINT64_MAX);
+}
+
+TEST(LatencyHistogramTest, MergesPerThreadHistograms) {
+  LatencyHistogram a;
+  LatencyHistogram b;
+  LatencyHistogram both;
+  std::mt19937_64 gen(1);
+  std::lognormal_distribution<double> latency(8.0, 1.5);
+  for (int i = 0; i < 50000; ++i) {
+    const auto v = static_cast<uint64_t>(latency(gen));
+    (i % 3 ? a : b).record(v);
+    both.record(v);
+  }
+  a.merge(b);
+  EXPECT_EQ(a.count(), both.count());
+  EXPECT_EQ(a.min(), both.min());
+  EXPECT_EQ(a.max(), both.max());
+  for (double p : {50.0, 99.0, 99.99}) {
+    EXPECT_EQ(a.percentile(p), both.percentile(p));
+  }
+  a.reset();
+  EXPECT_EQ(a.count(), 0u);
+  EXPECT_EQ(a.max(), 0u);
+}
+
+TEST(LatencyHistogramTest, TscTicksConvertToNanoseconds) {
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t first = tscNow();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  const uint64_t nanos = tscToNanos(tscNow() - first);
+  const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+  EXPECT_GT(nanos, 15000000u);
+  EXPECT_LE(nanos, static_cast<uint64_t>(elapsed) * 11 / 10);
+}
+
+TEST(ExchangeTest, LatencyMetricsCoverAcksAndTrades) {
+  Exchange engine(1);
+  const int32_t sym = engine.registerSymbol("LAT", 0);
+  // Off by default.
+  engine.submitOrder(Order(1, 1, sym, OrderSide::Buy, OrderType::Limit, 99, 5));
+  EXPECT_EQ(engine.latencyMetrics().ack.count(), 0u);
+
+  engine.enableLatencyMetrics(true);
+  for (OrderId id = 2; id <= 101; ++id) {
+    engine.submitOrder(
+        Order(id, id, sym, OrderSide::Sell, OrderType::Limit, 100, 1));
+  }
+  // Ten of these trade, the rest rest; the cancel acks too.
+  for (OrderId id = 102; id <= 121; ++id) {
+    engine.submitOrder(Order(id, id, sym, OrderSide::Buy, OrderType::Limit,
+                             id <= 111 ? 100 : 98, 1));
+  }
+  engine.cancelOrder(sym, 1);
+
+  auto metrics = engine.latencyMetrics(true);
+  EXPECT_EQ(metrics.ack.count(), 121u);
+  EXPECT_EQ(metrics.trade.count(), 10u);
+  EXPECT_GT(metrics.ack.max(), 0u);
+  EXPECT_LE(metrics.trade.percentile(50), metrics.trade.max());
+  // Reset by the previous call.
+  EXPECT_EQ(engine.latencyMetrics().ack.count(), 0u);
+}
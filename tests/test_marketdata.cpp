@@ -0,0 +1,246 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Exchange.hpp"
+#include "MarketDataFeed.hpp"
+
+namespace {
+struct FeedMessage {
+  uint64_t sequence;
+  FeedMessageType type;
+  FeedTrade trade;
+  FeedQuote quote;
+  FeedLevelUpdate level;
+};
+
+// Splits one packet into its messages, numbering them from the header.
+std::vector<FeedMessage> parsePacket(const char* data, size_t size,
+                                     FeedPacketHeader& header) {
+  std::vector<FeedMessage> messages;
+  std::memcpy(&header, data, sizeof(header));
+  size_t pos = sizeof(header);
+  for (uint16_t i = 0; i < header.count && pos < size; ++i) {
+    FeedMessage msg{};
+    msg.sequence = header.sequence + i;
+    msg.type = static_cast<FeedMessageType>(data[pos]);
+    size_t length = feedMessageSize(msg.type);
+    if (msg.type == FeedMessageType::Trade) {
+      std::memcpy(&msg.trade, data + pos, length);
+    } else if (msg.type == FeedMessageType::Quote) {
+      std::memcpy(&msg.quote, data + pos, length);
+    } else {
+      std::memcpy(&msg.level, data + pos, length);
+    }
+    pos += length;
+    messages.push_back(msg);
+  }
+  return messages;
+}
+
+// Reads length-prefixed packets from the recovery port until the empty
+// packet that ends a reply.
+std::vector<FeedMessage> readRecoveryReply(int fd, FeedPacketHeader& last) {
+  std::vector<FeedMessage> messages;
+  while (true) {
+    uint16_t length = 0;
+    if (recv(fd, &length, sizeof(length), MSG_WAITALL) != sizeof(length)) {
+      break;
+    }
+    std::vector<char> packet(length);
+    if (recv(fd, packet.data(), length, MSG_WAITALL) != length) break;
+    auto batch = parsePacket(packet.data(), length, last);
+    if (last.count == 0) break;
+    messages.insert(messages.end(), batch.begin(), batch.end());
+  }
+  return messages;
+}
+
+void waitForSequence(const MarketDataFeed& feed, uint64_t sequence) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while (feed.lastSequence() < sequence &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+}  // namespace
+
+TEST(MarketDataFeedTest, SequencesPacketsAndServesRecovery) {
+  int udp = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(bind(udp, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+  socklen_t addrLen = sizeof(addr);
+  getsockname(udp, reinterpret_cast<sockaddr*>(&addr), &addrLen);
+  timeval timeout{.tv_sec = 2, .tv_usec = 0};
+  setsockopt(udp, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  Exchange engine(1);
+  int32_t symId = engine.registerSymbol("TEST", 0);
+  MarketDataFeed feed(engine, "127.0.0.1", ntohs(addr.sin_port));
+  ASSERT_TRUE(feed.start());
+
+  engine.submitOrder(
+      Order(1, 0, symId, OrderSide::Sell, OrderType::Limit, 100, 10));
+  engine.flush();
+  waitForSequence(feed, 2);
+  engine.submitOrder(
+      Order(2, 0, symId, OrderSide::Buy, OrderType::Limit, 100, 4));
+  engine.flush();
+  waitForSequence(feed, 5);
+
+  std::vector<FeedMessage> live;
+  char buffer[MarketDataFeed::MAX_PACKET_BYTES];
+  while (live.size() < 5) {
+    ssize_t n = recv(udp, buffer, sizeof(buffer), 0);
+    ASSERT_GT(n, 0);
+    FeedPacketHeader header;
+    auto batch = parsePacket(buffer, static_cast<size_t>(n), header);
+    live.insert(live.end(), batch.begin(), batch.end());
+  }
+  ASSERT_EQ(live.size(), 5);
+  for (size_t i = 0; i < live.size(); ++i) {
+    EXPECT_EQ(live[i].sequence, i + 1);
+  }
+  ASSERT_EQ(live[0].type, FeedMessageType::LevelUpdate);
+  EXPECT_EQ(live[0].level.action, DeltaAction::New);
+  EXPECT_EQ(live[0].level.side, OrderSide::Sell);
+  EXPECT_EQ(live[0].level.price, 100);
+  EXPECT_EQ(live[0].level.quantity, 10);
+  ASSERT_EQ(live[1].type, FeedMessageType::Quote);
+  EXPECT_EQ(live[1].quote.askPrice, 100);
+  EXPECT_EQ(live[1].quote.askQuantity, 10);
+  ASSERT_EQ(live[2].type, FeedMessageType::Trade);
+  EXPECT_EQ(live[2].trade.quantity, 4);
+  EXPECT_EQ(live[2].trade.makerOrderId, 1);
+  ASSERT_EQ(live[3].type, FeedMessageType::LevelUpdate);
+  EXPECT_EQ(live[3].level.action, DeltaAction::Change);
+  EXPECT_EQ(live[3].level.quantity, 6);
+  ASSERT_EQ(live[4].type, FeedMessageType::Quote);
+  EXPECT_EQ(live[4].quote.askQuantity, 6);
+
+  int tcp = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in recovery{};
+  recovery.sin_family = AF_INET;
+  recovery.sin_port = htons(feed.recoveryPort());
+  recovery.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(connect(tcp, reinterpret_cast<sockaddr*>(&recovery),
+                    sizeof(recovery)),
+            0);
+  setsockopt(tcp, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  std::string request = "RETRANSMIT 3 100\nSNAPSHOT\n";
+  ASSERT_EQ(send(tcp, request.data(), request.size(), MSG_NOSIGNAL),
+            static_cast<ssize_t>(request.size()));
+
+  FeedPacketHeader last{};
+  auto replay = readRecoveryReply(tcp, last);
+  ASSERT_EQ(replay.size(), 3);
+  EXPECT_EQ(replay[0].sequence, 3);
+  EXPECT_EQ(replay[0].type, FeedMessageType::Trade);
+  EXPECT_EQ(replay[2].sequence, 5);
+  EXPECT_EQ(last.sequence, 5);
+
+  auto snapshot = readRecoveryReply(tcp, last);
+  EXPECT_EQ(last.sequence, 5);
+  EXPECT_EQ(last.flags, FeedPacketHeader::SNAPSHOT);
+  ASSERT_EQ(snapshot.size(), 3);
+  EXPECT_EQ(snapshot[0].type, FeedMessageType::Quote);
+  EXPECT_EQ(snapshot[0].quote.askQuantity, 6);
+  EXPECT_EQ(snapshot[1].type, FeedMessageType::Trade);
+  ASSERT_EQ(snapshot[2].type, FeedMessageType::LevelUpdate);
+  EXPECT_EQ(snapshot[2].level.price, 100);
+  EXPECT_EQ(snapshot[2].level.quantity, 6);
+
+  close(tcp);
+  close(udp);
+  feed.stop();
+}
+
+TEST(MarketDataFeedTest, DroppedEventsLeaveAGapAndRebuildTheSnapshot) {
+  int udp = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(bind(udp, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+  socklen_t addrLen = sizeof(addr);
+  getsockname(udp, reinterpret_cast<sockaddr*>(&addr), &addrLen);
+  timeval timeout{.tv_sec = 2, .tv_usec = 0};
+  setsockopt(udp, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  Exchange engine(1);
+  int32_t symId = engine.registerSymbol("TEST", 0);
+  // Room for 15 events and no publisher yet: ten new levels make twenty
+  // (a level update and a quote each), so the last five are dropped.
+  MarketDataFeed feed(engine, "127.0.0.1", ntohs(addr.sin_port), 0, 16);
+  for (int i = 1; i <= 10; ++i) {
+    engine.submitOrder(Order(i, 0, symId, OrderSide::Buy, OrderType::Limit,
+                             90 + i, 10));
+    engine.flush();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    DepthSnapshot depth;
+    while (engine.getDepth(symId, depth) && depth.bidLevels < i &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  EXPECT_EQ(feed.droppedEvents(), 5);
+
+  ASSERT_TRUE(feed.start());
+  waitForSequence(feed, 20);
+  EXPECT_EQ(feed.lastSequence(), 20);
+
+  // The dropped events keep their sequence numbers, so the gap shows.
+  char buffer[MarketDataFeed::MAX_PACKET_BYTES];
+  ssize_t n = recv(udp, buffer, sizeof(buffer), 0);
+  ASSERT_GT(n, 0);
+  FeedPacketHeader header;
+  auto live = parsePacket(buffer, static_cast<size_t>(n), header);
+  EXPECT_EQ(header.sequence, 6);
+  ASSERT_EQ(live.size(), 15);
+
+  int tcp = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in recovery{};
+  recovery.sin_family = AF_INET;
+  recovery.sin_port = htons(feed.recoveryPort());
+  recovery.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(connect(tcp, reinterpret_cast<sockaddr*>(&recovery),
+                    sizeof(recovery)),
+            0);
+  setsockopt(tcp, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  std::string request = "RETRANSMIT 1 100\nSNAPSHOT\n";
+  ASSERT_EQ(send(tcp, request.data(), request.size(), MSG_NOSIGNAL),
+            static_cast<ssize_t>(request.size()));
+
+  FeedPacketHeader last{};
+  auto replay = readRecoveryReply(tcp, last);
+  ASSERT_EQ(replay.size(), 15);
+  EXPECT_EQ(replay[0].sequence, 6);
+  EXPECT_EQ(last.sequence, 20);
+
+  // The snapshot holds all ten levels and the quote the lost events carried.
+  auto snapshot = readRecoveryReply(tcp, last);
+  EXPECT_EQ(last.sequence, 20);
+  ASSERT_EQ(snapshot.size(), 11);
+  ASSERT_EQ(snapshot[0].type, FeedMessageType::Quote);
+  EXPECT_EQ(snapshot[0].quote.bidPrice, 100);
+  EXPECT_EQ(snapshot[0].quote.bidQuantity, 10);
+  for (size_t i = 1; i < snapshot.size(); ++i) {
+    ASSERT_EQ(snapshot[i].type, FeedMessageType::LevelUpdate);
+    EXPECT_EQ(snapshot[i].level.price, static_cast<Price>(90 + i));
+    EXPECT_EQ(snapshot[i].level.quantity, 10);
+  }
+
+  close(tcp);
+  close(udp);
+  feed.stop();
+}
@@ -1,12 +1,17 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <random>
+#include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "Exchange.hpp"
+#include "L3BookBuilder.hpp"
 #include "OrderBook.hpp"
 
 class ExchangeLogicTest : public ::testing::Test {
@@ -180,6 +185,580 @@ TEST_F(ExchangeLogicTest, MarketOrderFullFill) {
   ASSERT_EQ(trades[0].price, 10000);
 }
 
+TEST_F(ExchangeLogicTest, StopOrderTriggersOnTrade) {
+  int32_t symId = engine.registerSymbol("TEST", -1);
+  engine.submitOrder(
+      Order(1, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 10));
+  engine.submitOrder(
+      Order(2, 0, symId, OrderSide::Sell, OrderType::Limit, 10100, 10));
+  engine.submitOrder(Order(3, 0, symId, OrderSide::Buy, OrderType::Stop, 0, 5,
+                           10000));
+
+  auto noTrades = waitForTrades(1, std::chrono::milliseconds(50));
+  ASSERT_TRUE(noTrades.empty());
+
+  engine.submitOrder(
+      Order(4, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 10));
+
+  auto trades = waitForTrades(2);
+  ASSERT_EQ(trades.size(), 2);
+  ASSERT_EQ(trades[0].takerOrderId, 4);
+  ASSERT_EQ(trades[1].takerOrderId, 3);
+  ASSERT_EQ(trades[1].makerOrderId, 2);
+  ASSERT_EQ(trades[1].price, 10100);
+  ASSERT_EQ(trades[1].quantity, 5);
+}
+
+TEST_F(ExchangeLogicTest, StopOrdersCascadeInTriggerOrder) {
+  int32_t symId = engine.registerSymbol("TEST", -1);
+  engine.submitOrder(
+      Order(1, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 1));
+  engine.submitOrder(
+      Order(2, 0, symId, OrderSide::Buy, OrderType::Limit, 9900, 1));
+  engine.submitOrder(
+      Order(3, 0, symId, OrderSide::Buy, OrderType::Limit, 9800, 1));
+  engine.submitOrder(Order(4, 0, symId, OrderSide::Sell,
+                           OrderType::StopLimit, 9800, 1, 9900));
+  engine.submitOrder(Order(5, 0, symId, OrderSide::Sell, OrderType::Stop, 0, 1,
+                           10000));
+
+  engine.submitOrder(
+      Order(6, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 1));
+
+  auto trades = waitForTrades(3);
+  ASSERT_EQ(trades.size(), 3);
+  ASSERT_EQ(trades[0].takerOrderId, 6);
+  ASSERT_EQ(trades[1].takerOrderId, 5);
+  ASSERT_EQ(trades[1].price, 9900);
+  ASSERT_EQ(trades[2].takerOrderId, 4);
+  ASSERT_EQ(trades[2].price, 9800);
+
+  engine.stop();
+  OrderBook* book = const_cast<OrderBook*>(engine.getOrderBook(symId));
+  ASSERT_NE(book, nullptr);
+  ASSERT_FALSE(book->hasStopOrders());
+  ASSERT_EQ(book->getLastTradePrice(), 9800);
+}
+
+TEST_F(ExchangeLogicTest, CancelStopOrder) {
+  int32_t symId = engine.registerSymbol("TEST", -1);
+  engine.submitOrder(Order(1, 0, symId, OrderSide::Buy, OrderType::Stop, 0, 5,
+                           10000));
+  waitForProcessing();
+  engine.cancelOrder(symId, 1);
+
+  engine.submitOrder(
+      Order(2, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 10));
+  engine.submitOrder(
+      Order(3, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 5));
+
+  auto trades = waitForTrades(2, std::chrono::milliseconds(100));
+  ASSERT_EQ(trades.size(), 1);
+  ASSERT_EQ(trades[0].takerOrderId, 3);
+
+  engine.stop();
+  OrderBook* book = const_cast<OrderBook*>(engine.getOrderBook(symId));
+  ASSERT_FALSE(book->hasStopOrders());
+  ASSERT_EQ(countActiveOrdersAt(book, 10000, OrderSide::Sell), 1);
+}
+
+TEST_F(ExchangeLogicTest, IcebergReplenishesAtBackOfLevel) {
+  int32_t symId = engine.registerSymbol("TEST", -1);
+  Order iceberg(1, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 25);
+  iceberg.peakQuantity = 10;
+  engine.submitOrder(iceberg);
+  engine.submitOrder(
+      Order(2, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 5));
+  waitForProcessing();
+
+  const OrderBook* book = engine.getOrderBook(symId);
+  ASSERT_EQ(book->getLevel(10000, OrderSide::Sell).totalQuantity, 15);
+
+  engine.submitOrder(
+      Order(3, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 12));
+  engine.submitOrder(
+      Order(4, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 5));
+
+  auto trades = waitForTrades(4);
+  ASSERT_EQ(trades.size(), 4);
+  ASSERT_EQ(trades[0].makerOrderId, 1);
+  ASSERT_EQ(trades[0].quantity, 10);
+  ASSERT_EQ(trades[1].makerOrderId, 2);
+  ASSERT_EQ(trades[1].quantity, 2);
+  // The replenished slice lost time priority to order 2.
+  ASSERT_EQ(trades[2].makerOrderId, 2);
+  ASSERT_EQ(trades[2].quantity, 3);
+  ASSERT_EQ(trades[3].makerOrderId, 1);
+  ASSERT_EQ(trades[3].quantity, 2);
+
+  engine.stop();
+  const auto& level = book->getLevel(10000, OrderSide::Sell);
+  ASSERT_EQ(level.totalQuantity, 8);
+  ASSERT_EQ(level.activeCount, 1);
+  const Order* rest = getFirstActive(book, 10000, OrderSide::Sell);
+  ASSERT_NE(rest, nullptr);
+  ASSERT_EQ(rest->quantity, 8);
+  ASSERT_EQ(rest->hiddenQuantity, 5);
+}
+
+TEST(OrderBookTest, LoneIcebergRefillsInPlace) {
+  auto book = std::make_unique<OrderBook>();
+  StandardMatchingStrategy strategy;
+  std::vector<Trade> trades;
+  Order iceberg(1, 0, 0, OrderSide::Sell, OrderType::Limit, 100, 45);
+  iceberg.peakQuantity = 10;
+  strategy.match(*book, iceberg, trades);
+
+  // One sweep takes three slices and part of a fourth, all from slot 0.
+  Order sweep(2, 0, 0, OrderSide::Buy, OrderType::Limit, 100, 34);
+  strategy.match(*book, sweep, trades);
+  ASSERT_EQ(trades.size(), 4u);
+  for (const Trade& trade : trades) EXPECT_EQ(trade.makerOrderId, 1u);
+  EXPECT_EQ(trades.back().quantity, 4u);
+
+  const PriceLevel& level = book->getLevel(100, OrderSide::Sell);
+  EXPECT_EQ(level.orders.size(), 1u);
+  EXPECT_EQ(level.totalQuantity, 6u);
+  EXPECT_EQ(level.orders[0].hiddenQuantity, 5u);
+  EXPECT_TRUE(book->cancelOrder(1));
+}
+
+TEST(OrderBookTest, AlternatingIcebergsReuseTheirLevel) {
+  auto book = std::make_unique<OrderBook>();
+  std::vector<L3Event> events;
+  book->setL3Sink(&events);
+  StandardMatchingStrategy strategy;
+  std::vector<Trade> trades;
+  for (OrderId id : {1, 2}) {
+    Order iceberg(id, 0, 0, OrderSide::Sell, OrderType::Limit, 100, 2000);
+    iceberg.peakQuantity = 10;
+    strategy.match(*book, iceberg, trades);
+  }
+
+  // Each buy takes one slice, which goes behind the other iceberg's.
+  const PriceLevel& level = book->getLevel(100, OrderSide::Sell);
+  size_t capacity = 0;
+  for (OrderId id = 3; id < 303; ++id) {
+    Order buy(id, 0, 0, OrderSide::Buy, OrderType::Limit, 100, 10);
+    strategy.match(*book, buy, trades);
+    if (id == 10) capacity = level.orders.capacity();
+  }
+  ASSERT_EQ(trades.size(), 300u);
+  for (size_t i = 0; i < trades.size(); ++i) {
+    EXPECT_EQ(trades[i].makerOrderId, 1 + i % 2) << "trade " << i;
+  }
+  EXPECT_EQ(level.orders.capacity(), capacity);
+
+  // Positions keep rising across compactions, so the L3 stream still
+  // rebuilds the queue.
+  L3BookBuilder builder;
+  for (size_t i = 0; i < events.size(); ++i) {
+    events[i].sequence = i + 1;
+    ASSERT_TRUE(builder.apply(events[i]));
+  }
+  std::string error;
+  EXPECT_TRUE(builder.matches(0, *book, &error)) << error;
+  EXPECT_TRUE(book->cancelOrder(1));
+  EXPECT_TRUE(book->cancelOrder(2));
+}
+
+TEST_F(ExchangeLogicTest, ProRataAllocatesResidueByTimePriority) {
+  int32_t symId =
+      engine.registerSymbol("RATES", -1, MatchingAlgorithm::ProRata);
+  engine.submitOrder(
+      Order(1, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 10));
+  engine.submitOrder(
+      Order(2, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 20));
+  engine.submitOrder(
+      Order(3, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 30));
+  engine.submitOrder(
+      Order(4, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 25));
+
+  auto trades = waitForTrades(4);
+  ASSERT_EQ(trades.size(), 4);
+  ASSERT_EQ(trades[0].makerOrderId, 1);
+  ASSERT_EQ(trades[0].quantity, 4);
+  ASSERT_EQ(trades[1].makerOrderId, 2);
+  ASSERT_EQ(trades[1].quantity, 8);
+  ASSERT_EQ(trades[2].makerOrderId, 3);
+  ASSERT_EQ(trades[2].quantity, 12);
+  ASSERT_EQ(trades[3].makerOrderId, 1);
+  ASSERT_EQ(trades[3].quantity, 1);
+
+  engine.stop();
+  const OrderBook* book = engine.getOrderBook(symId);
+  ASSERT_EQ(book->getLevel(10000, OrderSide::Sell).totalQuantity, 35);
+}
+
+TEST_F(ExchangeLogicTest, PriceTimeProRataFillsTopOfQueueFirst) {
+  int32_t symId = engine.registerSymbol("RATES", -1,
+                                        MatchingAlgorithm::PriceTimeProRata);
+  engine.submitOrder(
+      Order(1, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 10));
+  engine.submitOrder(
+      Order(2, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 20));
+  engine.submitOrder(
+      Order(3, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 30));
+  engine.submitOrder(
+      Order(4, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 25));
+
+  auto trades = waitForTrades(3);
+  ASSERT_EQ(trades.size(), 3);
+  ASSERT_EQ(trades[0].makerOrderId, 1);
+  ASSERT_EQ(trades[0].quantity, 10);
+  ASSERT_EQ(trades[1].makerOrderId, 2);
+  ASSERT_EQ(trades[1].quantity, 6);
+  ASSERT_EQ(trades[2].makerOrderId, 3);
+  ASSERT_EQ(trades[2].quantity, 9);
+}
+
+TEST(ExchangeTest, ExecutionReportsCarrySessionAndQuantities) {
+  std::vector<ExecutionReport> reports;
+  std::mutex mtx;
+  Exchange engine(1);
+  engine.setExecutionReportCallback([&](const auto& batch) {
+    std::lock_guard<std::mutex> lock(mtx);
+    reports.insert(reports.end(), batch.begin(), batch.end());
+  });
+
+  int32_t symId = engine.registerSymbol("TEST", -1);
+  Order maker(1, 101, symId, OrderSide::Sell, OrderType::Limit, 10000, 10);
+  maker.sessionId = 7;
+  maker.ownerId = 7;
+  Order taker(2, 202, symId, OrderSide::Buy, OrderType::Limit, 10000, 4);
+  taker.sessionId = 9;
+  taker.ownerId = 9;
+  Order anonymous(3, 0, symId, OrderSide::Buy, OrderType::Limit, 9000, 4);
+
+  engine.submitOrder(maker);
+  engine.submitOrder(taker);
+  engine.submitOrder(anonymous);
+  // Another session's order is out of reach.
+  engine.cancelOrder(symId, 1, 9);
+  engine.modifyOrder(symId, 1, 10000, 2, 9);
+  engine.cancelOrder(symId, 1, 7);
+  engine.cancelOrder(symId, 1, 7);
+  engine.stop();
+
+  std::lock_guard<std::mutex> lock(mtx);
+  ASSERT_EQ(reports.size(), 7);
+
+  EXPECT_EQ(reports[0].status, ExecStatus::New);
+  EXPECT_EQ(reports[0].sessionId, 7);
+  EXPECT_EQ(reports[0].clientOrderId, 101);
+  EXPECT_EQ(reports[0].leavesQuantity, 10);
+
+  EXPECT_EQ(reports[1].status, ExecStatus::PartiallyFilled);
+  EXPECT_EQ(reports[1].orderId, 1);
+  EXPECT_EQ(reports[1].lastQuantity, 4);
+  EXPECT_EQ(reports[1].lastPrice, 10000);
+  EXPECT_EQ(reports[1].leavesQuantity, 6);
+  EXPECT_EQ(reports[1].cumQuantity, 4);
+
+  EXPECT_EQ(reports[2].status, ExecStatus::Filled);
+  EXPECT_EQ(reports[2].sessionId, 9);
+  EXPECT_EQ(reports[2].clientOrderId, 202);
+  EXPECT_EQ(reports[2].leavesQuantity, 0);
+  EXPECT_EQ(reports[2].cumQuantity, 4);
+
+  for (int i : {3, 4}) {
+    EXPECT_EQ(reports[i].status, ExecStatus::CancelRejected);
+    EXPECT_EQ(reports[i].sessionId, 9);
+    EXPECT_EQ(reports[i].orderId, 1);
+  }
+
+  EXPECT_EQ(reports[5].status, ExecStatus::Cancelled);
+  EXPECT_EQ(reports[5].orderId, 1);
+  EXPECT_EQ(reports[5].leavesQuantity, 0);
+  EXPECT_EQ(reports[5].cumQuantity, 4);
+
+  EXPECT_EQ(reports[6].status, ExecStatus::CancelRejected);
+  EXPECT_EQ(reports[6].sessionId, 7);
+}
+
+TEST(ExchangeTest, ListenersAreAddedSetAndRemovedIndependently) {
+  Exchange engine(1);
+  int32_t symId = engine.registerSymbol("TEST", -1);
+  std::atomic<int> added{0}, removed{0}, replaced{0}, set{0};
+  engine.addTradeCallback([&](const auto&) { ++added; });
+  auto handle = engine.addTradeCallback([&](const auto&) { ++removed; });
+  engine.setTradeCallback([&](const auto&) { ++replaced; });
+  // Replaces only the earlier set* listener.
+  engine.setTradeCallback([&](const auto&) { ++set; });
+  engine.removeCallback(handle);
+
+  engine.submitOrder(
+      Order(1, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 1));
+  engine.submitOrder(
+      Order(2, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 1));
+  engine.stop();
+
+  EXPECT_EQ(added.load(), 1);
+  EXPECT_EQ(set.load(), 1);
+  EXPECT_EQ(removed.load(), 0);
+  EXPECT_EQ(replaced.load(), 0);
+}
+
+TEST(ExchangeTest, OrdersAreAcknowledgedOnce) {
+  std::vector<ExecutionReport> reports;
+  std::mutex mtx;
+  Exchange engine(1);
+  engine.setExecutionReportCallback([&](const auto& batch) {
+    std::lock_guard<std::mutex> lock(mtx);
+    reports.insert(reports.end(), batch.begin(), batch.end());
+  });
+
+  int32_t symId = engine.registerSymbol("TEST", -1);
+  auto owned = [&](Order o) {
+    o.sessionId = 5;
+    o.ownerId = 5;
+    return o;
+  };
+  // A resting limit repriced to a new level, and a stop-limit that
+  // triggers on a trade at 10000 and rests without filling.
+  engine.submitOrder(
+      owned(Order(1, 0, symId, OrderSide::Buy, OrderType::Limit, 9000, 5)));
+  engine.modifyOrder(symId, 1, 9100, 5, 5);
+  engine.submitOrder(owned(Order(2, 0, symId, OrderSide::Buy,
+                                 OrderType::StopLimit, 9500, 5, 10000)));
+  engine.submitOrder(
+      Order(3, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 1));
+  engine.submitOrder(
+      Order(4, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 1));
+  engine.stop();
+
+  std::lock_guard<std::mutex> lock(mtx);
+  std::vector<std::pair<OrderId, ExecStatus>> seen;
+  for (const auto& report : reports) {
+    seen.emplace_back(report.orderId, report.status);
+  }
+  const std::vector<std::pair<OrderId, ExecStatus>> expected = {
+      {1, ExecStatus::New}, {1, ExecStatus::Replaced}, {2, ExecStatus::New}};
+  EXPECT_EQ(seen, expected);
+
+  const OrderBook* book = engine.getOrderBook(symId);
+  EXPECT_EQ(book->getLevel(9100, OrderSide::Buy).activeCount, 1);
+  EXPECT_EQ(book->getLevel(9500, OrderSide::Buy).activeCount, 1);
+}
+
+TEST_F(ExchangeLogicTest, MassCancelByOwnerAndSide) {
+  int32_t symId = engine.registerSymbol("TEST", -1);
+  auto owned = [&](OrderId id, uint32_t owner, OrderSide side, Price price) {
+    Order o(id, 0, symId, side, OrderType::Limit, price, 10);
+    o.ownerId = owner;
+    return o;
+  };
+  engine.submitOrder(owned(1, 5, OrderSide::Buy, 9900));
+  engine.submitOrder(owned(2, 5, OrderSide::Sell, 10100));
+  engine.submitOrder(owned(3, 6, OrderSide::Sell, 10100));
+  engine.submitOrder(owned(4, 5, OrderSide::Sell, 10200));
+  Order stop(5, 0, symId, OrderSide::Buy, OrderType::Stop, 0, 10, 10500);
+  stop.ownerId = 5;
+  engine.submitOrder(stop);
+
+  engine.massCancel(symId, 5, MassCancelSide::Sell);
+  waitForProcessing();
+
+  const OrderBook* book = engine.getOrderBook(symId);
+  ASSERT_EQ(book->getLevel(10100, OrderSide::Sell).activeCount, 1);
+  ASSERT_EQ(book->getLevel(10200, OrderSide::Sell).activeCount, 0);
+  ASSERT_EQ(book->getLevel(9900, OrderSide::Buy).activeCount, 1);
+  ASSERT_TRUE(book->hasStopOrders());
+
+  engine.massCancel(-1, 5);
+  waitForProcessing();
+  ASSERT_EQ(book->getLevel(9900, OrderSide::Buy).activeCount, 0);
+  ASSERT_FALSE(book->hasStopOrders());
+  ASSERT_EQ(book->getLevel(10100, OrderSide::Sell).activeCount, 1);
+
+  engine.massCancel(-1, 0);
+  engine.stop();
+  ASSERT_EQ(book->getLevel(10100, OrderSide::Sell).activeCount, 0);
+  ASSERT_EQ(book->getBestAsk(), -1);
+}
+
+TEST_F(ExchangeLogicTest, ModifyKeepsPriorityOnlyWhenReducingSize) {
+  int32_t symId = engine.registerSymbol("TEST", -1);
+  for (OrderId id = 1; id <= 3; ++id) {
+    engine.submitOrder(
+        Order(id, 0, symId, OrderSide::Sell, OrderType::Limit, 10000, 10));
+  }
+  engine.modifyOrder(symId, 1, 10000, 5);
+  engine.modifyOrder(symId, 2, 10000, 20);
+  waitForProcessing();
+
+  const OrderBook* book = engine.getOrderBook(symId);
+  ASSERT_EQ(book->getLevel(10000, OrderSide::Sell).totalQuantity, 35);
+
+  engine.submitOrder(
+      Order(4, 0, symId, OrderSide::Buy, OrderType::Limit, 10000, 10));
+  auto trades = waitForTrades(2);
+  ASSERT_EQ(trades.size(), 2);
+  EXPECT_EQ(trades[0].makerOrderId, 1);
+  EXPECT_EQ(trades[0].quantity, 5);
+  EXPECT_EQ(trades[1].makerOrderId, 3);
+  EXPECT_EQ(trades[1].quantity, 5);
+
+  // A price change crosses like a fresh order.
+  clearTrades();
+  engine.modifyOrder(symId, 2, 9000, 20);
+  engine.submitOrder(
+      Order(5, 0, symId, OrderSide::Buy, OrderType::Limit, 9500, 20));
+  trades = waitForTrades(1);
+  ASSERT_EQ(trades.size(), 1);
+  EXPECT_EQ(trades[0].makerOrderId, 2);
+  EXPECT_EQ(trades[0].price, 9000);
+}
+
+TEST_F(ExchangeLogicTest, DepthSnapshotsArePublishedByTheShard) {
+  int32_t symId = engine.registerSymbol("TEST", -1);
+  engine.submitOrder(
+      Order(1, 0, symId, OrderSide::Buy, OrderType::Limit, 100, 10));
+  engine.submitOrder(
+      Order(2, 0, symId, OrderSide::Buy, OrderType::Limit, 99, 5));
+  engine.submitOrder(
+      Order(3, 0, symId, OrderSide::Buy, OrderType::Limit, 100, 7));
+  engine.submitOrder(
+      Order(4, 0, symId, OrderSide::Sell, OrderType::Limit, 105, 3));
+  waitForProcessing();
+
+  DepthSnapshot depth;
+  ASSERT_TRUE(engine.getDepth(symId, depth));
+  EXPECT_EQ(depth.symbolId, symId);
+  ASSERT_EQ(depth.bidLevels, 2);
+  EXPECT_EQ(depth.bids[0].price, 100);
+  EXPECT_EQ(depth.bids[0].quantity, 17);
+  EXPECT_EQ(depth.bids[1].price, 99);
+  ASSERT_EQ(depth.askLevels, 1);
+  EXPECT_EQ(depth.asks[0].quantity, 3);
+  EXPECT_FALSE(engine.getDepth(symId + 1, depth));
+
+  // Readers racing the worker only ever see whole snapshots.
+  std::atomic<bool> done{false};
+  std::atomic<int> torn{0};
+  std::thread reader([&] {
+    while (!done) {
+      DepthSnapshot d;
+      engine.getDepth(symId, d);
+      for (int i = 1; i < d.bidLevels; ++i) {
+        if (d.bids[i].price >= d.bids[i - 1].price) torn++;
+      }
+      for (int i = 1; i < d.askLevels; ++i) {
+        if (d.asks[i].price <= d.asks[i - 1].price) torn++;
+      }
+    }
+  });
+  for (OrderId id = 10; id < 20000; ++id) {
+    engine.submitOrder(Order(id, 0, symId, OrderSide::Sell, OrderType::Limit,
+                             200 + static_cast<Price>(id % 50), 1));
+    if (id % 3 == 0) engine.cancelOrder(symId, id - 1);
+  }
+  waitForProcessing();
+  done = true;
+  reader.join();
+  EXPECT_EQ(torn, 0);
+}
+
+TEST_F(ExchangeLogicTest, BookDeltasAreCoalescedPerBatch) {
+  std::vector<BookDelta> deltas;
+  std::mutex mtx;
+  engine.addBookDeltaCallback([&](const std::vector<BookDelta>& batch) {
+    std::lock_guard<std::mutex> lock(mtx);
+    deltas.insert(deltas.end(), batch.begin(), batch.end());
+  });
+  auto take = [&] {
+    waitForProcessing();
+    std::lock_guard<std::mutex> lock(mtx);
+    return std::exchange(deltas, {});
+  };
+
+  int32_t symId = engine.registerSymbol("TEST", -1);
+  for (OrderId id = 1; id <= 50; ++id) {
+    engine.submitOrder(
+        Order(id, 0, symId, OrderSide::Sell, OrderType::Limit, 100, 1));
+  }
+  auto added = take();
+  ASSERT_EQ(added.size(), 1);
+  EXPECT_EQ(added[0].symbolId, symId);
+  EXPECT_EQ(added[0].side, OrderSide::Sell);
+  EXPECT_EQ(added[0].action, DeltaAction::New);
+  EXPECT_EQ(added[0].price, 100);
+  EXPECT_EQ(added[0].quantity, 50);
+
+  // A sweep through all 50 orders is a single level delete.
+  engine.submitOrder(
+      Order(51, 0, symId, OrderSide::Buy, OrderType::Limit, 100, 50));
+  auto swept = take();
+  ASSERT_EQ(swept.size(), 1);
+  EXPECT_EQ(swept[0].action, DeltaAction::Delete);
+  EXPECT_EQ(swept[0].quantity, 0);
+
+  // A level that appears and disappears within one batch is never shown.
+  engine.submitOrder(
+      Order(52, 0, symId, OrderSide::Buy, OrderType::Limit, 90, 5));
+  engine.cancelOrder(symId, 52);
+  EXPECT_TRUE(take().empty());
+
+  engine.submitOrder(
+      Order(53, 0, symId, OrderSide::Buy, OrderType::Limit, 95, 8));
+  take();
+  engine.submitOrder(
+      Order(54, 0, symId, OrderSide::Sell, OrderType::Limit, 95, 3));
+  auto partial = take();
+  ASSERT_EQ(partial.size(), 1);
+  EXPECT_EQ(partial[0].side, OrderSide::Buy);
+  EXPECT_EQ(partial[0].action, DeltaAction::Change);
+  EXPECT_EQ(partial[0].quantity, 5);
+}
+
+TEST_F(ExchangeLogicTest, L3EventsRebuildTheBook) {
+  engine.enableL3Events();
+  int32_t symId = engine.registerSymbol("TEST", 0);
+
+  // Resting orders, icebergs, sweeps, cancels and both kinds of modify.
+  std::mt19937 rng(7);
+  OrderId nextId = 1;
+  for (int i = 0; i < 5000; ++i) {
+    int action = static_cast<int>(rng() % 10);
+    if (action < 6 || nextId < 10) {
+      auto side = (rng() % 2) ? OrderSide::Buy : OrderSide::Sell;
+      Price price = (side == OrderSide::Buy) ? 95 + rng() % 8 : 98 + rng() % 8;
+      Order order(nextId++, 0, symId, side, OrderType::Limit, price,
+                  1 + rng() % 20);
+      if (rng() % 5 == 0) order.peakQuantity = 3;
+      engine.submitOrder(order);
+    } else if (action < 8) {
+      engine.cancelOrder(symId, 1 + rng() % (nextId - 1));
+    } else {
+      engine.modifyOrder(symId, 1 + rng() % (nextId - 1), 95 + rng() % 11,
+                         1 + rng() % 20);
+    }
+  }
+  waitForProcessing();
+
+  L3BookBuilder builder;
+  std::vector<L3Event> events(4096);
+  size_t count = 0;
+  while ((count = engine.pollL3Events(0, events.data(), events.size())) > 0) {
+    for (size_t i = 0; i < count; ++i) {
+      ASSERT_TRUE(builder.apply(events[i])) << "gap at " << events[i].sequence;
+    }
+  }
+  EXPECT_EQ(engine.droppedL3Events(), 0);
+  EXPECT_GT(builder.orderCount(), 0);
+
+  std::string error;
+  EXPECT_TRUE(builder.matches(symId, *engine.getOrderBook(symId), &error))
+      << error;
+
+  engine.reset();
+  waitForProcessing();
+  while ((count = engine.pollL3Events(0, events.data(), events.size())) > 0) {
+    for (size_t i = 0; i < count; ++i) builder.apply(events[i]);
+  }
+  EXPECT_EQ(builder.orderCount(), 0);
+}
+
 TEST(ExchangeTest, MultiAssetIsolation) {
   std::vector<Trade> captured;
   std::mutex mtx;
@@ -235,3 +814,194 @@ TEST(ExchangeTest, SmartSharding) {
   ASSERT_NE(bookA, nullptr);
   ASSERT_NE(bookB, nullptr);
 }
+
+TEST(ExchangeTest, SymbolsRegisterWhileDepthIsRead) {
+  // Every book reserves its full arena, so keep the count small.
+  constexpr int SYMBOLS = 4;
+  Exchange engine(2, SYMBOLS);
+
+  // Two gateways register symbols and trade on them while a third thread
+  // reads depth for ids that may or may not exist yet.
+  std::atomic<bool> registering{true};
+  std::atomic<int> badReads{0};
+  std::thread reader([&] {
+    DepthSnapshot depth;
+    while (registering.load()) {
+      for (int32_t id = 0; id < SYMBOLS; ++id) {
+        if (engine.getDepth(id, depth) && depth.symbolId != id) ++badReads;
+      }
+    }
+  });
+  std::vector<std::thread> gateways;
+  for (int g = 0; g < 2; ++g) {
+    gateways.emplace_back([&, g] {
+      for (int s = g; s < SYMBOLS; s += 2) {
+        int32_t id = engine.registerSymbol("SYM-" + std::to_string(s), -1);
+        engine.submitOrder(Order(engine.nextOrderId(), 0, id, OrderSide::Buy,
+                                 OrderType::Limit, 100, 10));
+      }
+      engine.flush();
+    });
+  }
+  for (auto& gateway : gateways) gateway.join();
+  engine.drain();
+  registering = false;
+  reader.join();
+
+  EXPECT_EQ(badReads.load(), 0);
+  EXPECT_EQ(engine.registerSymbol("ONE-TOO-MANY", -1), -1);
+  for (int32_t id = 0; id < SYMBOLS; ++id) {
+    DepthSnapshot depth;
+    ASSERT_TRUE(engine.getDepth(id, depth));
+    EXPECT_EQ(depth.symbolId, id);
+  }
+}
+
+TEST(OrderBookTest, ImageRoundTripsLiveOrdersAndIndexes) {
+  auto book = std::make_unique<OrderBook>();
+  for (OrderId id = 1; id <= 6; ++id) {
+    Order order(id, id, 0, (id % 2) ? OrderSide::Buy : OrderSide::Sell,
+                OrderType::Limit, (id % 2) ? 99 : 101, 10);
+    order.ownerId = (id <= 3) ? 7 : 8;
+    book->addOrder(order);
+  }
+  Order iceberg(7, 7, 0, OrderSide::Buy, OrderType::Limit, 98, 50);
+  iceberg.peakQuantity = 10;
+  book->addOrder(iceberg);
+  book->addStopOrder(
+      Order(8, 8, 0, OrderSide::Sell, OrderType::Stop, 0, 5, 95));
+  // Tombstones are left out of the image.
+  ASSERT_TRUE(book->cancelOrder(1));
+  ASSERT_TRUE(book->cancelOrder(2));
+
+  std::vector<std::byte> image;
+  book->writeImage(3, image);
+  book.reset();
+
+  auto restored = std::make_unique<OrderBook>();
+  ASSERT_EQ(restored->loadImage(image.data(), image.data() + image.size()),
+            image.data() + image.size());
+  EXPECT_EQ(restored->getBestBid(), 99);
+  EXPECT_EQ(restored->getBestAsk(), 101);
+  const PriceLevel& bids = restored->getLevel(99, OrderSide::Buy);
+  ASSERT_EQ(bids.orders.size(), 2u);
+  EXPECT_EQ(bids.orders[0].id, 3u);
+  EXPECT_EQ(bids.totalQuantity, 20u);
+  EXPECT_EQ(restored->getLevel(98, OrderSide::Buy).orders[0].hiddenQuantity,
+            40u);
+  EXPECT_EQ(restored->getStopLevel(95, OrderSide::Sell).activeCount, 1);
+  EXPECT_TRUE(restored->hasStopOrders());
+
+  // Every level comes back as a new delta.
+  std::vector<BookDelta> deltas;
+  restored->collectDeltas(3, deltas);
+  EXPECT_EQ(deltas.size(), 3u);
+
+  // The order and owner indexes are rebuilt.
+  EXPECT_TRUE(restored->cancelOrder(8));
+  EXPECT_EQ(restored->massCancel(8, MassCancelSide::Both), 3u);
+  EXPECT_TRUE(restored->cancelOrder(3));
+  EXPECT_FALSE(restored->cancelOrder(1));
+  EXPECT_EQ(restored->getBestAsk(), -1);
+
+  // A truncated image is refused.
+  auto partial = std::make_unique<OrderBook>();
+  EXPECT_EQ(partial->loadImage(image.data(), image.data() + image.size() - 8),
+            nullptr);
+}
+
+TEST(OrderBookTest, StateHashFollowsEveryChange) {
+  StandardMatchingStrategy priceTime;
+  ProRataMatchingStrategy proRata;
+  for (MatchingStrategy* strategy :
+       std::initializer_list<MatchingStrategy*>{&priceTime, &proRata}) {
+    auto book = std::make_unique<OrderBook>();
+    std::vector<Trade> trades;
+    std::mt19937 gen(3);
+    std::uniform_int_distribution<int> action(0, 9);
+    std::uniform_int_distribution<Price> price(95, 105);
+    std::uniform_int_distribution<Quantity> quantity(1, 60);
+    for (OrderId id = 1; id <= 3000; ++id) {
+      const int a = action(gen);
+      const OrderSide side = (id % 2) ? OrderSide::Buy : OrderSide::Sell;
+      if (a == 0 && id > 10) {
+        book->cancelOrder(id - 10);
+      } else if (a == 1 && id > 20) {
+        Order replacement;
+        if (book->modifyOrder(id - 20, price(gen), quantity(gen),
+                              replacement) ==
+            OrderBook::ModifyResult::Replaced) {
+          strategy->match(*book, replacement, trades);
+        }
+      } else if (a == 2) {
+        Order stop(id, id, 0, side, OrderType::StopLimit, price(gen),
+                   quantity(gen), price(gen));
+        strategy->match(*book, stop, trades);
+      } else {
+        Order order(id, id, 0, side, OrderType::Limit, price(gen),
+                    quantity(gen));
+        if (a == 3) order.peakQuantity = 5;
+        strategy->match(*book, order, trades);
+      }
+    }
+    ASSERT_GT(trades.size(), 100u);
+
+    // A book rebuilt from scratch out of the live orders hashes the same as
+    // the one maintained change by change.
+    std::vector<std::byte> image;
+    book->writeImage(0, image);
+    auto restored = std::make_unique<OrderBook>();
+    ASSERT_NE(restored->loadImage(image.data(), image.data() + image.size()),
+              nullptr);
+    EXPECT_EQ(restored->stateHash(), book->stateHash());
+
+    // Any change to a live order moves it.
+    const uint64_t before = book->stateHash();
+    const PriceLevel& level =
+        book->getLevel(book->getBestBid(), OrderSide::Buy);
+    OrderId resting = 0;
+    for (size_t i = level.headIndex; i < level.orders.size(); ++i) {
+      if (level.orders[i].active && level.orders[i].quantity > 1) {
+        resting = level.orders[i].id;
+        break;
+      }
+    }
+    ASSERT_NE(resting, 0u);
+    Order unused;
+    ASSERT_EQ(book->modifyOrder(resting, book->getBestBid(), 1, unused),
+              OrderBook::ModifyResult::Amended);
+    EXPECT_NE(book->stateHash(), before);
+  }
+}
+
+TEST(OrderBookTest, OwnerIndexFollowsSparseSessionIds) {
+  auto book = std::make_unique<OrderBook>();
+  StandardMatchingStrategy strategy;
+  std::vector<Trade> trades;
+  // Thousands of short-lived sessions whose orders all fill, then two far
+  // apart ids with resting orders: only those two are still indexed.
+  OrderId id = 1;
+  for (uint32_t owner = 1; owner <= 5000; ++owner) {
+    Order sell(id, id, 0, OrderSide::Sell, OrderType::Limit, 100, 1);
+    sell.ownerId = owner;
+    ++id;
+    strategy.match(*book, sell, trades);
+    Order buy(id, id, 0, OrderSide::Buy, OrderType::Limit, 100, 1);
+    ++id;
+    strategy.match(*book, buy, trades);
+  }
+  ASSERT_EQ(trades.size(), 5000u);
+
+  for (uint32_t owner : {7u, 4'000'000'000u}) {
+    for (int i = 0; i < 3; ++i) {
+      Order order(id, id, 0, OrderSide::Sell, OrderType::Limit, 110 + i, 1);
+      order.ownerId = owner;
+      ++id;
+      book->addOrder(order);
+    }
+  }
+  EXPECT_EQ(book->massCancel(4'000'000'000u, MassCancelSide::Both), 3u);
+  EXPECT_EQ(book->massCancel(4'000'000'000u, MassCancelSide::Both), 0u);
+  EXPECT_EQ(book->massCancel(7, MassCancelSide::Sell), 3u);
+  EXPECT_EQ(book->getBestAsk(), -1);
+}
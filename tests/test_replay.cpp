@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "ReplayFile.hpp"
+
+namespace {
+std::string tempPath(const char* name) {
+  return ::testing::TempDir() + name + "-" + std::to_string(getpid());
+}
+}  // namespace
+
+TEST(ReplayFileTest, CsvCancelsClearTheOrdersAddedAtTheirLevel) {
+  const std::string csv = tempPath("capture.csv");
+  {
+    std::ofstream out(csv);
+    out << "timestamp,type,side,price,quantity\n"
+        << "1000,A,B,100.25,0.5\n"
+        << "1000,A,S,101.00,1.25\n"
+        << "1001,T,B,100.25,0.00001\n"
+        << "1002,C,B,100.25,0\n"
+        << "1003,C,S,99.00,0\n"
+        << "garbage\n"
+        << "1004,A,B,100.25,1,ETHUSDT\n"
+        << "1005,C,B,100.25,0,ETHUSDT\n";
+  }
+  ReplayCapture capture;
+  ASSERT_TRUE(readReplayCsv(csv, capture, "BTCUSDT"));
+  std::remove(csv.c_str());
+  const auto& records = capture.records;
+
+  ASSERT_EQ(capture.symbols, (std::vector<std::string>{"BTCUSDT", "ETHUSDT"}));
+  ASSERT_EQ(records.size(), 7u);
+  EXPECT_EQ(records[0].action, ReplayAction::Add);
+  EXPECT_EQ(records[0].orderId, 1u);
+  EXPECT_EQ(records[0].price, 10025);
+  EXPECT_EQ(records[0].quantity, 5000u);
+  EXPECT_EQ(records[0].timestamp, 1000u);
+  EXPECT_EQ(records[1].side, OrderSide::Sell);
+  // Sizes that round to zero still trade one unit.
+  EXPECT_EQ(records[2].quantity, 1u);
+  // Both orders added at bid 100.25 are cancelled; the empty ask level
+  // at 99.00 yields nothing.
+  EXPECT_EQ(records[3].action, ReplayAction::Cancel);
+  EXPECT_EQ(records[3].orderId, 1u);
+  EXPECT_EQ(records[4].action, ReplayAction::Cancel);
+  EXPECT_EQ(records[4].orderId, 3u);
+  // Levels are per symbol.
+  EXPECT_EQ(records[5].symbol, 1u);
+  EXPECT_EQ(records[6].action, ReplayAction::Cancel);
+  EXPECT_EQ(records[6].orderId, 4u);
+}
+
+TEST(ReplayFileTest, BinaryFileMapsBackTheSameRecords) {
+  ReplayCapture capture;
+  capture.symbols = {"AAA", "BBB"};
+  auto& records = capture.records;
+  for (OrderId id = 1; id <= 100; ++id) {
+    ReplayRecord record{};
+    record.timestamp = 1000 + id;
+    record.orderId = id;
+    record.price = static_cast<Price>(10000 + id);
+    record.quantity = static_cast<Quantity>(id);
+    record.side = (id % 2) ? OrderSide::Buy : OrderSide::Sell;
+    record.action = (id % 10) ? ReplayAction::Add : ReplayAction::Cancel;
+    record.symbol = static_cast<uint16_t>(id % 2);
+    records.push_back(record);
+  }
+
+  const std::string path = tempPath("capture.bin");
+  ASSERT_TRUE(writeReplayFile(path, capture));
+  EXPECT_TRUE(isReplayFile(path));
+
+  ReplayFile file;
+  std::string error;
+  ASSERT_TRUE(file.open(path, error)) << error;
+  EXPECT_EQ(file.symbols(), capture.symbols);
+  ASSERT_EQ(file.size(), records.size());
+  for (size_t i = 0; i < records.size(); ++i) {
+    EXPECT_EQ(file.records()[i].orderId, records[i].orderId);
+    EXPECT_EQ(file.records()[i].price, records[i].price);
+    EXPECT_EQ(file.records()[i].action, records[i].action);
+    EXPECT_EQ(file.records()[i].symbol, records[i].symbol);
+  }
+
+  // A cut-off file is refused rather than read past its end.
+  truncate(path.c_str(), sizeof(ReplayFileHeader) +
+                            2 * sizeof(ReplaySymbol) + sizeof(ReplayRecord));
+  ReplayFile truncated;
+  EXPECT_FALSE(truncated.open(path, error));
+  std::remove(path.c_str());
+  EXPECT_FALSE(isReplayFile(path));
+}
@@ -0,0 +1,202 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "Exchange.hpp"
+#include "Journal.hpp"
+#include "Replica.hpp"
+
+namespace {
+std::string tempPath(const char* name, const char* suffix) {
+  return ::testing::TempDir() + name + "-" + std::to_string(getpid()) +
+         suffix;
+}
+
+JournalOptions replicatedOptions(const std::string& socket) {
+  JournalOptions options;
+  options.sync = JournalSyncPolicy::None;
+  options.replicaSocket = socket;
+  // The replica builds each book as it meets its symbol, which can hold up
+  // its reads for a while on a small test machine.
+  options.replicaTimeout = std::chrono::seconds(10);
+  // A state check after every batch.
+  options.stateCheckInterval = std::chrono::microseconds(1);
+  return options;
+}
+
+// Random adds, cancels and modifies around 100 on both symbols, ids
+// [first, last].
+void trade(Exchange& engine, OrderId first, OrderId last, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> action(0, 9);
+  std::uniform_int_distribution<Price> price(95, 105);
+  std::uniform_int_distribution<Quantity> quantity(1, 50);
+  for (OrderId id = first; id <= last; ++id) {
+    int32_t sym = static_cast<int32_t>(id % 2);
+    int a = action(gen);
+    if (a == 0 && id > first + 10) {
+      engine.cancelOrder(sym, id - 10);
+    } else if (a == 1 && id > first + 20) {
+      engine.modifyOrder(sym, id - 20, price(gen), quantity(gen));
+    } else {
+      OrderSide side = (a % 2) ? OrderSide::Buy : OrderSide::Sell;
+      engine.submitOrder(Order(id, id, sym, side, OrderType::Limit,
+                               price(gen), quantity(gen)));
+    }
+  }
+  engine.drain();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+// Waits until the replica has applied everything the primary journaled.
+bool caughtUp(Exchange& primary, const Replica& replica) {
+  primary.journal()->sync();
+  for (int i = 0; i < 500; ++i) {
+    bool done = true;
+    for (size_t s = 0; s < primary.shardCount(); ++s) {
+      done &= replica.appliedSequence(s) ==
+              primary.journal()->durableSequence(s);
+    }
+    if (done) return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+bool waitForReplica(Exchange& primary) {
+  for (int i = 0; i < 500 && !primary.journal()->replicaConnected(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return primary.journal()->replicaConnected();
+}
+}  // namespace
+
+TEST(ReplicaTest, FollowsThePrimaryAndPromotes) {
+  const std::string path = tempPath("replica", ".journal");
+  const std::string socket = tempPath("replica", ".sock");
+  Exchange primary(2);
+  ASSERT_TRUE(primary.enableJournal(path, replicatedOptions(socket)));
+  primary.registerSymbol("SYM_A", 0);
+  primary.registerSymbol("SYM_B", 1, MatchingAlgorithm::ProRata);
+
+  Exchange standby(2);
+  Replica replica(standby, socket);
+  ASSERT_TRUE(replica.start());
+  ASSERT_TRUE(waitForReplica(primary));
+
+  trade(primary, 1, 4000, 11);
+  ASSERT_TRUE(caughtUp(primary, replica));
+  EXPECT_TRUE(replica.following());
+  EXPECT_FALSE(replica.diverged());
+  EXPECT_EQ(standby.getSymbolName(1), "SYM_B");
+  for (int32_t sym = 0; sym < 2; ++sym) {
+    EXPECT_EQ(standby.getOrderBook(sym)->stateHash(),
+              primary.getOrderBook(sym)->stateHash());
+  }
+  // Acknowledgements made it back.
+  for (int i = 0; i < 100 && primary.journal()->replicaSequence(0) <
+                                 primary.journal()->durableSequence(0);
+       ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(primary.journal()->replicaSequence(0),
+            primary.journal()->durableSequence(0));
+
+  const uint64_t journaled = primary.journal()->durableSequence(0) +
+                             primary.journal()->durableSequence(1);
+  primary.stop();
+  std::remove(path.c_str());
+
+  auto promotion = replica.promote();
+  ASSERT_TRUE(promotion.ok) << promotion.error;
+  EXPECT_EQ(promotion.commands, journaled);
+  EXPECT_LT(promotion.elapsed, std::chrono::milliseconds(100));
+  EXPECT_GT(standby.nextOrderId(), 4000u);
+
+  // Its own journal starts from a snapshot of the promoted books.
+  const std::string promotedPath = tempPath("promoted", ".journal");
+  JournalOptions promotedOptions;
+  promotedOptions.sync = JournalSyncPolicy::None;
+  promotedOptions.baseSnapshot = promotedPath + ".base";
+  ASSERT_TRUE(standby.enableJournal(promotedPath, promotedOptions));
+
+  // The promoted engine takes orders against the replicated books.
+  std::vector<Trade> trades;
+  standby.setTradeCallback([&](const std::vector<Trade>& batch) {
+    trades.insert(trades.end(), batch.begin(), batch.end());
+  });
+  DepthSnapshot depth;
+  ASSERT_TRUE(standby.getDepth(0, depth));
+  ASSERT_GT(depth.askLevels, 0);
+  const Price bestAsk = depth.asks[0].price;
+  standby.submitOrder(Order(standby.nextOrderId(), 1, 0, OrderSide::Buy,
+                            OrderType::Limit, bestAsk, 1));
+  standby.drain();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_EQ(trades.size(), 1u);
+  EXPECT_EQ(trades[0].price, bestAsk);
+
+  const auto promotedDigest = standby.digest();
+  standby.stop();
+  {
+    Exchange alone(2);
+    auto result = alone.recoverFromJournal(promotedPath);
+    EXPECT_FALSE(result.ok);
+    EXPECT_NE(result.error.find("snapshot"), std::string::npos);
+  }
+  {
+    Exchange restored(2);
+    auto result = restored.restoreFromSnapshot(promotedOptions.baseSnapshot,
+                                               promotedPath);
+    ASSERT_TRUE(result.ok) << result.error;
+    EXPECT_EQ(restored.digest()[0].bookHash, promotedDigest[0].bookHash);
+    EXPECT_EQ(restored.digest()[1].bookHash, promotedDigest[1].bookHash);
+  }
+  std::remove(promotedPath.c_str());
+  std::remove(promotedOptions.baseSnapshot.c_str());
+}
+
+TEST(ReplicaTest, CatchesUpMidSessionAndDetectsDivergence) {
+  const std::string path = tempPath("replica-late", ".journal");
+  const std::string socket = tempPath("replica-late", ".sock");
+  Exchange primary(2);
+  ASSERT_TRUE(primary.enableJournal(path, replicatedOptions(socket)));
+  primary.registerSymbol("SYM_A", 0);
+  primary.registerSymbol("SYM_B", 1);
+  trade(primary, 1, 2000, 5);
+
+  // Everything journaled before it connected comes from the file.
+  Exchange standby(2);
+  Replica replica(standby, socket);
+  ASSERT_TRUE(replica.start());
+  ASSERT_TRUE(waitForReplica(primary));
+  trade(primary, 2001, 3000, 6);
+  ASSERT_TRUE(caughtUp(primary, replica));
+  EXPECT_FALSE(replica.diverged());
+  for (int32_t sym = 0; sym < 2; ++sym) {
+    EXPECT_EQ(standby.getOrderBook(sym)->stateHash(),
+              primary.getOrderBook(sym)->stateHash());
+  }
+
+  // An order the primary never saw shows up at its next state check.
+  const uint64_t before = primary.journal()->durableSequence(0);
+  standby.submitOrder(
+      Order(1000000, 1, 0, OrderSide::Buy, OrderType::Limit, 50, 5));
+  standby.drain();
+  trade(primary, 3001, 3100, 7);
+  ASSERT_TRUE(caughtUp(primary, replica));
+  EXPECT_TRUE(replica.diverged());
+  EXPECT_GT(standby.divergedAt(0), before);
+  EXPECT_EQ(standby.divergedAt(1), 0u);
+
+  primary.stop();
+  std::remove(path.c_str());
+  auto promotion = replica.promote();
+  EXPECT_FALSE(promotion.ok);
+  EXPECT_NE(promotion.error.find("diverged"), std::string::npos);
+}
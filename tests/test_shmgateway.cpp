@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "Exchange.hpp"
+#include "ShmChannel.hpp"
+#include "ShmGateway.hpp"
+
+namespace {
+std::string testPrefix() {
+  return "ome-test-" + std::to_string(getpid());
+}
+
+// Polls until a message of `type` arrives or two seconds pass.
+template <typename Message>
+bool awaitMessage(ShmClient& client, Message& msg) {
+  char out[MAX_BINARY_MESSAGE];
+  BinaryHeader header;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (!client.poll(out, header)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (header.type == Message::TYPE) {
+      std::memcpy(&msg, out, sizeof(msg));
+      return true;
+    }
+  }
+  return false;
+}
+
+NewOrderMessage limitOrder(int32_t symbolId, uint64_t clientOrderId,
+                           OrderSide side, Price price, Quantity quantity) {
+  auto msg = makeMessage<NewOrderMessage>();
+  msg.clientOrderId = clientOrderId;
+  msg.symbolId = symbolId;
+  msg.side = side;
+  msg.orderType = OrderType::Limit;
+  msg.price = price;
+  msg.quantity = quantity;
+  return msg;
+}
+}  // namespace
+
+TEST(ShmGatewayTest, ClientsTradeThroughSharedMemory) {
+  Exchange engine(1);
+  ShmGateway gateway(engine, testPrefix(), 2);
+  ASSERT_TRUE(gateway.start());
+
+  ShmClient seller;
+  ShmClient buyer;
+  ASSERT_TRUE(seller.connect(gateway.prefix()));
+  ASSERT_TRUE(buyer.connect(gateway.prefix()));
+
+  auto lookup = makeMessage<SymbolLookupMessage>();
+  std::strncpy(lookup.symbol, "SHM", sizeof(lookup.symbol));
+  ASSERT_TRUE(seller.send(lookup));
+  SymbolInfoMessage info;
+  ASSERT_TRUE(awaitMessage(seller, info));
+  int32_t symId = info.symbolId;
+  EXPECT_EQ(engine.getSymbolName(symId), "SHM");
+
+  ASSERT_TRUE(seller.send(limitOrder(symId, 11, OrderSide::Sell, 100, 5)));
+  AckMessage sellAck;
+  ASSERT_TRUE(awaitMessage(seller, sellAck));
+  EXPECT_EQ(sellAck.clientOrderId, 11u);
+
+  ASSERT_TRUE(buyer.send(limitOrder(symId, 22, OrderSide::Buy, 100, 5)));
+  AckMessage buyAck;
+  ASSERT_TRUE(awaitMessage(buyer, buyAck));
+  EXPECT_EQ(buyAck.clientOrderId, 22u);
+  EXPECT_NE(buyAck.orderId, sellAck.orderId);
+
+  // Each side hears only about its own order.
+  ExecReportMessage report;
+  do {
+    ASSERT_TRUE(awaitMessage(buyer, report));
+    EXPECT_EQ(report.orderId, buyAck.orderId);
+  } while (report.status != ExecStatus::Filled);
+  EXPECT_EQ(report.lastPrice, 100);
+  EXPECT_EQ(report.cumQuantity, 5u);
+  do {
+    ASSERT_TRUE(awaitMessage(seller, report));
+    EXPECT_EQ(report.orderId, sellAck.orderId);
+  } while (report.status != ExecStatus::Filled);
+
+  // Unknown symbols are rejected on the response ring.
+  ASSERT_TRUE(buyer.send(limitOrder(symId + 100, 33, OrderSide::Buy, 1, 1)));
+  RejectMessage reject;
+  ASSERT_TRUE(awaitMessage(buyer, reject));
+  EXPECT_EQ(reject.clientOrderId, 33u);
+  EXPECT_EQ(reject.reason, RejectReason::UnknownSymbol);
+}
+
+TEST(ShmGatewayTest, ClosedClientIsCancelledAndItsSlotReused) {
+  Exchange engine(1);
+  int32_t symId = engine.registerSymbol("TEST", 0);
+  ShmGateway gateway(engine, testPrefix(), 1);
+  ASSERT_TRUE(gateway.start());
+
+  auto client = std::make_unique<ShmClient>();
+  ASSERT_TRUE(client->connect(gateway.prefix()));
+  ShmClient other;
+  EXPECT_FALSE(other.connect(gateway.prefix()));
+
+  ASSERT_TRUE(client->send(limitOrder(symId, 1, OrderSide::Buy, 99, 10)));
+  AckMessage ack;
+  ASSERT_TRUE(awaitMessage(*client, ack));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  DepthSnapshot depth;
+  ASSERT_TRUE(engine.getDepth(symId, depth));
+  ASSERT_EQ(depth.bidLevels, 1);
+  EXPECT_EQ(depth.bids[0].price, 99);
+
+  client.reset();
+  bool reclaimed = false;
+  for (int i = 0; i < 200 && !reclaimed; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    reclaimed = other.connect(gateway.prefix());
+  }
+  ASSERT_TRUE(reclaimed);
+  EXPECT_TRUE(other.connected());
+  // Freeing the slot cancelled the order the first client left resting.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_TRUE(engine.getDepth(symId, depth));
+  EXPECT_EQ(depth.bidLevels, 0);
+}
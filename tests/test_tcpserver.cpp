@@ -0,0 +1,401 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Exchange.hpp"
+#include "Protocol.hpp"
+#include "TcpServer.hpp"
+
+namespace {
+int connectTo(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  timeval timeout{.tv_sec = 2, .tv_usec = 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return fd;
+}
+
+void sendText(int fd, const std::string& text) {
+  ASSERT_EQ(send(fd, text.data(), text.size(), MSG_NOSIGNAL),
+            static_cast<ssize_t>(text.size()));
+}
+
+// Reads until `count` newline-terminated lines have arrived or the receive
+// timeout expires.
+std::vector<std::string> readLines(int fd, size_t count) {
+  std::vector<std::string> lines;
+  std::string pending;
+  char buffer[4096];
+  while (lines.size() < count) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) break;
+    pending.append(buffer, static_cast<size_t>(n));
+    size_t pos = 0;
+    while ((pos = pending.find('\n')) != std::string::npos) {
+      lines.push_back(pending.substr(0, pos));
+      pending.erase(0, pos + 1);
+    }
+  }
+  return lines;
+}
+
+template <typename Message>
+void sendMessage(int fd, const Message& msg) {
+  ASSERT_EQ(send(fd, &msg, sizeof(msg), MSG_NOSIGNAL),
+            static_cast<ssize_t>(sizeof(msg)));
+}
+
+// Reads exactly one message of the expected type, or fails the test.
+template <typename Message>
+Message readMessage(int fd) {
+  Message msg{};
+  size_t received = 0;
+  auto* bytes = reinterpret_cast<char*>(&msg);
+  while (received < sizeof(msg)) {
+    ssize_t n = recv(fd, bytes + received, sizeof(msg) - received, 0);
+    if (n <= 0) break;
+    received += static_cast<size_t>(n);
+  }
+  EXPECT_EQ(received, sizeof(msg));
+  EXPECT_EQ(msg.header.type, Message::TYPE);
+  EXPECT_EQ(msg.header.length, sizeof(msg));
+  return msg;
+}
+}  // namespace
+
+TEST(TcpServerTest, ServesManyConcurrentSessions) {
+  Exchange engine(1);
+  engine.registerSymbol("TEST", 0);
+  TcpServer server(engine, 0, 2);
+  ASSERT_TRUE(server.start());
+
+  const int sessions = 200;
+  std::vector<int> fds;
+  for (int i = 0; i < sessions; ++i) {
+    int fd = connectTo(server.port());
+    ASSERT_GE(fd, 0);
+    fds.push_back(fd);
+  }
+
+  for (int i = 0; i < sessions; ++i) {
+    sendText(fds[i], "BUY TEST 1 " + std::to_string(100 + i) + "\n");
+  }
+  for (int fd : fds) {
+    auto lines = readLines(fd, 1);
+    ASSERT_GE(lines.size(), 1);
+    EXPECT_TRUE(lines[0].starts_with("ORDER_ACCEPTED_ASYNC ")) << lines[0];
+  }
+
+  for (int fd : fds) close(fd);
+  server.stop();
+}
+
+TEST(TcpServerTest, CancelsSessionOrdersOnDisconnect) {
+  Exchange engine(1);
+  int32_t symId = engine.registerSymbol("TEST", 0);
+  TcpServer server(engine, 0);
+  ASSERT_TRUE(server.start());
+
+  int fd = connectTo(server.port());
+  ASSERT_GE(fd, 0);
+  sendText(fd, "SELL TEST 10 10000\n");
+  auto lines = readLines(fd, 2);
+  ASSERT_GE(lines.size(), 2);
+  EXPECT_TRUE(lines[1].starts_with("EXEC ")) << lines[1];
+  close(fd);
+
+  server.stop();
+  engine.stop();
+  const OrderBook* book = engine.getOrderBook(symId);
+  EXPECT_EQ(book->getLevel(10000, OrderSide::Sell).activeCount, 0);
+}
+
+TEST(TcpServerTest, BinarySessionsCoexistWithText) {
+  Exchange engine(1);
+  int32_t symId = engine.registerSymbol("TEST", 0);
+  TcpServer server(engine, 0);
+  ASSERT_TRUE(server.start());
+
+  int binaryFd = connectTo(server.port());
+  ASSERT_GE(binaryFd, 0);
+  const char hello = static_cast<char>(BINARY_HELLO);
+  ASSERT_EQ(send(binaryFd, &hello, 1, MSG_NOSIGNAL), 1);
+
+  auto lookup = makeMessage<SymbolLookupMessage>();
+  std::strncpy(lookup.symbol, "TEST", sizeof(lookup.symbol));
+  sendMessage(binaryFd, lookup);
+  auto info = readMessage<SymbolInfoMessage>(binaryFd);
+  EXPECT_EQ(info.symbolId, symId);
+
+  auto order = makeMessage<NewOrderMessage>();
+  order.clientOrderId = 42;
+  order.price = 10000;
+  order.symbolId = symId;
+  order.quantity = 10;
+  order.side = OrderSide::Sell;
+  order.orderType = OrderType::Limit;
+  sendMessage(binaryFd, order);
+  auto ack = readMessage<AckMessage>(binaryFd);
+  EXPECT_EQ(ack.clientOrderId, 42);
+  auto report = readMessage<ExecReportMessage>(binaryFd);
+  EXPECT_EQ(report.orderId, ack.orderId);
+  EXPECT_EQ(report.status, ExecStatus::New);
+
+  auto modify = makeMessage<ModifyMessage>();
+  modify.orderId = ack.orderId;
+  modify.price = 10000;
+  modify.symbolId = symId;
+  modify.quantity = 6;
+  sendMessage(binaryFd, modify);
+  report = readMessage<ExecReportMessage>(binaryFd);
+  EXPECT_EQ(report.status, ExecStatus::Replaced);
+  EXPECT_EQ(report.leavesQuantity, 6);
+
+  int textFd = connectTo(server.port());
+  ASSERT_GE(textFd, 0);
+  sendText(textFd, "BUY TEST 4 10000\n");
+  auto lines = readLines(textFd, 1);
+  ASSERT_GE(lines.size(), 1);
+  EXPECT_TRUE(lines[0].starts_with("ORDER_ACCEPTED_ASYNC ")) << lines[0];
+
+  report = readMessage<ExecReportMessage>(binaryFd);
+  EXPECT_EQ(report.status, ExecStatus::PartiallyFilled);
+  EXPECT_EQ(report.lastQuantity, 4);
+  EXPECT_EQ(report.leavesQuantity, 2);
+
+  order.symbolId = 99;
+  sendMessage(binaryFd, order);
+  auto reject = readMessage<RejectMessage>(binaryFd);
+  EXPECT_EQ(reject.reason, RejectReason::UnknownSymbol);
+
+  close(textFd);
+  close(binaryFd);
+  server.stop();
+}
+
+TEST(TcpServerTest, HandlesPipelinedAndSplitFrames) {
+  Exchange engine(1);
+  engine.registerSymbol("TEST", 0);
+  TcpServer server(engine, 0);
+  ASSERT_TRUE(server.start());
+
+  int fd = connectTo(server.port());
+  ASSERT_GE(fd, 0);
+  const int orders = 500;
+  std::string batch;
+  for (int i = 0; i < orders; ++i) {
+    batch += "BUY TEST 1 " + std::to_string(100 + i % 50) + "\r\n";
+  }
+  // Cut mid-line so the tail of one frame arrives in a later read.
+  size_t cut = batch.size() / 2 + 3;
+  sendText(fd, batch.substr(0, cut));
+  usleep(20000);
+  sendText(fd, batch.substr(cut));
+
+  size_t acks = 0;
+  for (const auto& line : readLines(fd, 2 * orders)) {
+    if (line.starts_with("ORDER_ACCEPTED_ASYNC ")) acks++;
+  }
+  EXPECT_EQ(acks, orders);
+  close(fd);
+
+  fd = connectTo(server.port());
+  ASSERT_GE(fd, 0);
+  std::string frames(1, static_cast<char>(BINARY_HELLO));
+  auto order = makeMessage<NewOrderMessage>();
+  order.price = 100;
+  order.quantity = 1;
+  order.side = OrderSide::Sell;
+  order.orderType = OrderType::Limit;
+  for (int i = 0; i < 3; ++i) {
+    order.clientOrderId = static_cast<uint64_t>(i);
+    appendMessage(frames, order);
+  }
+  for (char byte : frames) {
+    ASSERT_EQ(send(fd, &byte, 1, MSG_NOSIGNAL), 1);
+  }
+  // Acks come from the I/O thread and reports from the shard worker, so
+  // only the order within each stream is fixed.
+  std::vector<uint64_t> acked;
+  std::vector<uint64_t> reported;
+  for (int i = 0; i < 6; ++i) {
+    char buffer[MAX_BINARY_MESSAGE];
+    ASSERT_EQ(recv(fd, buffer, sizeof(BinaryHeader), MSG_WAITALL),
+              static_cast<ssize_t>(sizeof(BinaryHeader)));
+    BinaryHeader header;
+    ASSERT_TRUE(peekHeader(buffer, sizeof(BinaryHeader), header));
+    size_t body = header.length - sizeof(BinaryHeader);
+    ASSERT_EQ(recv(fd, buffer + sizeof(BinaryHeader), body, MSG_WAITALL),
+              static_cast<ssize_t>(body));
+    if (AckMessage ack; decodeMessage(buffer, header.length, ack)) {
+      acked.push_back(ack.clientOrderId);
+    } else if (ExecReportMessage report;
+               decodeMessage(buffer, header.length, report)) {
+      reported.push_back(report.clientOrderId);
+    }
+  }
+  EXPECT_EQ(acked, (std::vector<uint64_t>{0, 1, 2}));
+  EXPECT_EQ(reported, (std::vector<uint64_t>{0, 1, 2}));
+  close(fd);
+  server.stop();
+}
+
+TEST(TcpServerTest, DisconnectsSlowSubscribers) {
+  Exchange engine(1);
+  int32_t symId = engine.registerSymbol("TEST", 0);
+  TcpServer server(engine, 0);
+  ASSERT_TRUE(server.start());
+
+  int fd = connectTo(server.port());
+  ASSERT_GE(fd, 0);
+  sendText(fd, "SUBSCRIBE TEST\n");
+  ASSERT_EQ(readLines(fd, 1).size(), 1);
+
+  engine.submitOrder(
+      Order(1, 0, symId, OrderSide::Sell, OrderType::Limit, 100, 1));
+  engine.submitOrder(
+      Order(2, 0, symId, OrderSide::Buy, OrderType::Limit, 100, 1));
+  engine.flush();
+  auto lines = readLines(fd, 1);
+  ASSERT_EQ(lines.size(), 1);
+  EXPECT_EQ(lines[0], "TRADE TEST 100 1");
+
+  // Never read while the feed pushes far more than the backlog limit.
+  const OrderId trades = 1000000;
+  for (OrderId i = 0; i < trades; ++i) {
+    engine.submitOrder(Order(3 + 2 * i, 0, symId, OrderSide::Sell,
+                             OrderType::Limit, 100, 1));
+    engine.submitOrder(Order(4 + 2 * i, 0, symId, OrderSide::Buy,
+                             OrderType::Limit, 100, 1));
+  }
+  engine.drain();
+
+  size_t received = 0;
+  char buffer[65536];
+  ssize_t n = 0;
+  while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    received += static_cast<size_t>(n);
+  }
+  EXPECT_TRUE(n == 0 || errno == ECONNRESET) << std::strerror(errno);
+  EXPECT_LT(received, trades * std::string("TRADE TEST 100 1\n").size());
+
+  close(fd);
+  server.stop();
+}
+
+TEST(TcpServerTest, DisconnectsSessionsThatFallBehindOnReports) {
+  Exchange engine(1);
+  int32_t symId = engine.registerSymbol("TEST", 0);
+  // Far too small for one batch of reports, so the worker overflows it.
+  TcpServer server(engine, 0, 1, IoBackendType::Epoll, 16);
+  ASSERT_TRUE(server.start());
+
+  // The first session of a fresh engine.
+  int fd = connectTo(server.port());
+  ASSERT_GE(fd, 0);
+  sendText(fd, "SELL TEST 1 100\n");
+  ASSERT_EQ(readLines(fd, 2).size(), 2);
+  const uint32_t sessionId = 1;
+
+  const OrderId pairs = 1000;
+  for (OrderId i = 0; i < pairs; ++i) {
+    for (OrderSide side : {OrderSide::Buy, OrderSide::Sell}) {
+      Order order(100 + 2 * i + (side == OrderSide::Sell), 0, symId, side,
+                  OrderType::Limit, 100, 1);
+      order.sessionId = sessionId;
+      order.ownerId = sessionId;
+      engine.submitOrder(order);
+    }
+  }
+  // Returns although the reporter cannot keep up.
+  engine.drain();
+
+  size_t received = 0;
+  char buffer[65536];
+  ssize_t n = 0;
+  while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    received += static_cast<size_t>(n);
+  }
+  EXPECT_TRUE(n == 0 || errno == ECONNRESET) << std::strerror(errno);
+  EXPECT_LT(received,
+            3 * pairs * std::string("EXEC 1 0 FILL 1 100 0 1\n").size());
+  close(fd);
+
+  // Other sessions are still served.
+  int other = connectTo(server.port());
+  ASSERT_GE(other, 0);
+  sendText(other, "SELL TEST 1 200\n");
+  auto lines = readLines(other, 2);
+  ASSERT_EQ(lines.size(), 2);
+  EXPECT_TRUE(lines[1].starts_with("EXEC ")) << lines[1];
+  close(other);
+
+  server.stop();
+  engine.stop();
+  const OrderBook* book = engine.getOrderBook(symId);
+  EXPECT_EQ(book->getLevel(100, OrderSide::Sell).activeCount, 0);
+}
+
+TEST(TcpServerTest, IoUringBackendServesSessions) {
+  Exchange engine(1);
+  int32_t symId = engine.registerSymbol("TEST", 0);
+  TcpServer server(engine, 0, 2, IoBackendType::IoUring);
+  ASSERT_TRUE(server.start());
+  if (server.backendType() != IoBackendType::IoUring) {
+    server.stop();
+    engine.stop();
+    GTEST_SKIP() << "io_uring unavailable; the server fell back to epoll";
+  }
+
+  std::vector<int> fds;
+  for (int i = 0; i < 50; ++i) {
+    int fd = connectTo(server.port());
+    ASSERT_GE(fd, 0);
+    fds.push_back(fd);
+  }
+  // Frames split across packets and several frames per packet.
+  for (int i = 0; i < 50; ++i) {
+    sendText(fds[i], "SELL TEST 1 ");
+  }
+  for (int i = 0; i < 50; ++i) {
+    sendText(fds[i], std::to_string(200 + i) + "\nSELL TEST 1 300\n");
+  }
+  for (int fd : fds) {
+    auto lines = readLines(fd, 4);
+    ASSERT_EQ(lines.size(), 4);
+    EXPECT_TRUE(lines[0].starts_with("ORDER_ACCEPTED_ASYNC ")) << lines[0];
+  }
+
+  // Descriptors are reused after close; the new sessions must not see
+  // completions left over from the old ones.
+  for (int fd : fds) close(fd);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  int fd = connectTo(server.port());
+  ASSERT_GE(fd, 0);
+  sendText(fd, "SELL TEST 1 400\n");
+  auto lines = readLines(fd, 2);
+  ASSERT_EQ(lines.size(), 2);
+  EXPECT_TRUE(lines[1].starts_with("EXEC ")) << lines[1];
+  close(fd);
+
+  server.stop();
+  engine.stop();
+  const OrderBook* book = engine.getOrderBook(symId);
+  EXPECT_EQ(book->getLevel(300, OrderSide::Sell).activeCount, 0);
+  EXPECT_EQ(book->getLevel(400, OrderSide::Sell).activeCount, 0);
+}